@@ -107,6 +107,13 @@ if(USE_NLJSON_KV_SERIALISER)
   add_definitions(-DUSE_NLJSON_KV_SERIALISER)
 endif()
 
+option(USE_FLATBUFFERS_KV_SERIALISER "Use FlatBuffers as the KV serialiser"
+       OFF
+)
+if(USE_FLATBUFFERS_KV_SERIALISER)
+  add_definitions(-DUSE_FLATBUFFERS_KV_SERIALISER)
+endif()
+
 enable_language(ASM)
 
 set(CCF_GENERATED_DIR ${CMAKE_CURRENT_BINARY_DIR}/generated)
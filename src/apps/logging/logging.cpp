@@ -281,17 +281,22 @@ namespace ccfapp
         .set_require_client_identity(false);
       install(Procs::LOG_RECORD_RAW_TEXT, log_record_text, Write);
 
-      nwt.signatures.set_global_hook([this, &notifier](
-                                       kv::Version version,
-                                       const Signatures::State& s,
-                                       const Signatures::Write& w) {
-        if (w.size() > 0)
-        {
-          nlohmann::json notify_j;
-          notify_j["commit"] = version;
-          notifier.notify(jsonrpc::pack(notify_j, jsonrpc::Pack::Text));
-        }
-      });
+      // Notifications are sent asynchronously, so that they do not delay
+      // consensus. Several signatures may then be reported by a single
+      // notification, of the latest of them
+      nwt.signatures.set_global_hook(
+        [this, &notifier](
+          kv::Version version,
+          const Signatures::State& s,
+          const Signatures::Write& w) {
+          if (w.size() > 0)
+          {
+            nlohmann::json notify_j;
+            notify_j["commit"] = version;
+            notifier.notify(jsonrpc::pack(notify_j, jsonrpc::Pack::Text));
+          }
+        },
+        true);
     }
   };
 
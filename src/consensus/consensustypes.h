@@ -20,11 +20,17 @@ namespace consensus
     size_t raft_election_timeout;
     size_t pbft_view_change_timeout;
     size_t pbft_status_interval;
+    // Followers acknowledge entries once recorded, rather than once applied
+    bool raft_ack_on_record = false;
+    // Entries only count towards commit once durable in the host ledger
+    bool raft_durable_ledger = false;
     MSGPACK_DEFINE(
       raft_request_timeout,
       raft_election_timeout,
       pbft_view_change_timeout,
-      pbft_status_interval);
+      pbft_status_interval,
+      raft_ack_on_record,
+      raft_durable_ledger);
   };
 
 #pragma pack(push, 1)
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "consensus/ledgerenclavetypes.h"
+#include "ds/buffer.h"
 #include "ds/serialized.h"
 
 #include <algorithm>
@@ -19,6 +20,10 @@ namespace consensus
   private:
     ringbuffer::WriterPtr to_host;
 
+    // Truncations sent to the host, so that durable indices it reported
+    // before processing the latest one can be told apart
+    size_t truncations = 0;
+
   public:
     LedgerEnclave(ringbuffer::AbstractWriterFactory& writer_factory_) :
       to_host(writer_factory_.create_writer_to_outside())
@@ -54,19 +59,20 @@ namespace consensus
      * @param data Serialised entries
      * @param size Size of overall serialised entries
      *
-     * @return Pair of boolean status (false if rejected), raw data as a vector
+     * @return Pair of boolean status (false if rejected), raw data as a
+     * buffer referring to the serialised entries, so only valid as long as
+     * they are
      */
-    std::pair<std::vector<uint8_t>, bool> record_entry(
-      const uint8_t*& data, size_t& size)
+    std::pair<CBuffer, bool> record_entry(const uint8_t*& data, size_t& size)
     {
       auto entry_len = serialized::read<uint32_t>(data, size);
-      std::vector<uint8_t> entry(data, data + entry_len);
-
-      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_append, to_host, entry);
-
+      CBuffer entry = {data, entry_len};
       serialized::skip(data, size, entry_len);
 
-      return std::make_pair(std::move(entry), true);
+      serializer::ByteRange byte_range = {entry.p, entry.n};
+      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_append, to_host, byte_range);
+
+      return std::make_pair(entry, true);
     }
 
     /**
@@ -101,7 +107,20 @@ namespace consensus
      */
     void truncate(Index idx)
     {
+      truncations++;
       RINGBUFFER_WRITE_MESSAGE(consensus::ledger_truncate, to_host, idx);
     }
+
+    /**
+     * Whether a durable index reported by the host refers to the entries
+     * currently in the ledger, rather than to entries since truncated.
+     *
+     * @param host_truncations Truncations the host had processed when it
+     * reported the index
+     */
+    bool is_current(size_t host_truncations)
+    {
+      return host_truncations == truncations;
+    }
   };
 }
\ No newline at end of file
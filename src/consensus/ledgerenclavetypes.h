@@ -10,12 +10,15 @@ namespace consensus
   /// Consensus-related ringbuffer messages
   enum : ringbuffer::Message
   {
-    /// Request individual log entries. Enclave -> Host
-    DEFINE_RINGBUFFER_MSG_TYPE(ledger_get),
+    /// Request the log entries from the first given index up to the second.
+    /// Enclave -> Host
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_get_range),
 
     ///@{
-    /// Respond to log_get. Host -> Enclave
-    DEFINE_RINGBUFFER_MSG_TYPE(ledger_entry),
+    /// Respond to ledger_get_range, with as many of the requested entries as
+    /// fit in a batch, each framed by its size, or with no entry if the first
+    /// index is not in the log. Host -> Enclave
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_entries),
     DEFINE_RINGBUFFER_MSG_TYPE(ledger_no_entry),
     ///@}
 
@@ -24,14 +27,61 @@ namespace consensus
     DEFINE_RINGBUFFER_MSG_TYPE(ledger_append),
     DEFINE_RINGBUFFER_MSG_TYPE(ledger_truncate),
     ///@}
+
+    /// Start an empty log after the given index, as the node is starting
+    /// from a snapshot at that index. Enclave -> Host
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_init),
+
+    /// Entries up to the given index are durably stored, after the given
+    /// number of truncations of the log. Host -> Enclave
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_durable),
+
+    /// Write a snapshot of the store. Enclave -> Host
+    DEFINE_RINGBUFFER_MSG_TYPE(snapshot),
+
+    /// Request the latest snapshot before an index, or the latest snapshot if
+    /// the index is 0. Enclave -> Host
+    DEFINE_RINGBUFFER_MSG_TYPE(snapshot_get),
+
+    ///@{
+    /// Respond to snapshot_get. Host -> Enclave
+    DEFINE_RINGBUFFER_MSG_TYPE(snapshot_entry),
+    DEFINE_RINGBUFFER_MSG_TYPE(snapshot_no_entry),
+    ///@}
+
+    /// Request a log entry to rebuild a historical state. Enclave -> Host
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_get_historical),
+
+    ///@{
+    /// Respond to ledger_get_historical. Host -> Enclave
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_historical_entry),
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_historical_no_entry),
+    ///@}
   };
 }
 
-DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::ledger_get, consensus::Index);
 DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
-  consensus::ledger_entry, std::vector<uint8_t>);
-DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::ledger_no_entry);
+  consensus::ledger_get_range, consensus::Index, consensus::Index);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_entries, consensus::Index, serializer::ByteRange);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_no_entry, consensus::Index);
 DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
   consensus::ledger_append, std::vector<uint8_t>);
 DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
   consensus::ledger_truncate, consensus::Index);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::ledger_init, consensus::Index);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_durable, consensus::Index, size_t);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::snapshot, consensus::Index, std::vector<uint8_t>);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::snapshot_get, consensus::Index);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::snapshot_entry, consensus::Index, std::vector<uint8_t>);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::snapshot_no_entry);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_get_historical, consensus::Index);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_historical_entry, consensus::Index, std::vector<uint8_t>);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_historical_no_entry, consensus::Index);
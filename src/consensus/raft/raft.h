@@ -4,6 +4,7 @@
 
 #include "ds/logger.h"
 #include "ds/serialized.h"
+#include "ds/sharedtasks.h"
 #include "ds/spinlock.h"
 #include "kv/kvtypes.h"
 #include "node/nodetypes.h"
@@ -11,6 +12,7 @@
 
 #include <algorithm>
 #include <deque>
+#include <functional>
 #include <list>
 #include <random>
 #include <unordered_map>
@@ -43,6 +45,12 @@ namespace raft
       auto it = upper_bound(terms.begin(), terms.end(), idx);
       return (it - terms.begin()) - 1;
     }
+
+    std::vector<Index> get_history(Index idx)
+    {
+      auto it = upper_bound(terms.begin(), terms.end(), idx);
+      return {terms.begin(), it};
+    }
   };
 
   template <class LedgerProxy, class ChannelProxy>
@@ -115,6 +123,22 @@ namespace raft
     // should be replicated
     std::optional<Index> recovery_max_index;
 
+    // When this is set, followers acknowledge append entries once the entries
+    // are recorded in the ledger, rather than once they are applied. This
+    // requires a durable ledger, so that only entries which the host has
+    // synced to disk are acknowledged.
+    bool ack_on_record = false;
+
+    // When this is set, entries only count towards commit once the host
+    // reports that they are durably stored in the ledger, up to durable_idx
+    bool durable_ledger = false;
+    Index durable_idx = 0;
+
+    // Runs the deserialisation of an entry on another thread, while the
+    // previous entry is applied. If there is none, entries are deserialised
+    // just before they are applied
+    std::function<void(std::function<void()>&&)> apply_dispatcher = nullptr;
+
     // Randomness
     std::uniform_int_distribution<int> distrib;
     std::default_random_engine rand;
@@ -185,6 +209,55 @@ namespace raft
       public_only = false;
     }
 
+    void set_ack_on_record(bool ack_on_record_)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+      if (ack_on_record_ && !durable_ledger)
+        throw std::logic_error(
+          "Acknowledging entries on record requires a durable ledger");
+      ack_on_record = ack_on_record_;
+    }
+
+    void set_durable_ledger(bool durable_ledger_)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+      if (!durable_ledger_ && ack_on_record)
+        throw std::logic_error(
+          "Acknowledging entries on record requires a durable ledger");
+      durable_ledger = durable_ledger_;
+      durable_idx = last_idx;
+    }
+
+    /** The host has durably stored the entries of the ledger up to idx
+     *
+     * @param idx Last durable index
+     * @param truncations Truncations of the ledger the host had processed
+     */
+    void ledger_durable(Index idx, size_t truncations)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+      if (!durable_ledger || !ledger->is_current(truncations))
+        return;
+
+      if (idx <= durable_idx)
+        return;
+
+      durable_idx = idx;
+      LOG_DEBUG_FMT("Durable on {}: {}", local_id, durable_idx);
+
+      if (state == Leader)
+        update_commit();
+      else if (state == Follower && leader_id != NoNode)
+        send_append_entries_response(leader_id, true);
+    }
+
+    void set_apply_dispatcher(
+      std::function<void(std::function<void()>&&)> dispatcher)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+      apply_dispatcher = dispatcher;
+    }
+
     void suspend_replication(Index idx)
     {
       // Suspend replication of append entries up to a specific version
@@ -228,6 +301,7 @@ namespace raft
       std::lock_guard<SpinLock> guard(lock);
       current_term = term;
       last_idx = index;
+      durable_idx = index;
       commit_idx = commit_idx_;
       term_history.update(index, term);
       current_term += 2;
@@ -248,6 +322,7 @@ namespace raft
       std::lock_guard<SpinLock> guard(lock);
       current_term = term;
       last_idx = index;
+      durable_idx = index;
       commit_idx = commit_idx_;
       term_history.initialise(terms);
       term_history.update(index, term);
@@ -255,6 +330,27 @@ namespace raft
       become_leader();
     }
 
+    void init_as_follower(
+      Index index, Term term, const std::vector<Index>& terms)
+    {
+      // This should only be called when the node has not yet received any
+      // entries, to start from a snapshot at index rather than from an empty
+      // ledger.
+      std::lock_guard<SpinLock> guard(lock);
+      last_idx = index;
+      durable_idx = index;
+      commit_idx = index;
+      term_history.initialise(terms);
+      term_history.update(index, term);
+      become_follower(term);
+    }
+
+    std::vector<Index> get_term_history(Index idx)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+      return term_history.get_history(idx);
+    }
+
     Index get_last_idx()
     {
       return last_idx;
@@ -591,6 +687,10 @@ namespace raft
         r.idx,
         r.prev_idx);
 
+      // Entries are recorded in the ledger as a batch, and then applied
+      std::vector<std::pair<Index, CBuffer>> recorded;
+      bool suspended = false;
+
       for (Index i = r.prev_idx + 1; i <= r.idx; i++)
       {
         if (i <= last_idx)
@@ -624,8 +724,8 @@ namespace raft
               "Replication suspended up to {} but deserialised up to {}",
               recovery_max_index.value(),
               i - 1);
-            send_append_entries_response(r.from_node, true);
-            return;
+            suspended = true;
+            break;
           }
         }
 
@@ -644,61 +744,143 @@ namespace raft
             r.from_node);
 
           last_idx = r.prev_idx;
+          durable_idx = std::min(durable_idx, last_idx);
           ledger->truncate(r.prev_idx);
           send_append_entries_response(r.from_node, false);
           return;
         }
 
-        Term sig_term = 0;
-        auto deserialise_success =
-          store->deserialise(ret.first, public_only, &sig_term);
-
-        switch (deserialise_success)
-        {
-          case kv::DeserialiseSuccess::FAILED:
-            throw std::logic_error(
-              "Follower failed to apply log entry " + std::to_string(i));
-            break;
-
-          case kv::DeserialiseSuccess::PASS_SIGNATURE:
-            LOG_DEBUG_FMT("Deserialising signature at {}", i);
-            committable_indices.push_back(i);
-            if (sig_term)
-              term_history.update(commit_idx + 1, sig_term);
-            break;
-
-          case kv::DeserialiseSuccess::PASS:
-            break;
-
-          default:
-            throw std::logic_error("Unknown DeserialiseSuccess value");
-        }
+        recorded.emplace_back(i, ret.first);
       }
 
       // Update the current leader because we accepted entries.
-      if (leader_id != r.from_node)
+      if (!suspended && leader_id != r.from_node)
       {
         leader_id = r.from_node;
         LOG_DEBUG_FMT("Node {} thinks leader is {}", local_id, leader_id);
       }
 
-      send_append_entries_response(r.from_node, true);
+      // Only the entries which are already durable are acknowledged here.
+      // The others are acknowledged once the host reports them durable.
+      if (ack_on_record)
+        send_append_entries_response(r.from_node, true);
+
+      apply_entries(recorded);
+
+      if (!ack_on_record)
+        send_append_entries_response(r.from_node, true);
+
+      if (suspended)
+        return;
+
       commit_if_possible(r.leader_commit_idx);
 
       term_history.update(commit_idx + 1, r.term_of_idx);
     }
 
+    void apply_entries(const std::vector<std::pair<Index, CBuffer>>& entries)
+    {
+      // Each entry is deserialised while the previous one is applied. If no
+      // other thread has started deserialising an entry by the time it is
+      // needed, it is deserialised on this thread instead
+      std::vector<std::function<kv::DeserialiseSuccess(Term*)>> prepared(
+        entries.size());
+      auto prepare = [this, &entries, &prepared](size_t j) {
+        std::vector<std::function<void()>> task;
+        task.emplace_back(
+          [this, &entries, &prepared, j, public_only = public_only]() {
+            const auto& entry = entries[j].second;
+            prepared[j] =
+              store->prepare_deserialise(entry.p, entry.n, public_only);
+          });
+        return std::make_shared<ds::SharedTasks>(std::move(task));
+      };
+
+      std::shared_ptr<ds::SharedTasks> next;
+      if (!entries.empty())
+        next = prepare(0);
+
+      try
+      {
+        for (size_t j = 0; j < entries.size(); ++j)
+        {
+          next->run();
+
+          if (j + 1 < entries.size())
+          {
+            next = prepare(j + 1);
+            if (apply_dispatcher)
+              apply_dispatcher([next]() { next->help(); });
+          }
+
+          apply_entry(entries[j].first, prepared[j]);
+          prepared[j] = nullptr;
+        }
+      }
+      catch (...)
+      {
+        // The next entry may still be being deserialised, from buffers which
+        // are about to be released
+        try
+        {
+          next->run();
+        }
+        catch (...)
+        {}
+        throw;
+      }
+    }
+
+    void apply_entry(
+      Index i, const std::function<kv::DeserialiseSuccess(Term*)>& apply)
+    {
+      Term sig_term = 0;
+      auto deserialise_success = apply(&sig_term);
+
+      switch (deserialise_success)
+      {
+        case kv::DeserialiseSuccess::FAILED:
+          throw std::logic_error(
+            "Follower failed to apply log entry " + std::to_string(i));
+          break;
+
+        case kv::DeserialiseSuccess::PASS_SIGNATURE:
+          LOG_DEBUG_FMT("Deserialising signature at {}", i);
+          committable_indices.push_back(i);
+          if (sig_term)
+            term_history.update(commit_idx + 1, sig_term);
+          break;
+
+        case kv::DeserialiseSuccess::PASS:
+          break;
+
+        default:
+          throw std::logic_error("Unknown DeserialiseSuccess value");
+      }
+    }
+
+    // Last index which counts towards commit on this node
+    Index get_matched_idx()
+    {
+      return durable_ledger ? std::min(durable_idx, last_idx) : last_idx;
+    }
+
     void send_append_entries_response(NodeId to, bool answer)
     {
+      const auto matched_idx = get_matched_idx();
+
       LOG_DEBUG_FMT(
         "Send append entries response from {} to {} for index {}: {}",
         local_id,
         to,
-        last_idx,
+        matched_idx,
         answer);
 
-      AppendEntriesResponse response = {
-        raft_append_entries_response, local_id, current_term, last_idx, answer};
+      AppendEntriesResponse response = {raft_append_entries_response,
+                                        local_id,
+                                        current_term,
+                                        matched_idx,
+                                        answer};
 
       channels->send_authenticated(
         ccf::NodeMsgType::consensus_msg, to, response);
@@ -1073,7 +1255,7 @@ namespace raft
         for (auto node : c.nodes)
         {
           if (node == local_id)
-            match.push_back(last_idx);
+            match.push_back(get_matched_idx());
           else
             match.push_back(nodes.at(node).match_idx);
         }
@@ -1168,6 +1350,7 @@ namespace raft
       store->rollback(idx);
       ledger->truncate(idx);
       last_idx = idx;
+      durable_idx = std::min(durable_idx, idx);
       LOG_DEBUG_FMT("Rolled back at {}", idx);
 
       while (!committable_indices.empty() && (committable_indices.back() > idx))
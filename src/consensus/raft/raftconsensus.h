@@ -49,6 +49,17 @@ namespace raft
       raft->force_become_leader(seqno, view, terms, commit_seqno);
     }
 
+    void init_as_backup(
+      SeqNo seqno, View view, const std::vector<SeqNo>& view_history) override
+    {
+      raft->init_as_follower(seqno, view, view_history);
+    }
+
+    std::vector<SeqNo> get_view_history(SeqNo seqno) override
+    {
+      return raft->get_term_history(seqno);
+    }
+
     bool replicate(const kv::BatchVector& entries) override
     {
       return raft->replicate(entries);
@@ -92,6 +103,11 @@ namespace raft
       raft->periodic(elapsed);
     }
 
+    void ledger_durable(SeqNo seqno, size_t truncations) override
+    {
+      raft->ledger_durable(seqno, truncations);
+    }
+
     void enable_all_domains() override
     {
       raft->enable_all_domains();
@@ -7,6 +7,7 @@
 
 #include <chrono>
 #include <cstdint>
+#include <functional>
 #include <limits>
 
 namespace raft
@@ -24,9 +25,14 @@ namespace raft
   public:
     virtual ~Store() {}
     virtual S deserialise(
-      const std::vector<uint8_t>& data,
+      const uint8_t* data,
+      size_t size,
       bool public_only = false,
       Term* term = nullptr) = 0;
+    // Deserialises an entry ahead of applying it, possibly on another
+    // thread, and returns a function which applies it
+    virtual std::function<S(Term*)> prepare_deserialise(
+      const uint8_t* data, size_t size, bool public_only = false) = 0;
     virtual void compact(Index v) = 0;
     virtual void rollback(Index v) = 0;
   };
@@ -41,17 +47,28 @@ namespace raft
     Adaptor(std::shared_ptr<T> x) : x(x) {}
 
     S deserialise(
-      const std::vector<uint8_t>& data,
+      const uint8_t* data,
+      size_t size,
       bool public_only = false,
       Term* term = nullptr)
     {
       auto p = x.lock();
       if (p)
-        return p->deserialise(data, public_only, term);
+        return p->deserialise(data, size, public_only, term);
 
       return S::FAILED;
     }
 
+    std::function<S(Term*)> prepare_deserialise(
+      const uint8_t* data, size_t size, bool public_only = false)
+    {
+      auto p = x.lock();
+      if (p)
+        return p->prepare_deserialise(data, size, public_only);
+
+      return [](Term*) { return S::FAILED; };
+    }
+
     void compact(Index v)
     {
       auto p = x.lock();
@@ -89,7 +89,8 @@ TEST_CASE("Enclave record")
   auto r = follower_ledger_enclave.record_entry(data__, size_);
 
   REQUIRE(r.second);
-  REQUIRE(r.first == tx);
+  REQUIRE(r.first.p == msg.data() + sizeof(uint32_t));
+  REQUIRE(std::vector<uint8_t>(r.first) == tx);
   eio_follower.read_from_inside().read(
     -1, [&](ringbuffer::Message m, const uint8_t* data, size_t size) {
       switch (m)
@@ -18,6 +18,7 @@ namespace raft
   public:
     std::vector<std::shared_ptr<std::vector<uint8_t>>> ledger;
     uint64_t skip_count = 0;
+    size_t truncations = 0;
 
     LedgerStubProxy(NodeId id) : _id(id) {}
 
@@ -37,8 +38,7 @@ namespace raft
       ledger.push_back(buffer);
     }
 
-    std::pair<std::vector<uint8_t>, bool> record_entry(
-      const uint8_t*& data, size_t& size)
+    std::pair<CBuffer, bool> record_entry(const uint8_t*& data, size_t& size)
     {
 #ifdef STUB_LOG
       std::cout << "  Node" << _id << "->>Ledger" << _id
@@ -47,7 +47,7 @@ namespace raft
 
       auto buffer = std::make_shared<std::vector<uint8_t>>(data, data + size);
       ledger.push_back(buffer);
-      return std::make_pair(*buffer, true);
+      return std::make_pair(CBuffer(*buffer), true);
     }
 
     void skip_entry(const uint8_t*& data, size_t& size)
@@ -55,8 +55,14 @@ namespace raft
       skip_count++;
     }
 
+    bool is_current(size_t host_truncations)
+    {
+      return host_truncations == truncations;
+    }
+
     void truncate(Index idx)
     {
+      truncations++;
       ledger.resize(idx);
 #ifdef STUB_LOG
       std::cout << "  KV" << _id << "->>Node" << _id << ": truncate i: " << idx
@@ -149,12 +155,21 @@ namespace raft
     }
 
     virtual kv::DeserialiseSuccess deserialise(
-      const std::vector<uint8_t>& data,
+      const uint8_t* data,
+      size_t size,
       bool public_only = false,
       Term* term = nullptr)
     {
       return kv::DeserialiseSuccess::PASS;
     }
+
+    std::function<kv::DeserialiseSuccess(Term*)> prepare_deserialise(
+      const uint8_t* data, size_t size, bool public_only = false)
+    {
+      return [this, data, size, public_only](Term* term) {
+        return deserialise(data, size, public_only, term);
+      };
+    }
   };
 
   class LoggingStubStoreSig : public LoggingStubStore
@@ -163,7 +178,8 @@ namespace raft
     LoggingStubStoreSig(raft::NodeId id) : LoggingStubStore(id) {}
 
     kv::DeserialiseSuccess deserialise(
-      const std::vector<uint8_t>& data,
+      const uint8_t* data,
+      size_t size,
       bool public_only = false,
       Term* term = nullptr) override
     {
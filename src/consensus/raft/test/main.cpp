@@ -7,9 +7,11 @@
 
 #define DOCTEST_CONFIG_NO_SHORT_MACRO_NAMES
 
+#include <atomic>
 #include <chrono>
 #include <doctest/doctest.h>
 #include <string>
+#include <thread>
 
 using namespace std;
 
@@ -1011,4 +1013,230 @@ DOCTEST_TEST_CASE(
     DOCTEST_CHECK(r2.get_commit_idx() == 2);
     DOCTEST_CHECK(r2.get_last_idx() == 3);
   }
-}
\ No newline at end of file
+}
+// Records the order in which entries are deserialised and applied
+class PipelineStubStore : public raft::LoggingStubStore
+{
+public:
+  std::atomic<size_t> prepared = 0;
+  std::vector<size_t> prepared_when_applied;
+  kv::DeserialiseSuccess result = kv::DeserialiseSuccess::PASS;
+
+  PipelineStubStore(raft::NodeId id) : raft::LoggingStubStore(id) {}
+
+  std::function<kv::DeserialiseSuccess(raft::Term*)> prepare_deserialise(
+    const uint8_t* data, size_t size, bool public_only = false)
+  {
+    ++prepared;
+    return [this](raft::Term*) {
+      prepared_when_applied.push_back(prepared);
+      return result;
+    };
+  }
+};
+
+DOCTEST_TEST_CASE("Follower apply pipeline" * doctest::test_suite("multiple"))
+{
+  auto kv_store0 = std::make_shared<Store>(0);
+  auto kv_store1 = std::make_shared<PipelineStubStore>(1);
+
+  raft::NodeId node_id0(0);
+  raft::NodeId node_id1(1);
+
+  ms request_timeout(10);
+
+  TRaft r0(
+    std::make_unique<Adaptor>(kv_store0),
+    std::make_unique<raft::LedgerStubProxy>(node_id0),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id0,
+    request_timeout,
+    ms(20));
+  TRaft r1(
+    std::make_unique<raft::Adaptor<PipelineStubStore, kv::DeserialiseSuccess>>(
+      kv_store1),
+    std::make_unique<raft::LedgerStubProxy>(node_id1),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id1,
+    request_timeout,
+    ms(100));
+
+  // Entries are deserialised ahead on helper threads
+  std::vector<std::thread> helpers;
+  r1.set_apply_dispatcher([&helpers](std::function<void()>&& help) {
+    helpers.emplace_back(std::move(help));
+  });
+
+  std::unordered_set<raft::NodeId> config0 = {node_id0, node_id1};
+  r0.add_configuration(0, config0);
+  r1.add_configuration(0, config0);
+
+  map<raft::NodeId, TRaft*> nodes;
+  nodes[node_id0] = &r0;
+  nodes[node_id1] = &r1;
+
+  r0.periodic(std::chrono::milliseconds(200));
+  DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_request_vote));
+  DOCTEST_REQUIRE(
+    1 == dispatch_all(nodes, r1.channels->sent_request_vote_response));
+  DOCTEST_REQUIRE(r0.is_leader());
+  DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  DOCTEST_REQUIRE(
+    1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+
+  std::vector<uint8_t> entry = {1, 2, 3};
+  auto data = std::make_shared<std::vector<uint8_t>>(entry);
+
+  DOCTEST_INFO("A batch of entries is applied in order");
+  {
+    for (size_t i = 1; i <= 3; ++i)
+      DOCTEST_REQUIRE(r0.replicate(kv::BatchVector{{i, data, true}}));
+    r0.periodic(ms(10));
+    DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+
+    DOCTEST_REQUIRE(r1.ledger->ledger.size() == 3);
+    DOCTEST_REQUIRE(kv_store1->prepared == 3);
+    DOCTEST_REQUIRE(kv_store1->prepared_when_applied.size() == 3);
+    for (size_t i = 0; i < 3; ++i)
+      DOCTEST_REQUIRE(kv_store1->prepared_when_applied[i] >= i + 1);
+    DOCTEST_REQUIRE(helpers.size() == 2);
+
+    DOCTEST_REQUIRE(
+      1 ==
+      dispatch_all_and_DOCTEST_CHECK(
+        nodes, r1.channels->sent_append_entries_response, [](const auto& msg) {
+          DOCTEST_REQUIRE(msg.last_log_idx == 3);
+          DOCTEST_REQUIRE(msg.success);
+        }));
+  }
+
+  DOCTEST_INFO("Ack on record requires a durable ledger");
+  {
+    DOCTEST_REQUIRE_THROWS_AS(r1.set_ack_on_record(true), std::logic_error);
+    r1.set_durable_ledger(true);
+    r1.set_ack_on_record(true);
+    DOCTEST_REQUIRE_THROWS_AS(
+      r1.set_durable_ledger(false), std::logic_error);
+  }
+
+  DOCTEST_INFO("With ack on record, only durable entries are acknowledged");
+  {
+    DOCTEST_REQUIRE(r0.replicate(kv::BatchVector{{4, data, true}}));
+    r0.periodic(ms(10));
+    DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+    DOCTEST_REQUIRE(r1.ledger->ledger.size() == 4);
+
+    // The entry is recorded, but the host has not synced it yet
+    DOCTEST_REQUIRE(
+      1 ==
+      dispatch_all_and_DOCTEST_CHECK(
+        nodes, r1.channels->sent_append_entries_response, [](const auto& msg) {
+          DOCTEST_REQUIRE(msg.last_log_idx == 3);
+          DOCTEST_REQUIRE(msg.success);
+        }));
+
+    r1.ledger_durable(4, r1.ledger->truncations);
+    DOCTEST_REQUIRE(
+      1 ==
+      dispatch_all_and_DOCTEST_CHECK(
+        nodes, r1.channels->sent_append_entries_response, [](const auto& msg) {
+          DOCTEST_REQUIRE(msg.last_log_idx == 4);
+          DOCTEST_REQUIRE(msg.success);
+        }));
+  }
+
+  for (auto& helper : helpers)
+    helper.join();
+}
+
+DOCTEST_TEST_CASE("Durable ledger commit" * doctest::test_suite("multiple"))
+{
+  auto kv_store0 = std::make_shared<Store>(0);
+  auto kv_store1 = std::make_shared<Store>(1);
+
+  raft::NodeId node_id0(0);
+  raft::NodeId node_id1(1);
+
+  ms request_timeout(10);
+
+  TRaft r0(
+    std::make_unique<Adaptor>(kv_store0),
+    std::make_unique<raft::LedgerStubProxy>(node_id0),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id0,
+    request_timeout,
+    ms(20));
+  TRaft r1(
+    std::make_unique<Adaptor>(kv_store1),
+    std::make_unique<raft::LedgerStubProxy>(node_id1),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id1,
+    request_timeout,
+    ms(100));
+
+  r0.set_durable_ledger(true);
+  r1.set_durable_ledger(true);
+
+  std::unordered_set<raft::NodeId> config0 = {node_id0, node_id1};
+  r0.add_configuration(0, config0);
+  r1.add_configuration(0, config0);
+
+  map<raft::NodeId, TRaft*> nodes;
+  nodes[node_id0] = &r0;
+  nodes[node_id1] = &r1;
+
+  r0.periodic(std::chrono::milliseconds(200));
+  DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_request_vote));
+  DOCTEST_REQUIRE(
+    1 == dispatch_all(nodes, r1.channels->sent_request_vote_response));
+  DOCTEST_REQUIRE(r0.is_leader());
+  DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  DOCTEST_REQUIRE(
+    1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+
+  auto data = std::make_shared<std::vector<uint8_t>>(
+    std::vector<uint8_t>{1, 2, 3});
+
+  DOCTEST_INFO("Entries which are not yet durable are not acknowledged");
+  {
+    for (size_t i = 1; i <= 3; ++i)
+      DOCTEST_REQUIRE(r0.replicate(kv::BatchVector{{i, data, true}}));
+    r0.periodic(ms(10));
+    DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+    DOCTEST_REQUIRE(r1.ledger->ledger.size() == 3);
+
+    DOCTEST_REQUIRE(
+      1 ==
+      dispatch_all_and_DOCTEST_CHECK(
+        nodes, r1.channels->sent_append_entries_response, [](const auto& msg) {
+          DOCTEST_REQUIRE(msg.last_log_idx == 0);
+          DOCTEST_REQUIRE(msg.success);
+        }));
+    DOCTEST_REQUIRE(r0.get_commit_idx() == 0);
+  }
+
+  DOCTEST_INFO("Followers acknowledge entries once they are durable");
+  {
+    r1.ledger_durable(3, r1.ledger->truncations);
+    DOCTEST_REQUIRE(
+      1 ==
+      dispatch_all_and_DOCTEST_CHECK(
+        nodes, r1.channels->sent_append_entries_response, [](const auto& msg) {
+          DOCTEST_REQUIRE(msg.last_log_idx == 3);
+          DOCTEST_REQUIRE(msg.success);
+        }));
+
+    // The leader's own entries must also be durable
+    DOCTEST_REQUIRE(r0.get_commit_idx() == 0);
+    r0.ledger_durable(2, r0.ledger->truncations);
+    DOCTEST_REQUIRE(r0.get_commit_idx() == 2);
+  }
+
+  DOCTEST_INFO("Reports from before a truncation are ignored");
+  {
+    r0.ledger_durable(3, r0.ledger->truncations - 1);
+    DOCTEST_REQUIRE(r0.get_commit_idx() == 2);
+    r0.ledger_durable(3, r0.ledger->truncations);
+    DOCTEST_REQUIRE(r0.get_commit_idx() == 3);
+  }
+}
@@ -57,20 +57,23 @@ namespace crypto
 
     std::vector<uint8_t> serialise()
     {
-      auto space = RAW_DATA_SIZE;
-      std::vector<uint8_t> serial_hdr(space);
-
-      auto data_ = serial_hdr.data();
-      serialized::write(data_, space, tag, sizeof(tag));
-      serialized::write(data_, space, iv, sizeof(iv));
-
+      std::vector<uint8_t> serial_hdr(RAW_DATA_SIZE);
+      serialise(serial_hdr.data());
       return serial_hdr;
     }
 
-    void deserialise(const std::vector<uint8_t>& serial_hdr)
+    // Writes RAW_DATA_SIZE bytes
+    void serialise(uint8_t* data) const
+    {
+      auto space = RAW_DATA_SIZE;
+      serialized::write(data, space, tag, sizeof(tag));
+      serialized::write(data, space, iv, sizeof(iv));
+    }
+
+    void deserialise(CBuffer serial_hdr)
     {
-      auto data_ = serial_hdr.data();
-      auto size = serial_hdr.size();
+      auto data_ = serial_hdr.p;
+      auto size = serial_hdr.n;
 
       memcpy(
         tag, serialized::read(data_, size, GCM_SIZE_TAG).data(), GCM_SIZE_TAG);
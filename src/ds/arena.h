@@ -0,0 +1,227 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace ds
+{
+  struct ArenaStats
+  {
+    // Allocations served by the arena, and their total size
+    size_t allocations = 0;
+    size_t bytes = 0;
+    // Chunks obtained from the heap to serve them
+    size_t chunks = 0;
+    size_t resets = 0;
+  };
+
+  /** Bump allocator for objects which all die at the same time.
+   *
+   * Memory is handed out from chunks taken from the heap, and is only
+   * reclaimed when the whole arena is reset. The first chunk is kept across
+   * resets, so that an arena which is reset after every request stops
+   * allocating once it has grown to the size of a typical request.
+   *
+   * Each thread has its own arena, which is used by allocations on that
+   * thread while an ArenaScope is open.
+   */
+  class Arena
+  {
+  public:
+    static constexpr size_t chunk_size = 64 * 1024;
+
+  private:
+    struct Chunk
+    {
+      std::unique_ptr<uint8_t[]> data;
+      size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t offset = 0;
+    size_t scopes = 0;
+    ArenaStats stats;
+
+    void add_chunk(size_t min_size)
+    {
+      const auto size = std::max(chunk_size, min_size);
+      chunks.push_back({std::unique_ptr<uint8_t[]>(new uint8_t[size]), size});
+      offset = 0;
+      stats.chunks++;
+    }
+
+    static Arena& thread_arena()
+    {
+      thread_local Arena arena;
+      return arena;
+    }
+
+    friend class ArenaScope;
+
+  public:
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+      if (!chunks.empty())
+      {
+        auto& chunk = chunks.back();
+        const auto base = reinterpret_cast<uintptr_t>(chunk.data.get());
+        const auto aligned = (base + offset + align - 1) & ~(align - 1);
+        if (aligned + size <= base + chunk.size)
+        {
+          offset = aligned + size - base;
+          stats.allocations++;
+          stats.bytes += size;
+          return reinterpret_cast<void*>(aligned);
+        }
+      }
+
+      // Chunks are aligned for any type, so a fresh chunk always fits
+      add_chunk(size);
+      offset = size;
+      stats.allocations++;
+      stats.bytes += size;
+      return chunks.back().data.get();
+    }
+
+    void reset()
+    {
+      if (chunks.size() > 1)
+        chunks.erase(chunks.begin() + 1, chunks.end());
+      offset = 0;
+      stats.resets++;
+    }
+
+    const ArenaStats& get_stats() const
+    {
+      return stats;
+    }
+
+    /** The arena of the calling thread, if an ArenaScope is open on it
+     */
+    static Arena* current()
+    {
+      auto& arena = thread_arena();
+      return arena.scopes > 0 ? &arena : nullptr;
+    }
+
+    /** Statistics of the calling thread's arena
+     */
+    static ArenaStats thread_stats()
+    {
+      return thread_arena().stats;
+    }
+  };
+
+  /** While open, allocations through ArenaAllocator on this thread use the
+   * thread's arena. The arena is reset when the outermost scope closes, so
+   * nothing allocated in the scope may outlive it.
+   */
+  class ArenaScope
+  {
+  public:
+    ArenaScope()
+    {
+      Arena::thread_arena().scopes++;
+    }
+
+    ~ArenaScope()
+    {
+      auto& arena = Arena::thread_arena();
+      if (--arena.scopes == 0)
+        arena.reset();
+    }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+  };
+
+  /** Standard allocator which uses the calling thread's arena if an
+   * ArenaScope is open when it is created, and the heap otherwise.
+   * Deallocating arena memory does nothing.
+   */
+  template <typename T>
+  class ArenaAllocator
+  {
+  private:
+    template <typename U>
+    friend class ArenaAllocator;
+
+    Arena* arena;
+
+  public:
+    using value_type = T;
+
+    ArenaAllocator() : arena(Arena::current()) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& that) : arena(that.arena)
+    {}
+
+    T* allocate(size_t n)
+    {
+      if (arena != nullptr)
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+
+      return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+      if (arena == nullptr)
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& that) const
+    {
+      return arena == that.arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& that) const
+    {
+      return arena != that.arena;
+    }
+  };
+
+  /** Base for classes whose instances are allocated from the calling
+   * thread's arena while an ArenaScope is open. Each allocation records
+   * where it came from, so instances can be deleted as usual.
+   */
+  class ArenaAllocated
+  {
+  private:
+    // Keeps the object aligned for any type
+    struct alignas(std::max_align_t) Header
+    {
+      bool in_arena;
+    };
+
+  public:
+    static void* operator new(size_t size)
+    {
+      auto arena = Arena::current();
+      auto total = sizeof(Header) + size;
+      auto header = static_cast<Header*>(
+        arena != nullptr ? arena->allocate(total) : ::operator new(total));
+      header->in_arena = arena != nullptr;
+      return header + 1;
+    }
+
+    static void operator delete(void* p)
+    {
+      if (p == nullptr)
+        return;
+
+      auto header = static_cast<Header*>(p) - 1;
+      if (!header->in_arena)
+        ::operator delete(header);
+    }
+  };
+}
@@ -2,9 +2,14 @@
 // Licensed under the Apache 2.0 License.
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <memory>
+#include <new>
 #include <optional>
+#include <type_traits>
+#include <unordered_set>
 #include <vector>
 
 namespace champ
@@ -34,6 +39,18 @@ namespace champ
     return (hash >> ((Hash)depth * index_mask_bits)) & index_mask;
   }
 
+  // Nodes created by a TransientMap are tagged with its edit token, and only
+  // that TransientMap may modify them in place. Nodes of persistent maps carry
+  // no_edit, and are always copied before being modified.
+  using EditToken = uint64_t;
+  static constexpr EditToken no_edit = 0;
+
+  inline EditToken new_edit_token()
+  {
+    static std::atomic<EditToken> next_token(no_edit + 1);
+    return next_token++;
+  }
+
   class Bitmap
   {
     uint32_t _bits;
@@ -69,6 +86,33 @@ namespace champ
     }
   };
 
+  // Bytes allocated alongside each node by std::make_shared, for its
+  // reference counts
+  static constexpr size_t shared_node_overhead = 2 * sizeof(void*);
+
+  /** Memory used by the nodes of one or more maps
+   *
+   * Nodes and entries shared between the maps are counted once. Memory owned
+   * by keys and values is not included.
+   */
+  struct Footprint
+  {
+    size_t nodes = 0;
+    size_t bytes = 0;
+
+    // Allocations which have already been counted
+    std::unordered_set<const void*> seen;
+
+    bool add(const void* p, size_t size)
+    {
+      if (!seen.insert(p).second)
+        return false;
+
+      bytes += shared_node_overhead + size;
+      return true;
+    }
+  };
+
   template <class K, class V, class H>
   struct SubNodes;
 
@@ -78,7 +122,7 @@ namespace champ
     K key;
     V value;
 
-    Entry(K k, V v) : key(k), value(v) {}
+    Entry(K k, V v) : key(std::move(k)), value(std::move(v)) {}
 
     const V* getp(const K& k) const
     {
@@ -89,22 +133,65 @@ namespace champ
     }
   };
 
+  // Entries whose keys and values are cheap to copy are stored inline in
+  // their node. Others are allocated separately, and shared between the
+  // copies of a node, so that copying a node does not copy them.
+  template <class K, class V>
+  inline constexpr bool inline_entries =
+    std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>;
+
+  template <class K, class V>
+  using Slot = std::conditional_t<
+    inline_entries<K, V>,
+    Entry<K, V>,
+    std::shared_ptr<const Entry<K, V>>>;
+
+  template <class K, class V>
+  Slot<K, V> make_slot(const K& k, const V& v)
+  {
+    if constexpr (inline_entries<K, V>)
+      return Entry<K, V>(k, v);
+    else
+      return std::make_shared<const Entry<K, V>>(k, v);
+  }
+
+  template <class K, class V>
+  const Entry<K, V>& get_entry(const Entry<K, V>& slot)
+  {
+    return slot;
+  }
+
+  template <class K, class V>
+  const Entry<K, V>& get_entry(const std::shared_ptr<const Entry<K, V>>& slot)
+  {
+    return *slot;
+  }
+
+  template <class K, class V>
+  size_t slot_footprint(const Slot<K, V>& slot, Footprint& fp)
+  {
+    if constexpr (!inline_entries<K, V>)
+      fp.add(slot.get(), sizeof(Entry<K, V>));
+    return sizeof(Slot<K, V>);
+  }
+
   template <class K, class V, class H>
   using Node = std::shared_ptr<void>;
 
   template <class K, class V, class H>
   struct Collisions
   {
-    std::array<std::vector<std::shared_ptr<Entry<K, V>>>, collision_bins> bins;
+    std::array<std::vector<Slot<K, V>>, collision_bins> bins;
 
     const V* getp(Hash hash, const K& k) const
     {
       const auto idx = mask(hash, collision_depth);
       const auto& bin = bins[idx];
-      for (const auto& node : bin)
+      for (const auto& slot : bin)
       {
-        if (k == node->key)
-          return &node->value;
+        const auto& entry = get_entry(slot);
+        if (k == entry.key)
+          return &entry.value;
       }
       return nullptr;
     }
@@ -113,16 +200,15 @@ namespace champ
     {
       const auto idx = mask(hash, collision_depth);
       auto& bin = bins[idx];
-      for (size_t i = 0; i < bin.size(); ++i)
+      for (auto& slot : bin)
       {
-        const auto& entry = bin[i];
-        if (k == entry->key)
+        if (k == get_entry(slot).key)
         {
-          bin[i] = std::make_shared<Entry<K, V>>(k, v);
+          slot = make_slot(k, v);
           return false;
         }
       }
-      bin.push_back(std::make_shared<Entry<K, V>>(k, v));
+      bin.push_back(make_slot(k, v));
       return true;
     }
 
@@ -131,132 +217,340 @@ namespace champ
     {
       for (const auto& bin : bins)
       {
-        for (const auto& entry : bin)
-          if (!f(entry->key, entry->value))
+        for (const auto& slot : bin)
+        {
+          const auto& entry = get_entry(slot);
+          if (!f(entry.key, entry.value))
             return false;
+        }
       }
       return true;
     }
+
+    void footprint(Footprint& fp) const
+    {
+      if (!fp.add(this, sizeof(Collisions)))
+        return;
+
+      fp.nodes++;
+      for (const auto& bin : bins)
+      {
+        fp.bytes += (bin.capacity() - bin.size()) * sizeof(Slot<K, V>);
+        for (const auto& slot : bin)
+          fp.bytes += slot_footprint<K, V>(slot, fp);
+      }
+    }
   };
 
+  // Entry slots are stored in the node itself, followed by its child nodes, in
+  // a single allocation holding exactly as many of each as there are bits set
+  // in data_map and node_map. Nodes are always copied before they are
+  // modified, unless they are owned by a TransientMap, so modifying one in
+  // place reallocates its storage.
   template <class K, class V, class H>
   struct SubNodes
   {
-    std::vector<Node<K, V, H>> nodes;
     Bitmap node_map;
     Bitmap data_map;
+    EditToken edit = no_edit;
 
-    SubNodes() {}
+  private:
+    using E = Slot<K, V>;
+    using N = Node<K, V, H>;
 
-    SubNodes(std::vector<Node<K, V, H>> ns) : nodes(ns) {}
+    static constexpr size_t storage_align = std::max(alignof(E), alignof(N));
 
-    SubNodes(std::vector<Node<K, V, H>> ns, Bitmap nm, Bitmap dm) :
-      nodes(ns),
-      node_map(nm),
-      data_map(dm)
-    {}
+    void* storage = nullptr;
 
-    SmallIndex compressed_idx(SmallIndex idx) const
+    static constexpr Bitmap below(SmallIndex idx)
     {
-      if (!node_map.check(idx) && !data_map.check(idx))
-        return (SmallIndex)-1;
+      return Bitmap(~((uint32_t)-1 << idx));
+    }
 
-      const auto mask = Bitmap(~((uint32_t)-1 << idx));
-      if (data_map.check(idx))
-        return (data_map & mask).pop();
+    static size_t children_offset(size_t entries)
+    {
+      const auto bytes = entries * sizeof(E);
+      return (bytes + alignof(N) - 1) / alignof(N) * alignof(N);
+    }
 
-      return data_map.pop() + (node_map & mask).pop();
+    static size_t storage_size(size_t entries, size_t children)
+    {
+      return children_offset(entries) + children * sizeof(N);
+    }
+
+    static void* allocate(size_t entries, size_t children)
+    {
+      const auto size = storage_size(entries, children);
+      if (size == 0)
+        return nullptr;
+
+      return ::operator new(size, std::align_val_t(storage_align));
+    }
+
+    static void deallocate(void* p)
+    {
+      if (p != nullptr)
+        ::operator delete(p, std::align_val_t(storage_align));
+    }
+
+    static E* entries_of(void* s)
+    {
+      return static_cast<E*>(s);
+    }
+
+    static N* children_of(void* s, size_t entries)
+    {
+      return reinterpret_cast<N*>(
+        static_cast<char*>(s) + children_offset(entries));
+    }
+
+    size_t entry_count() const
+    {
+      return data_map.pop();
+    }
+
+    size_t child_count() const
+    {
+      return node_map.pop();
+    }
+
+    E& entry_at(SmallIndex idx) const
+    {
+      return entries_of(storage)[(data_map & below(idx)).pop()];
+    }
+
+    N& child_at(SmallIndex idx) const
+    {
+      return children_of(storage, entry_count())[(node_map & below(idx)).pop()];
+    }
+
+    template <class A>
+    static const std::shared_ptr<A>& node_as(const N& node)
+    {
+      return reinterpret_cast<const std::shared_ptr<A>&>(node);
+    }
+
+    void destroy()
+    {
+      const auto entries = entry_count();
+      const auto children = child_count();
+      for (size_t i = 0; i < entries; ++i)
+        entries_of(storage)[i].~E();
+      for (size_t i = 0; i < children; ++i)
+        children_of(storage, entries)[i].~N();
+      deallocate(storage);
+      storage = nullptr;
+    }
+
+    // Moves entries and children to storage for one more or one fewer of
+    // each, skipping the entry at skip_entry and leaving a gap at
+    // insert_entry, and likewise for children. Elements are never both
+    // skipped and inserted.
+    void* reshape(
+      size_t entries,
+      size_t children,
+      size_t skip_entry,
+      size_t insert_entry,
+      size_t skip_child,
+      size_t insert_child)
+    {
+      const auto old_entries = entry_count();
+      const auto old_children = child_count();
+      auto next = allocate(entries, children);
+
+      auto from_e = entries_of(storage);
+      auto to_e = entries_of(next);
+      for (size_t i = 0, j = 0; i < old_entries; ++i)
+      {
+        if (i == skip_entry)
+          continue;
+        if (j == insert_entry)
+          ++j;
+        new (to_e + j++) E(std::move(from_e[i]));
+      }
+
+      auto from_c = children_of(storage, old_entries);
+      auto to_c = children_of(next, entries);
+      for (size_t i = 0, j = 0; i < old_children; ++i)
+      {
+        if (i == skip_child)
+          continue;
+        if (j == insert_child)
+          ++j;
+        new (to_c + j++) N(std::move(from_c[i]));
+      }
+
+      return next;
+    }
+
+    static constexpr size_t none = (size_t)-1;
+
+    void insert_entry(SmallIndex idx, E&& entry)
+    {
+      const auto entries = entry_count() + 1;
+      const auto pos = (data_map & below(idx)).pop();
+      auto next = reshape(entries, child_count(), none, pos, none, none);
+      new (entries_of(next) + pos) E(std::move(entry));
+
+      destroy();
+      storage = next;
+      data_map = data_map.set(idx);
+    }
+
+    // Replaces the entry at idx with a child node holding it
+    void push_down(SmallIndex idx, N&& child)
+    {
+      const auto entries = entry_count() - 1;
+      const auto e_pos = (data_map & below(idx)).pop();
+      const auto c_pos = (node_map & below(idx)).pop();
+      auto next = reshape(entries, child_count() + 1, e_pos, none, none, c_pos);
+      new (children_of(next, entries) + c_pos) N(std::move(child));
+
+      destroy();
+      storage = next;
+      data_map = data_map.clear(idx);
+      node_map = node_map.set(idx);
+    }
+
+  public:
+    SubNodes(EditToken edit_ = no_edit) : edit(edit_) {}
+
+    SubNodes(const SubNodes& that) :
+      node_map(that.node_map),
+      data_map(that.data_map),
+      edit(that.edit)
+    {
+      const auto entries = entry_count();
+      const auto children = child_count();
+      auto next = allocate(entries, children);
+
+      size_t copied = 0;
+      try
+      {
+        for (; copied < entries; ++copied)
+          new (entries_of(next) + copied) E(entries_of(that.storage)[copied]);
+      }
+      catch (...)
+      {
+        for (size_t i = 0; i < copied; ++i)
+          entries_of(next)[i].~E();
+        deallocate(next);
+        throw;
+      }
+
+      for (size_t i = 0; i < children; ++i)
+        new (children_of(next, entries) + i)
+          N(children_of(that.storage, entries)[i]);
+
+      storage = next;
+    }
+
+    SubNodes(SubNodes&& that) :
+      node_map(that.node_map),
+      data_map(that.data_map),
+      edit(that.edit),
+      storage(that.storage)
+    {
+      that.node_map = Bitmap();
+      that.data_map = Bitmap();
+      that.storage = nullptr;
+    }
+
+    SubNodes& operator=(const SubNodes& that) = delete;
+    SubNodes& operator=(SubNodes&& that) = delete;
+
+    ~SubNodes()
+    {
+      destroy();
     }
 
     const V* getp(SmallIndex depth, Hash hash, const K& k) const
     {
       const auto idx = mask(hash, depth);
-      const auto c_idx = compressed_idx(idx);
-
-      if (c_idx == (SmallIndex)-1)
-        return nullptr;
 
       if (data_map.check(idx))
-        return node_as<Entry<K, V>>(c_idx)->getp(k);
+        return get_entry(entry_at(idx)).getp(k);
+
+      if (!node_map.check(idx))
+        return nullptr;
 
       if (depth == (collision_depth - 1))
-        return node_as<Collisions<K, V, H>>(c_idx)->getp(hash, k);
+        return node_as<Collisions<K, V, H>>(child_at(idx))->getp(hash, k);
 
-      return node_as<SubNodes<K, V, H>>(c_idx)->getp(depth + 1, hash, k);
+      return node_as<SubNodes<K, V, H>>(child_at(idx))
+        ->getp(depth + 1, hash, k);
     }
 
-    bool put_mut(SmallIndex depth, Hash hash, const K& k, const V& v)
+    // Modifies this node in place. Child nodes are copied before they are
+    // modified, unless they are already owned by the given edit token.
+    bool put_mut(
+      SmallIndex depth,
+      Hash hash,
+      const K& k,
+      const V& v,
+      EditToken edit_ = no_edit)
     {
       const auto idx = mask(hash, depth);
-      auto c_idx = compressed_idx(idx);
-
-      if (c_idx == (SmallIndex)-1)
-      {
-        data_map = data_map.set(idx);
-        c_idx = compressed_idx(idx);
-        nodes.insert(
-          nodes.begin() + c_idx, std::make_shared<Entry<K, V>>(k, v));
-        return true;
-      }
 
       if (node_map.check(idx))
       {
+        auto& node = child_at(idx);
         bool insert;
         if (depth < (collision_depth - 1))
         {
-          auto sn = *node_as<SubNodes<K, V, H>>(c_idx);
-          insert = sn.put_mut(depth + 1, hash, k, v);
-          nodes[c_idx] = std::make_shared<SubNodes<K, V, H>>(std::move(sn));
+          const auto& child = node_as<SubNodes<K, V, H>>(node);
+          if (edit_ != no_edit && child->edit == edit_)
+            return child->put_mut(depth + 1, hash, k, v, edit_);
+
+          auto sn = *child;
+          sn.edit = edit_;
+          insert = sn.put_mut(depth + 1, hash, k, v, edit_);
+          node = std::make_shared<SubNodes<K, V, H>>(std::move(sn));
         }
         else
         {
-          auto sn = *node_as<Collisions<K, V, H>>(c_idx);
+          auto sn = *node_as<Collisions<K, V, H>>(node);
           insert = sn.put_mut(hash, k, v);
-          nodes[c_idx] = std::make_shared<Collisions<K, V, H>>(std::move(sn));
+          node = std::make_shared<Collisions<K, V, H>>(std::move(sn));
         }
         return insert;
       }
 
-      const auto& entry0 = node_as<Entry<K, V>>(c_idx);
-      if (k == entry0->key)
+      if (!data_map.check(idx))
       {
-        nodes[c_idx] = std::make_shared<Entry<K, V>>(k, v);
+        insert_entry(idx, make_slot(k, v));
+        return true;
+      }
+
+      auto& slot0 = entry_at(idx);
+      const auto& key0 = get_entry(slot0).key;
+      if (k == key0)
+      {
+        slot0 = make_slot(k, v);
         return false;
       }
 
+      // The existing entry moves into a new child node, with the new one
+      const auto hash0 = H()(key0);
+      N child;
       if (depth < (collision_depth - 1))
       {
-        const auto hash0 = H()(entry0->key);
-        const auto idx0 = mask(hash0, depth + 1);
-        auto sub_node =
-          SubNodes<K, V, H>({entry0}, Bitmap(0), Bitmap(0).set(idx0));
-        sub_node.put_mut(depth + 1, hash, k, v);
-
-        nodes.erase(nodes.begin() + c_idx);
-        data_map = data_map.clear(idx);
-        node_map = node_map.set(idx);
-        c_idx = compressed_idx(idx);
-        nodes.insert(
-          nodes.begin() + c_idx,
-          std::make_shared<SubNodes<K, V, H>>(std::move(sub_node)));
+        auto sub_node = SubNodes<K, V, H>(edit_);
+        sub_node.insert_entry(mask(hash0, depth + 1), std::move(slot0));
+        sub_node.put_mut(depth + 1, hash, k, v, edit_);
+        child = std::make_shared<SubNodes<K, V, H>>(std::move(sub_node));
       }
       else
       {
         auto sub_node = Collisions<K, V, H>();
-        const auto hash0 = H()(entry0->key);
-        const auto idx0 = mask(hash0, collision_depth);
-        sub_node.bins[idx0].push_back(entry0);
-        const auto idx1 = mask(hash, collision_depth);
-        sub_node.bins[idx1].push_back(std::make_shared<Entry<K, V>>(k, v));
-
-        nodes.erase(nodes.begin() + c_idx);
-        data_map = data_map.clear(idx);
-        node_map = node_map.set(idx);
-        c_idx = compressed_idx(idx);
-        nodes.insert(
-          nodes.begin() + c_idx,
-          std::make_shared<Collisions<K, V, H>>(std::move(sub_node)));
+        sub_node.bins[mask(hash0, collision_depth)].push_back(
+          std::move(slot0));
+        sub_node.bins[mask(hash, collision_depth)].push_back(
+          make_slot(k, v));
+        child = std::make_shared<Collisions<K, V, H>>(std::move(sub_node));
       }
+
+      push_down(idx, std::move(child));
       return true;
     }
 
@@ -264,6 +558,7 @@ namespace champ
       SmallIndex depth, Hash hash, const K& k, const V& v) const
     {
       auto node = *this;
+      node.edit = no_edit;
       auto r = node.put_mut(depth, hash, k, v);
       return std::make_pair(
         std::make_shared<SubNodes<K, V, H>>(std::move(node)), r);
@@ -272,23 +567,26 @@ namespace champ
     template <class F>
     bool foreach(SmallIndex depth, F&& f) const
     {
-      const auto entries = data_map.pop();
-      for (SmallIndex i = 0; i < entries; ++i)
+      const auto entries = entry_count();
+      for (size_t i = 0; i < entries; ++i)
       {
-        const auto& entry = node_as<Entry<K, V>>(i);
-        if (!f(entry->key, entry->value))
+        const auto& entry = get_entry(entries_of(storage)[i]);
+        if (!f(entry.key, entry.value))
           return false;
       }
-      for (size_t i = entries; i < nodes.size(); ++i)
+
+      const auto children = child_count();
+      for (size_t i = 0; i < children; ++i)
       {
+        const auto& node = children_of(storage, entries)[i];
         if (depth == (collision_depth - 1))
         {
-          if (!node_as<Collisions<K, V, H>>(i)->foreach(std::forward<F>(f)))
+          if (!node_as<Collisions<K, V, H>>(node)->foreach(std::forward<F>(f)))
             return false;
         }
         else
         {
-          if (!node_as<SubNodes<K, V, H>>(i)->foreach(
+          if (!node_as<SubNodes<K, V, H>>(node)->foreach(
                 depth + 1, std::forward<F>(f)))
             return false;
         }
@@ -296,18 +594,38 @@ namespace champ
       return true;
     }
 
-  private:
-    template <class A>
-    const std::shared_ptr<A>& node_as(SmallIndex c_idx) const
+    void footprint(SmallIndex depth, Footprint& fp) const
     {
-      return reinterpret_cast<const std::shared_ptr<A>&>(nodes[c_idx]);
+      const auto entries = entry_count();
+      const auto children = child_count();
+      if (!fp.add(this, sizeof(SubNodes) + children_offset(entries)))
+        return;
+
+      fp.nodes++;
+      fp.bytes += children * sizeof(N);
+      for (size_t i = 0; i < entries; ++i)
+        slot_footprint<K, V>(entries_of(storage)[i], fp);
+
+      for (size_t i = 0; i < children; ++i)
+      {
+        const auto& node = children_of(storage, entries)[i];
+        if (depth == (collision_depth - 1))
+          node_as<Collisions<K, V, H>>(node)->footprint(fp);
+        else
+          node_as<SubNodes<K, V, H>>(node)->footprint(depth + 1, fp);
+      }
     }
   };
 
+  template <class K, class V, class H>
+  class TransientMap;
+
   template <class K, class V, class H = std::hash<K>>
   class Map
   {
   private:
+    friend TransientMap<K, V, H>;
+
     std::shared_ptr<SubNodes<K, V, H>> root;
     size_t _size = 0;
 
@@ -354,6 +672,105 @@ namespace champ
       return Map(std::move(r.first), size_);
     }
 
+    /** Create a mutable builder from this map
+     *
+     * Successive puts on the builder modify the nodes it has already copied
+     * in place, rather than copying a path from the root for each put. This
+     * map is unaffected.
+     */
+    TransientMap<K, V, H> transient() const
+    {
+      return TransientMap<K, V, H>(*this);
+    }
+
+    template <class F>
+    bool foreach(F&& f) const
+    {
+      return root->foreach(0, std::forward<F>(f));
+    }
+
+    /** Add the nodes of this map to a footprint
+     *
+     * Nodes which this map shares with maps already added to the footprint
+     * are not counted again.
+     *
+     * @param fp Footprint to add to
+     */
+    void footprint(Footprint& fp) const
+    {
+      root->footprint(0, fp);
+    }
+  };
+
+  // A TransientMap owns every node it has modified since it was created, or
+  // since it was last frozen with persistent(). It is not thread safe, and
+  // must not be shared.
+  template <class K, class V, class H = std::hash<K>>
+  class TransientMap
+  {
+  private:
+    std::shared_ptr<SubNodes<K, V, H>> root;
+    size_t _size;
+    EditToken edit;
+
+  public:
+    TransientMap(const Map<K, V, H>& map) :
+      root(map.root),
+      _size(map._size),
+      edit(new_edit_token())
+    {}
+
+    TransientMap(const TransientMap& that) = delete;
+    TransientMap(TransientMap&& that) = default;
+
+    size_t size() const
+    {
+      return _size;
+    }
+
+    bool empty() const
+    {
+      return _size == 0;
+    }
+
+    std::optional<V> get(const K& key) const
+    {
+      auto v = root->getp(0, H()(key), key);
+
+      if (v)
+        return *v;
+      else
+        return {};
+    }
+
+    const V* getp(const K& key) const
+    {
+      return root->getp(0, H()(key), key);
+    }
+
+    void put(const K& key, const V& value)
+    {
+      if (root->edit != edit)
+      {
+        root = std::make_shared<SubNodes<K, V, H>>(*root);
+        root->edit = edit;
+      }
+
+      if (root->put_mut(0, H()(key), key, value, edit))
+        _size++;
+    }
+
+    /** Freeze the current contents as a persistent map
+     *
+     * The builder remains usable, but will copy any node it modifies from
+     * here on, since the returned map now shares them.
+     */
+    Map<K, V, H> persistent()
+    {
+      edit = new_edit_token();
+      return Map<K, V, H>(root, _size);
+    }
+
     template <class F>
     bool foreach(F&& f) const
     {
@@ -88,14 +88,64 @@ public:
   }
 
   template <class F>
-  void foreach(F&& f) const
+  bool foreach(F&& f) const
   {
-    if (!empty())
-    {
-      left().foreach(std::forward<F>(f));
-      f(rootKey(), rootValue());
+    if (empty())
+      return true;
+
+    return left().foreach(std::forward<F>(f)) && f(rootKey(), rootValue()) &&
       right().foreach(std::forward<F>(f));
+  }
+
+  // Visit entries with from <= key < to, in key order. Returns false if f
+  // stopped the iteration by returning false.
+  template <class F>
+  bool foreach_range(const K& from, const K& to, F&& f) const
+  {
+    return range(from, &to, f);
+  }
+
+  // Visit entries with from <= key, in key order.
+  template <class F>
+  bool foreach_from(const K& from, F&& f) const
+  {
+    return range(from, nullptr, f);
+  }
+
+  // RBMap cannot be modified in place, so its transient simply applies
+  // persistent puts. This lets an RBMap be used wherever a champ::Map is.
+  class Transient
+  {
+  private:
+    RBMap map;
+
+  public:
+    Transient(const RBMap& map_) : map(map_) {}
+
+    std::optional<V> get(const K& key) const
+    {
+      return map.get(key);
+    }
+
+    const V* getp(const K& key) const
+    {
+      return map.getp(key);
+    }
+
+    void put(const K& key, const V& value)
+    {
+      map = map.put(key, value);
+    }
+
+    RBMap persistent()
+    {
+      return map;
     }
+  };
+
+  Transient transient() const
+  {
+    return Transient(*this);
   }
 
 private:
@@ -126,6 +176,30 @@ private:
     return RBMap(_root->_rgt);
   }
 
+  template <class F>
+  bool range(const K& from, const K* to, F& f) const
+  {
+    if (empty())
+      return true;
+
+    auto& y = rootKey();
+
+    // Only descend into subtrees which may hold keys in range
+    if (from < y && !left().range(from, to, f))
+      return false;
+
+    if (!(y < from) && (to == nullptr || y < *to))
+    {
+      if (!f(y, rootValue()))
+        return false;
+    }
+
+    if (to == nullptr || y < *to)
+      return right().range(from, to, f);
+
+    return true;
+  }
+
   RBMap insert(const K& x, const V& v) const
   {
     if (empty())
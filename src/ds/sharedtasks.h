@@ -0,0 +1,77 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace ds
+{
+  /** A batch of independent tasks, shared out between the thread which runs
+   * the batch and any helper threads which join in.
+   *
+   * Tasks are claimed one at a time, so the batch completes even if no helper
+   * ever joins, and helpers which join late find nothing left to do. Helpers
+   * should hold the batch by shared_ptr, as they may outlive run().
+   */
+  class SharedTasks
+  {
+  private:
+    std::vector<std::function<void()>> tasks;
+    std::vector<std::exception_ptr> errors;
+    std::atomic<size_t> next = 0;
+    std::atomic<size_t> done = 0;
+
+  public:
+    SharedTasks(std::vector<std::function<void()>>&& tasks_) :
+      tasks(std::move(tasks_)),
+      errors(tasks.size())
+    {}
+
+    size_t size() const
+    {
+      return tasks.size();
+    }
+
+    /** Run tasks until none are left to claim. This may be called from any
+     * number of threads, at any time.
+     */
+    void help()
+    {
+      for (auto i = next++; i < tasks.size(); i = next++)
+      {
+        try
+        {
+          tasks[i]();
+        }
+        catch (...)
+        {
+          errors[i] = std::current_exception();
+        }
+        ++done;
+      }
+    }
+
+    /** Run tasks on the calling thread, alongside any helpers, and wait for
+     * all of them to complete. If any task threw, the exception of the first
+     * such task is rethrown.
+     */
+    void run()
+    {
+      help();
+
+      while (done.load() < tasks.size())
+        std::this_thread::yield();
+
+      for (auto& e : errors)
+      {
+        if (e)
+          std::rethrow_exception(e);
+      }
+    }
+  };
+}
@@ -0,0 +1,372 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace ds
+{
+  /** Hash map for small sets of entries, such as the reads and writes of a
+   * transaction.
+   *
+   * Entries are kept contiguously, in insertion order. Up to N of them are
+   * stored inline and found by a linear scan, so small maps do not allocate.
+   * Beyond that, the entries move to a single heap array, indexed by a flat
+   * open-addressing table of positions. Erasing moves the last entry into the
+   * erased one's place.
+   *
+   * Inserting or erasing invalidates iterators and references to entries.
+   */
+  template <
+    class K,
+    class V,
+    class H = std::hash<K>,
+    size_t N = 8,
+    class A = std::allocator<std::pair<K, V>>>
+  class SmallMap
+  {
+  public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K, V>;
+    using size_type = size_t;
+    using iterator = value_type*;
+    using const_iterator = const value_type*;
+    using allocator_type = A;
+
+  private:
+    using Traits = std::allocator_traits<A>;
+    using IndexAllocator = typename Traits::template rebind_alloc<uint32_t>;
+
+    // Slots hold the position of an entry plus one, or 0 if they are empty
+    static constexpr uint32_t empty_slot = 0;
+
+    A alloc;
+    alignas(value_type) unsigned char inline_entries[N * sizeof(value_type)];
+    value_type* entries;
+    size_t entry_count = 0;
+    size_t capacity = N;
+    std::vector<uint32_t, IndexAllocator> index;
+
+    bool is_inline() const
+    {
+      return entries == reinterpret_cast<const value_type*>(inline_entries);
+    }
+
+    value_type* inline_data()
+    {
+      return reinterpret_cast<value_type*>(inline_entries);
+    }
+
+    size_t slot_for(const K& key) const
+    {
+      return H()(key) & (index.size() - 1);
+    }
+
+    void index_entry(size_t pos)
+    {
+      auto slot = slot_for(entries[pos].first);
+      while (index[slot] != empty_slot)
+        slot = (slot + 1) & (index.size() - 1);
+      index[slot] = pos + 1;
+    }
+
+    void rebuild_index()
+    {
+      if (capacity <= N)
+      {
+        index.clear();
+        return;
+      }
+
+      // Keep the table at most half full
+      size_t slots = 1;
+      while (slots < 2 * capacity)
+        slots *= 2;
+
+      index.assign(slots, empty_slot);
+      for (size_t i = 0; i < entry_count; ++i)
+        index_entry(i);
+    }
+
+    void grow()
+    {
+      const auto new_capacity = 2 * capacity;
+      auto new_entries = Traits::allocate(alloc, new_capacity);
+      for (size_t i = 0; i < entry_count; ++i)
+      {
+        new (new_entries + i) value_type(std::move(entries[i]));
+        entries[i].~value_type();
+      }
+      release();
+      entries = new_entries;
+      capacity = new_capacity;
+      rebuild_index();
+    }
+
+    void release()
+    {
+      if (!is_inline())
+        Traits::deallocate(alloc, entries, capacity);
+    }
+
+    void destroy_entries()
+    {
+      for (size_t i = 0; i < entry_count; ++i)
+        entries[i].~value_type();
+      entry_count = 0;
+    }
+
+    template <typename... Args>
+    iterator append(Args&&... args)
+    {
+      if (entry_count == capacity)
+        grow();
+
+      new (entries + entry_count) value_type(std::forward<Args>(args)...);
+      entry_count++;
+      if (!index.empty())
+        index_entry(entry_count - 1);
+      return entries + entry_count - 1;
+    }
+
+    void take(SmallMap&& that)
+    {
+      if (that.is_inline())
+      {
+        for (size_t i = 0; i < that.entry_count; ++i)
+          new (inline_data() + i) value_type(std::move(that.entries[i]));
+        entry_count = that.entry_count;
+        that.destroy_entries();
+      }
+      else
+      {
+        entries = that.entries;
+        entry_count = that.entry_count;
+        capacity = that.capacity;
+        index = std::move(that.index);
+        that.entries = that.inline_data();
+        that.entry_count = 0;
+        that.capacity = N;
+        that.index.clear();
+      }
+    }
+
+  public:
+    SmallMap() : entries(inline_data()) {}
+
+    explicit SmallMap(const A& alloc_) :
+      alloc(alloc_),
+      entries(inline_data()),
+      index(IndexAllocator(alloc_))
+    {}
+
+    SmallMap(const SmallMap& that) :
+      alloc(Traits::select_on_container_copy_construction(that.alloc)),
+      entries(inline_data()),
+      index(IndexAllocator(alloc))
+    {
+      for (const auto& e : that)
+        append(e);
+    }
+
+    SmallMap(SmallMap&& that) :
+      alloc(that.alloc),
+      entries(inline_data()),
+      index(IndexAllocator(alloc))
+    {
+      take(std::move(that));
+    }
+
+    SmallMap& operator=(const SmallMap& that)
+    {
+      if (this != &that)
+      {
+        clear();
+        for (const auto& e : that)
+          append(e);
+      }
+      return *this;
+    }
+
+    SmallMap& operator=(SmallMap&& that)
+    {
+      if (this != &that)
+      {
+        destroy_entries();
+        release();
+        entries = inline_data();
+        capacity = N;
+        index.clear();
+
+        if (alloc == that.alloc)
+        {
+          take(std::move(that));
+        }
+        else
+        {
+          for (auto& e : that)
+            append(std::move(e));
+          that.clear();
+        }
+      }
+      return *this;
+    }
+
+    ~SmallMap()
+    {
+      destroy_entries();
+      release();
+    }
+
+    iterator begin()
+    {
+      return entries;
+    }
+
+    iterator end()
+    {
+      return entries + entry_count;
+    }
+
+    const_iterator begin() const
+    {
+      return entries;
+    }
+
+    const_iterator end() const
+    {
+      return entries + entry_count;
+    }
+
+    size_t size() const
+    {
+      return entry_count;
+    }
+
+    bool empty() const
+    {
+      return entry_count == 0;
+    }
+
+    void clear()
+    {
+      destroy_entries();
+      if (!index.empty())
+        std::fill(index.begin(), index.end(), empty_slot);
+    }
+
+    iterator find(const K& key)
+    {
+      return const_cast<iterator>(std::as_const(*this).find(key));
+    }
+
+    const_iterator find(const K& key) const
+    {
+      if (index.empty())
+      {
+        for (size_t i = 0; i < entry_count; ++i)
+        {
+          if (entries[i].first == key)
+            return entries + i;
+        }
+        return end();
+      }
+
+      for (auto slot = slot_for(key); index[slot] != empty_slot;
+           slot = (slot + 1) & (index.size() - 1))
+      {
+        const auto pos = index[slot] - 1;
+        if (entries[pos].first == key)
+          return entries + pos;
+      }
+      return end();
+    }
+
+    size_t count(const K& key) const
+    {
+      return find(key) == end() ? 0 : 1;
+    }
+
+    V& at(const K& key)
+    {
+      auto it = find(key);
+      if (it == end())
+        throw std::out_of_range("Key not found in SmallMap");
+      return it->second;
+    }
+
+    const V& at(const K& key) const
+    {
+      auto it = find(key);
+      if (it == end())
+        throw std::out_of_range("Key not found in SmallMap");
+      return it->second;
+    }
+
+    V& operator[](const K& key)
+    {
+      auto it = find(key);
+      if (it != end())
+        return it->second;
+
+      return append(
+               std::piecewise_construct,
+               std::forward_as_tuple(key),
+               std::forward_as_tuple())
+        ->second;
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value)
+    {
+      auto it = find(value.first);
+      if (it != end())
+        return {it, false};
+
+      return {append(value), true};
+    }
+
+    std::pair<iterator, bool> insert(value_type&& value)
+    {
+      auto it = find(value.first);
+      if (it != end())
+        return {it, false};
+
+      return {append(std::move(value)), true};
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+      value_type value(std::forward<Args>(args)...);
+      return insert(std::move(value));
+    }
+
+    size_t erase(const K& key)
+    {
+      auto it = find(key);
+      if (it == end())
+        return 0;
+
+      auto last = end() - 1;
+      if (it != last)
+        *it = std::move(*last);
+      last->~value_type();
+      entry_count--;
+
+      if (!index.empty())
+        rebuild_index();
+
+      return 1;
+    }
+  };
+}
@@ -0,0 +1,84 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#include "../arena.h"
+
+#include <doctest/doctest.h>
+#include <string>
+#include <unordered_map>
+
+using Map = std::unordered_map<
+  std::string,
+  size_t,
+  std::hash<std::string>,
+  std::equal_to<std::string>,
+  ds::ArenaAllocator<std::pair<const std::string, size_t>>>;
+
+struct Object : public ds::ArenaAllocated
+{
+  size_t value;
+
+  Object(size_t value_) : value(value_) {}
+};
+
+TEST_CASE("Arena allocation" * doctest::test_suite("arena"))
+{
+  REQUIRE(ds::Arena::current() == nullptr);
+  const auto before = ds::Arena::thread_stats();
+
+  INFO("Without a scope, allocations use the heap");
+  {
+    Map m;
+    m["key"] = 1;
+    std::unique_ptr<Object> o(new Object(1));
+    REQUIRE(ds::Arena::thread_stats().allocations == before.allocations);
+  }
+
+  INFO("In a scope, allocations use the arena until it closes");
+  {
+    {
+      ds::ArenaScope scope;
+      REQUIRE(ds::Arena::current() != nullptr);
+
+      {
+        ds::ArenaScope nested;
+      }
+      REQUIRE(ds::Arena::current() != nullptr);
+      REQUIRE(ds::Arena::thread_stats().resets == before.resets);
+
+      Map m;
+      for (size_t i = 0; i < 100; ++i)
+        m[std::to_string(i)] = i;
+      REQUIRE(m.at("42") == 42);
+
+      std::unique_ptr<Object> o(new Object(2));
+      REQUIRE(o->value == 2);
+      REQUIRE(
+        reinterpret_cast<uintptr_t>(o.get()) % alignof(std::max_align_t) == 0);
+    }
+
+    const auto after = ds::Arena::thread_stats();
+    REQUIRE(ds::Arena::current() == nullptr);
+    REQUIRE(after.allocations > before.allocations);
+    REQUIRE(after.chunks == before.chunks + 1);
+    REQUIRE(after.resets == before.resets + 1);
+  }
+
+  INFO("The first chunk is reused after a reset");
+  {
+    {
+      ds::ArenaScope scope;
+      Map m;
+      m["key"] = 1;
+    }
+    REQUIRE(ds::Arena::thread_stats().chunks == before.chunks + 1);
+  }
+
+  INFO("Allocations larger than a chunk get their own chunk");
+  {
+    ds::ArenaScope scope;
+    auto arena = ds::Arena::current();
+    auto p = arena->allocate(2 * ds::Arena::chunk_size);
+    REQUIRE(p != nullptr);
+    REQUIRE(arena->allocate(1) != nullptr);
+  }
+}
@@ -0,0 +1,83 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#include "../champmap.h"
+#include "../logger.h"
+
+#include <deque>
+#include <random>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+using namespace std;
+
+using K = uint64_t;
+using V = uint64_t;
+
+static constexpr size_t total_puts = 1000000;
+static constexpr size_t puts_per_commit = 100;
+static constexpr size_t retained_versions = 10;
+
+static constexpr size_t max_expected_bytes_per_key = 48;
+
+static size_t get_maxrss()
+{
+  rusage r;
+  auto rc = getrusage(RUSAGE_SELF, &r);
+  if (rc != 0)
+    throw std::logic_error("getrusage failed");
+  return r.ru_maxrss;
+}
+
+static champ::Footprint get_footprint(
+  const std::deque<champ::Map<K, V>>& versions)
+{
+  champ::Footprint fp;
+  for (const auto& v : versions)
+    v.footprint(fp);
+  return fp;
+}
+
+static int commit_and_compact()
+{
+  std::deque<champ::Map<K, V>> versions = {champ::Map<K, V>()};
+  std::mt19937_64 r;
+
+  for (size_t index = 0; index < total_puts; index += puts_per_commit)
+  {
+    auto next = versions.back().transient();
+    for (size_t i = 0; i < puts_per_commit; ++i)
+      next.put(r(), index + i);
+    versions.push_back(next.persistent());
+
+    if (versions.size() > retained_versions)
+      versions.pop_front();
+
+    if (index % (total_puts / 10) == 0)
+    {
+      auto fp = get_footprint(versions);
+      LOG_INFO_FMT(
+        "{} keys: {} nodes, {} bytes, MAX RSS: {}Kb",
+        versions.back().size(),
+        fp.nodes,
+        fp.bytes,
+        get_maxrss());
+    }
+  }
+
+  auto fp = get_footprint(versions);
+  auto bytes_per_key = fp.bytes / versions.back().size();
+  LOG_INFO_FMT(
+    "{} keys: {} nodes, {} bytes ({} per key), MAX RSS: {}Kb",
+    versions.back().size(),
+    fp.nodes,
+    fp.bytes,
+    bytes_per_key,
+    get_maxrss());
+
+  return bytes_per_key < max_expected_bytes_per_key ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+  return commit_and_compact();
+}
@@ -117,6 +117,72 @@ static void benchmark_foreach(picobench::state& s)
   s.stop_timer();
 }
 
+// Applies a batch of s.iterations() puts to a large map, as a transaction
+// commit does, either one persistent put at a time or through a transient
+template <bool transient>
+static void benchmark_put_batch(picobench::state& s)
+{
+  using M = champ::Map<K, V>;
+  size_t size = s.iterations();
+  auto v = gen_val(val_size);
+  auto map = gen_map<M>(32 << 8);
+  s.start_timer();
+  if constexpr (transient)
+  {
+    auto t = map.transient();
+    for (size_t i = 0; i < size; ++i)
+    {
+      t.put(i * 3, v);
+    }
+    auto res = t.persistent();
+    do_not_optimize(res);
+  }
+  else
+  {
+    auto res = map;
+    for (size_t i = 0; i < size; ++i)
+    {
+      res = res.put(i * 3, v);
+    }
+    do_not_optimize(res);
+  }
+  clobber_memory();
+  s.stop_timer();
+}
+
+// Visits the 32 keys following the middle of the map. champ::Map is not
+// ordered, so it must visit every entry and filter those in range.
+template <class M>
+static void benchmark_range(picobench::state& s)
+{
+  size_t size = s.iterations();
+  auto map = gen_map<M>(size);
+  const K from = size / 2;
+  const K to = from + 32;
+  size_t count = 0;
+  auto f = [&count](const auto& key, const auto& value) {
+    count++;
+    return true;
+  };
+  s.start_timer();
+  for (auto _ : s)
+  {
+    (void)_;
+    if constexpr (std::is_same_v<M, RBMap<K, V>>)
+    {
+      map.foreach_range(from, to, f);
+    }
+    else
+    {
+      map.foreach([&](const auto& key, const auto& value) {
+        return (key < from || key >= to) || f(key, value);
+      });
+    }
+    clobber_memory();
+  }
+  s.stop_timer();
+}
+
 const std::vector<int> sizes = {32, 32 << 2, 32 << 4, 32 << 6, 32 << 8};
 
 PICOBENCH_SUITE("put");
@@ -125,6 +191,19 @@ PICOBENCH(bench_rb_map_put).iterations(sizes).samples(10).baseline();
 auto bench_champ_map_put = benchmark_put<champ::Map<K, V>>;
 PICOBENCH(bench_champ_map_put).iterations(sizes).samples(10);
 
+const std::vector<int> batch_sizes = {10, 100, 10000};
+
+PICOBENCH_SUITE("put_batch");
+auto bench_champ_map_put_batch = benchmark_put_batch<false>;
+PICOBENCH(bench_champ_map_put_batch)
+  .iterations(batch_sizes)
+  .samples(10)
+  .baseline();
+auto bench_champ_map_put_batch_transient = benchmark_put_batch<true>;
+PICOBENCH(bench_champ_map_put_batch_transient)
+  .iterations(batch_sizes)
+  .samples(10);
+
 PICOBENCH_SUITE("get");
 auto bench_rb_map_get = benchmark_get<RBMap<K, V>>;
 PICOBENCH(bench_rb_map_get).iterations(sizes).samples(10).baseline();
@@ -142,3 +221,9 @@ auto bench_rb_map_foreach = benchmark_foreach<RBMap<K, V>>;
 PICOBENCH(bench_rb_map_foreach).iterations(for_sizes).samples(10).baseline();
 auto bench_champ_map_foreach = benchmark_foreach<champ::Map<K, V>>;
 PICOBENCH(bench_champ_map_foreach).iterations(for_sizes).samples(10);
+
+PICOBENCH_SUITE("range");
+auto bench_rb_map_range = benchmark_range<RBMap<K, V>>;
+PICOBENCH(bench_rb_map_range).iterations(sizes).samples(10).baseline();
+auto bench_champ_map_range = benchmark_range<champ::Map<K, V>>;
+PICOBENCH(bench_champ_map_range).iterations(sizes).samples(10);
@@ -6,6 +6,7 @@
 
 #include <doctest/doctest.h>
 #include <random>
+#include <string>
 
 using namespace std;
 
@@ -136,3 +137,164 @@ TEST_CASE("persistent map operations")
     champ = champ_new;
   }
 }
+
+TEST_CASE("transient map operations")
+{
+  RBMap<K, V> rb;
+  champ::Map<K, V, H> champ;
+
+  auto ops = gen_ops(500);
+  constexpr size_t batch_size = 50;
+
+  for (size_t i = 0; i < ops.size(); i += batch_size)
+  {
+    auto rb_new = rb;
+    auto transient = champ.transient();
+
+    // Apply a batch of puts to the transient map, and the same puts to the
+    // reference persistent map
+    for (size_t j = i; j < std::min(i + batch_size, ops.size()); ++j)
+    {
+      auto put = dynamic_cast<Put*>(ops[j].get());
+      REQUIRE(put != nullptr);
+      transient.put(put->k, put->v);
+      rb_new = rb_new.put(put->k, put->v);
+    }
+
+    auto champ_new = transient.persistent();
+
+    INFO("check consistency of frozen transient map");
+    {
+      size_t n = 0;
+      champ_new.foreach([&](const auto& k, const auto& v) {
+        n++;
+        auto p = rb_new.get(k);
+        REQUIRE(p.has_value());
+        REQUIRE(p.value() == v);
+        return true;
+      });
+      REQUIRE(n == champ_new.size());
+      REQUIRE(n == transient.size());
+    }
+
+    INFO("check further transient puts do not modify frozen map");
+    {
+      const auto size_before = champ_new.size();
+      for (const auto& op : ops)
+      {
+        auto put = dynamic_cast<Put*>(op.get());
+        transient.put(put->k, put->v + 1);
+        transient.put(put->k + 1, put->v);
+      }
+      REQUIRE(champ_new.size() == size_before);
+      champ_new.foreach([&](const auto& k, const auto& v) {
+        REQUIRE(rb_new.get(k).value() == v);
+        return true;
+      });
+    }
+
+    INFO("check persistence of previous versions");
+    {
+      size_t n = 0;
+      champ.foreach([&](const auto& k, const auto& v) {
+        n++;
+        auto p = rb.get(k);
+        REQUIRE(p.has_value());
+        REQUIRE(p.value() == v);
+        return true;
+      });
+      REQUIRE(n == champ.size());
+    }
+
+    rb = rb_new;
+    champ = champ_new;
+  }
+}
+
+TEST_CASE("ordered range iteration")
+{
+  RBMap<K, V> rb;
+  for (K k = 0; k < 100; k += 3)
+  {
+    rb = rb.put(k, k * 2);
+  }
+
+  auto collect = [&rb](K from, std::optional<K> to) {
+    vector<K> keys;
+    auto f = [&keys](const K& k, const V& v) {
+      REQUIRE(v == k * 2);
+      keys.push_back(k);
+      return true;
+    };
+    if (to.has_value())
+      REQUIRE(rb.foreach_range(from, to.value(), f));
+    else
+      REQUIRE(rb.foreach_from(from, f));
+    return keys;
+  };
+
+  REQUIRE(collect(0, 10) == vector<K>{0, 3, 6, 9});
+  REQUIRE(collect(1, 9) == vector<K>{3, 6});
+  REQUIRE(collect(10, 12).empty());
+  REQUIRE(collect(90, {}) == vector<K>{90, 93, 96, 99});
+  REQUIRE(collect(100, {}).empty());
+
+  size_t count = 0;
+  REQUIRE_FALSE(rb.foreach_range(0, 100, [&count](const K& k, const V& v) {
+    return ++count < 5;
+  }));
+  REQUIRE(count == 5);
+}
+
+TEST_CASE("champ map footprint")
+{
+  champ::Map<K, V, H> champ;
+
+  INFO("an empty map has only a root node");
+  {
+    champ::Footprint fp;
+    champ.footprint(fp);
+    REQUIRE(fp.nodes == 1);
+  }
+
+  for (K k = 0; k < 1000; ++k)
+    champ = champ.put(k, k);
+
+  champ::Footprint fp;
+  champ.footprint(fp);
+  REQUIRE(fp.nodes > 1);
+  REQUIRE(fp.bytes > fp.nodes * sizeof(V));
+
+  INFO("counting a map twice does not change its footprint");
+  {
+    auto fp2 = fp;
+    champ.footprint(fp2);
+    REQUIRE(fp2.nodes == fp.nodes);
+    REQUIRE(fp2.bytes == fp.bytes);
+  }
+
+  INFO("nodes shared between versions are counted once");
+  {
+    auto next = champ.put(0, 1);
+    champ::Footprint both;
+    champ.footprint(both);
+    next.footprint(both);
+    REQUIRE(both.nodes > fp.nodes);
+    REQUIRE(both.nodes < 2 * fp.nodes);
+    REQUIRE(both.bytes < 2 * fp.bytes);
+  }
+
+  INFO("entries which are not stored inline are counted");
+  {
+    champ::Map<K, std::string, H> strings;
+    for (K k = 0; k < 1000; ++k)
+      strings = strings.put(k, std::to_string(k));
+
+    champ::Footprint strings_fp;
+    strings.footprint(strings_fp);
+    REQUIRE(strings_fp.nodes == fp.nodes);
+    REQUIRE(
+      strings_fp.bytes >
+      fp.bytes + strings.size() * sizeof(champ::Entry<K, std::string>));
+  }
+}
@@ -0,0 +1,91 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#include "../smallmap.h"
+
+#include <doctest/doctest.h>
+#include <map>
+#include <random>
+#include <string>
+
+using Map = ds::SmallMap<std::string, size_t, std::hash<std::string>, 4>;
+
+TEST_CASE("SmallMap matches std::map" * doctest::test_suite("smallmap"))
+{
+  std::mt19937 rng(42);
+  std::map<std::string, size_t> expected;
+  Map m;
+
+  auto check = [&]() {
+    REQUIRE(m.size() == expected.size());
+    for (const auto& [k, v] : expected)
+    {
+      REQUIRE(m.count(k) == 1);
+      REQUIRE(m.at(k) == v);
+    }
+    for (const auto& [k, v] : m)
+      REQUIRE(expected.at(k) == v);
+  };
+
+  // Random inserts, updates and erases, while the map grows past its inline
+  // capacity and shrinks again
+  for (size_t i = 0; i < 2000; ++i)
+  {
+    const auto range = i < 1000 ? 2 + i / 10 : 2 + (2000 - i) / 10;
+    const auto key = std::to_string(rng() % range);
+
+    switch (rng() % 4)
+    {
+      case 0:
+      {
+        REQUIRE(m.insert({key, i}).second == (expected.count(key) == 0));
+        expected.insert({key, i});
+        break;
+      }
+      case 1:
+      {
+        m[key] = i;
+        expected[key] = i;
+        break;
+      }
+      case 2:
+      {
+        REQUIRE(m.erase(key) == expected.erase(key));
+        break;
+      }
+      default:
+      {
+        REQUIRE((m.find(key) == m.end()) == (expected.count(key) == 0));
+      }
+    }
+
+    check();
+  }
+
+  INFO("Copies and moves keep every entry");
+  {
+    Map copy(m);
+    Map moved(std::move(copy));
+    REQUIRE(copy.empty());
+    REQUIRE(moved.size() == m.size());
+
+    Map assigned;
+    assigned = moved;
+    for (const auto& [k, v] : m)
+      REQUIRE(assigned.at(k) == v);
+
+    m.clear();
+    expected.clear();
+    check();
+  }
+
+  INFO("Missing keys");
+  {
+    REQUIRE_THROWS_AS(m.at("missing"), std::out_of_range);
+    auto [it, inserted] = m.emplace(
+      std::piecewise_construct,
+      std::forward_as_tuple("key"),
+      std::forward_as_tuple(1));
+    REQUIRE(inserted);
+    REQUIRE(it->second == 1);
+  }
+}
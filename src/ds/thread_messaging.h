@@ -211,6 +211,18 @@ namespace enclave
       return tid;
     }
 
+    /** Worker thread which runs the execution lane of a key
+     *
+     * Lanes are run by the ordinary worker threads, between their other
+     * tasks.
+     *
+     * @param key_hash Hash of the key
+     */
+    static uint16_t get_lane_thread(size_t key_hash)
+    {
+      return get_execution_thread(static_cast<uint32_t>(key_hash));
+    }
+
     template <typename Payload>
     static void ChangeTmsgCallback(
       std::unique_ptr<Tmsg<Payload>>& msg,
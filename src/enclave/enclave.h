@@ -7,10 +7,12 @@
 #include "ds/oversized.h"
 #include "interface.h"
 #include "node/entities.h"
+#include "node/globalhooks.h"
 #include "node/networkstate.h"
 #include "node/nodestate.h"
 #include "node/nodetypes.h"
 #include "node/notifier.h"
+#include "node/paralleldeserialise.h"
 #include "node/rpc/forwarder.h"
 #include "node/rpc/nodefrontend.h"
 #include "node/timer.h"
@@ -60,6 +62,13 @@ namespace enclave
       logger::config::msg() = AdminMessage::log_msg;
       logger::config::writer() = writer_factory.create_writer_to_outside();
 
+      ccf::GlobalHookDispatcher::install(*network.tables);
+      ccf::ParallelDeserialiseDispatcher::install(*network.tables);
+
+      // Created before the frontends, so that they can serve historical reads
+      network.historical_states = std::make_shared<ccf::historical::StateCache>(
+        *network.tables, writer_factory);
+
       REGISTER_FRONTEND(
         rpc_map,
         members,
@@ -76,6 +85,7 @@ namespace enclave
         fe->set_sig_intervals(
           signature_intervals.sig_max_tx, signature_intervals.sig_max_ms);
         fe->set_cmd_forwarder(cmd_forwarder);
+        fe->set_rpc_responder(rpcsessions);
       }
 
       node.initialize(consensus_config, n2n_channels, rpc_map, cmd_forwarder);
@@ -214,24 +224,66 @@ namespace enclave
 
         DISPATCHER_SET_MESSAGE_HANDLER(
           bp,
-          consensus::ledger_entry,
+          consensus::ledger_entries,
           [this](const uint8_t* data, size_t size) {
-            auto [body] =
-              ringbuffer::read_message<consensus::ledger_entry>(data, size);
-            if (node.is_reading_public_ledger())
-              node.recover_public_ledger_entry(body);
-            else if (node.is_reading_private_ledger())
-              node.recover_private_ledger_entry(body);
-            else
-              LOG_FAIL_FMT("Cannot recover ledger entry: Unexpected state");
+            auto [from, entries] =
+              ringbuffer::read_message<consensus::ledger_entries>(data, size);
+            node.recover_ledger_entries(from, entries.data, entries.size);
           });
 
         DISPATCHER_SET_MESSAGE_HANDLER(
           bp,
           consensus::ledger_no_entry,
           [this](const uint8_t* data, size_t size) {
-            ringbuffer::read_message<consensus::ledger_no_entry>(data, size);
-            node.recover_ledger_end();
+            auto [idx] =
+              ringbuffer::read_message<consensus::ledger_no_entry>(data, size);
+            node.recover_ledger_end(idx);
+          });
+
+        DISPATCHER_SET_MESSAGE_HANDLER(
+          bp,
+          consensus::ledger_durable,
+          [this](const uint8_t* data, size_t size) {
+            auto [idx, truncations] =
+              ringbuffer::read_message<consensus::ledger_durable>(data, size);
+            node.ledger_durable(idx, truncations);
+          });
+
+        DISPATCHER_SET_MESSAGE_HANDLER(
+          bp,
+          consensus::ledger_historical_entry,
+          [this](const uint8_t* data, size_t size) {
+            auto [idx, body] =
+              ringbuffer::read_message<consensus::ledger_historical_entry>(
+                data, size);
+            network.historical_states->handle_ledger_entry(idx, body);
+          });
+
+        DISPATCHER_SET_MESSAGE_HANDLER(
+          bp,
+          consensus::ledger_historical_no_entry,
+          [this](const uint8_t* data, size_t size) {
+            auto [idx] =
+              ringbuffer::read_message<consensus::ledger_historical_no_entry>(
+                data, size);
+            network.historical_states->handle_no_entry(idx);
+          });
+
+        DISPATCHER_SET_MESSAGE_HANDLER(
+          bp,
+          consensus::snapshot_entry,
+          [this](const uint8_t* data, size_t size) {
+            auto [idx, body] =
+              ringbuffer::read_message<consensus::snapshot_entry>(data, size);
+            node.recv_snapshot(idx, body);
+          });
+
+        DISPATCHER_SET_MESSAGE_HANDLER(
+          bp,
+          consensus::snapshot_no_entry,
+          [this](const uint8_t* data, size_t size) {
+            ringbuffer::read_message<consensus::snapshot_no_entry>(data, size);
+            node.recv_snapshot(0, {});
           });
 
         rpcsessions->register_message_handlers(bp.get_dispatcher());
@@ -46,6 +46,28 @@ struct CCFConfig
   };
   SignatureIntervals signature_intervals = {};
 
+  struct GroupCommit
+  {
+    size_t max_batch_size;
+    size_t max_delay_ms;
+    MSGPACK_DEFINE(max_batch_size, max_delay_ms);
+  };
+  GroupCommit group_commit = {};
+
+  struct Snapshots
+  {
+    size_t tx_interval;
+    MSGPACK_DEFINE(tx_interval);
+  };
+  Snapshots snapshots = {};
+
+  struct HistoricalStates
+  {
+    size_t max_cache_bytes;
+    MSGPACK_DEFINE(max_cache_bytes);
+  };
+  HistoricalStates historical_states = {};
+
   struct Genesis
   {
     std::vector<ccf::MemberPubInfo> members_info;
@@ -69,6 +91,9 @@ struct CCFConfig
     node_info_network,
     domain,
     signature_intervals,
+    group_commit,
+    snapshots,
+    historical_states,
     genesis,
     joining);
 };
@@ -18,6 +18,11 @@ namespace enclave
     std::vector<uint8_t> caller_cert = {}; // DER certificate
     bool is_forwarding = false;
 
+    // Requests of this session being processed in a frontend's lane, and the
+    // thread running that lane. Only accessed from the session's thread
+    size_t requests_in_lane = 0;
+    uint16_t lane_thread = 0;
+
     //
     // Only set in the case of a forwarded RPC
     //
@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "ds/logger.h"
+#include "proxy.h"
+
+namespace asynchost
+{
+  // This runs on the loop after it is woken by send(), which may be called
+  // from any thread. Several sends may be coalesced into a single run.
+  template <typename Behaviour>
+  class Async : public with_uv_handle<uv_async_t>
+  {
+  private:
+    friend class close_ptr<Async<Behaviour>>;
+    Behaviour behaviour;
+
+    template <typename... Args>
+    Async(Args&&... args) : behaviour(std::forward<Args>(args)...)
+    {
+      int rc;
+
+      if ((rc = uv_async_init(uv_default_loop(), &uv_handle, on_async)) < 0)
+      {
+        LOG_FAIL_FMT("uv_async_init failed: {}", uv_strerror(rc));
+        throw std::logic_error("uv_async_init failed");
+      }
+
+      uv_handle.data = this;
+    }
+
+    static void on_async(uv_async_t* handle)
+    {
+      static_cast<Async*>(handle->data)->on_async();
+    }
+
+    void on_async()
+    {
+      behaviour.on_async();
+    }
+
+  public:
+    void send()
+    {
+      int rc;
+
+      if ((rc = uv_async_send(&uv_handle)) < 0)
+      {
+        LOG_FAIL_FMT("uv_async_send failed: {}", uv_strerror(rc));
+        throw std::logic_error("uv_async_send failed");
+      }
+    }
+  };
+}
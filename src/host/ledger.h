@@ -3,156 +3,412 @@
 #pragma once
 
 #include "consensus/ledgerenclavetypes.h"
+#include "ds/buffer.h"
 #include "ds/logger.h"
 #include "ds/messaging.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <vector>
 
 namespace asynchost
 {
-  class Ledger
+  /** Framed entries read from the ledger. data remains valid for as long as
+   * owner is held, even if the chunk holding the entries is closed or
+   * truncated in the meantime.
+   */
+  struct FramedEntries
+  {
+    CBuffer data;
+    std::shared_ptr<const void> owner;
+  };
+
+  /** A chunk of the ledger: a file holding a contiguous range of entries,
+   * each framed by its size.
+   *
+   * When a chunk is completed, a trailer holding the position of each of its
+   * entries, followed by the size of its frames, is appended to it, and it is
+   * renamed to include the index of its last entry. The range of a complete
+   * chunk is then known from its name alone, and its positions are read from
+   * its trailer, without scanning its entries, only once it is opened.
+   *
+   * Complete chunks are mapped read-only, so that their entries can be sent
+   * without being copied. Only the incomplete chunk is read and written
+   * through stdio.
+   */
+  class LedgerChunk
   {
   private:
     static constexpr size_t frame_header_size = sizeof(uint32_t);
+    using Position = uint64_t;
 
-    // This uses C stdio instead of fstream because an fstream
-    // cannot be truncated.
-    FILE* file;
-    std::vector<size_t> positions;
-    size_t total_len;
-    ringbuffer::WriterPtr to_enclave;
-
-  public:
-    Ledger(
-      const std::string& filename,
-      ringbuffer::AbstractWriterFactory& writer_factory) :
-      file(NULL),
-      to_enclave(writer_factory.create_writer_to_inside())
+    struct Mapping
     {
-      file = fopen(filename.c_str(), "r+b");
+      const uint8_t* data = nullptr;
+      size_t size = 0;
 
-      if (!file)
-        file = fopen(filename.c_str(), "w+b");
+      Mapping(const std::string& path)
+      {
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+          throw std::logic_error("Unable to open ledger chunk " + path);
 
-      if (!file)
-        throw std::logic_error("Unable to open or create ledger file");
+        struct stat st;
+        auto rc = fstat(fd, &st);
+        size = st.st_size;
+
+        void* p = nullptr;
+        if (rc == 0 && size > 0)
+          p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (rc != 0 || p == MAP_FAILED)
+        {
+          std::stringstream ss;
+          ss << "Unable to map ledger chunk " << path << ": "
+             << strerror(errno);
+          throw std::logic_error(ss.str());
+        }
+        data = (const uint8_t*)p;
+      }
+
+      Mapping(const Mapping& that) = delete;
+
+      ~Mapping()
+      {
+        if (data)
+          munmap((void*)data, size);
+      }
+    };
+
+    const std::string dir;
+    const size_t start_idx;
+    size_t last_idx;
+    bool complete;
+
+    // The file of an incomplete chunk. This uses C stdio instead of fstream
+    // because an fstream cannot be truncated.
+    FILE* file = nullptr;
 
-      fseeko(file, 0, SEEK_END);
-      auto len = ftello(file);
-      if (len == 1)
+    // The mapping of a complete chunk, shared with the entries read from it
+    std::shared_ptr<const Mapping> mapping;
+
+    std::vector<Position> positions;
+    size_t total_len = 0;
+
+    std::string get_path() const
+    {
+      return dir + "/" + get_file_name(start_idx, last_idx, complete);
+    }
+
+    void flush()
+    {
+      if (fflush(file) != 0)
       {
         std::stringstream ss;
-        ss << "Failed to tell file size: " << strerror(errno);
+        ss << "Failed to flush file: " << strerror(errno);
         throw std::logic_error(ss.str());
       }
-      fseeko(file, 0, SEEK_SET);
-      size_t pos = 0;
-      uint32_t size = 0;
+    }
 
-      while (len >= frame_header_size)
+    void rename_to(const std::string& from)
+    {
+      if (rename(from.c_str(), get_path().c_str()) != 0)
       {
-        if (fread(&size, frame_header_size, 1, file) != 1)
-          throw std::logic_error("Failed to read from file");
+        std::stringstream ss;
+        ss << "Failed to rename ledger chunk " << from << ": "
+           << strerror(errno);
+        throw std::logic_error(ss.str());
+      }
+    }
 
-        len -= frame_header_size;
+    // Find the position of each entry in len bytes of frames
+    static bool scan_frames(
+      const uint8_t* data, size_t len, std::vector<Position>& positions)
+    {
+      positions.clear();
+      size_t pos = 0;
+      uint32_t size = 0;
 
-        if (len < size)
-          throw std::logic_error("Malformed ledger file");
+      while (len - pos >= frame_header_size)
+      {
+        memcpy(&size, data + pos, frame_header_size);
 
-        fseeko(file, size, SEEK_CUR);
-        len -= size;
+        if (len - pos - frame_header_size < size)
+          return false;
 
         positions.push_back(pos);
         pos += (size + frame_header_size);
       }
 
-      total_len = pos;
-
-      if (len != 0)
-        throw std::logic_error("Malformed ledger file");
+      return pos == len;
     }
 
-    Ledger(const Ledger& that) = delete;
-
-    ~Ledger()
+    // Read the trailer of the chunk, if its file ends with one
+    bool read_trailer(const Mapping& m)
     {
-      if (file)
-      {
-        fflush(file);
-        fclose(file);
-      }
+      Position frames_len;
+      if (m.size < sizeof(frames_len))
+        return false;
+
+      memcpy(
+        &frames_len,
+        m.data + m.size - sizeof(frames_len),
+        sizeof(frames_len));
+
+      const auto table_size = m.size - sizeof(frames_len) - frames_len;
+      if (
+        frames_len > m.size - sizeof(frames_len) ||
+        table_size % sizeof(Position) != 0)
+        return false;
+
+      positions.resize(table_size / sizeof(Position));
+      if (!positions.empty())
+        memcpy(positions.data(), m.data + frames_len, table_size);
+
+      total_len = frames_len;
+      return positions.empty() ?
+        frames_len == 0 :
+        (positions.front() == 0 && positions.back() < frames_len);
     }
 
-    size_t get_last_idx()
+    const uint8_t* read(size_t pos, size_t len, uint8_t* data)
     {
-      return positions.size();
+      if (mapping)
+        return (const uint8_t*)memcpy(data, mapping->data + pos, len);
+
+      fseeko(file, pos, SEEK_SET);
+      if (len > 0 && fread(data, len, 1, file) != 1)
+        throw std::logic_error("Failed to read from file");
+      return data;
     }
 
-    const std::vector<uint8_t> read_entry(size_t idx)
+  public:
+    /** Create a new, empty chunk, whose first entry will be start_idx */
+    LedgerChunk(const std::string& dir, size_t start_idx) :
+      dir(dir),
+      start_idx(start_idx),
+      last_idx(start_idx - 1),
+      complete(false)
     {
-      if ((idx == 0) || (idx > positions.size()))
-        return {};
+      file = fopen(get_path().c_str(), "w+b");
+      if (!file)
+        throw std::logic_error("Unable to create ledger chunk " + get_path());
+    }
 
-      auto len = entry_size(idx);
-      std::vector<uint8_t> entry(len);
-      fseeko(file, positions.at(idx - 1) + frame_header_size, SEEK_SET);
+    /** An existing chunk, which is not read until it is opened */
+    LedgerChunk(
+      const std::string& dir,
+      size_t start_idx,
+      size_t last_idx,
+      bool complete) :
+      dir(dir),
+      start_idx(start_idx),
+      last_idx(last_idx),
+      complete(complete)
+    {}
 
-      if (fread(entry.data(), len, 1, file) != 1)
-        throw std::logic_error("Failed to read from file");
+    LedgerChunk(const LedgerChunk& that) = delete;
 
-      return entry;
+    ~LedgerChunk()
+    {
+      close();
     }
 
-    const std::vector<uint8_t> read_framed_entries(size_t from, size_t to)
+    static std::string get_file_name(
+      size_t start_idx, size_t last_idx, bool complete)
     {
-      auto framed_size = framed_entries_size(from, to);
+      auto name = "ledger_" + std::to_string(start_idx);
+      if (complete)
+        name += "-" + std::to_string(last_idx);
+      return name;
+    }
 
-      std::vector<uint8_t> framed_entries(framed_size);
-      if (framed_size == 0)
-        return framed_entries;
+    size_t get_start_idx() const
+    {
+      return start_idx;
+    }
 
-      fseeko(file, positions.at(from - 1), SEEK_SET);
+    size_t get_last_idx() const
+    {
+      return last_idx;
+    }
 
-      if (fread(framed_entries.data(), framed_size, 1, file) != 1)
-        throw std::logic_error("Failed to read from file");
+    size_t get_len() const
+    {
+      return total_len;
+    }
 
-      return framed_entries;
+    bool is_complete() const
+    {
+      return complete;
     }
 
-    size_t framed_entries_size(size_t from, size_t to)
+    bool is_open() const
     {
-      if ((from == 0) || (to < from) || (to > positions.size()))
-        return 0;
+      return file != nullptr || mapping != nullptr;
+    }
+
+    /** Open the file of the chunk and load the positions of its entries */
+    void open()
+    {
+      if (is_open())
+        return;
+
+      const auto path = get_path();
+      auto mapped = std::make_shared<const Mapping>(path);
 
-      if (to == positions.size())
+      if (complete)
       {
-        return total_len - positions.at(from - 1);
+        if (
+          !read_trailer(*mapped) ||
+          positions.size() != last_idx + 1 - start_idx)
+          throw std::logic_error("Malformed ledger chunk " + path);
+        mapping = std::move(mapped);
+        return;
       }
-      else
+
+      // A chunk which ends with a valid trailer was completed, but the node
+      // stopped before it was renamed
+      if (read_trailer(*mapped))
       {
-        return positions.at(to) - positions.at(from - 1);
+        std::vector<Position> scanned;
+        if (
+          scan_frames(mapped->data, total_len, scanned) &&
+          scanned == positions)
+        {
+          last_idx = start_idx - 1 + positions.size();
+          complete = true;
+          rename_to(path);
+          mapping = std::move(mapped);
+          return;
+        }
       }
+
+      if (!scan_frames(mapped->data, mapped->size, positions))
+        throw std::logic_error("Malformed ledger chunk " + path);
+
+      total_len = mapped->size;
+      last_idx = start_idx - 1 + positions.size();
+
+      file = fopen(path.c_str(), "r+b");
+      if (!file)
+        throw std::logic_error("Unable to open ledger chunk " + path);
     }
 
-    size_t entry_size(size_t idx)
+    /** Close the file of the chunk, and release the positions of its entries
+     */
+    void close()
     {
-      auto framed_size = framed_entries_size(idx, idx);
+      if (file)
+      {
+        fflush(file);
+        fclose(file);
+        file = nullptr;
+      }
+      mapping.reset();
+      std::vector<Position>().swap(positions);
+    }
+
+    std::vector<uint8_t> read_entry(size_t idx)
+    {
+      auto len = framed_entries_size(idx, idx) - frame_header_size;
+      std::vector<uint8_t> entry(len);
+      read(
+        positions.at(idx - start_idx) + frame_header_size, len, entry.data());
+      return entry;
+    }
+
+    /** Read the framed entries from..to of this chunk, in place if the chunk
+     * is complete
+     *
+     * @param from First index to read, in this chunk
+     * @param to Last index to read, in this chunk
+     *
+     * @return Framed entries
+     */
+    FramedEntries read_framed_entries(size_t from, size_t to)
+    {
+      auto framed_size = framed_entries_size(from, to);
+      auto pos = positions.at(from - start_idx);
+
+      if (mapping)
+        return {{mapping->data + pos, framed_size}, mapping};
 
-      return framed_size ? framed_size - frame_header_size : 0;
+      auto copy = std::make_shared<std::vector<uint8_t>>(framed_size);
+      read(pos, framed_size, copy->data());
+      return {{copy->data(), copy->size()}, copy};
+    }
+
+    /** Copy the framed entries from..to of this chunk
+     *
+     * @param from First index to read, in this chunk
+     * @param to Last index to read, in this chunk
+     * @param data Buffer of framed_entries_size(from, to) bytes to read into
+     */
+    void read_framed_entries(size_t from, size_t to, uint8_t* data)
+    {
+      read(
+        positions.at(from - start_idx), framed_entries_size(from, to), data);
+    }
+
+    size_t framed_entries_size(size_t from, size_t to) const
+    {
+      auto end =
+        (to == last_idx) ? total_len : positions.at(to + 1 - start_idx);
+      return end - positions.at(from - start_idx);
+    }
+
+    /** Find the last index up to which the framed entries from a first index
+     * fit in a number of bytes
+     *
+     * @param from First index, in this chunk
+     * @param to Last index to consider, in this chunk
+     * @param max_size Number of bytes
+     *
+     * @return Last index in from..to whose framed entries from from fit in
+     * max_size bytes, or from if its own entry does not
+     */
+    size_t last_within(size_t from, size_t to, size_t max_size) const
+    {
+      if (framed_entries_size(from, to) <= max_size)
+        return to;
+
+      auto lo = from;
+      auto hi = to;
+      while (lo < hi)
+      {
+        auto mid = lo + (hi - lo + 1) / 2;
+        if (framed_entries_size(from, mid) <= max_size)
+          lo = mid;
+        else
+          hi = mid - 1;
+      }
+      return lo;
     }
 
     void write_entry(const uint8_t* data, size_t size)
     {
       fseeko(file, total_len, SEEK_SET);
       positions.push_back(total_len);
+      last_idx++;
 
-      LOG_DEBUG_FMT("Ledger write {}: {} bytes", positions.size(), size);
+      LOG_DEBUG_FMT("Ledger write {}: {} bytes", last_idx, size);
 
       total_len += (size + frame_header_size);
 
@@ -165,65 +421,630 @@ namespace asynchost
         throw std::logic_error("Failed to write to file");
     }
 
-    void truncate(size_t last_idx)
+    /** Append the trailer to the chunk, rename it after its range, and map
+     * it for reading
+     *
+     * @param durable Whether to sync the chunk to disk before closing it
+     */
+    void seal(bool durable = false)
     {
-      LOG_DEBUG_FMT("Ledger truncate: {}/{}", last_idx, positions.size());
+      fseeko(file, total_len, SEEK_SET);
+      Position frames_len = total_len;
+
+      if (
+        fwrite(
+          positions.data(), sizeof(Position), positions.size(), file) !=
+          positions.size() ||
+        fwrite(&frames_len, sizeof(frames_len), 1, file) != 1)
+        throw std::logic_error("Failed to write to file");
+
+      if (durable)
+        sync();
+      else
+        flush();
+      fclose(file);
+      file = nullptr;
 
-      // positions[last_idx - 1] is the position of the specified
-      // final index. Truncate the ledger at position[last_idx].
-      if (last_idx >= positions.size())
+      const auto from = get_path();
+      complete = true;
+      rename_to(from);
+      mapping = std::make_shared<const Mapping>(get_path());
+
+      LOG_DEBUG_FMT("Ledger chunk {}-{} complete", start_idx, last_idx);
+    }
+
+    /** Remove the entries of the chunk after idx. If the chunk was complete,
+     * it is reopened for writing.
+     */
+    void truncate(size_t idx)
+    {
+      const auto from = get_path();
+      auto kept = (idx < start_idx) ? 0 : idx + 1 - start_idx;
+      total_len = (kept == positions.size()) ? total_len : positions.at(kept);
+      positions.resize(kept);
+      last_idx = start_idx - 1 + kept;
+
+      if (!complete)
+      {
+        flush();
+
+        if (ftruncate(fileno(file), total_len))
+          throw std::logic_error("Failed to truncate file");
+
+        fseeko(file, total_len, SEEK_SET);
         return;
+      }
 
-      total_len = positions.at(last_idx);
-      positions.resize(last_idx);
+      // Entries read from the mapping may still be in use, so the kept
+      // entries are copied to a new file rather than truncated in place. If
+      // the node stops before the complete file is removed, the new file is
+      // preferred when the ledger is reopened.
+      complete = false;
+      const auto tmp = get_path() + ".tmp";
+      file = fopen(tmp.c_str(), "w+b");
+      if (
+        !file ||
+        (total_len > 0 && fwrite(mapping->data, total_len, 1, file) != 1))
+        throw std::logic_error("Failed to write to file " + tmp);
 
-      if (fflush(file) != 0)
+      flush();
+      rename_to(tmp);
+      mapping.reset();
+
+      if (::remove(from.c_str()) != 0)
+        LOG_FAIL_FMT("Failed to remove ledger chunk {}", from);
+    }
+
+    /** Sync the entries written to the incomplete chunk to disk */
+    void sync()
+    {
+      flush();
+      if (fdatasync(fileno(file)) != 0)
       {
         std::stringstream ss;
-        ss << "Failed to flush file: " << strerror(errno);
+        ss << "Failed to sync file: " << strerror(errno);
         throw std::logic_error(ss.str());
       }
+    }
 
-      if (ftruncate(fileno(file), total_len))
-        throw std::logic_error("Failed to truncate file");
+    /** Close and delete the file of the chunk */
+    void remove()
+    {
+      close();
+      if (::remove(get_path().c_str()) != 0)
+        LOG_FAIL_FMT("Failed to remove ledger chunk {}", get_path());
+    }
+  };
 
-      fseeko(file, total_len, SEEK_SET);
+  /** The ledger, split into chunks of roughly chunk_size bytes, each in a
+   * file of its own in the ledger directory.
+   *
+   * Only the last chunk is written to. Complete chunks are opened when their
+   * entries are read, and only the most recently read of them are kept open,
+   * so that the time taken to open the ledger and the memory it uses do not
+   * grow with its length.
+   */
+  class Ledger
+  {
+  private:
+    static constexpr auto chunk_file_prefix = "ledger_";
+
+    // Complete chunks which are kept open once read
+    static constexpr size_t max_open_chunks = 8;
+
+    const std::string dir;
+    const size_t chunk_size;
+    ringbuffer::WriterPtr to_enclave;
+
+    // The ledger directory, which is synced once chunks have been created,
+    // renamed or removed, so that the entries reported as durable are still
+    // found in the right files after a crash
+    int dir_fd = -1;
+    bool dir_changed = false;
+
+    // Chunks, by the index of their first entry. The last chunk is always
+    // open and incomplete.
+    std::map<size_t, std::unique_ptr<LedgerChunk>> chunks;
+
+    // Open complete chunks, most recently read first
+    std::list<LedgerChunk*> open_chunks;
+
+    // With group fsync, written entries are synced to disk together, at most
+    // fsync_window after the first of them, or once fsync_bytes of them are
+    // pending, and the enclave is told up to which index they are durable
+    bool group_fsync = false;
+    std::chrono::milliseconds fsync_window{0};
+    size_t fsync_bytes = 0;
+    size_t unsynced_bytes = 0;
+    std::chrono::steady_clock::time_point first_unsynced;
+    size_t durable_idx = 0;
+
+    // Truncations processed, reported with the durable index so that the
+    // enclave can ignore reports about entries it has since truncated
+    size_t truncations = 0;
+
+    LedgerChunk& last_chunk()
+    {
+      return *chunks.rbegin()->second;
+    }
+
+    size_t get_start_idx() const
+    {
+      return chunks.begin()->first;
+    }
+
+    LedgerChunk& get_chunk(size_t idx)
+    {
+      auto it = chunks.upper_bound(idx);
+      auto& chunk = *std::prev(it)->second;
+      if (it == chunks.end())
+        return chunk;
+
+      auto open = std::find(open_chunks.begin(), open_chunks.end(), &chunk);
+      if (open != open_chunks.end())
+      {
+        open_chunks.splice(open_chunks.begin(), open_chunks, open);
+        return chunk;
+      }
+
+      chunk.open();
+      keep_open(chunk);
+      return chunk;
+    }
+
+    void keep_open(LedgerChunk& chunk)
+    {
+      open_chunks.push_front(&chunk);
+      if (open_chunks.size() > max_open_chunks)
+      {
+        open_chunks.back()->close();
+        open_chunks.pop_back();
+      }
+    }
+
+    void add_chunk(size_t start_idx)
+    {
+      chunks.emplace(start_idx, std::make_unique<LedgerChunk>(dir, start_idx));
+      dir_changed = true;
+    }
+
+    void sync_dir()
+    {
+      if (!dir_changed)
+        return;
+
+      if (fsync(dir_fd) != 0)
+      {
+        std::stringstream ss;
+        ss << "Failed to sync ledger directory " << dir << ": "
+           << strerror(errno);
+        throw std::logic_error(ss.str());
+      }
+      dir_changed = false;
+    }
+
+    void report_durable()
+    {
+      sync_dir();
+      unsynced_bytes = 0;
+      durable_idx = get_last_idx();
+      RINGBUFFER_WRITE_MESSAGE(
+        consensus::ledger_durable, to_enclave, durable_idx, truncations);
+    }
+
+    void remove_chunk(size_t start_idx)
+    {
+      auto it = chunks.find(start_idx);
+      open_chunks.remove(it->second.get());
+      it->second->remove();
+      chunks.erase(it);
+      dir_changed = true;
     }
 
-    void register_message_handlers(
-      messaging::Dispatcher<ringbuffer::Message>& disp)
+    void list_chunks()
     {
-      DISPATCHER_SET_MESSAGE_HANDLER(
-        disp,
-        consensus::ledger_append,
-        [this](const uint8_t* data, size_t size) { write_entry(data, size); });
+      const auto prefix = dir + "/" + chunk_file_prefix;
+      const auto pattern = prefix + "*";
 
-      DISPATCHER_SET_MESSAGE_HANDLER(
-        disp,
-        consensus::ledger_truncate,
-        [this](const uint8_t* data, size_t size) {
-          auto idx = serialized::read<consensus::Index>(data, size);
-          truncate(idx);
-        });
+      glob_t g;
+      if (glob(pattern.c_str(), 0, nullptr, &g) == 0)
+      {
+        for (size_t i = 0; i < g.gl_pathc; ++i)
+        {
+          std::string suffix(g.gl_pathv[i] + prefix.size());
+          auto sep = suffix.find('-');
+          auto start = suffix.substr(0, sep);
+          auto last =
+            (sep == std::string::npos) ? std::string() : suffix.substr(sep + 1);
+          auto is_index = [](const std::string& s) {
+            return !s.empty() && std::all_of(s.begin(), s.end(), ::isdigit);
+          };
 
-      DISPATCHER_SET_MESSAGE_HANDLER(
-        disp, consensus::ledger_get, [&](const uint8_t* data, size_t size) {
-          // The enclave has asked for a ledger entry.
-          auto [idx] =
-            ringbuffer::read_message<consensus::ledger_get>(data, size);
+          if (
+            !is_index(start) ||
+            (sep != std::string::npos && !is_index(last)))
+            continue;
 
-          auto& entry = read_entry(idx);
+          const auto start_idx = std::stoull(start);
+          const auto complete = sep != std::string::npos;
+          auto chunk = std::make_unique<LedgerChunk>(
+            dir,
+            start_idx,
+            complete ? std::stoull(last) : start_idx - 1,
+            complete);
 
-          if (entry.size() > 0)
+          auto it = chunks.find(start_idx);
+          if (it == chunks.end())
           {
-            RINGBUFFER_WRITE_MESSAGE(
-              consensus::ledger_entry, to_enclave, entry);
+            chunks.emplace(start_idx, std::move(chunk));
+            continue;
           }
-          else
+
+          // A complete chunk was being truncated, and has been replaced by
+          // the incomplete chunk with the same start
+          if (complete == it->second->is_complete())
+            throw std::logic_error("Malformed ledger " + dir);
+          dir_changed = true;
+          if (complete)
           {
-            RINGBUFFER_WRITE_MESSAGE(consensus::ledger_no_entry, to_enclave);
+            chunk->remove();
+            continue;
           }
-        });
+          it->second->remove();
+          it->second = std::move(chunk);
+        }
+      }
+      globfree(&g);
+
+      size_t next_idx = chunks.empty() ? 1 : get_start_idx();
+      for (auto& [start_idx, chunk] : chunks)
+      {
+        if (
+          start_idx != next_idx ||
+          (!chunk->is_complete() && chunk.get() != &last_chunk()))
+          throw std::logic_error("Malformed ledger " + dir);
+        next_idx = chunk->get_last_idx() + 1;
+      }
+    }
+
+    static void load_pages(CBuffer data)
+    {
+      static const size_t page_size = sysconf(_SC_PAGESIZE);
+      volatile uint8_t sink = 0;
+      for (size_t i = 0; i < data.n; i += page_size)
+        sink = sink ^ data.p[i];
+    }
+
+  public:
+    static constexpr size_t default_chunk_size = 5 * 1024 * 1024;
+    static constexpr size_t default_piece_size = 1024 * 1024;
+
+    /** Open the ledger in a directory, creating it if necessary
+     *
+     * @param dir Directory holding the chunks of the ledger
+     * @param writer_factory Factory for writers to the enclave
+     * @param chunk_size Size in bytes after which a chunk is completed
+     */
+    Ledger(
+      const std::string& dir,
+      ringbuffer::AbstractWriterFactory& writer_factory,
+      size_t chunk_size = default_chunk_size) :
+      dir(dir),
+      chunk_size(chunk_size),
+      to_enclave(writer_factory.create_writer_to_inside())
+    {
+      if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+      {
+        std::stringstream ss;
+        ss << "Unable to create ledger directory " << dir << ": "
+           << strerror(errno);
+        throw std::logic_error(ss.str());
+      }
+
+      dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+      if (dir_fd == -1)
+      {
+        std::stringstream ss;
+        ss << "Unable to open ledger directory " << dir << ": "
+           << strerror(errno);
+        throw std::logic_error(ss.str());
+      }
+
+      list_chunks();
+
+      if (chunks.empty())
+      {
+        add_chunk(1);
+        return;
+      }
+
+      // Only the last chunk is read, and only if it is incomplete. Otherwise,
+      // a new chunk is started after it.
+      auto& last = last_chunk();
+      last.open();
+      if (last.is_complete())
+      {
+        keep_open(last);
+        add_chunk(last.get_last_idx() + 1);
+      }
+    }
+
+    Ledger(const Ledger& that) = delete;
+
+    ~Ledger()
+    {
+      ::close(dir_fd);
+    }
+
+    /** Sync written entries to disk in groups, and report the index up to
+     * which they are durable to the enclave
+     *
+     * @param window Longest time an entry waits to be synced. If 0, each
+     * entry is synced as it is written
+     * @param bytes Size of pending entries after which they are synced
+     */
+    void set_group_fsync(std::chrono::milliseconds window, size_t bytes)
+    {
+      group_fsync = true;
+      fsync_window = window;
+      fsync_bytes = bytes;
+
+      // Entries already written are only reported as durable once synced
+      last_chunk().sync();
+      sync_dir();
+      durable_idx = get_last_idx();
+    }
+
+    size_t get_last_idx()
+    {
+      return last_chunk().get_last_idx();
+    }
+
+    size_t get_durable_idx() const
+    {
+      return durable_idx;
+    }
+
+    /** Sync pending entries to disk, and report them as durable */
+    void sync()
+    {
+      if (!group_fsync || unsynced_bytes == 0)
+        return;
+
+      last_chunk().sync();
+      report_durable();
+    }
+
+    /** Whether written entries are waiting to be synced */
+    bool has_unsynced_entries() const
+    {
+      return unsynced_bytes > 0;
+    }
+
+    /** Sync pending entries if the first of them has waited for the whole
+     * window. This is called periodically by the host.
+     */
+    void sync_if_due()
+    {
+      if (
+        unsynced_bytes > 0 &&
+        std::chrono::steady_clock::now() - first_unsynced >= fsync_window)
+        sync();
+    }
+
+    /** Whether the ledger can continue after idx: either it has no entries
+     * yet, or it already contains idx.
+     */
+    bool can_init(size_t idx)
+    {
+      return get_last_idx() < get_start_idx() ||
+        ((idx >= get_start_idx() - 1) && (idx <= get_last_idx()));
+    }
+
+    /** Continue the ledger after idx, when the node starts from a snapshot at
+     * idx. If the ledger has no entries, the next entry written will be
+     * idx + 1.
+     */
+    void init(size_t idx)
+    {
+      if (!can_init(idx))
+      {
+        std::stringstream ss;
+        ss << "Cannot start ledger after " << idx << ": it contains entries "
+           << get_start_idx() << " to " << get_last_idx();
+        throw std::logic_error(ss.str());
+      }
+
+      if (get_last_idx() >= get_start_idx() || idx == get_start_idx() - 1)
+        return;
+
+      LOG_INFO_FMT("Ledger starting after {}", idx);
+      remove_chunk(get_start_idx());
+      add_chunk(idx + 1);
+      if (group_fsync)
+        sync_dir();
+      durable_idx = idx;
+    }
+
+    const std::vector<uint8_t> read_entry(size_t idx)
+    {
+      if ((idx < get_start_idx()) || (idx > get_last_idx()))
+        return {};
+
+      return get_chunk(idx).read_entry(idx);
+    }
+
+    /** Read framed entries. Entries of a single complete chunk are read in
+     * place, from its mapping. Otherwise, they are copied.
+     *
+     * @param from First index to read
+     * @param to Last index to read
+     *
+     * @return Framed entries, empty if the range is not in the ledger
+     */
+    FramedEntries read_framed_entries(size_t from, size_t to)
+    {
+      auto framed_size = framed_entries_size(from, to);
+      if (framed_size == 0)
+        return {};
+
+      auto& first = get_chunk(from);
+      if (to <= first.get_last_idx())
+        return first.read_framed_entries(from, to);
+
+      auto copy = std::make_shared<std::vector<uint8_t>>(framed_size);
+      auto data = copy->data();
+      for (auto idx = from; idx <= to;)
+      {
+        auto& chunk = get_chunk(idx);
+        auto last = std::min(to, chunk.get_last_idx());
+        chunk.read_framed_entries(idx, last, data);
+        data += chunk.framed_entries_size(idx, last);
+        idx = last + 1;
+      }
+
+      return {{copy->data(), copy->size()}, copy};
+    }
+
+    /** Read framed entries as a series of pieces, each from a single chunk
+     * and of at most max_size bytes, unless it holds a single larger entry.
+     *
+     * Pieces of complete chunks are read in place, and their pages are loaded
+     * before they are returned, so that the thread which later sends them
+     * does not wait for the disk.
+     *
+     * @param from First index to read
+     * @param to Last index to read
+     * @param max_size Size of each piece
+     *
+     * @return Pieces of framed entries, none if the range is not in the ledger
+     */
+    std::vector<FramedEntries> read_framed_entries_in_pieces(
+      size_t from, size_t to, size_t max_size = default_piece_size)
+    {
+      std::vector<FramedEntries> pieces;
+      if ((from < get_start_idx()) || (to < from) || (to > get_last_idx()))
+        return pieces;
+
+      for (auto idx = from; idx <= to;)
+      {
+        auto [last, piece] = read_first_piece(idx, to, max_size);
+        pieces.push_back(std::move(piece));
+        idx = last + 1;
+      }
+
+      return pieces;
+    }
+
+    /** Read the first of the pieces which read_framed_entries_in_pieces would
+     * return for a range.
+     *
+     * @param from First index to read
+     * @param to Last index to read
+     * @param max_size Size of the piece
+     *
+     * @return Last index in the piece, 0 if the range is not in the ledger,
+     * and the piece
+     */
+    std::pair<size_t, FramedEntries> read_first_piece(
+      size_t from, size_t to, size_t max_size = default_piece_size)
+    {
+      if ((from < get_start_idx()) || (to < from) || (to > get_last_idx()))
+        return {0, {}};
+
+      auto& chunk = get_chunk(from);
+      auto last =
+        chunk.last_within(from, std::min(to, chunk.get_last_idx()), max_size);
+      auto piece = chunk.read_framed_entries(from, last);
+      load_pages(piece.data);
+
+      return {last, std::move(piece)};
+    }
+
+    size_t framed_entries_size(size_t from, size_t to)
+    {
+      if ((from < get_start_idx()) || (to < from) || (to > get_last_idx()))
+        return 0;
+
+      size_t framed_size = 0;
+      for (auto idx = from; idx <= to;)
+      {
+        auto& chunk = get_chunk(idx);
+        auto last = std::min(to, chunk.get_last_idx());
+        framed_size += chunk.framed_entries_size(idx, last);
+        idx = last + 1;
+      }
+
+      return framed_size;
+    }
+
+    size_t entry_size(size_t idx)
+    {
+      auto framed_size = framed_entries_size(idx, idx);
+
+      return framed_size ? framed_size - sizeof(uint32_t) : 0;
+    }
+
+    void write_entry(const uint8_t* data, size_t size)
+    {
+      auto& last = last_chunk();
+      last.write_entry(data, size);
+
+      if (group_fsync)
+      {
+        if (unsynced_bytes == 0)
+          first_unsynced = std::chrono::steady_clock::now();
+        unsynced_bytes += size;
+      }
+
+      if (last.get_len() >= chunk_size)
+      {
+        last.seal(group_fsync);
+        dir_changed = true;
+        keep_open(last);
+        add_chunk(last.get_last_idx() + 1);
+        if (group_fsync)
+          report_durable();
+        return;
+      }
+
+      if (
+        group_fsync &&
+        (fsync_window.count() == 0 || unsynced_bytes >= fsync_bytes))
+        sync();
+    }
+
+    /** Remove the entries after last_idx. Only the chunk holding last_idx is
+     * rewritten, and the chunks after it are deleted.
+     */
+    void truncate(size_t last_idx)
+    {
+      LOG_DEBUG_FMT("Ledger truncate: {}/{}", last_idx, get_last_idx());
+
+      truncations++;
+      durable_idx = std::min(durable_idx, last_idx);
+
+      if (last_idx >= get_last_idx())
+        return;
+
+      const auto first_removed = std::max(last_idx + 1, get_start_idx());
+      auto& chunk = get_chunk(first_removed);
+      while (&last_chunk() != &chunk)
+        remove_chunk(last_chunk().get_start_idx());
+
+      open_chunks.remove(&chunk);
+      const auto was_complete = chunk.is_complete();
+      chunk.truncate(last_idx);
+      dir_changed = dir_changed || was_complete;
+
+      // A complete chunk is rewritten when truncated, and its kept entries
+      // must stay durable. The removal of the later chunks must be durable
+      // too, or their entries would reappear after a crash.
+      if (group_fsync)
+      {
+        chunk.sync();
+        sync_dir();
+      }
     }
   };
-}
\ No newline at end of file
+}
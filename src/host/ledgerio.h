@@ -0,0 +1,287 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "async.h"
+#include "consensus/ledgerenclavetypes.h"
+#include "ds/logger.h"
+#include "ds/messaging.h"
+#include "ledger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace asynchost
+{
+  /** Runs all operations on the ledger on a dedicated thread, so that a slow
+   * disk does not stall the loop which services the network and the enclave.
+   *
+   * Operations run one at a time, in the order in which they were submitted.
+   * Work which must happen on the loop, such as writing to a socket, is
+   * posted back to it as a completion. Completions also run in the order in
+   * which they were posted.
+   */
+  class LedgerIO
+  {
+  public:
+    using Operation = std::function<void(Ledger&)>;
+    using Completion = std::function<void()>;
+
+  private:
+    struct Completions
+    {
+      LedgerIO& io;
+
+      Completions(LedgerIO& io) : io(io) {}
+
+      void on_async()
+      {
+        io.run_completions();
+      }
+    };
+
+    /** Batch of entries read ahead of the enclave's request for them */
+    struct ReadAhead
+    {
+      consensus::Index from;
+      consensus::Index last;
+      FramedEntries entries;
+    };
+
+    // Longest wait between checks for entries due to be synced, while some
+    // are pending
+    static constexpr std::chrono::milliseconds sync_check_period{1};
+
+    Ledger& ledger;
+    ringbuffer::WriterPtr to_enclave;
+
+    // Only used on the ledger thread
+    std::optional<ReadAhead> read_ahead;
+
+    std::mutex operations_lock;
+    std::condition_variable operations_cv;
+    std::deque<Operation> operations;
+    bool finished = false;
+
+    std::mutex completions_lock;
+    std::vector<Completion> completions;
+    proxy_ptr<Async<Completions>> wake_loop;
+
+    std::thread thread;
+
+    void run()
+    {
+      std::unique_lock<std::mutex> guard(operations_lock);
+      while (true)
+      {
+        if (operations.empty())
+        {
+          if (finished)
+            return;
+
+          if (ledger.has_unsynced_entries())
+            operations_cv.wait_for(guard, sync_check_period);
+          else
+            operations_cv.wait(guard);
+        }
+
+        std::deque<Operation> pending;
+        pending.swap(operations);
+        guard.unlock();
+
+        for (auto& op : pending)
+          op(ledger);
+        ledger.sync_if_due();
+
+        guard.lock();
+      }
+    }
+
+    void run_completions()
+    {
+      std::vector<Completion> pending;
+      {
+        std::lock_guard<std::mutex> guard(completions_lock);
+        pending.swap(completions);
+      }
+
+      for (auto& completion : pending)
+        completion();
+    }
+
+    void send_entries(
+      Ledger& ledger, consensus::Index from, consensus::Index to)
+    {
+      to = std::min<consensus::Index>(to, ledger.get_last_idx());
+
+      consensus::Index last;
+      FramedEntries entries;
+      if (
+        read_ahead.has_value() && read_ahead->from == from &&
+        read_ahead->last <= to)
+      {
+        last = read_ahead->last;
+        entries = std::move(read_ahead->entries);
+      }
+      else
+      {
+        std::tie(last, entries) = ledger.read_first_piece(from, to);
+      }
+      read_ahead.reset();
+
+      if (last == 0)
+      {
+        RINGBUFFER_WRITE_MESSAGE(consensus::ledger_no_entry, to_enclave, from);
+        return;
+      }
+
+      RINGBUFFER_WRITE_MESSAGE(
+        consensus::ledger_entries,
+        to_enclave,
+        from,
+        serializer::ByteRange{entries.data.p, entries.data.n});
+
+      // The enclave asks for the next batch as soon as it receives this one,
+      // so it is read while the enclave applies this one
+      if (last < to)
+      {
+        auto [next_last, next] = ledger.read_first_piece(last + 1, to);
+        if (next_last != 0)
+          read_ahead = ReadAhead{last + 1, next_last, std::move(next)};
+      }
+    }
+
+  public:
+    /** Start the thread which owns the ledger. The ledger must not be used
+     * directly until this is destroyed.
+     *
+     * @param ledger Ledger to run operations on
+     * @param writer_factory Factory for writers to the enclave, used from the
+     * ledger thread only
+     */
+    LedgerIO(
+      Ledger& ledger, ringbuffer::AbstractWriterFactory& writer_factory) :
+      ledger(ledger),
+      to_enclave(writer_factory.create_writer_to_inside()),
+      wake_loop(*this),
+      thread(&LedgerIO::run, this)
+    {}
+
+    LedgerIO(const LedgerIO& that) = delete;
+
+    ~LedgerIO()
+    {
+      {
+        std::lock_guard<std::mutex> guard(operations_lock);
+        finished = true;
+      }
+      operations_cv.notify_one();
+      thread.join();
+    }
+
+    /** Run an operation on the ledger, on the ledger thread */
+    void submit(Operation&& op)
+    {
+      {
+        std::lock_guard<std::mutex> guard(operations_lock);
+        operations.push_back(std::move(op));
+      }
+      operations_cv.notify_one();
+    }
+
+    /** Run a completion on the loop. This may be called from any thread. */
+    void post(Completion&& completion)
+    {
+      {
+        std::lock_guard<std::mutex> guard(completions_lock);
+        completions.push_back(std::move(completion));
+      }
+      wake_loop->send();
+    }
+
+    void register_message_handlers(
+      messaging::Dispatcher<ringbuffer::Message>& disp)
+    {
+      // Replies to the enclave are written by the ledger thread itself, with
+      // writers of its own, so that the loop never waits for the disk
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_append,
+        [this](const uint8_t* data, size_t size) {
+          submit([entry = std::vector<uint8_t>(data, data + size)](
+                   Ledger& ledger) {
+            ledger.write_entry(entry.data(), entry.size());
+          });
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_truncate,
+        [this](const uint8_t* data, size_t size) {
+          auto idx = serialized::read<consensus::Index>(data, size);
+          submit([this, idx](Ledger& ledger) {
+            read_ahead.reset();
+            ledger.truncate(idx);
+          });
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_init,
+        [this](const uint8_t* data, size_t size) {
+          auto [idx] =
+            ringbuffer::read_message<consensus::ledger_init>(data, size);
+          submit([this, idx = idx](Ledger& ledger) {
+            read_ahead.reset();
+            ledger.init(idx);
+          });
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_get_range,
+        [this](const uint8_t* data, size_t size) {
+          // The enclave is reading through the ledger, to recover from it
+          auto [from, to] =
+            ringbuffer::read_message<consensus::ledger_get_range>(data, size);
+
+          submit([this, from = from, to = to](Ledger& ledger) {
+            send_entries(ledger, from, to);
+          });
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_get_historical,
+        [this](const uint8_t* data, size_t size) {
+          // The enclave is rebuilding a historical state
+          auto [idx] =
+            ringbuffer::read_message<consensus::ledger_get_historical>(
+              data, size);
+
+          submit([this, idx = idx](Ledger& ledger) {
+            auto entry = ledger.read_entry(idx);
+
+            if (entry.size() > 0)
+            {
+              RINGBUFFER_WRITE_MESSAGE(
+                consensus::ledger_historical_entry, to_enclave, idx, entry);
+            }
+            else
+            {
+              RINGBUFFER_WRITE_MESSAGE(
+                consensus::ledger_historical_no_entry, to_enclave, idx);
+            }
+          });
+        });
+    }
+  };
+}
@@ -8,10 +8,12 @@
 #include "ds/oversized.h"
 #include "enclave.h"
 #include "handle_ringbuffer.h"
+#include "ledgerio.h"
 #include "nodeconnections.h"
 #include "notifyconnections.h"
 #include "rpcconnections.h"
 #include "sigterm.h"
+#include "snapshots.h"
 #include "ticker.h"
 
 #include <CLI11/CLI11.hpp>
@@ -88,8 +90,44 @@ int main(int argc, char** argv)
     "Address to advertise publicly to clients (defaults to same as "
     "--rpc-address)");
 
-  std::string ledger_file("ccf.ledger");
-  app.add_option("--ledger-file", ledger_file, "Ledger file", true);
+  std::string ledger_dir("ledger");
+  app.add_option(
+    "--ledger-dir",
+    ledger_dir,
+    "Directory in which the ledger is written, as a series of chunk files",
+    true);
+
+  size_t ledger_chunk_bytes = asynchost::Ledger::default_chunk_size;
+  app.add_option(
+    "--ledger-chunk-bytes",
+    ledger_chunk_bytes,
+    "Size in bytes after which a ledger chunk is completed and a new one is "
+    "started",
+    true);
+
+  bool ledger_fsync = false;
+  auto ledger_fsync_flag = app.add_flag(
+    "--ledger-fsync",
+    ledger_fsync,
+    "Sync ledger entries to disk, in groups, and only count entries towards "
+    "commit once they are durable on a majority of nodes");
+
+  size_t ledger_fsync_window = 1;
+  app.add_option(
+    "--ledger-fsync-window-ms",
+    ledger_fsync_window,
+    "With --ledger-fsync, longest time in milliseconds for which a ledger "
+    "entry waits to be synced with the entries written after it. 0 syncs "
+    "each entry as it is written",
+    true);
+
+  size_t ledger_fsync_bytes = 1024 * 1024;
+  app.add_option(
+    "--ledger-fsync-bytes",
+    ledger_fsync_bytes,
+    "With --ledger-fsync, size in bytes of pending ledger entries after which "
+    "they are synced without waiting for the window to end",
+    true);
 
   std::string host_log_level("info");
   app.add_set(
@@ -133,6 +171,43 @@ int main(int argc, char** argv)
     "Maximum milliseconds between signatures",
     true);
 
+  size_t group_commit_max_txs = 1;
+  app.add_option(
+    "--group-commit-max-txs",
+    group_commit_max_txs,
+    "Number of committed transactions to accumulate before replicating them "
+    "as a single batch. 1 replicates every transaction as soon as it commits. "
+    "Above 1, a transaction is reported as committed once it is queued, "
+    "before it is replicated: if replication of its batch fails, its client "
+    "is not told",
+    true);
+
+  size_t group_commit_max_ms = 0;
+  app.add_option(
+    "--group-commit-max-ms",
+    group_commit_max_ms,
+    "Maximum milliseconds a committed transaction may wait for its batch to "
+    "fill before being replicated. Checked on every tick",
+    true);
+
+  size_t snapshot_tx_interval = 0;
+  app.add_option(
+    "--snapshot-tx-interval",
+    snapshot_tx_interval,
+    "Number of globally committed transactions between snapshots of the "
+    "store, written next to the ledger. 0 disables snapshots. Each snapshot "
+    "is sent between the enclave and the host as a single message, so "
+    "snapshots of a store larger than --max-msg-size are not written",
+    true);
+
+  size_t historical_cache_mb = 64;
+  app.add_option(
+    "--historical-cache-mb",
+    historical_cache_mb,
+    "Size budget, in MB, of the cache of historical states rebuilt from the "
+    "ledger to serve reads at past versions",
+    true);
+
   size_t circuit_size_shift = 22;
   app.add_option(
     "--circuit-size-shift",
@@ -165,6 +240,17 @@ int main(int argc, char** argv)
     "election.",
     true);
 
+  bool raft_ack_on_record = false;
+  app
+    .add_flag(
+      "--raft-ack-on-record",
+      raft_ack_on_record,
+      "Raft followers acknowledge entries once they are durably recorded in "
+      "the ledger, rather than once they are applied to the store. This lowers "
+      "commit latency when followers are slower to apply entries than the "
+      "leader. Requires --ledger-fsync")
+    ->needs(ledger_fsync_flag);
+
   size_t pbft_view_change_timeout = 5000;
   app.add_option(
     "--pbft_view-change-timeout-ms",
@@ -401,8 +487,13 @@ int main(int argc, char** argv)
   ccf_config.consensus_config = {raft_timeout,
                                  raft_election_timeout,
                                  pbft_view_change_timeout,
-                                 pbft_status_interval};
+                                 pbft_status_interval,
+                                 raft_ack_on_record,
+                                 ledger_fsync};
   ccf_config.signature_intervals = {sig_max_tx, sig_max_ms};
+  ccf_config.group_commit = {group_commit_max_txs, group_commit_max_ms};
+  ccf_config.snapshots = {snapshot_tx_interval};
+  ccf_config.historical_states = {historical_cache_mb * 1024 * 1024};
   ccf_config.node_info_network = {rpc_address.hostname,
                                   public_rpc_address.hostname,
                                   node_address.hostname,
@@ -463,12 +554,31 @@ int main(int argc, char** argv)
 
   LOG_INFO_FMT("Created new node");
 
-  // ledger
-  asynchost::Ledger ledger(ledger_file, writer_factory);
-  ledger.register_message_handlers(bp.get_dispatcher());
+  // ledger, only used from its own thread once that is started. That thread
+  // writes to the enclave without queueing, as the queues of non-blocking
+  // writers are flushed by this thread. It may block, but the enclave does
+  // not wait for it to read its own messages.
+  oversized::WriterFactory ledger_writer_factory(base_factory, writer_config);
+  asynchost::Ledger ledger(
+    ledger_dir, ledger_writer_factory, ledger_chunk_bytes);
+  if (ledger_fsync)
+    ledger.set_group_fsync(
+      std::chrono::milliseconds(ledger_fsync_window), ledger_fsync_bytes);
+
+  asynchost::LedgerIO ledger_io(ledger, ledger_writer_factory);
+  ledger_io.register_message_handlers(bp.get_dispatcher());
+
+  // snapshots, in the directory which holds the ledger directory
+  const auto ledger_dir_end = ledger_dir.find_last_of('/');
+  asynchost::Snapshots snapshots(
+    ledger_dir_end == std::string::npos ? "." :
+                                          ledger_dir.substr(0, ledger_dir_end),
+    ledger_io,
+    ledger_writer_factory);
+  snapshots.register_message_handlers(bp.get_dispatcher());
 
   asynchost::NodeConnections node(
-    ledger, writer_factory, node_address.hostname, node_address.port);
+    ledger_io, writer_factory, node_address.hostname, node_address.port);
   node.register_message_handlers(bp.get_dispatcher());
 
   asynchost::NotifyConnections report(
@@ -5,7 +5,7 @@
 #include "consensus/consensustypes.h"
 #include "consensus/pbft/pbfttypes.h"
 #include "consensus/raft/rafttypes.h"
-#include "ledger.h"
+#include "ledgerio.h"
 #include "node/nodetypes.h"
 #include "tcp.h"
 
@@ -167,7 +167,7 @@ namespace asynchost
       }
     };
 
-    Ledger& ledger;
+    LedgerIO& ledger_io;
     TCP listener;
     std::unordered_map<ccf::NodeId, TCP> outgoing;
     std::unordered_map<size_t, TCP> incoming;
@@ -175,13 +175,18 @@ namespace asynchost
     size_t next_id = 1;
     ringbuffer::WriterPtr to_enclave;
 
+    // Messages to each node which wait for the ledger thread, either for
+    // their entries to be read, or because an earlier message to the same
+    // node is waiting
+    std::unordered_map<ccf::NodeId, size_t> waiting;
+
   public:
     NodeConnections(
-      Ledger& ledger,
+      LedgerIO& ledger_io,
       ringbuffer::AbstractWriterFactory& writer_factory,
       const std::string& host,
       const std::string& service) :
-      ledger(ledger),
+      ledger_io(ledger_io),
       to_enclave(writer_factory.create_writer_to_inside())
     {
       listener->set_behaviour(std::make_unique<ServerBehaviour>(*this));
@@ -207,9 +212,8 @@ namespace asynchost
       DISPATCHER_SET_MESSAGE_HANDLER(
         disp, ccf::node_outbound, [this](const uint8_t* data, size_t size) {
           auto to = serialized::read<ccf::NodeId>(data, size);
-          auto node = find(to, true);
 
-          if (!node)
+          if (!find(to, true))
             return;
 
           auto data_to_send = data;
@@ -217,6 +221,7 @@ namespace asynchost
 
           // If the message is a consensus append entries message, affix the
           // corresponding ledger entries
+          ReadEntries read_entries = nullptr;
           auto msg_type = serialized::read<ccf::NodeMsgType>(data, size);
           if (
             msg_type == ccf::NodeMsgType::consensus_msg &&
@@ -234,37 +239,90 @@ namespace asynchost
 
             const auto& ae =
               serialized::overlay<consensus::AppendEntriesIndex>(p, psize);
-            // Find the total frame size, and write it along with the header.
-            auto count = ae.idx - ae.prev_idx;
-            uint32_t frame = (uint32_t)(
-              size_to_send +
-              ledger.framed_entries_size(ae.prev_idx + 1, ae.idx));
-
-            LOG_DEBUG_FMT(
-              "send AE to {} [{}]: {}, {}", to, frame, ae.idx, ae.prev_idx);
-
-            node.value()->write(sizeof(uint32_t), (uint8_t*)&frame);
-            node.value()->write(size_to_send, data_to_send);
-
-            auto framed_entries =
-              ledger.read_framed_entries(ae.prev_idx + 1, ae.idx);
-            frame = (uint32_t)framed_entries.size();
-            node.value()->write(frame, framed_entries.data());
+
+            LOG_DEBUG_FMT("send AE to {}: {}, {}", to, ae.idx, ae.prev_idx);
+
+            // The entries are read on the ledger thread, in pieces of bounded
+            // size. Entries of complete ledger chunks are sent in place,
+            // without being copied.
+            if (ae.idx > ae.prev_idx)
+            {
+              read_entries = [from = ae.prev_idx + 1, to = ae.idx](
+                               Ledger& ledger) {
+                return ledger.read_framed_entries_in_pieces(from, to);
+              };
+            }
+          }
+
+          if (read_entries || waiting.find(to) != waiting.end())
+          {
+            wait_for_ledger(
+              to,
+              std::vector<uint8_t>(data_to_send, data_to_send + size_to_send),
+              std::move(read_entries));
           }
           else
           {
-            // Write as framed data to the recipient.
-            uint32_t frame = (uint32_t)size_to_send;
-
-            LOG_DEBUG_FMT("node send to {} [{}]", to, frame);
-
-            node.value()->write(sizeof(uint32_t), (uint8_t*)&frame);
-            node.value()->write(size_to_send, data_to_send);
+            send(to, data_to_send, size_to_send, {});
           }
         });
     }
 
   private:
+    using ReadEntries = std::function<std::vector<FramedEntries>(Ledger&)>;
+
+    /** Send a message to a node once the ledger thread has read the entries
+     * to append to it, if any, and after all earlier messages to the same
+     * node which also wait. The message and its entries are written at once,
+     * so that they are never split by a reconnection.
+     */
+    void wait_for_ledger(
+      ccf::NodeId to, std::vector<uint8_t>&& msg, ReadEntries&& read_entries)
+    {
+      waiting[to]++;
+      ledger_io.submit([this,
+                        to,
+                        msg = std::move(msg),
+                        read_entries = std::move(read_entries)](
+                         Ledger& ledger) mutable {
+        std::vector<FramedEntries> entries;
+        if (read_entries)
+          entries = read_entries(ledger);
+
+        ledger_io.post(
+          [this, to, msg = std::move(msg), entries = std::move(entries)]() {
+            auto it = waiting.find(to);
+            if (--it->second == 0)
+              waiting.erase(it);
+
+            if (find(to, true))
+              send(to, msg.data(), msg.size(), entries);
+          });
+      });
+    }
+
+    void send(
+      ccf::NodeId to,
+      const uint8_t* data,
+      size_t size,
+      const std::vector<FramedEntries>& entries)
+    {
+      auto node = find(to, true);
+
+      // Write as framed data to the recipient, followed by any entries.
+      uint32_t frame = (uint32_t)size;
+      for (const auto& e : entries)
+        frame += (uint32_t)e.data.n;
+
+      LOG_DEBUG_FMT("node send to {} [{}]", to, frame);
+
+      node.value()->write(sizeof(uint32_t), (uint8_t*)&frame);
+      node.value()->write(size, data);
+
+      for (const auto& e : entries)
+        node.value()->write(e.data, e.owner);
+    }
+
     bool add_node(
       ccf::NodeId node, const std::string& host, const std::string& service)
     {
@@ -0,0 +1,195 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "consensus/ledgerenclavetypes.h"
+#include "ds/files.h"
+#include "ds/logger.h"
+#include "ds/messaging.h"
+#include "ledgerio.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <glob.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace asynchost
+{
+  /** Snapshots of the enclave's store, each written to its own file, named
+   * after the index of the snapshot, next to the ledger directory.
+   */
+  class Snapshots
+  {
+  private:
+    static constexpr auto snapshot_file_prefix = "snapshot_";
+
+    // Older snapshots are deleted once a new one has been written
+    static constexpr size_t snapshots_to_keep = 2;
+
+    const std::string snapshot_dir;
+    LedgerIO& ledger_io;
+    ringbuffer::WriterPtr to_enclave;
+
+    std::string get_snapshot_file(size_t idx)
+    {
+      return snapshot_dir + "/" + snapshot_file_prefix + std::to_string(idx);
+    }
+
+    // Indices of all snapshots in the directory, in ascending order
+    std::vector<size_t> list_snapshots()
+    {
+      std::vector<size_t> snapshots;
+      const auto prefix = snapshot_dir + "/" + snapshot_file_prefix;
+      const auto pattern = prefix + "*";
+
+      glob_t g;
+      if (glob(pattern.c_str(), 0, nullptr, &g) == 0)
+      {
+        for (size_t i = 0; i < g.gl_pathc; ++i)
+        {
+          std::string suffix(g.gl_pathv[i] + prefix.size());
+          if (
+            suffix.empty() ||
+            !std::all_of(suffix.begin(), suffix.end(), ::isdigit))
+            continue;
+
+          snapshots.push_back(std::stoull(suffix));
+        }
+      }
+      globfree(&g);
+
+      std::sort(snapshots.begin(), snapshots.end());
+      return snapshots;
+    }
+
+  public:
+    Snapshots(
+      const std::string& snapshot_dir,
+      LedgerIO& ledger_io,
+      ringbuffer::AbstractWriterFactory& writer_factory) :
+      snapshot_dir(snapshot_dir),
+      ledger_io(ledger_io),
+      to_enclave(writer_factory.create_writer_to_inside())
+    {}
+
+    Snapshots(const Snapshots& that) = delete;
+
+    void write_snapshot(size_t idx, const uint8_t* data, size_t size)
+    {
+      // Write to a temporary file first, so that an incomplete snapshot is
+      // never picked up
+      auto snapshot_file = get_snapshot_file(idx);
+      auto tmp_file = snapshot_file + ".tmp";
+
+      auto f = fopen(tmp_file.c_str(), "wb");
+      if (!f)
+      {
+        LOG_FAIL_FMT("Unable to create snapshot file {}", tmp_file);
+        return;
+      }
+
+      auto written = fwrite(data, size, 1, f) == 1;
+      if (fclose(f) != 0 || !written)
+      {
+        LOG_FAIL_FMT("Failed to write snapshot file {}", tmp_file);
+        remove(tmp_file.c_str());
+        return;
+      }
+
+      if (rename(tmp_file.c_str(), snapshot_file.c_str()) != 0)
+      {
+        LOG_FAIL_FMT("Failed to rename snapshot file {}", tmp_file);
+        remove(tmp_file.c_str());
+        return;
+      }
+
+      LOG_INFO_FMT("Wrote snapshot at {} ({} bytes)", idx, size);
+
+      auto snapshots = list_snapshots();
+      for (size_t i = 0; i + snapshots_to_keep < snapshots.size(); ++i)
+      {
+        remove(get_snapshot_file(snapshots[i]).c_str());
+      }
+    }
+
+    /** Find the latest snapshot that the ledger can continue from.
+     *
+     * @param ledger Ledger to continue
+     * @param before If not 0, only consider snapshots before this index
+     *
+     * @return Index and contents of the snapshot, if there is one
+     */
+    std::optional<std::pair<size_t, std::vector<uint8_t>>>
+    read_latest_snapshot(Ledger& ledger, size_t before = 0)
+    {
+      auto snapshots = list_snapshots();
+      for (auto it = snapshots.rbegin(); it != snapshots.rend(); ++it)
+      {
+        if ((before != 0 && *it >= before) || !ledger.can_init(*it))
+          continue;
+
+        auto snapshot = files::slurp(get_snapshot_file(*it), true);
+        if (!snapshot.empty())
+          return std::make_pair(*it, std::move(snapshot));
+      }
+
+      return std::nullopt;
+    }
+
+    void register_message_handlers(
+      messaging::Dispatcher<ringbuffer::Message>& disp)
+    {
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp, consensus::snapshot, [this](const uint8_t* data, size_t size) {
+          auto idx = serialized::read<consensus::Index>(data, size);
+
+          // Snapshots may be large, so they are written on the ledger thread
+          // rather than on the loop
+          ledger_io.submit(
+            [this, idx, snapshot = std::vector<uint8_t>(data, data + size)](
+              Ledger&) {
+              write_snapshot(idx, snapshot.data(), snapshot.size());
+            });
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::snapshot_get,
+        [this](const uint8_t* data, size_t size) {
+          // The enclave has asked for a snapshot to start from
+          auto [before] =
+            ringbuffer::read_message<consensus::snapshot_get>(data, size);
+
+          // Whether the ledger can continue from a snapshot is checked on
+          // the ledger thread, after earlier operations on the ledger
+          ledger_io.submit([this, before = before](Ledger& ledger) {
+            auto snapshot = read_latest_snapshot(ledger, before);
+            if (snapshot.has_value())
+            {
+              LOG_INFO_FMT("Found snapshot at {}", snapshot->first);
+              try
+              {
+                RINGBUFFER_WRITE_MESSAGE(
+                  consensus::snapshot_entry,
+                  to_enclave,
+                  snapshot->first,
+                  snapshot->second);
+                return;
+              }
+              catch (const std::exception& e)
+              {
+                LOG_FAIL_FMT(
+                  "Could not send snapshot at {}: {}",
+                  snapshot->first,
+                  e.what());
+              }
+            }
+
+            RINGBUFFER_WRITE_MESSAGE(consensus::snapshot_no_entry, to_enclave);
+          });
+        });
+    }
+  };
+}
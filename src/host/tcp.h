@@ -2,10 +2,13 @@
 // Licensed under the Apache 2.0 License.
 #pragma once
 
+#include "../ds/buffer.h"
 #include "../ds/logger.h"
 #include "dns.h"
 #include "proxy.h"
 
+#include <memory>
+
 namespace asynchost
 {
   class TCPImpl;
@@ -48,6 +51,15 @@ namespace asynchost
       RECONNECTING
     };
 
+    // Data of a write. It is either copied, or written in place and kept
+    // alive by its owner until the write completes.
+    struct WriteData
+    {
+      CBuffer data;
+      std::unique_ptr<uint8_t[]> copy;
+      std::shared_ptr<const void> owner;
+    };
+
     struct PendingWrite
     {
       uv_write_t* req;
@@ -142,11 +154,31 @@ namespace asynchost
 
     bool write(size_t len, const uint8_t* data)
     {
-      auto req = new uv_write_t;
-      char* copy = new char[len];
+      auto write_data = new WriteData;
+      write_data->copy.reset(new uint8_t[len]);
       if (data)
-        memcpy(copy, data, len);
-      req->data = copy;
+        memcpy(write_data->copy.get(), data, len);
+      write_data->data = {write_data->copy.get(), len};
+
+      return write(write_data);
+    }
+
+    /** Write data without copying it
+     *
+     * @param data Data to write
+     * @param owner Keeps data alive. It is held until the write completes.
+     */
+    bool write(CBuffer data, std::shared_ptr<const void> owner)
+    {
+      return write(new WriteData{data, nullptr, std::move(owner)});
+    }
+
+  private:
+    bool write(WriteData* write_data)
+    {
+      auto req = new uv_write_t;
+      req->data = write_data;
+      const auto len = write_data->data.n;
 
       switch (status)
       {
@@ -178,7 +210,6 @@ namespace asynchost
       return true;
     }
 
-  private:
     bool init()
     {
       assert_status(FRESH, FRESH);
@@ -202,10 +233,10 @@ namespace asynchost
 
     bool send_write(uv_write_t* req, size_t len)
     {
-      char* copy = (char*)req->data;
+      auto write_data = (WriteData*)req->data;
 
       uv_buf_t buf;
-      buf.base = copy;
+      buf.base = (char*)write_data->data.p;
       buf.len = len;
 
       int rc;
@@ -516,8 +547,7 @@ namespace asynchost
       if (req == nullptr)
         return;
 
-      char* copy = (char*)req->data;
-      delete[] copy;
+      delete (WriteData*)req->data;
       delete req;
     }
 
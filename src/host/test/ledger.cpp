@@ -3,9 +3,33 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "../ledger.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <doctest/doctest.h>
+#include <glob.h>
 #include <string>
 
+static void remove_ledger(const std::string& dir)
+{
+  REQUIRE(system(("rm -rf " + dir).c_str()) == 0);
+}
+
+static size_t count_chunks(const std::string& dir)
+{
+  glob_t g;
+  size_t count = 0;
+  if (glob((dir + "/ledger_*").c_str(), 0, nullptr, &g) == 0)
+    count = g.gl_pathc;
+  globfree(&g);
+  return count;
+}
+
+static std::vector<uint8_t> make_entry(size_t idx)
+{
+  return std::vector<uint8_t>(idx % 7 + 1, (uint8_t)idx);
+}
+
 TEST_CASE("Read/Write test")
 {
   ringbuffer::Circuit eio(1024);
@@ -52,10 +76,336 @@ TEST_CASE("Entry sizes")
   REQUIRE(
     l.framed_entries_size(1, 2) ==
     (e1.size() + sizeof(uint32_t) + e2.size() + sizeof(uint32_t)));
+}
+
+TEST_CASE("Start after snapshot index")
+{
+  ringbuffer::Circuit eio(1024);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  remove_ledger("testlog_start");
+
+  const std::vector<uint8_t> e1 = {1, 2, 3};
+  const std::vector<uint8_t> e2 = {5, 5, 6, 7};
+  {
+    asynchost::Ledger l("testlog_start", wf);
+    REQUIRE(l.can_init(10));
+    l.init(10);
+    REQUIRE(l.get_last_idx() == 10);
+    REQUIRE(l.read_entry(10).empty());
+
+    l.write_entry(e1.data(), e1.size());
+    l.write_entry(e2.data(), e2.size());
+    REQUIRE(l.get_last_idx() == 12);
+    REQUIRE(l.entry_size(11) == e1.size());
+    REQUIRE(l.framed_entries_size(11, 12) == l.framed_entries_size(11, 11) +
+              l.framed_entries_size(12, 12));
+
+    REQUIRE(l.can_init(11));
+    REQUIRE_FALSE(l.can_init(9));
+    REQUIRE_FALSE(l.can_init(13));
+    REQUIRE_THROWS(l.init(13));
+  }
+
+  asynchost::Ledger l("testlog_start", wf);
+  REQUIRE(l.get_last_idx() == 12);
+  REQUIRE(l.read_entry(11) == e1);
+  REQUIRE(l.read_entry(12) == e2);
+
+  l.truncate(11);
+  REQUIRE(l.get_last_idx() == 11);
+  REQUIRE(l.read_entry(11) == e1);
+
+  l.truncate(5);
+  REQUIRE(l.get_last_idx() == 10);
+  REQUIRE(l.read_entry(11).empty());
+}
+
+TEST_CASE("Chunks")
+{
+  ringbuffer::Circuit eio(1024);
+  auto wf = ringbuffer::WriterFactory(eio);
 
-  /*
-    auto e = l.read_framed_entries(1, 1);
-    for (auto c : e)
-      std::cout << std::hex << (int)c;
-    std::cout << std::endl;*/
-}
\ No newline at end of file
+  remove_ledger("testlog_chunks");
+
+  // Each chunk holds 4 entries of at most 8 bytes
+  constexpr size_t chunk_size = 4 * sizeof(uint32_t) + 4;
+  constexpr size_t entries = 50;
+
+  std::vector<size_t> chunk_ends;
+  {
+    asynchost::Ledger l("testlog_chunks", wf, chunk_size);
+    size_t len = 0;
+    for (size_t i = 1; i <= entries; ++i)
+    {
+      auto e = make_entry(i);
+      l.write_entry(e.data(), e.size());
+      len += e.size() + sizeof(uint32_t);
+      if (len >= chunk_size)
+      {
+        chunk_ends.push_back(i);
+        len = 0;
+      }
+    }
+    REQUIRE(l.get_last_idx() == entries);
+    REQUIRE(count_chunks("testlog_chunks") == chunk_ends.size() + 1);
+  }
+
+  asynchost::Ledger l("testlog_chunks", wf, chunk_size);
+  REQUIRE(l.get_last_idx() == entries);
+
+  INFO("Entries are read from any chunk, in any order");
+  for (size_t i = entries; i > 0; --i)
+    REQUIRE(l.read_entry(i) == make_entry(i));
+  for (size_t i = 1; i <= entries; ++i)
+    REQUIRE(l.entry_size(i) == make_entry(i).size());
+
+  INFO("Framed entries span chunks");
+  {
+    auto framed = l.read_framed_entries(2, entries - 1);
+    REQUIRE(framed.data.n == l.framed_entries_size(2, entries - 1));
+
+    const uint8_t* data = framed.data.p;
+    size_t size = framed.data.n;
+    for (size_t i = 2; i < entries; ++i)
+    {
+      auto len = serialized::read<uint32_t>(data, size);
+      REQUIRE(std::vector<uint8_t>(data, data + len) == make_entry(i));
+      serialized::skip(data, size, len);
+    }
+    REQUIRE(size == 0);
+  }
+
+  INFO("Framed entries of a complete chunk are read in place");
+  {
+    auto framed = l.read_framed_entries(1, chunk_ends[0]);
+    auto copy = l.read_framed_entries(1, chunk_ends[0] + 1);
+    REQUIRE(framed.data.n == l.framed_entries_size(1, chunk_ends[0]));
+    REQUIRE(framed.data.p != copy.data.p);
+    REQUIRE(
+      std::equal(framed.data.p, framed.data.p + framed.data.n, copy.data.p));
+    REQUIRE(l.read_framed_entries(1, chunk_ends[0]).data.p == framed.data.p);
+  }
+
+  INFO("Entries read in place outlive the truncation of their chunk");
+  auto held = l.read_framed_entries(chunk_ends[0] + 1, chunk_ends[1]);
+  const std::vector<uint8_t> held_copy(held.data.p, held.data.p + held.data.n);
+
+  INFO("Truncating reopens the chunk holding the new last entry");
+  const auto truncated = chunk_ends[1] - 1;
+  l.truncate(truncated);
+  REQUIRE(l.get_last_idx() == truncated);
+  REQUIRE(count_chunks("testlog_chunks") == 2);
+  REQUIRE(l.read_entry(truncated) == make_entry(truncated));
+  REQUIRE(l.read_entry(truncated + 1).empty());
+
+  REQUIRE(
+    std::vector<uint8_t>(held.data.p, held.data.p + held.data.n) ==
+    held_copy);
+
+  auto e = make_entry(0);
+  l.write_entry(e.data(), e.size());
+  REQUIRE(l.read_entry(truncated + 1) == e);
+
+  {
+    asynchost::Ledger l2("testlog_chunks", wf, chunk_size);
+    REQUIRE(l2.get_last_idx() == truncated + 1);
+    for (size_t i = 1; i <= truncated; ++i)
+      REQUIRE(l2.read_entry(i) == make_entry(i));
+    REQUIRE(l2.read_entry(truncated + 1) == e);
+  }
+
+  INFO("Truncating to before the first entry empties the ledger");
+  l.truncate(0);
+  REQUIRE(l.get_last_idx() == 0);
+  REQUIRE(count_chunks("testlog_chunks") == 1);
+}
+
+TEST_CASE("Chunk completed before it was renamed")
+{
+  ringbuffer::Circuit eio(1024);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  remove_ledger("testlog_seal");
+
+  const std::vector<uint8_t> e1 = {1, 2, 3};
+  const std::vector<uint8_t> e2 = {5, 5, 6, 7};
+  {
+    asynchost::Ledger l("testlog_seal", wf, 1);
+    l.write_entry(e1.data(), e1.size());
+    l.write_entry(e2.data(), e2.size());
+  }
+
+  REQUIRE(rename("testlog_seal/ledger_2-2", "testlog_seal/ledger_2") == 0);
+  REQUIRE(remove("testlog_seal/ledger_3") == 0);
+
+  asynchost::Ledger l("testlog_seal", wf, 1);
+  REQUIRE(l.get_last_idx() == 2);
+  REQUIRE(l.read_entry(1) == e1);
+  REQUIRE(l.read_entry(2) == e2);
+  REQUIRE(count_chunks("testlog_seal") == 3);
+}
+
+TEST_CASE("Chunk truncated before it was removed")
+{
+  ringbuffer::Circuit eio(1024);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  remove_ledger("testlog_rewrite");
+
+  const std::vector<uint8_t> e1 = {1, 2, 3};
+  const std::vector<uint8_t> e2 = {5, 5, 6, 7};
+  {
+    asynchost::Ledger l("testlog_rewrite", wf, 1);
+    l.write_entry(e1.data(), e1.size());
+    l.write_entry(e2.data(), e2.size());
+  }
+
+  // The rewritten chunk 2 is empty, and replaces the complete one
+  REQUIRE(remove("testlog_rewrite/ledger_3") == 0);
+  fclose(fopen("testlog_rewrite/ledger_2", "wb"));
+
+  asynchost::Ledger l("testlog_rewrite", wf, 1);
+  REQUIRE(l.get_last_idx() == 1);
+  REQUIRE(l.read_entry(1) == e1);
+  REQUIRE(l.read_entry(2).empty());
+  REQUIRE(count_chunks("testlog_rewrite") == 2);
+}
+
+TEST_CASE("Group fsync")
+{
+  ringbuffer::Circuit eio(1024);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  remove_ledger("testlog_fsync");
+
+  std::vector<std::pair<size_t, size_t>> reports;
+  auto read_reports = [&]() {
+    reports.clear();
+    eio.read_from_outside().read(
+      -1, [&](ringbuffer::Message m, const uint8_t* data, size_t size) {
+        REQUIRE(m == consensus::ledger_durable);
+        auto [idx, truncations] =
+          ringbuffer::read_message<consensus::ledger_durable>(data, size);
+        reports.emplace_back(idx, truncations);
+      });
+  };
+
+  asynchost::Ledger l("testlog_fsync", wf, 64);
+  l.set_group_fsync(std::chrono::hours(1), 16);
+
+  INFO("Entries wait until enough bytes are pending");
+  {
+    auto e = make_entry(6);
+    for (size_t i = 0; i < 2; ++i)
+      l.write_entry(e.data(), e.size());
+    l.sync_if_due();
+    read_reports();
+    REQUIRE(reports.empty());
+    REQUIRE(l.get_durable_idx() == 0);
+
+    for (size_t i = 0; i < 2; ++i)
+      l.write_entry(e.data(), e.size());
+    read_reports();
+    REQUIRE(reports == decltype(reports){{3, 0}});
+    REQUIRE(l.get_durable_idx() == 3);
+  }
+
+  INFO("Completing a chunk makes its entries durable");
+  {
+    auto e = make_entry(13);
+    while (count_chunks("testlog_fsync") == 1)
+      l.write_entry(e.data(), e.size());
+    read_reports();
+    REQUIRE(reports.size() == 1);
+    REQUIRE(reports.back().first == l.get_last_idx());
+  }
+
+  INFO("Reports after a truncation carry the count of truncations");
+  {
+    auto e = make_entry(0);
+    l.write_entry(e.data(), e.size());
+    l.truncate(2);
+    REQUIRE(l.get_durable_idx() == 2);
+    l.sync();
+    read_reports();
+    REQUIRE(reports == decltype(reports){{2, 1}});
+  }
+
+  INFO("Entries are synced once their window has passed");
+  {
+    remove_ledger("testlog_fsync_window");
+    asynchost::Ledger l2("testlog_fsync_window", wf);
+    l2.set_group_fsync(std::chrono::milliseconds(0), 1024);
+    auto e = make_entry(0);
+    l2.write_entry(e.data(), e.size());
+    read_reports();
+    REQUIRE(reports == decltype(reports){{1, 0}});
+  }
+}
+
+TEST_CASE("Read in pieces")
+{
+  ringbuffer::Circuit eio(1024);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  remove_ledger("testlog_pieces");
+
+  asynchost::Ledger l("testlog_pieces", wf, 64);
+  for (size_t i = 1; i <= 40; ++i)
+  {
+    auto e = make_entry(i);
+    l.write_entry(e.data(), e.size());
+  }
+  REQUIRE(count_chunks("testlog_pieces") > 2);
+
+  auto check = [&](size_t from, size_t to, size_t max_size) {
+    auto pieces = l.read_framed_entries_in_pieces(from, to, max_size);
+    auto whole = l.read_framed_entries(from, to);
+
+    std::vector<uint8_t> joined;
+    for (const auto& piece : pieces)
+    {
+      // Only a piece holding a single larger entry exceeds the bound
+      auto p = piece.data.p;
+      auto n = piece.data.n;
+      if (n > max_size)
+      {
+        uint32_t frame;
+        memcpy(&frame, p, sizeof(frame));
+        REQUIRE(n == frame + sizeof(frame));
+      }
+      joined.insert(joined.end(), p, p + n);
+    }
+    REQUIRE(
+      joined ==
+      std::vector<uint8_t>(whole.data.p, whole.data.p + whole.data.n));
+    return pieces.size();
+  };
+
+  INFO("Pieces do not cross chunks");
+  REQUIRE(check(1, 40, 1024) == count_chunks("testlog_pieces"));
+
+  INFO("Pieces are bounded in size");
+  REQUIRE(check(1, 40, 16) > count_chunks("testlog_pieces"));
+  check(3, 27, 20);
+
+  INFO("Entries larger than a piece are read whole");
+  check(1, 40, 1);
+
+  INFO("The first piece is read alone, with its last index");
+  {
+    auto pieces = l.read_framed_entries_in_pieces(3, 27, 20);
+    auto [last, first] = l.read_first_piece(3, 27, 20);
+    REQUIRE(last >= 3);
+    REQUIRE(last < 27);
+    REQUIRE(first.data.n == pieces[0].data.n);
+    REQUIRE(first.data.n == l.framed_entries_size(3, last));
+    REQUIRE(memcmp(first.data.p, pieces[0].data.p, first.data.n) == 0);
+  }
+
+  INFO("Ranges outside the ledger are not read");
+  REQUIRE(l.read_framed_entries_in_pieces(0, 3).empty());
+  REQUIRE(l.read_framed_entries_in_pieces(3, 41).empty());
+  REQUIRE(l.read_first_piece(3, 41).first == 0);
+}
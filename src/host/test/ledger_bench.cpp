@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#define PICOBENCH_IMPLEMENT_WITH_MAIN
+#include "../ledger.h"
+
+#include <cstdlib>
+#include <picobench/picobench.hpp>
+
+using namespace std::chrono_literals;
+
+static constexpr auto bench_dir = "ledger_bench";
+static constexpr size_t entry_size = 1024;
+
+// Writes s.iterations() entries, checking after each one whether the pending
+// entries are due to be synced, as the host does on a timer
+template <bool Fsync, size_t WindowMs>
+static void write_entries(picobench::state& s)
+{
+  if (system((std::string("rm -rf ") + bench_dir).c_str()) != 0)
+    throw std::logic_error("Failed to remove ledger");
+
+  ringbuffer::Circuit eio(1 << 20);
+  auto wf = ringbuffer::WriterFactory(eio);
+  asynchost::Ledger l(bench_dir, wf);
+  if (Fsync)
+    l.set_group_fsync(std::chrono::milliseconds(WindowMs), 1024 * 1024);
+
+  std::vector<uint8_t> entry(entry_size, 42);
+
+  s.start_timer();
+  for (auto _ : s)
+  {
+    (void)_;
+    l.write_entry(entry.data(), entry.size());
+    l.sync_if_due();
+    eio.read_from_outside().read(
+      -1, [](ringbuffer::Message, const uint8_t*, size_t) {});
+  }
+  l.sync();
+  s.stop_timer();
+}
+
+const std::vector<int> entry_counts = {1000, 10000};
+
+PICOBENCH_SUITE("write 1KB entries");
+auto no_fsync = write_entries<false, 0>;
+PICOBENCH(no_fsync).iterations(entry_counts).samples(3).baseline();
+auto fsync_window_0ms = write_entries<true, 0>;
+PICOBENCH(fsync_window_0ms).iterations(entry_counts).samples(3);
+auto fsync_window_1ms = write_entries<true, 1>;
+PICOBENCH(fsync_window_1ms).iterations(entry_counts).samples(3);
+auto fsync_window_5ms = write_entries<true, 5>;
+PICOBENCH(fsync_window_5ms).iterations(entry_counts).samples(3);
+auto fsync_window_10ms = write_entries<true, 10>;
+PICOBENCH(fsync_window_10ms).iterations(entry_counts).samples(3);
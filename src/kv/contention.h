@@ -0,0 +1,81 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "ds/spinlock.h"
+
+#include <array>
+#include <cstddef>
+#include <optional>
+
+namespace kv
+{
+  /** Learns which keys of a map transactions conflict on.
+   *
+   * Keys are tracked by hash, in a small direct-mapped table. A conflict on a
+   * key that is not in its slot wears down the count of the key that is, and
+   * replaces it once that count reaches zero, so that the slots end up held
+   * by the most contended keys. All counts are halved periodically, so keys
+   * which are no longer contended cool down.
+   */
+  class ContentionTracker
+  {
+  public:
+    static constexpr size_t slot_count = 64;
+    static constexpr size_t hot_threshold = 4;
+    static constexpr size_t decay_interval = 1024;
+
+  private:
+    struct Slot
+    {
+      size_t key_hash = 0;
+      size_t conflicts = 0;
+    };
+
+    SpinLock lock;
+    std::array<Slot, slot_count> slots = {};
+    size_t recorded = 0;
+
+  public:
+    void record(size_t key_hash)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+
+      auto& slot = slots[key_hash % slot_count];
+      if (slot.key_hash == key_hash || slot.conflicts == 0)
+      {
+        slot.key_hash = key_hash;
+        slot.conflicts++;
+      }
+      else
+      {
+        slot.conflicts--;
+      }
+
+      if (++recorded % decay_interval == 0)
+      {
+        for (auto& s : slots)
+          s.conflicts /= 2;
+      }
+    }
+
+    bool is_hot(size_t key_hash)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+      const auto& slot = slots[key_hash % slot_count];
+      return slot.key_hash == key_hash && slot.conflicts >= hot_threshold;
+    }
+
+    size_t hot_keys()
+    {
+      std::lock_guard<SpinLock> guard(lock);
+      size_t count = 0;
+      for (const auto& s : slots)
+      {
+        if (s.conflicts >= hot_threshold)
+          count++;
+      }
+      return count;
+    }
+  };
+}
@@ -0,0 +1,338 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "../ds/msgpack_adaptor_nlohmann.h"
+#include "genericserialisewrapper.h"
+#include "kvtypes.h"
+
+#include <flatbuffers/flatbuffers.h>
+#include <limits>
+#include <msgpack/msgpack.hpp>
+#include <type_traits>
+
+namespace kv
+{
+  class FlatbuffersWriter;
+  template <typename W>
+  class GenericSerialiseWrapper;
+  using FlatbuffersKvStoreSerialiser =
+    GenericSerialiseWrapper<FlatbuffersWriter>;
+
+  class FlatbuffersReader;
+  template <typename W>
+  class GenericDeserialiseWrapper;
+  using FlatbuffersKvStoreDeserialiser =
+    GenericDeserialiseWrapper<FlatbuffersReader>;
+
+  /** Each domain of a transaction is a single FlatBuffer, equivalent to the
+   * schema:
+   *
+   *   table Entry { data:[ubyte]; }
+   *   table Frame { entries:[Entry]; }
+   *   root_type Frame;
+   *
+   * with one entry per item written by the GenericSerialiseWrapper (version,
+   * operation types, map names, keys, values, ...). Strings and byte vectors
+   * are stored as their raw bytes, and arithmetic and enum types as
+   * little-endian fixed-width integers, so that readers can access them in
+   * place. Any other type is stored as its msgpack encoding.
+   *
+   * The accessors below are written as flatc would generate them for this
+   * schema, so that the build does not depend on flatc.
+   */
+  namespace fbs
+  {
+    struct Entry : private flatbuffers::Table
+    {
+      enum
+      {
+        VT_DATA = 4
+      };
+
+      const flatbuffers::Vector<uint8_t>* data() const
+      {
+        return GetPointer<const flatbuffers::Vector<uint8_t>*>(VT_DATA);
+      }
+
+      bool Verify(flatbuffers::Verifier& verifier) const
+      {
+        return VerifyTableStart(verifier) && VerifyOffset(verifier, VT_DATA) &&
+          verifier.VerifyVector(data()) && verifier.EndTable();
+      }
+    };
+
+    struct Frame : private flatbuffers::Table
+    {
+      enum
+      {
+        VT_ENTRIES = 4
+      };
+
+      const flatbuffers::Vector<flatbuffers::Offset<Entry>>* entries() const
+      {
+        return GetPointer<
+          const flatbuffers::Vector<flatbuffers::Offset<Entry>>*>(VT_ENTRIES);
+      }
+
+      bool Verify(flatbuffers::Verifier& verifier) const
+      {
+        return VerifyTableStart(verifier) &&
+          VerifyOffset(verifier, VT_ENTRIES) &&
+          verifier.VerifyVector(entries()) &&
+          verifier.VerifyVectorOfTables(entries()) && verifier.EndTable();
+      }
+    };
+
+    template <typename T>
+    constexpr bool is_raw_bytes =
+      std::is_same_v<T, std::vector<uint8_t>> ||
+      std::is_same_v<T, std::string>;
+
+    template <typename T>
+    constexpr bool is_scalar = std::is_arithmetic_v<T> || std::is_enum_v<T>;
+
+    template <typename T, typename = void>
+    struct scalar_repr
+    {
+      using type = T;
+    };
+
+    template <typename T>
+    struct scalar_repr<T, std::enable_if_t<std::is_enum_v<T>>>
+    {
+      using type = std::underlying_type_t<T>;
+    };
+  }
+
+  class FlatbuffersWriter
+  {
+  private:
+    flatbuffers::FlatBufferBuilder builder;
+    std::vector<flatbuffers::Offset<fbs::Entry>> entries;
+    msgpack::sbuffer packed;
+    bool finished = false;
+
+    void add_entry(const uint8_t* data, size_t size)
+    {
+      auto bytes = builder.CreateVector(data, size);
+      auto start = builder.StartTable();
+      builder.AddOffset(fbs::Entry::VT_DATA, bytes);
+      entries.emplace_back(builder.EndTable(start));
+    }
+
+  public:
+    template <typename T>
+    void append(T&& t)
+    {
+      using Tb = std::decay_t<T>;
+
+      if (finished)
+      {
+        throw KvSerialiserException(
+          "Cannot append to a FlatBuffer that has already been finished");
+      }
+
+      if constexpr (fbs::is_raw_bytes<Tb>)
+      {
+        add_entry(reinterpret_cast<const uint8_t*>(t.data()), t.size());
+      }
+      else if constexpr (fbs::is_scalar<Tb>)
+      {
+        using R = typename fbs::scalar_repr<Tb>::type;
+        uint8_t data[sizeof(R)];
+        flatbuffers::WriteScalar(data, static_cast<R>(t));
+        add_entry(data, sizeof(data));
+      }
+      else
+      {
+        packed.clear();
+        msgpack::pack(packed, std::forward<T>(t));
+        add_entry(
+          reinterpret_cast<const uint8_t*>(packed.data()), packed.size());
+      }
+    }
+
+    void clear()
+    {
+      builder.Clear();
+      entries.clear();
+      finished = false;
+    }
+
+    bool is_empty()
+    {
+      return entries.empty();
+    }
+
+    // Finishes the FlatBuffer, which can no longer be appended to until it is
+    // cleared. An empty writer produces no data at all
+    CBuffer get_raw_data()
+    {
+      if (entries.empty())
+        return {};
+
+      if (!finished)
+      {
+        auto entries_vec = builder.CreateVector(entries);
+        auto start = builder.StartTable();
+        builder.AddOffset(fbs::Frame::VT_ENTRIES, entries_vec);
+        builder.Finish(
+          flatbuffers::Offset<fbs::Frame>(builder.EndTable(start)));
+        finished = true;
+      }
+
+      return {builder.GetBufferPointer(), builder.GetSize()};
+    }
+  };
+
+  class FlatbuffersReader
+  {
+  private:
+    const flatbuffers::Vector<flatbuffers::Offset<fbs::Entry>>* entries;
+    size_t data_offset;
+    size_t data_end;
+
+    static msgpack::zone& unpack_zone()
+    {
+      thread_local msgpack::zone zone;
+      return zone;
+    }
+
+    static bool reference_in_place(msgpack::type::object_type, size_t, void*)
+    {
+      return true;
+    }
+
+    template <typename T>
+    T read(size_t offset)
+    {
+      auto raw = read_raw(offset);
+
+      if constexpr (fbs::is_raw_bytes<T>)
+      {
+        return T(raw.p, raw.p + raw.n);
+      }
+      else if constexpr (fbs::is_scalar<T>)
+      {
+        using R = typename fbs::scalar_repr<T>::type;
+        if (raw.n != sizeof(R))
+        {
+          throw KvSerialiserException(fmt::format(
+            "Expected a scalar of {} bytes, found {}", sizeof(R), raw.n));
+        }
+        return static_cast<T>(flatbuffers::ReadScalar<R>(raw.p));
+      }
+      else
+      {
+        auto& zone = unpack_zone();
+        zone.clear();
+        size_t unpacked = 0;
+        return msgpack::unpack(
+                 zone,
+                 reinterpret_cast<const char*>(raw.p),
+                 raw.n,
+                 unpacked,
+                 &reference_in_place)
+          .as<T>();
+      }
+    }
+
+    CBuffer read_raw(size_t offset)
+    {
+      if (entries == nullptr || offset >= data_end)
+      {
+        throw KvSerialiserException(
+          fmt::format("No entry at offset {} of FlatBuffer", offset));
+      }
+
+      auto data = entries->Get(offset)->data();
+      if (data == nullptr)
+        return {};
+
+      return {data->data(), data->size()};
+    }
+
+  public:
+    FlatbuffersReader(const FlatbuffersReader& other) = delete;
+    FlatbuffersReader& operator=(const FlatbuffersReader& other) = delete;
+
+    FlatbuffersReader(
+      const uint8_t* data_in_ptr = nullptr, size_t data_in_size = 0)
+    {
+      init(data_in_ptr, data_in_size);
+    }
+
+    void init(const uint8_t* data_in_ptr, size_t data_in_size)
+    {
+      data_offset = 0;
+      data_end = 0;
+      entries = nullptr;
+
+      if (data_in_ptr == nullptr || data_in_size == 0)
+        return;
+
+      // Transactions may legitimately contain more than the verifier's
+      // default limit of 1M tables
+      flatbuffers::Verifier verifier(
+        data_in_ptr,
+        data_in_size,
+        64,
+        std::numeric_limits<flatbuffers::uoffset_t>::max());
+      if (!verifier.VerifyBuffer<fbs::Frame>(nullptr))
+      {
+        throw KvSerialiserException("Invalid FlatBuffer transaction");
+      }
+
+      entries = flatbuffers::GetRoot<fbs::Frame>(data_in_ptr)->entries();
+      data_end = entries == nullptr ? 0 : entries->size();
+    }
+
+    /** Read only the entries of another reader from offset begin to end
+     */
+    void init_section(
+      const FlatbuffersReader& parent, size_t begin, size_t end)
+    {
+      entries = parent.entries;
+      data_offset = begin;
+      data_end = end;
+    }
+
+    size_t get_offset() const
+    {
+      return data_offset;
+    }
+
+    template <typename T>
+    T read_next()
+    {
+      return read<T>(data_offset++);
+    }
+
+    template <typename T>
+    T peek_next()
+    {
+      return read<T>(data_offset);
+    }
+
+    /** Returns the encoding of the next item in place, without copying or
+     * decoding it. For strings and byte vectors, this is the item itself.
+     *
+     * @return Buffer referring to the input, valid as long as it is
+     */
+    CBuffer read_next_raw()
+    {
+      return read_raw(data_offset++);
+    }
+
+    void skip_next()
+    {
+      data_offset++;
+    }
+
+    bool is_eos()
+    {
+      return entries == nullptr || data_offset >= data_end;
+    }
+  };
+}
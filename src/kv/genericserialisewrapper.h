@@ -5,7 +5,10 @@
 #include "ds/buffer.h"
 #include "kvtypes.h"
 
+#include <memory>
 #include <optional>
+#include <string>
+#include <vector>
 
 namespace kv
 {
@@ -58,8 +61,38 @@ namespace kv
   class GenericSerialiseWrapper
   {
   private:
-    W public_writer;
-    W private_writer;
+    // Domains are staged in writers pooled by the calling thread, which keep
+    // their capacity from one transaction to the next, so that the only
+    // allocation per transaction is the buffer returned by get_raw_data().
+    // Each serialiser checks writers out of the pool and returns them when it
+    // is destroyed, so serialisers on one thread may be nested or interleaved
+    struct Writers
+    {
+      W public_writer;
+      W private_writer;
+    };
+    using WritersPtr = std::unique_ptr<Writers>;
+
+    static std::vector<WritersPtr>& writers_pool()
+    {
+      thread_local std::vector<WritersPtr> pool;
+      return pool;
+    }
+
+    static WritersPtr check_out_writers()
+    {
+      auto& pool = writers_pool();
+      if (pool.empty())
+        return std::make_unique<Writers>();
+
+      auto writers = std::move(pool.back());
+      pool.pop_back();
+      return writers;
+    }
+
+    WritersPtr writers;
+    W& public_writer;
+    W& private_writer;
     W* current_writer;
     Version version;
 
@@ -100,13 +133,28 @@ namespace kv
   public:
     GenericSerialiseWrapper(
       std::shared_ptr<AbstractTxEncryptor> e, const Version& version_) :
+      writers(check_out_writers()),
+      public_writer(writers->public_writer),
+      private_writer(writers->private_writer),
       crypto_util(e)
     {
+      public_writer.clear();
+      private_writer.clear();
       set_current_domain(SecurityDomain::PUBLIC);
       serialise_internal(version_);
       version = version_;
     }
 
+    GenericSerialiseWrapper(const GenericSerialiseWrapper&) = delete;
+    GenericSerialiseWrapper& operator=(const GenericSerialiseWrapper&) =
+      delete;
+
+    ~GenericSerialiseWrapper()
+    {
+      if (writers)
+        writers_pool().push_back(std::move(writers));
+    }
+
     void start_map(const std::string& name, SecurityDomain domain)
     {
       if (domain == SecurityDomain::PRIVATE && !crypto_util)
@@ -122,6 +170,23 @@ namespace kv
       serialise_internal(name);
     }
 
+    /** Serialise the view history and history tree of a snapshot in the
+     * public domain, right after the version, so that they are authenticated
+     * with it
+     *
+     * @param view_history First version of each view
+     * @param tree Serialised history tree
+     */
+    void serialise_snapshot_header(
+      const std::vector<Version>& view_history,
+      const std::vector<uint8_t>& tree)
+    {
+      serialise_internal_public(static_cast<uint64_t>(view_history.size()));
+      for (auto v : view_history)
+        serialise_internal_public(v);
+      serialise_internal_public(tree);
+    }
+
     template <class Version>
     void serialise_read_version(const Version& version)
     {
@@ -171,67 +236,51 @@ namespace kv
 
     std::vector<uint8_t> get_raw_data()
     {
-      // make sure the private buffer is empty when we return
-      auto writer_guard_func = [](W* writer) { writer->clear(); };
-      std::unique_ptr<decltype(private_writer), decltype(writer_guard_func)>
-        writer_guard(&private_writer, writer_guard_func);
-
       auto serialised_public_domain = public_writer.get_raw_data();
 
       // If no crypto util is set, all maps have been serialised by the public
       // writer.
       if (!crypto_util)
       {
-        return serialised_public_domain;
+        return {serialised_public_domain.p,
+                serialised_public_domain.p + serialised_public_domain.n};
       }
 
-      auto serialised_private_domain = private_writer.get_raw_data();
-
       return serialise_domains(
-        serialised_public_domain, serialised_private_domain);
+        serialised_public_domain, private_writer.get_raw_data());
     }
 
     std::vector<uint8_t> serialise_domains(
-      const std::vector<uint8_t>& serialised_public_domain,
-      const std::vector<uint8_t>& serialised_private_domain =
-        std::vector<uint8_t>())
+      CBuffer serialised_public_domain,
+      CBuffer serialised_private_domain = nullb)
     {
-      std::vector<uint8_t> serialised_tx;
-      std::vector<uint8_t> serialised_hdr;
-      std::vector<uint8_t> encrypted_private_domain(
-        serialised_private_domain.size());
-
-      crypto_util->encrypt(
-        serialised_private_domain,
-        serialised_public_domain,
-        serialised_hdr,
-        encrypted_private_domain,
-        version);
-
       // Serialise entire tx
       // Format: gcm hdr (iv + tag) + len of public domain + public domain +
       // encrypted privated domain
-      auto space = serialised_hdr.size() + sizeof(size_t) +
-        serialised_public_domain.size() + encrypted_private_domain.size();
-      serialised_tx.resize(space);
-      auto data_ = serialised_tx.data();
-
-      serialized::write(
-        data_, space, serialised_hdr.data(), serialised_hdr.size());
-      serialized::write(data_, space, serialised_public_domain.size());
+      // The header is written last, once the private domain has been
+      // encrypted straight into its place in the buffer
+      auto hdr_size = crypto_util->get_header_length();
+      auto space = hdr_size + sizeof(size_t) + serialised_public_domain.n +
+        serialised_private_domain.n;
+      std::vector<uint8_t> serialised_tx(space);
+      auto hdr = serialised_tx.data();
+      auto data_ = hdr + hdr_size;
+      space -= hdr_size;
+
+      serialized::write(data_, space, serialised_public_domain.n);
+      auto public_domain = data_;
       serialized::write(
         data_,
         space,
-        serialised_public_domain.data(),
-        serialised_public_domain.size());
-      if (encrypted_private_domain.size() > 0)
-      {
-        serialized::write(
-          data_,
-          space,
-          encrypted_private_domain.data(),
-          encrypted_private_domain.size());
-      }
+        serialised_public_domain.p,
+        serialised_public_domain.n);
+
+      crypto_util->encrypt(
+        serialised_private_domain,
+        {public_domain, serialised_public_domain.n},
+        hdr,
+        data_,
+        version);
 
       return serialised_tx;
     }
@@ -244,7 +293,6 @@ namespace kv
     R public_reader;
     R private_reader;
     R* current_reader;
-    std::vector<uint8_t> decrypted_buffer;
     KvOperationType unhandled_op;
     Version version;
     std::shared_ptr<AbstractTxEncryptor> crypto_util;
@@ -265,6 +313,15 @@ namespace kv
       return try_read_op_flag(type, *current_reader);
     }
 
+    // Private domains are decrypted into a buffer owned by the calling thread,
+    // which keeps its capacity from one transaction to the next. It is only
+    // valid until the next transaction is deserialised on this thread
+    static std::vector<uint8_t>& decryption_arena()
+    {
+      thread_local std::vector<uint8_t> arena;
+      return arena;
+    }
+
     KvOperationType try_read_op_flag(KvOperationType type, R& reader)
     {
       if (unhandled_op != KvOperationType::KOT_NOT_SUPPORTED)
@@ -331,12 +388,12 @@ namespace kv
 
       // Go to start of private domain
       serialized::skip(data_, size_, public_domain_length);
-      decrypted_buffer.resize(size_);
+      auto& decrypted_buffer = decryption_arena();
 
       if (!crypto_util->decrypt(
-            {data_, data_ + size_},
-            {data_public, data_public + public_domain_length},
-            {data, data + crypto_util->get_header_length()},
+            {data_, size_},
+            {data_public, public_domain_length},
+            {data, crypto_util->get_header_length()},
             decrypted_buffer,
             version))
       {
@@ -355,6 +412,22 @@ namespace kv
       return version;
     }
 
+    /** Read the view history and history tree written by
+     * serialise_snapshot_header()
+     *
+     * @param view_history Set to the first version of each view
+     * @param tree Set to the serialised history tree
+     */
+    void deserialise_snapshot_header(
+      std::vector<Version>& view_history, std::vector<uint8_t>& tree)
+    {
+      auto n_views = public_reader.template read_next<uint64_t>();
+      view_history.clear();
+      for (uint64_t i = 0; i < n_views; ++i)
+        view_history.push_back(public_reader.template read_next<Version>());
+      tree = public_reader.template read_next<std::vector<uint8_t>>();
+    }
+
     std::optional<std::string> start_map()
     {
       if (current_reader->is_eos())
@@ -374,6 +447,54 @@ namespace kv
         current_reader->template read_next<std::string>()};
     }
 
+    struct MapSection
+    {
+      std::string name;
+      // Reads the contents of the map, from its read version onwards
+      std::unique_ptr<GenericDeserialiseWrapper> deserialiser;
+      // Reads, writes and removes in the map
+      size_t entries = 0;
+    };
+
+    /** Split the next map off into a deserialiser of its own, skipping over
+     * its contents without decoding them, so that maps can be deserialised
+     * independently of each other. The new deserialiser refers to the input
+     * of this one, and must not outlive it.
+     *
+     * @return Name and contents of the map, or nothing if there are no more
+     * maps
+     */
+    std::optional<MapSection> split_map()
+    {
+      auto name = start_map();
+      if (!name.has_value())
+        return {};
+
+      auto& reader = *current_reader;
+      const auto begin = reader.get_offset();
+
+      // A map is its read version, followed by counted reads, writes and
+      // removes, as written by serialise_read(), serialise_write() and
+      // serialise_remove()
+      constexpr size_t items_per_entry[] = {2, 2, 1};
+      size_t entries = 0;
+      reader.skip_next();
+      for (auto items : items_per_entry)
+      {
+        const auto count = reader.template read_next<uint64_t>();
+        for (size_t i = 0; i < count * items; ++i)
+          reader.skip_next();
+        entries += count;
+      }
+
+      auto section = std::make_unique<GenericDeserialiseWrapper>(
+        nullptr, domain_restriction);
+      section->public_reader.init_section(reader, begin, reader.get_offset());
+      section->current_reader = &section->public_reader;
+
+      return MapSection{name.value(), std::move(section), entries};
+    }
+
     template <class Version>
     Version deserialise_read_version()
     {
@@ -2,14 +2,25 @@
 // Licensed under the Apache 2.0 License.
 #pragma once
 
+#include "ds/arena.h"
 #include "ds/champmap.h"
 #include "ds/dllist.h"
 #include "ds/logger.h"
+#include "ds/rbmap.h"
+#include "ds/serialized.h"
+#include "ds/sharedtasks.h"
+#include "ds/smallmap.h"
 #include "ds/spinlock.h"
+#include "contention.h"
 #include "kvtypes.h"
+#include "secondaryindex.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <list>
 #include <map>
@@ -58,7 +69,32 @@ namespace kv
   template <class S, class D>
   class Store;
 
-  template <class K, class V, class H, class S, class D>
+  template <class V>
+  struct VersionV
+  {
+    Version version;
+    V value;
+
+    VersionV() = default;
+    VersionV(Version ver, V val) : version(ver), value(val) {}
+  };
+
+  // States which keep their keys ordered, and so support range reads
+  template <class State>
+  struct is_ordered_state : std::false_type
+  {};
+
+  template <class K, class V>
+  struct is_ordered_state<RBMap<K, V>> : std::true_type
+  {};
+
+  template <
+    class K,
+    class V,
+    class H,
+    class S,
+    class D,
+    class State_ = champ::Map<K, VersionV<V>, H>>
   class Map : public AbstractMap<S, D>
   {
   public:
@@ -67,31 +103,43 @@ namespace kv
       return version < 0;
     }
 
-    struct VersionV
-    {
-      Version version;
-      V value;
-
-      VersionV() = default;
-      VersionV(Version ver, V val) : version(ver), value(val) {}
-    };
-
-    using State = champ::Map<K, VersionV, H>;
-    using Read = std::unordered_map<K, Version, H>;
-    using Write = std::unordered_map<K, VersionV, H>;
+    using VersionV = kv::VersionV<V>;
+    using State = State_;
+    // Most transactions read and write a handful of keys, so read and write
+    // sets are kept inline until they grow. Read sets never outlive their
+    // transaction, so are allocated from the calling thread's arena when
+    // there is one. Write sets are moved into the map on commit, so are
+    // always allocated from the heap, and kept smaller, as every version of
+    // the map holds one.
+    using Read = ds::SmallMap<
+      K,
+      Version,
+      H,
+      8,
+      ds::ArenaAllocator<std::pair<K, Version>>>;
+    using Write = ds::SmallMap<K, VersionV, H, 4>;
     /// Signature for transaction commit handlers
     using CommitHook = std::function<void(Version, const State&, const Write&)>;
+    using AbstractIndex = kv::AbstractIndex<K, V>;
+    /// Secondary indexes of a map, in order of definition
+    using Indexes = std::vector<std::shared_ptr<const AbstractIndex>>;
 
   private:
-    using This = Map<K, V, H, S, D>;
+    using This = Map<K, V, H, S, D, State_>;
+    using AbstractSnapshot = typename AbstractMap<S, D>::Snapshot;
 
     struct LocalCommit
     {
       LocalCommit() = default;
-      LocalCommit(Version v, State s, Write w) :
+      LocalCommit(
+        Version v,
+        State s,
+        Write w,
+        std::shared_ptr<const Indexes> i = nullptr) :
         version(std::move(v)),
         state(std::move(s)),
         writes(std::move(w)),
+        indexes(std::move(i)),
         next(nullptr),
         prev(nullptr)
       {}
@@ -99,6 +147,8 @@ namespace kv
       Version version;
       State state;
       Write writes;
+      // Secondary indexes at this version, or nullptr if there are none
+      std::shared_ptr<const Indexes> indexes;
       LocalCommit* next;
       LocalCommit* prev;
     };
@@ -106,38 +156,88 @@ namespace kv
 
     Store<S, D>* store;
     std::string name;
+    MapId id;
     size_t rollback_counter;
     std::unique_ptr<LocalCommits> roll;
     CommitHook local_hook;
     CommitHook global_hook;
     LocalCommits commit_deltas;
     SpinLock sl;
+
+    // Empty states of the secondary indexes, from which the map's initial
+    // state is built
+    const Indexes index_definitions;
+
+    // Deltas waiting for an asynchronous global hook. Whichever dispatched
+    // run gets run_lock first passes every queued delta to the hook, so
+    // deltas are delivered in order. The queue is shared with the dispatched
+    // runs, which may outlive the map. Once the map has been destroyed, they
+    // do nothing.
+    struct HookDelta
+    {
+      Version version;
+      State state;
+      Write writes;
+    };
+    struct HookQueue
+    {
+      SpinLock lock;
+      std::vector<HookDelta> deltas;
+      GlobalHookMetrics metrics;
+      CommitHook hook;
+      std::mutex run_lock;
+      bool closed = false;
+    };
+    bool async_global_hook = false;
+    std::shared_ptr<HookQueue> hook_queue = std::make_shared<HookQueue>();
     const SecurityDomain security_domain;
     const bool replicated;
 
+    std::atomic<bool> early_conflict_detection = false;
+    std::atomic<size_t> early_conflicts = 0;
+    // Incremented, with the map locked, whenever the tail of the roll
+    // changes. Views which detect conflicts early read it without the lock
+    // to find that the map has not been written to since they were created.
+    std::atomic<size_t> generation = 0;
+    std::atomic<size_t> commit_conflicts = 0;
+    ContentionTracker contention;
+
     LocalCommits empty_commits;
 
     Map(
       Store<S, D>* store_,
       std::string name_,
+      MapId id_,
       SecurityDomain security_domain_,
       bool replicated_,
       CommitHook local_hook_,
-      CommitHook global_hook_) :
+      CommitHook global_hook_,
+      Indexes indexes_ = {}) :
       store(store_),
       name(name_),
+      id(id_),
       roll(std::make_unique<LocalCommits>()),
       rollback_counter(0),
       security_domain(security_domain_),
       replicated(replicated_),
       local_hook(local_hook_),
-      global_hook(global_hook_)
+      global_hook(global_hook_),
+      index_definitions(std::move(indexes_))
     {
-      roll->insert_back(create_new_local_commit(0, State(), Write()));
+      roll->insert_back(
+        create_new_local_commit(0, State(), Write(), empty_indexes()));
+      hook_queue->hook = global_hook;
     }
 
     Map(const Map& that) = delete;
 
+    ~Map()
+    {
+      // Waits for a hook that is running, and stops later runs
+      std::lock_guard<std::mutex> run_guard(hook_queue->run_lock);
+      hook_queue->closed = true;
+    }
+
     template <typename... Args>
     LocalCommit* create_new_local_commit(Args&&... args)
     {
@@ -154,7 +254,62 @@ namespace kv
       return c;
     }
 
+    std::shared_ptr<const Indexes> empty_indexes() const
+    {
+      if (index_definitions.empty())
+        return nullptr;
+
+      return std::make_shared<const Indexes>(index_definitions);
+    }
+
+    // Gets the states of the secondary indexes after a commit
+    static std::shared_ptr<const Indexes> apply_indexes(
+      const std::shared_ptr<const Indexes>& indexes,
+      const std::vector<typename AbstractIndex::Change>& changes,
+      Version v)
+    {
+      if (indexes == nullptr || changes.empty())
+        return indexes;
+
+      Indexes next;
+      next.reserve(indexes->size());
+      for (const auto& index : *indexes)
+        next.push_back(index->apply(changes, v));
+      return std::make_shared<const Indexes>(std::move(next));
+    }
+
+    size_t index_position(const std::string& index_name) const
+    {
+      for (size_t i = 0; i < index_definitions.size(); ++i)
+      {
+        if (index_definitions[i]->get_name() == index_name)
+          return i;
+      }
+
+      throw std::logic_error(
+        fmt::format("Map {} has no index {}", name, index_name));
+    }
+
   public:
+    /** Define a secondary index, to be passed to `Store::create`
+     *
+     * The index maps each value in the map to an index key, and is updated
+     * whenever a value is committed, locally or by deserialisation.
+     * Transactions read through it with `TxView::get_by_index`.
+     *
+     * @param index_name Name of the index, unique within the map
+     * @param extract Function returning the index key of a value
+     *
+     * @return Definition of the index
+     */
+    template <class IK, class IH = std::hash<IK>>
+    static std::shared_ptr<const AbstractIndex> make_index(
+      std::string index_name, std::function<IK(const V&)> extract)
+    {
+      return std::make_shared<const Index<K, V, H, IK, IH>>(
+        std::move(index_name), std::move(extract));
+    }
+
     virtual AbstractMap<S, D>* clone(AbstractStore* store) override
     {
       Store<S, D>* store_ = dynamic_cast<Store<S, D>*>(store);
@@ -163,18 +318,34 @@ namespace kv
         throw std::logic_error("Failed to cast store in Map clone");
 
       return new Map(
-        store_, name, security_domain, replicated, nullptr, nullptr);
+        store_,
+        name,
+        id,
+        security_domain,
+        replicated,
+        nullptr,
+        nullptr,
+        index_definitions);
     }
 
     /** Get the name of the map
      *
      * @return const std::string&
      */
-    const std::string& get_name() const
+    const std::string& get_name() const override
     {
       return name;
     }
 
+    /** Get the id of the map within its store
+     *
+     * @return Dense index of the map, assigned on creation
+     */
+    MapId get_id() const override
+    {
+      return id;
+    }
+
     /** Get store that the map belongs to
      *
      * @return Pointer to `kv::AbstractStore`
@@ -195,13 +366,86 @@ namespace kv
     }
 
     /** Set handler to be called on global transaction commit
+     *
+     * A synchronous hook is called from `Store::compact()`, once for each
+     * compacted version which wrote to the map. An asynchronous hook is run
+     * by the store's global hook dispatcher instead, so that it does not
+     * delay compaction. Consecutive deltas which are waiting for it are then
+     * coalesced into a single call, at the latest of their versions and with
+     * their writes merged.
      *
      * @param hook function to be called on global transaction commit
+     * @param async whether the hook is run asynchronously
      */
-    void set_global_hook(CommitHook hook)
+    void set_global_hook(CommitHook hook, bool async = false)
     {
       std::lock_guard<SpinLock> guard(sl);
       global_hook = hook;
+      async_global_hook = async;
+
+      std::lock_guard<SpinLock> queue_guard(hook_queue->lock);
+      hook_queue->hook = hook;
+    }
+
+    /** Detect conflicts while transactions execute, rather than only when
+     * they commit
+     *
+     * A view then checks each of its reads against the latest state of the
+     * map. Once the view has read a stale value and has written to the map,
+     * it can only fail to commit, so `kv::EarlyConflict` is thrown and the
+     * transaction can be executed again straight away.
+     *
+     * @param enabled Whether views created from now on detect conflicts early
+     */
+    void set_early_conflict_detection(bool enabled)
+    {
+      early_conflict_detection = enabled;
+    }
+
+    std::optional<GlobalHookMetrics> get_global_hook_metrics() override
+    {
+      {
+        std::lock_guard<SpinLock> guard(sl);
+        if (!async_global_hook)
+          return std::nullopt;
+      }
+
+      std::lock_guard<SpinLock> guard(hook_queue->lock);
+      auto metrics = hook_queue->metrics;
+      metrics.queued = hook_queue->deltas.size();
+      return metrics;
+    }
+
+    ConflictMetrics get_conflict_metrics() override
+    {
+      return {early_conflicts, commit_conflicts, contention.hot_keys()};
+    }
+
+    MemoryMetrics get_memory_metrics() override
+    {
+      // States are persistent, so they are copied under the lock and walked
+      // outside it.
+      std::vector<State> states;
+      lock();
+      for (auto r = roll->get_head(); r != nullptr; r = r->next)
+        states.push_back(r->state);
+      unlock();
+
+      MemoryMetrics metrics;
+      metrics.versions = states.size();
+
+      if constexpr (!is_ordered_state<State>::value)
+      {
+        champ::Footprint fp;
+        for (const auto& state : states)
+          state.footprint(fp);
+
+        metrics.entries = states.back().size();
+        metrics.nodes = fp.nodes;
+        metrics.bytes = fp.bytes;
+      }
+
+      return metrics;
     }
 
     /** Get security domain of a Map
@@ -280,17 +524,31 @@ namespace kv
       return !(*this == that);
     }
 
-    class TxView : public AbstractTxView<S, D>
+    class TxView : public AbstractTxView<S, D>, public ds::ArenaAllocated
     {
       friend Map;
       friend Tx<S, D>;
 
     private:
+      // A read over all keys in [from, to), or from onwards if there is no to
+      struct RangeRead
+      {
+        K from;
+        std::optional<K> to;
+      };
+
+      // A read through a secondary index, which holds while the set of keys
+      // with the index key is unchanged
+      using IndexRead = std::function<bool(const LocalCommit&)>;
+
       This& map;
       State state;
       State committed;
+      std::shared_ptr<const Indexes> indexes;
       Read reads;
       Write writes;
+      std::vector<RangeRead, ds::ArenaAllocator<RangeRead>> range_reads;
+      std::vector<IndexRead, ds::ArenaAllocator<IndexRead>> index_reads;
       Version start_version;
       size_t rollback_counter;
       Version read_version;
@@ -299,19 +557,82 @@ namespace kv
       bool deserialised;
       bool committed_writes;
 
-      TxView(This& parent, State& s, Version v, size_t r) :
+      // With early conflict detection, set once a read is known to be stale,
+      // so that the view will conflict at commit if it has any writes
+      bool detect_conflicts;
+      bool stale_read = false;
+
+      // Generation of the map when this view was created, if the view was
+      // created from the tail of the roll
+      static constexpr size_t behind_tail = SIZE_MAX;
+      size_t generation;
+
+      // Hash of the first read found to be stale when preparing to commit
+      std::optional<size_t> conflicting_key = std::nullopt;
+
+      TxView(
+        This& parent,
+        LocalCommit& c,
+        size_t r,
+        bool detect_conflicts_ = false) :
         map(parent),
-        state(s),
+        state(c.state),
         committed(parent.roll->get_head()->state),
-        start_version(v),
+        indexes(c.indexes),
+        start_version(c.version),
         rollback_counter(r),
         read_version(NoVersion),
         commit_version(NoVersion),
         changes(false),
         deserialised(false),
-        committed_writes(false)
+        committed_writes(false),
+        detect_conflicts(detect_conflicts_),
+        generation(
+          &c == parent.roll->get_tail() ? parent.generation.load() :
+                                          behind_tail)
       {}
 
+      // Compares a read with the current state of the map. Writes to the map
+      // are monotonic, apart from rollbacks which also fail the commit, so a
+      // stale read remains stale.
+      template <typename F>
+      void check_read(F&& is_stale)
+      {
+        if (!detect_conflicts || stale_read)
+          return;
+
+        // Most reads are of a map which has not been written to since the
+        // view was created, and so cannot be stale
+        if (map.generation.load(std::memory_order_acquire) == generation)
+          return;
+
+        map.lock();
+        auto current = map.roll->get_tail();
+        stale_read = (rollback_counter != map.rollback_counter) ||
+          (current->version != start_version && is_stale(*current));
+        map.unlock();
+
+        throw_if_conflicted();
+      }
+
+      void check_key_read(const K& key, Version version)
+      {
+        check_read([&key, version](const LocalCommit& current) {
+          auto search = current.state.get(key);
+          return search.has_value() ? (search->version != version) :
+                                      (version != NoVersion);
+        });
+      }
+
+      void throw_if_conflicted()
+      {
+        if (stale_read && !writes.empty())
+        {
+          map.early_conflicts++;
+          throw EarlyConflict();
+        }
+      }
+
     public:
       // Expose these types so that other code can use them as MyTx::KeyType or
       // MyMap::TxView::KeyType, templated on the TxView or Map type rather than
@@ -360,12 +681,14 @@ namespace kv
         if (!search.has_value())
         {
           reads.insert(std::make_pair(key, NoVersion));
+          check_key_read(key, NoVersion);
           return {};
         }
 
         // Record the version that we depend on.
         auto& found = search.value();
         reads.insert(std::make_pair(key, found.version));
+        check_key_read(key, found.version);
 
         // If the key has been deleted, return empty.
         if (deleted(found.version))
@@ -424,6 +747,7 @@ namespace kv
 
         // Record in the write set.
         writes[key] = {0, value};
+        throw_if_conflicted();
         return true;
       }
 
@@ -470,6 +794,7 @@ namespace kv
           std::piecewise_construct,
           std::forward_as_tuple(key),
           std::forward_as_tuple(NoVersion, V()));
+        throw_if_conflicted();
         return true;
       }
 
@@ -486,6 +811,9 @@ namespace kv
 
         // Record a global read dependency.
         read_version = start_version;
+        check_read([this](const LocalCommit& current) {
+          return current.version != read_version;
+        });
         auto& w = writes;
 
         state.foreach([&w, &f](const K& k, const VersionV& v) {
@@ -505,6 +833,147 @@ namespace kv
         return true;
       }
 
+      /** Iterate over entries with keys in [from, to), in key order
+       *
+       * Only available on an OrderedMap. The transaction depends on every key
+       * in the range, including ones that do not exist, so it will conflict
+       * with any transaction which writes to a key in the range.
+       *
+       * @param from First key in the range
+       * @param to Key following the range
+       * @param F functor, taking a key and a value, return value determines
+       * whether the iteration should continue (true) or stop (false)
+       */
+      template <class F>
+      bool range(const K& from, const K& to, F&& f)
+      {
+        if (commit_version != NoVersion)
+          return false;
+
+        range_reads.push_back({from, to});
+        return foreach_in_range(from, &to, f);
+      }
+
+      /** Get the first entry with a key not less than key
+       *
+       * Only available on an OrderedMap. The transaction depends on every key
+       * from key up to the returned key.
+       *
+       * @param key Key
+       *
+       * @return optional containing the found key and its value, empty if
+       * there is no such key
+       */
+      std::optional<std::pair<K, V>> lower_bound(const K& key)
+      {
+        if (commit_version != NoVersion)
+          return {};
+
+        std::optional<std::pair<K, V>> result;
+        foreach_in_range(key, nullptr, [&result](const K& k, const V& v) {
+          result.emplace(k, v);
+          return false;
+        });
+
+        if (!result.has_value())
+        {
+          range_reads.push_back({key, std::nullopt});
+          return {};
+        }
+
+        // Depend on nothing being inserted before the found key, and on the
+        // found key itself, unless we wrote it.
+        const auto& found = result->first;
+        range_reads.push_back({key, found});
+        if (writes.find(found) == writes.end())
+          reads.insert(std::make_pair(found, state.get(found)->version));
+
+        return result;
+      }
+
+      /** Iterate over entries whose values have an index key
+       *
+       * Reads through a secondary index of the map, reflecting this
+       * transaction's own writes. The transaction depends on the value of
+       * each visited key, and on no key gaining or losing the index key, so it
+       * will conflict with any transaction which changes either.
+       *
+       * @param index_name Name of an index passed to `Store::create`
+       * @param index_key Index key
+       * @param F functor, taking a key and a value, return value determines
+       * whether the iteration should continue (true) or stop (false)
+       */
+      template <class IK, class IH = std::hash<IK>, class F>
+      bool get_by_index(
+        const std::string& index_name, const IK& index_key, F&& f)
+      {
+        if (commit_version != NoVersion)
+          return false;
+
+        using IndexType = Index<K, V, H, IK, IH>;
+        const auto pos = map.index_position(index_name);
+        auto index = dynamic_cast<const IndexType*>((*indexes)[pos].get());
+        if (index == nullptr)
+          throw std::logic_error(fmt::format(
+            "Index {} of map {} has a different key type",
+            index_name,
+            map.name));
+
+        // Record the version at which the index key last gained or lost a key
+        auto entry = index->get(index_key);
+        const auto entry_version =
+          entry == nullptr ? NoVersion : entry->version;
+        IndexRead index_read =
+          [pos, index_key, entry_version](const LocalCommit& current) {
+            auto& current_index =
+              static_cast<const IndexType&>(*(*current.indexes)[pos]);
+            auto current_entry = current_index.get(index_key);
+            return entry_version ==
+              (current_entry == nullptr ? NoVersion : current_entry->version);
+          };
+        check_read([&index_read](const LocalCommit& current) {
+          return !index_read(current);
+        });
+        index_reads.push_back(std::move(index_read));
+
+        // The matching writes are copied, since f may put or remove keys,
+        // which moves the entries of the write set. Writes made by f are not
+        // visited.
+        std::vector<std::pair<K, V>> local;
+        for (auto it = writes.begin(); it != writes.end(); ++it)
+        {
+          if (
+            !deleted(it->second.version) &&
+            index->extract(it->second.value) == index_key)
+            local.emplace_back(it->first, it->second.value);
+        }
+
+        if (entry != nullptr)
+        {
+          // Keys which this transaction has written are visited below.
+          auto visit = [this, &f](const K& k, const Version& v) {
+            if (deleted(v) || writes.find(k) != writes.end())
+              return true;
+
+            auto found = state.getp(k);
+            reads.insert(std::make_pair(k, found->version));
+            check_key_read(k, found->version);
+            return f(k, found->value);
+          };
+
+          if (!entry->keys.foreach(visit))
+            return false;
+        }
+
+        for (const auto& [k, v] : local)
+        {
+          if (!f(k, v))
+            return false;
+        }
+
+        return true;
+      }
+
       Version start_order()
       {
         return start_version;
@@ -524,6 +993,105 @@ namespace kv
       }
 
     private:
+      // Visits live entries with from <= key < *to (unbounded if to is null),
+      // with this transaction's writes applied over the snapshot state.
+      template <class F>
+      bool foreach_in_range(const K& from, const K* to, F&& f)
+      {
+        static_assert(
+          is_ordered_state<State>::value,
+          "Range reads are only supported on an OrderedMap");
+
+        auto in_range = [&from, to](const K& k) {
+          return !(k < from) && (to == nullptr || k < *to);
+        };
+
+        // The writes are copied, since f may put or remove keys, which moves
+        // the entries of the write set. Writes made by f are not visited.
+        using LocalWrite = std::pair<K, VersionV>;
+        std::vector<LocalWrite> local;
+        for (auto it = writes.begin(); it != writes.end(); ++it)
+        {
+          if (in_range(it->first))
+            local.emplace_back(it->first, it->second);
+        }
+        std::sort(
+          local.begin(), local.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+          });
+
+        auto w = local.begin();
+        auto visit_local = [&w, &f]() {
+          const auto& [k, v] = *w++;
+          return deleted(v.version) || f(k, v.value);
+        };
+
+        auto visit = [&](const K& k, const VersionV& v) {
+          // Local writes to keys before this one are visited first.
+          while (w != local.end() && w->first < k)
+          {
+            if (!visit_local())
+              return false;
+          }
+
+          // A local write to this key shadows the state.
+          if (w != local.end() && !(k < w->first))
+            return visit_local();
+
+          return deleted(v.version) || f(k, v.value);
+        };
+
+        const bool completed = (to == nullptr) ?
+          state.foreach_from(from, visit) :
+          state.foreach_range(from, *to, visit);
+        if (!completed)
+          return false;
+
+        while (w != local.end())
+        {
+          if (!visit_local())
+            return false;
+        }
+
+        return true;
+      }
+
+      // Checks that no key in the range has been written between our
+      // snapshot and the current state.
+      bool range_unchanged(const RangeRead& r, const State& current)
+      {
+        using Entry = std::pair<const K*, Version>;
+        std::vector<Entry> snapshot_entries;
+        auto collect = [&snapshot_entries](const K& k, const VersionV& v) {
+          snapshot_entries.emplace_back(&k, v.version);
+          return true;
+        };
+
+        size_t i = 0;
+        auto compare = [&snapshot_entries, &i](const K& k, const VersionV& v) {
+          if (i == snapshot_entries.size())
+            return false;
+
+          const auto& [sk, sv] = snapshot_entries[i++];
+          return !(*sk < k) && !(k < *sk) && sv == v.version;
+        };
+
+        if (r.to.has_value())
+        {
+          state.foreach_range(r.from, r.to.value(), collect);
+          if (!current.foreach_range(r.from, r.to.value(), compare))
+            return false;
+        }
+        else
+        {
+          state.foreach_from(r.from, collect);
+          if (!current.foreach_from(r.from, compare))
+            return false;
+        }
+
+        return i == snapshot_entries.size();
+      }
+
       virtual bool has_writes()
       {
         return committed_writes || !writes.empty();
@@ -539,14 +1107,42 @@ namespace kv
         if (writes.empty())
           return true;
 
+        if (!reads_unchanged())
+        {
+          map.commit_conflicts++;
+          if (conflicting_key.has_value())
+            map.contention.record(conflicting_key.value());
+          return false;
+        }
+
+        return true;
+      }
+
+      std::optional<size_t> get_hot_conflict() override
+      {
+        if (
+          !conflicting_key.has_value() ||
+          !map.contention.is_hot(conflicting_key.value()))
+          return std::nullopt;
+
+        return std::hash<std::string>()(map.name) ^ conflicting_key.value();
+      }
+
+      bool reads_unchanged()
+      {
         // If the parent map has rolled back since this transaction began, this
         // transaction must fail.
         if (rollback_counter != map.rollback_counter)
           return false;
 
-        // If we have iterated over the map, check for a global version match.
+        // The version of the tail of the roll is the last version written to
+        // the map. If it has not been written to since this view was created,
+        // every read is still valid.
         auto current = map.roll->get_tail();
+        if (current->version == start_version)
+          return true;
 
+        // If we have iterated over the map, check for a global version match.
         if ((read_version != NoVersion) && (read_version != current->version))
         {
           LOG_DEBUG_FMT("Read version {} is invalid", read_version);
@@ -565,6 +1161,7 @@ namespace kv
             if (search.has_value())
             {
               LOG_DEBUG_FMT("Read depends on non-existing entry");
+              conflicting_key = H()(it->first);
               return false;
             }
           }
@@ -575,11 +1172,35 @@ namespace kv
             if (!search.has_value() || (it->second != search.value().version))
             {
               LOG_DEBUG_FMT("Read depends on invalid version of entry");
+              conflicting_key = H()(it->first);
+              return false;
+            }
+          }
+        }
+
+        // Check each range in our read set.
+        if constexpr (is_ordered_state<State>::value)
+        {
+          for (const auto& r : range_reads)
+          {
+            if (!range_unchanged(r, current->state))
+            {
+              LOG_DEBUG_FMT("Read depends on modified range of entries");
               return false;
             }
           }
         }
 
+        // Check each read through a secondary index.
+        for (const auto& index_read : index_reads)
+        {
+          if (!index_read(*current))
+          {
+            LOG_DEBUG_FMT("Read depends on modified index entry");
+            return false;
+          }
+        }
+
         return true;
       }
 
@@ -597,7 +1218,20 @@ namespace kv
 
         if (!writes.empty())
         {
-          auto state = map.roll->get_tail()->state;
+          // Apply all writes to a single transient copy of the tail state, so
+          // that intermediate states are not materialised for each key.
+          auto tail = map.roll->get_tail();
+          auto state = tail->state.transient();
+
+          // Secondary indexes are updated from the values each key had in
+          // the tail state, which is not modified by writes to the copy.
+          std::vector<typename AbstractIndex::Change> index_changes;
+          auto previous = [&tail](const K& key) -> const V* {
+            auto found = tail->state.getp(key);
+            if (found == nullptr || deleted(found->version))
+              return nullptr;
+            return &found->value;
+          };
 
           for (auto it = writes.begin(); it != writes.end(); ++it)
           {
@@ -605,7 +1239,11 @@ namespace kv
             {
               // Write the new value with the global version.
               changes = true;
-              state = state.put(it->first, VersionV{v, it->second.value});
+              state.put(it->first, VersionV{v, it->second.value});
+
+              if (tail->indexes != nullptr)
+                index_changes.push_back(
+                  {&it->first, previous(it->first), &it->second.value});
             }
             else
             {
@@ -615,15 +1253,23 @@ namespace kv
               if (search.has_value())
               {
                 changes = true;
-                state = state.put(it->first, VersionV{-v, V()});
+                state.put(it->first, VersionV{-v, V()});
+
+                if (tail->indexes != nullptr)
+                  index_changes.push_back(
+                    {&it->first, previous(it->first), nullptr});
               }
             }
           }
 
           if (changes)
           {
-            map.roll->insert_back(
-              map.create_new_local_commit(v, state, writes));
+            map.roll->insert_back(map.create_new_local_commit(
+              v,
+              state.persistent(),
+              writes,
+              apply_indexes(tail->indexes, index_changes, v)));
+            map.generation++;
           }
         }
       }
@@ -755,7 +1401,7 @@ namespace kv
         if (current->version <= version)
         {
           view = new TxView(
-            *this, current->state, current->version, rollback_counter);
+            *this, *current, rollback_counter, early_conflict_detection);
           break;
         }
       }
@@ -763,10 +1409,39 @@ namespace kv
       if (view == nullptr)
       {
         view = new TxView(
-          *this,
-          roll->get_head()->state,
-          roll->get_head()->version,
-          rollback_counter);
+          *this, *roll->get_head(), rollback_counter, early_conflict_detection);
+      }
+
+      unlock();
+      return view;
+    }
+
+    /** Create a view of the state of the map at a past version, if that state
+     * has not been discarded by compaction.
+     *
+     * @param version Version to read at
+     *
+     * @return View, or nullptr if the state at version is no longer retained
+     */
+    TxView* create_view_at(Version version)
+    {
+      lock();
+
+      // The head of the roll is the last entry at or before the compacted
+      // version, so every later version is still retained.
+      TxView* view = nullptr;
+
+      if (version >= roll->get_head()->version)
+      {
+        for (auto current = roll->get_tail(); current != nullptr;
+             current = current->prev)
+        {
+          if (current->version <= version)
+          {
+            view = new TxView(*this, *current, rollback_counter);
+            break;
+          }
+        }
       }
 
       unlock();
@@ -822,15 +1497,67 @@ namespace kv
 
     void post_compact() override
     {
-      if (global_hook)
+      if (global_hook && async_global_hook)
       {
-        for (auto r = commit_deltas.get_head(); r != nullptr; r = r->next)
+        if (commit_deltas.get_head() != nullptr)
         {
-          global_hook(r->version, r->state, r->writes);
-        }
-      }
-
-      commit_deltas.clear();
+          auto& q = *hook_queue;
+          {
+            std::lock_guard<SpinLock> guard(q.lock);
+            for (auto r = commit_deltas.get_head(); r != nullptr; r = r->next)
+            {
+              q.deltas.push_back({r->version, r->state, std::move(r->writes)});
+            }
+            q.metrics.max_queued =
+              std::max(q.metrics.max_queued, q.deltas.size());
+          }
+
+          store->dispatch_global_hooks(
+            [hook_queue = hook_queue]() { run_global_hooks(*hook_queue); });
+        }
+      }
+      else if (global_hook)
+      {
+        for (auto r = commit_deltas.get_head(); r != nullptr; r = r->next)
+        {
+          global_hook(r->version, r->state, r->writes);
+        }
+      }
+
+      commit_deltas.clear();
+    }
+
+    static void run_global_hooks(HookQueue& q)
+    {
+      std::lock_guard<std::mutex> run_guard(q.run_lock);
+      if (q.closed)
+        return;
+
+      std::vector<HookDelta> deltas;
+      CommitHook hook;
+      {
+        std::lock_guard<SpinLock> guard(q.lock);
+        deltas.swap(q.deltas);
+        hook = q.hook;
+      }
+
+      // An earlier run has already delivered these deltas
+      if (deltas.empty())
+        return;
+
+      auto& writes = deltas.front().writes;
+      for (size_t i = 1; i < deltas.size(); ++i)
+      {
+        for (auto& [key, value] : deltas[i].writes)
+          writes[key] = std::move(value);
+      }
+
+      if (hook)
+        hook(deltas.back().version, deltas.back().state, writes);
+
+      std::lock_guard<SpinLock> guard(q.lock);
+      q.metrics.deltas += deltas.size();
+      q.metrics.callbacks++;
     }
 
     void rollback(Version v) override
@@ -854,7 +1581,10 @@ namespace kv
       }
 
       if (advance)
+      {
         rollback_counter++;
+        generation++;
+      }
     }
 
     void clear() override
@@ -862,8 +1592,114 @@ namespace kv
       // This discards all entries in the roll and resets the compacted value
       // and rollback counter. The Map expects to be locked before clearing it.
       roll->clear();
-      roll->insert_back(create_new_local_commit(0, State(), Write()));
+      roll->insert_back(
+        create_new_local_commit(0, State(), Write(), empty_indexes()));
       rollback_counter = 0;
+      generation++;
+    }
+
+    /** The state of this map at a single version. This shares structure with
+     * the map's persistent state, so it is cheap to take and stays valid
+     * while the map is modified, compacted or rolled back.
+     */
+    class Snapshot : public AbstractMap<S, D>::Snapshot
+    {
+    private:
+      friend This;
+
+      const std::string name;
+      const SecurityDomain security_domain;
+      State state;
+
+    public:
+      Snapshot(
+        const std::string& name_,
+        SecurityDomain security_domain_,
+        State state_) :
+        name(name_),
+        security_domain(security_domain_),
+        state(std::move(state_))
+      {}
+
+      void serialise(S& s) override
+      {
+        // Removed keys read the same as absent ones, so they are left out
+        uint64_t ctr = 0;
+        state.foreach([&ctr](const K&, const VersionV& v) {
+          if (!deleted(v.version))
+            ++ctr;
+          return true;
+        });
+
+        s.start_map(name, security_domain);
+        s.serialise_count_header(ctr);
+        state.foreach([&s](const K& k, const VersionV& v) {
+          if (!deleted(v.version))
+            s.serialise_write_version(k, v.value, v.version);
+          return true;
+        });
+      }
+    };
+
+    std::unique_ptr<AbstractSnapshot> snapshot(Version v) override
+    {
+      // Find the last entry committed at or before this version. The Map
+      // expects to be locked while taking a snapshot.
+      auto current = roll->get_tail();
+      while (current->prev != nullptr && current->version > v)
+        current = current->prev;
+
+      return std::make_unique<Snapshot>(name, security_domain, current->state);
+    }
+
+    std::unique_ptr<AbstractSnapshot> deserialise_snapshot(D& d) override
+    {
+      auto state = State().transient();
+
+      auto ctr = d.deserialise_write_header();
+      for (size_t i = 0; i < ctr; ++i)
+      {
+        auto w = d.template deserialise_write_version<K, V, Version>();
+        if (!w.has_value() || w->is_remove || deleted(w->version))
+          throw KvSerialiserException(
+            fmt::format("Invalid entry in snapshot of {}", name));
+
+        state.put(w->key, VersionV(w->version, w->value));
+      }
+
+      return std::make_unique<Snapshot>(
+        name, security_domain, state.persistent());
+    }
+
+    void apply_snapshot(
+      Version v, std::unique_ptr<AbstractSnapshot> snapshot_) override
+    {
+      // This discards all entries in the roll, replacing them with the state
+      // in the snapshot. The Map expects to be locked while applying it.
+      auto snapshot = dynamic_cast<Snapshot*>(snapshot_.get());
+      if (snapshot == nullptr)
+        throw std::logic_error(
+          "Attempted to apply a snapshot of an incompatible map");
+
+      // Secondary indexes are not part of the snapshot, so are rebuilt from
+      // the values in it.
+      std::vector<typename AbstractIndex::Change> index_changes;
+      if (!index_definitions.empty())
+      {
+        snapshot->state.foreach(
+          [&index_changes](const K& k, const VersionV& v) {
+            if (!deleted(v.version))
+              index_changes.push_back({&k, nullptr, &v.value});
+            return true;
+          });
+      }
+      auto indexes = apply_indexes(empty_indexes(), index_changes, v);
+
+      roll->clear();
+      roll->insert_back(create_new_local_commit(
+        v, std::move(snapshot->state), Write(), std::move(indexes)));
+      rollback_counter++;
+      generation++;
     }
 
     void lock() override
@@ -885,12 +1721,21 @@ namespace kv
 
       std::swap(rollback_counter, map->rollback_counter);
       std::swap(roll, map->roll);
+      generation++;
+      map->generation++;
     }
   };
 
+  /// A Map whose keys are kept in order, supporting range reads
+  template <class K, class V, class S, class D>
+  using OrderedMap = Map<K, V, std::hash<K>, S, D, RBMap<K, VersionV<V>>>;
+
   template <class S, class D>
   struct MapView
   {
+    // Id of source map within its store
+    MapId id;
+
     // Weak pointer to source map
     AbstractMap<S, D>* map;
 
@@ -899,9 +1744,157 @@ namespace kv
   };
 
   // When a collection of Maps are locked, the locks must be acquired in a
-  // stable order to avoid deadlocks. This ordered map will claim in name-order
+  // stable order to avoid deadlocks. This collection is kept sorted by MapId,
+  // and so will claim in map creation order. Most transactions only touch a
+  // handful of maps, so views are stored inline and found by a linear scan
+  // over their ids, only spilling to the heap for very wide transactions.
   template <class S, class D>
-  using OrderedViews = std::map<std::string, MapView<S, D>>;
+  class OrderedViews
+  {
+  public:
+    static constexpr size_t inline_capacity = 8;
+
+    using iterator = MapView<S, D>*;
+    using const_iterator = const MapView<S, D>*;
+
+  private:
+    std::array<MapView<S, D>, inline_capacity> inline_views;
+    std::vector<MapView<S, D>> spilled_views;
+    size_t count = 0;
+
+    MapView<S, D>* data()
+    {
+      return spilled_views.empty() ? inline_views.data() :
+                                     spilled_views.data();
+    }
+
+    const MapView<S, D>* data() const
+    {
+      return spilled_views.empty() ? inline_views.data() :
+                                     spilled_views.data();
+    }
+
+  public:
+    OrderedViews() = default;
+    OrderedViews(const OrderedViews& that) = delete;
+
+    iterator begin()
+    {
+      return data();
+    }
+
+    iterator end()
+    {
+      return data() + count;
+    }
+
+    const_iterator begin() const
+    {
+      return data();
+    }
+
+    const_iterator end() const
+    {
+      return data() + count;
+    }
+
+    size_t size() const
+    {
+      return count;
+    }
+
+    bool empty() const
+    {
+      return count == 0;
+    }
+
+    iterator find(MapId id)
+    {
+      for (auto it = begin(); it != end() && it->id <= id; ++it)
+      {
+        if (it->id == id)
+          return it;
+      }
+      return end();
+    }
+
+    iterator find(const std::string& name)
+    {
+      for (auto it = begin(); it != end(); ++it)
+      {
+        if (it->map->get_name() == name)
+          return it;
+      }
+      return end();
+    }
+
+    bool insert(MapView<S, D>&& map_view)
+    {
+      auto pos = begin();
+      while (pos != end() && pos->id < map_view.id)
+        ++pos;
+
+      if (pos != end() && pos->id == map_view.id)
+        return false;
+
+      if (spilled_views.empty() && count < inline_capacity)
+      {
+        std::move_backward(pos, end(), end() + 1);
+        *pos = std::move(map_view);
+      }
+      else
+      {
+        const auto idx = pos - begin();
+        if (spilled_views.empty())
+        {
+          spilled_views.reserve(2 * inline_capacity);
+          std::move(begin(), end(), std::back_inserter(spilled_views));
+        }
+        spilled_views.insert(
+          spilled_views.begin() + idx, std::move(map_view));
+      }
+
+      ++count;
+      return true;
+    }
+
+    // Moves views over maps that are not yet present into this collection.
+    // As with std::map::merge, views over maps that are already present are
+    // left behind in that.
+    void merge(OrderedViews& that)
+    {
+      size_t kept = 0;
+      for (auto it = that.begin(); it != that.end(); ++it)
+      {
+        if (find(it->id) == end())
+        {
+          insert(std::move(*it));
+        }
+        else
+        {
+          *(that.begin() + kept) = std::move(*it);
+          ++kept;
+        }
+      }
+
+      while (that.count > kept)
+      {
+        that.data()[--that.count] = {};
+      }
+
+      if (that.count == 0)
+        that.spilled_views.clear();
+    }
+
+    void clear()
+    {
+      for (auto it = begin(); it != end(); ++it)
+        *it = {};
+
+      spilled_views.clear();
+      count = 0;
+    }
+  };
 
   template <typename SP, typename DP>
   static inline std::
@@ -910,10 +1903,9 @@ namespace kv
   {
     std::map<kv::SecurityDomain, std::vector<AbstractTxView<SP, DP>*>>
       grouped_maps;
-    for (auto it = maps.cbegin(); it != maps.cend(); ++it)
+    for (auto it = maps.begin(); it != maps.end(); ++it)
     {
-      grouped_maps[it->second.map->get_security_domain()].push_back(
-        it->second.view.get());
+      grouped_maps[it->map->get_security_domain()].push_back(it->view.get());
     }
     return grouped_maps;
   }
@@ -929,22 +1921,29 @@ namespace kv
     Version version;
     bool read_globally_committed = false;
 
+    // Set for read-only transactions at a past version
+    bool historical = false;
+    std::shared_ptr<Store<S, D>> historical_store = nullptr;
+
+    // Set when the last commit conflicted on a hot key
+    std::optional<size_t> hot_conflict = std::nullopt;
+
     kv::TxHistory::RequestID req_id;
 
     template <class M>
     std::tuple<typename M::TxView*> get_tuple(M& m)
     {
       // If the M is present, its AbtractTxView must be an M::TxView.
-      auto search = view_list.find(m.name);
-      if (search != view_list.end())
+      auto search = view_list.find(m.id);
+      if (search != view_list.end() && search->map == &m)
         return std::make_tuple(
-          static_cast<typename M::TxView*>(search->second.view.get()));
+          static_cast<typename M::TxView*>(search->view.get()));
 
       auto it = view_list.begin();
       if (it != view_list.end())
       {
         // All Maps must be in the same store.
-        if (it->second.map->get_store() != m.get_store())
+        if (it->map->get_store() != m.get_store())
           throw std::logic_error(
             "Transaction must be over maps in the same store");
       }
@@ -958,8 +1957,10 @@ namespace kv
           read_version = m.get_store()->current_version();
       }
 
-      typename M::TxView* view = m.create_view(read_version);
-      view_list[m.name] = {&m, std::unique_ptr<AbstractTxView<S, D>>(view)};
+      typename M::TxView* view = historical ? create_historical_view(m) :
+                                              m.create_view(read_version);
+      view_list.insert(
+        {m.id, &m, std::unique_ptr<AbstractTxView<S, D>>(view)});
       return std::make_tuple(view);
     }
 
@@ -970,6 +1971,37 @@ namespace kv
       return std::tuple_cat(get_tuple(m), get_tuple(ms...));
     }
 
+    template <class M>
+    typename M::TxView* create_historical_view(M& m)
+    {
+      if (read_version > m.get_store()->commit_version())
+      {
+        throw std::logic_error(fmt::format(
+          "Cannot read {} at {}, which is not globally committed",
+          m.get_name(),
+          read_version));
+      }
+
+      auto view = m.create_view_at(read_version);
+      if (view == nullptr && historical_store != nullptr)
+      {
+        auto historical_map =
+          historical_store->template get<M>(m.get_name());
+        if (historical_map != nullptr)
+          view = historical_map->create_view_at(read_version);
+      }
+
+      if (view == nullptr)
+      {
+        throw std::logic_error(fmt::format(
+          "State of {} at {} is no longer available",
+          m.get_name(),
+          read_version));
+      }
+
+      return view;
+    }
+
     void reset()
     {
       view_list.clear();
@@ -990,6 +2022,25 @@ namespace kv
 
     Tx(const Tx& that) = delete;
 
+    /** Key on which the last commit of this transaction conflicted, if
+     * that key is hot
+     *
+     * @return Identifier of the key, from which to pick the lane in which
+     * transactions contending for it are executed again
+     */
+    std::optional<size_t> get_hot_conflict() const
+    {
+      return hot_conflict;
+    }
+
+    /** Discard the views of a transaction which has conflicted, so that it
+     * can be executed again
+     */
+    void reset_conflicted()
+    {
+      reset();
+    }
+
     void set_view_list(OrderedViews<S, D>& view_list_)
     {
       // if view list is not empty then any coinciding keys will not be
@@ -1056,19 +2107,36 @@ namespace kv
       if (committed)
         throw std::logic_error("Transaction already committed");
 
-      if (view_list.empty())
+      if (historical)
+      {
+        for (auto& view : view_list)
+        {
+          if (view.view->has_writes())
+            throw std::logic_error("Historical transaction cannot write");
+        }
+      }
+
+      if (view_list.empty() || historical)
       {
         committed = true;
         success = true;
         return CommitSuccess::OK;
       }
 
-      auto store = view_list.begin()->second.map->get_store();
+      auto store = view_list.begin()->map->get_store();
       auto c = commit(view_list, [store]() { return store->next_version(); });
       success = c.has_value();
+      hot_conflict = std::nullopt;
 
       if (!success)
       {
+        for (auto& view : view_list)
+        {
+          hot_conflict = view.view->get_hot_conflict();
+          if (hot_conflict.has_value())
+            break;
+        }
+
         // Conflicting views (and contained writes) and all version tracking are
         // discarded. They must be reconstructed at updated, non-conflicting
         // versions
@@ -1144,9 +2212,9 @@ namespace kv
 
       for (auto it = views.begin(); it != views.end(); ++it)
       {
-        if (it->second.view->has_writes())
+        if (it->view->has_writes())
         {
-          it->second.map->lock();
+          it->map->lock();
           has_writes = true;
         }
       }
@@ -1155,7 +2223,7 @@ namespace kv
 
       for (auto it = views.begin(); it != views.end(); ++it)
       {
-        if (!it->second.view->prepare())
+        if (!it->view->prepare())
         {
           ok = false;
           break;
@@ -1168,16 +2236,16 @@ namespace kv
         version = f();
 
         for (auto it = views.begin(); it != views.end(); ++it)
-          it->second.view->commit(version);
+          it->view->commit(version);
 
         for (auto it = views.begin(); it != views.end(); ++it)
-          it->second.view->post_commit();
+          it->view->post_commit();
       }
 
       for (auto it = views.begin(); it != views.end(); ++it)
       {
-        if (it->second.view->has_writes())
-          it->second.map->unlock();
+        if (it->view->has_writes())
+          it->map->unlock();
       }
 
       if (!ok)
@@ -1199,7 +2267,7 @@ namespace kv
 
       for (auto it = view_list.begin(); it != view_list.end(); ++it)
       {
-        if (it->second.view->has_changes())
+        if (it->view->has_changes())
         {
           changes = true;
           break;
@@ -1211,7 +2279,7 @@ namespace kv
         return {};
       }
       // Retrieve encryptor.
-      auto map = view_list.begin()->second.map;
+      auto map = view_list.begin()->map;
       auto e = map->get_store()->get_encryptor();
 
       S replicated_serialiser(e, version);
@@ -1263,6 +2331,32 @@ namespace kv
       return {CommitSuccess::OK, {0, 0, 0}, std::move(serialise())};
     }
 
+    /** Read the state of the store at a past, globally committed version.
+     *
+     * The transaction is read-only. Maps which have not been compacted past
+     * version are read directly. Others are read from historical_store, which
+     * must hold the state of the store at version, rebuilt from the ledger
+     * (see ccf::historical::StateCache). Getting a view throws if neither
+     * holds the state of its map at version.
+     *
+     * @param version Version to read at
+     * @param historical_store Store rebuilt at version, if any
+     */
+    void set_read_version(
+      Version version,
+      std::shared_ptr<Store<S, D>> historical_store_ = nullptr)
+    {
+      if (read_version != NoVersion)
+      {
+        throw std::logic_error(
+          "Cannot set_read_version, read_version is already set");
+      }
+
+      read_version = version;
+      historical = true;
+      historical_store = historical_store_;
+    }
+
     // Set all reads on transaction to read at the global commit version,
     // rather than the local commit.
     void set_read_committed()
@@ -1279,79 +2373,713 @@ namespace kv
     }
   };
 
-  template <class S, class D>
-  class Store : public AbstractStore
+  /** Transactions which have been committed locally but not yet replicated,
+   * indexed by version.
+   *
+   * Versions are dense and arrive nearly in order, so each is kept in a ring
+   * slot at version % capacity. A version whose slot is still held by an
+   * earlier, unreplicated version is kept in a map until it is taken.
+   */
+  class PendingTxs
   {
   public:
-    template <class K, class V, class H = std::hash<K>>
-    using Map = Map<K, V, H, S, D>;
-    using Tx = Tx<S, D>;
+    using Entry = std::pair<PendingTx, bool>;
 
   private:
-    // All collections of Map must be ordered so that we lock their contained
-    // maps in a stable order. The order here is by map name
-    using Maps = std::map<std::string, std::unique_ptr<AbstractMap<S, D>>>;
-    Maps maps;
-
-    std::shared_ptr<Consensus> consensus = nullptr;
-    std::shared_ptr<TxHistory> history = nullptr;
-    std::shared_ptr<AbstractTxEncryptor> encryptor = nullptr;
-    Version version = 0;
-    Version compacted = 0;
+    static constexpr size_t capacity = 1024;
 
-    SpinLock maps_lock;
-    SpinLock version_lock;
+    struct Slot
+    {
+      Version version = NoVersion;
+      Entry entry;
+    };
 
-    std::unordered_map<Version, std::pair<PendingTx, bool>> pending_txs;
-    Version last_replicated = 0;
-    Version last_committable = 0;
-    Version rollback_count = 0;
-    kv::ReplicateType replicate_type = kv::ReplicateType::ALL;
-    std::unordered_set<std::string> replicated_tables;
+    std::vector<Slot> ring;
+    std::unordered_map<Version, Entry> overflow;
+    size_t count = 0;
 
-    template <typename SP, typename DP>
-    inline std::map<kv::SecurityDomain, std::vector<AbstractMap<SP, DP>*>>
-    get_maps_grouped_by_domain(
-      const std::map<std::string, std::unique_ptr<AbstractMap<SP, DP>>>& maps)
+  public:
+    void insert(Version version, Entry&& entry)
     {
-      std::map<kv::SecurityDomain, std::vector<AbstractMap<SP, DP>*>>
-        grouped_maps;
-      for (auto it = maps.begin(); it != maps.end(); ++it)
+      if (ring.empty())
+        ring.resize(capacity);
+
+      auto& slot = ring[version % capacity];
+      if (slot.version == version)
+        return;
+
+      if (slot.version == NoVersion)
       {
-        grouped_maps[it->second->get_security_domain()].push_back(
-          it->second.get());
+        slot.version = version;
+        slot.entry = std::move(entry);
+        ++count;
+      }
+      else if (overflow.emplace(version, std::move(entry)).second)
+      {
+        ++count;
       }
-      return grouped_maps;
     }
 
-    DeserialiseSuccess commit_deserialised(
-      OrderedViews<S, D>& views, Version& v)
+    /** Remove the entry at a version
+     *
+     * @param version Version to remove
+     *
+     * @return The removed entry, if there was one
+     */
+    std::optional<Entry> take(Version version)
     {
-      auto c = Tx::commit(views, [v]() { return v; });
-      if (!c.has_value())
+      if (count == 0)
+        return std::nullopt;
+
+      auto& slot = ring[version % capacity];
+      if (slot.version == version)
       {
-        LOG_FAIL_FMT("Failed to commit deserialised Tx at version {}", v);
-        return DeserialiseSuccess::FAILED;
+        std::optional<Entry> entry(std::move(slot.entry));
+        slot.version = NoVersion;
+        slot.entry.first = nullptr;
+        --count;
+        return entry;
       }
+
+      if (!overflow.empty())
       {
-        std::lock_guard<SpinLock> vguard(version_lock);
-        version = v;
-        last_replicated = version;
+        auto search = overflow.find(version);
+        if (search != overflow.end())
+        {
+          std::optional<Entry> entry(std::move(search->second));
+          overflow.erase(search);
+          --count;
+          return entry;
+        }
       }
-      return DeserialiseSuccess::PASS;
+
+      return std::nullopt;
     }
 
-  public:
-    void clone_schema(Store& target)
+    void clear()
     {
-      std::lock_guard<SpinLock> mguard(maps_lock);
+      if (count == 0)
+        return;
 
-      if ((maps.size() != 0) || (version != 0))
+      for (auto& slot : ring)
+      {
+        slot.version = NoVersion;
+        slot.entry.first = nullptr;
+      }
+      overflow.clear();
+      count = 0;
+    }
+  };
+
+  template <class S, class D>
+  class Store : public AbstractStore
+  {
+  public:
+    template <class K, class V, class H = std::hash<K>>
+    using Map = Map<K, V, H, S, D>;
+    template <class K, class V>
+    using OrderedMap = kv::OrderedMap<K, V, S, D>;
+    using Tx = Tx<S, D>;
+
+    /** A snapshot of all replicated maps at a globally committed version,
+     * with the history and view history needed to continue from it.
+     *
+     * Taking a snapshot only copies the persistent state of each map, so it
+     * can be serialised on any thread while the store keeps committing.
+     */
+    class Snapshot
+    {
+    public:
+      using MapSnapshots =
+        std::vector<std::unique_ptr<typename AbstractMap<S, D>::Snapshot>>;
+
+    private:
+      Version version;
+      MapSnapshots maps;
+      std::vector<uint8_t> tree;
+      std::vector<Version> view_history;
+      std::shared_ptr<AbstractTxEncryptor> encryptor;
+
+    public:
+      Snapshot(
+        Version version_,
+        MapSnapshots&& maps_,
+        std::vector<uint8_t>&& tree_,
+        std::vector<Version>&& view_history_,
+        std::shared_ptr<AbstractTxEncryptor> encryptor_) :
+        version(version_),
+        maps(std::move(maps_)),
+        tree(std::move(tree_)),
+        view_history(std::move(view_history_)),
+        encryptor(encryptor_)
+      {}
+
+      Version get_version() const
+      {
+        return version;
+      }
+
+      /** Serialise the snapshot as a single transaction at the snapshot's
+       * version. Its public domain starts with the view history and history
+       * tree, so that they are authenticated along with the maps.
+       *
+       * @return Serialised snapshot, to be passed to
+       * Store::deserialise_snapshot()
+       */
+      std::vector<uint8_t> serialise()
+      {
+        S s(encryptor, version);
+        s.serialise_snapshot_header(view_history, tree);
+        for (auto& map : maps)
+          map->serialise(s);
+        return s.get_raw_data();
+      }
+    };
+
+  private:
+    using MapSnapshot = std::pair<
+      AbstractMap<S, D>*,
+      std::unique_ptr<typename AbstractMap<S, D>::Snapshot>>;
+
+    // Maps are owned by this name-ordered collection. They are also indexed
+    // by their MapId, and that is the stable order in which they are locked
+    using Maps = std::map<std::string, std::unique_ptr<AbstractMap<S, D>>>;
+    Maps maps;
+    std::vector<AbstractMap<S, D>*> maps_by_id;
+
+    std::shared_ptr<Consensus> consensus = nullptr;
+    std::shared_ptr<TxHistory> history = nullptr;
+    std::shared_ptr<AbstractTxEncryptor> encryptor = nullptr;
+    Version version = 0;
+    Version compacted = 0;
+
+    SpinLock maps_lock;
+    SpinLock version_lock;
+
+    PendingTxs pending_txs;
+    Version last_replicated = 0;
+    Version last_committable = 0;
+    Version rollback_count = 0;
+    kv::ReplicateType replicate_type = kv::ReplicateType::ALL;
+    std::unordered_set<std::string> replicated_tables;
+
+    // Group commit. Committed transactions are pushed onto a lock-free stack
+    // by commit(), and moved to pending_txs and replicated by whichever
+    // thread holds flush_lock
+    struct QueuedTx
+    {
+      Version version;
+      PendingTx pending_tx;
+      bool globally_committable;
+      uint64_t enqueued_ms;
+      QueuedTx* next;
+    };
+    std::atomic<QueuedTx*> commit_queue = nullptr;
+    std::atomic<size_t> commit_queue_size = 0;
+    std::atomic<uint64_t> commit_queue_opened_ms = 0;
+    std::atomic<bool> flush_requested = false;
+    SpinLock flush_lock;
+
+    std::atomic<size_t> group_commit_max_batch_size = 1;
+    std::atomic<uint64_t> group_commit_max_delay_ms = 0;
+    GroupCommitMetrics group_commit_metrics;
+
+    // Runs asynchronous global hooks. If there is none, they are run as soon
+    // as they are dispatched
+    std::function<void(std::function<void()>&&)> global_hook_dispatcher =
+      nullptr;
+
+    // Shares out the deserialisation of large transactions between threads.
+    // If there is none, transactions are deserialised on the calling thread
+    std::function<void(size_t, std::function<void()>&&)>
+      parallel_deserialise_dispatcher = nullptr;
+    std::atomic<size_t> parallel_deserialise_min_size = 0;
+    // There is no trusted clock in the enclave, so time is only advanced by
+    // tick()
+    std::atomic<uint64_t> elapsed_ms = 0;
+
+    void discard_commit_queue()
+    {
+      auto queued = commit_queue.exchange(nullptr);
+      while (queued != nullptr)
+      {
+        auto next = queued->next;
+        delete queued;
+        --commit_queue_size;
+        queued = next;
+      }
+    }
+
+    template <typename SP, typename DP>
+    inline std::map<kv::SecurityDomain, std::vector<AbstractMap<SP, DP>*>>
+    get_maps_grouped_by_domain(
+      const std::map<std::string, std::unique_ptr<AbstractMap<SP, DP>>>& maps)
+    {
+      std::map<kv::SecurityDomain, std::vector<AbstractMap<SP, DP>*>>
+        grouped_maps;
+      for (auto it = maps.begin(); it != maps.end(); ++it)
+      {
+        grouped_maps[it->second->get_security_domain()].push_back(
+          it->second.get());
+      }
+      return grouped_maps;
+    }
+
+    struct DeferredView
+    {
+      AbstractTxView<S, D>* view;
+      typename D::MapSection section;
+    };
+
+    bool deserialise_deferred(
+      std::vector<DeferredView>& deferred, Version version)
+    {
+      if (deferred.empty())
+        return true;
+
+      // Largest maps first, so that the last maps to be claimed are small
+      std::sort(
+        deferred.begin(), deferred.end(), [](const auto& a, const auto& b) {
+          return a.section.entries > b.section.entries;
+        });
+
+      std::vector<char> ok(deferred.size(), false);
+      std::vector<std::function<void()>> tasks;
+      for (size_t i = 0; i < deferred.size(); ++i)
+      {
+        tasks.emplace_back([&deferred, &ok, i, version]() {
+          auto& [view, section] = deferred[i];
+          ok[i] = view->deserialise(*section.deserialiser, version);
+        });
+      }
+
+      auto shared = std::make_shared<ds::SharedTasks>(std::move(tasks));
+      if (shared->size() > 1)
+      {
+        parallel_deserialise_dispatcher(
+          shared->size() - 1, [shared]() { shared->help(); });
+      }
+      shared->run();
+
+      for (size_t i = 0; i < deferred.size(); ++i)
+      {
+        if (!ok[i])
+        {
+          LOG_FAIL_FMT(
+            "Could not deserialise Tx for map {} at version {}",
+            deferred[i].section.name,
+            version);
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    // A transaction which has been decrypted and deserialised into views,
+    // but not yet applied
+    struct DeserialisedTx
+    {
+      const uint8_t* data;
+      size_t size;
+      bool public_only;
+      Version version = NoVersion;
+      // Rollbacks of the store before the views were created. If the store
+      // is rolled back before the transaction is applied, it is deserialised
+      // again
+      Version rollback_count = 0;
+      OrderedViews<S, D> views = {};
+    };
+
+    // Deserialises a transaction into views, without modifying the store.
+    // Unless commit is set, the views are not given a committed version
+    bool deserialise_tx(DeserialisedTx& tx, bool commit)
+    {
+      {
+        std::lock_guard<SpinLock> vguard(version_lock);
+        tx.rollback_count = rollback_count;
+      }
+
+      auto e = get_encryptor();
+
+      // create the first deserialiser
+      auto d = std::make_unique<D>(
+        e,
+        tx.public_only ? kv::SecurityDomain::PUBLIC :
+                         std::optional<kv::SecurityDomain>());
+
+      if (!d->init(tx.data, tx.size))
+      {
+        LOG_FAIL_FMT("Initialisation of deserialise object failed");
+        return false;
+      }
+
+      const auto v = d->template deserialise_version<Version>();
+      tx.version = v;
+
+      // if we are not committing now then use NoVersion to deserialise
+      // otherwise the view will be considered as having a committed
+      // version
+      auto deserialise_version = (commit ? v : NoVersion);
+
+      // Large transactions are split into their maps first, and the maps are
+      // then deserialised in parallel. Views are allocated from the calling
+      // thread's arena if it has one, which other threads cannot use
+      const auto parallel = parallel_deserialise_dispatcher != nullptr &&
+        tx.size >= parallel_deserialise_min_size &&
+        ds::Arena::current() == nullptr;
+      std::vector<DeferredView> deferred;
+
+      while (true)
+      {
+        std::string map_name;
+        typename D::MapSection section;
+        if (parallel)
+        {
+          auto r = d->split_map();
+          if (!r.has_value())
+            break;
+          section = std::move(r.value());
+          map_name = section.name;
+        }
+        else
+        {
+          auto r = d->start_map();
+          if (!r.has_value())
+            break;
+          map_name = r.value();
+        }
+
+        // Deserialised transactions express read dependencies as versions,
+        // rather than with the actual value read. As a result, they don't
+        // need snapshot isolation on the map state, and so do not need to
+        // lock all the maps before creating the transaction.
+        AbstractTxView<S, D>* view;
+        {
+          std::lock_guard<SpinLock> mguard(maps_lock);
+          auto search = maps.find(map_name);
+          if (search == maps.end())
+          {
+            LOG_FAIL_FMT("No such map {} at version {}", map_name, v);
+            return false;
+          }
+
+          const auto map_id = search->second->get_id();
+          auto view_search = tx.views.find(map_id);
+          if (view_search != tx.views.end())
+          {
+            LOG_FAIL_FMT("Multiple writes on {} at version {}", map_name, v);
+            return false;
+          }
+
+          view = search->second->create_view(v);
+          tx.views.insert({map_id,
+                           search->second.get(),
+                           std::unique_ptr<AbstractTxView<S, D>>(view)});
+        }
+
+        if (parallel)
+        {
+          deferred.push_back({view, std::move(section)});
+        }
+        else if (!view->deserialise(*d, deserialise_version))
+        {
+          LOG_FAIL_FMT(
+            "Could not deserialise Tx for map {} at version {}",
+            map_name,
+            deserialise_version);
+          return false;
+        }
+      }
+
+      if (!d->end())
+      {
+        LOG_FAIL_FMT("Unexpected content in Tx at version {}", v);
+        return false;
+      }
+
+      return deserialise_deferred(deferred, deserialise_version);
+    }
+
+    DeserialiseSuccess apply_deserialised(
+      DeserialisedTx& deserialised, Term* term, Tx* tx)
+    {
+      auto commit = (tx == nullptr);
+      const auto v = deserialised.version;
+      auto& views = deserialised.views;
+
+      // Throw away any local commits that have not propagated via the
+      // consensus.
+      rollback(v - 1);
+
+      bool rolled_back;
+      {
+        std::lock_guard<SpinLock> vguard(version_lock);
+        rolled_back = rollback_count != deserialised.rollback_count;
+      }
+
+      if (rolled_back)
+      {
+        // The views may have been created from state that has since been
+        // rolled back
+        DeserialisedTx again{
+          deserialised.data, deserialised.size, deserialised.public_only};
+        if (!deserialise_tx(again, commit))
+          return DeserialiseSuccess::FAILED;
+
+        return apply_deserialised(again, term, tx);
+      }
+
+      // This will return FAILED if the serialised transaction is being
+      // applied out of order.
+      // Processing transactions locally and also deserialising to the
+      // same store will result in a store version mismatch and
+      // deserialisation will then fail.
+      auto cv = current_version();
+      if (cv != (v - 1))
+      {
+        LOG_FAIL_FMT(
+          "Tried to deserialise {} but current_version is {}", v, cv);
+        return DeserialiseSuccess::FAILED;
+      }
+
+      std::lock_guard<SpinLock> mguard(maps_lock);
+      auto success = DeserialiseSuccess::PASS;
+
+      if (commit)
+      {
+        success = commit_deserialised(views, deserialised.version);
+        if (success == DeserialiseSuccess::FAILED)
+        {
+          return success;
+        }
+        auto h = get_history();
+        if (h)
+        {
+          auto search = views.find("ccf.signatures");
+          if (search != views.end())
+          {
+            // Transactions containing a signature must only contain
+            // a signature and must be verified
+            if (views.size() > 1)
+            {
+              LOG_FAIL_FMT(
+                "Unexpected contents in signature transaction {}", v);
+              return DeserialiseSuccess::FAILED;
+            }
+
+            if (!h->verify(term))
+            {
+              LOG_FAIL_FMT("Signature in transaction {} failed to verify", v);
+              return DeserialiseSuccess::FAILED;
+            }
+            success = DeserialiseSuccess::PASS_SIGNATURE;
+          }
+
+          h->append(deserialised.data, deserialised.size);
+        }
+      }
+      else
+      {
+        // Transactions containing a pre prepare or a pbft request should not
+        // contain anything else
+        if (views.size() > 1)
+        {
+          LOG_FAIL_FMT("Unexpected contents in pbft transaction {}", v);
+          return DeserialiseSuccess::FAILED;
+        }
+
+        auto search = views.find("ccf.pbft.preprepares");
+        if (search != views.end())
+        {
+          success = DeserialiseSuccess::PASS_PRE_PREPARE;
+        }
+        else
+        {
+          auto search = views.find("ccf.pbft.requests");
+          if (search == views.end())
+          {
+            // we have deserialised an entry that didn't belong to the pbft
+            // requests nor the pbft pre prepares table
+            return DeserialiseSuccess::FAILED;
+          }
+        }
+      }
+
+      if (tx)
+      {
+        tx->set_view_list(views);
+      }
+
+      return success;
+    }
+
+    DeserialiseSuccess commit_deserialised(
+      OrderedViews<S, D>& views, Version& v)
+    {
+      auto c = Tx::commit(views, [v]() { return v; });
+      if (!c.has_value())
+      {
+        LOG_FAIL_FMT("Failed to commit deserialised Tx at version {}", v);
+        return DeserialiseSuccess::FAILED;
+      }
+      {
+        std::lock_guard<SpinLock> vguard(version_lock);
+        version = v;
+        last_replicated = version;
+      }
+      return DeserialiseSuccess::PASS;
+    }
+
+    bool replicate_queued(const std::shared_ptr<Consensus>& r)
+    {
+      std::unique_lock<SpinLock> vguard(version_lock);
+      auto now = elapsed_ms.load();
+
+      // Taken under version_lock so that a concurrent rollback cannot
+      // interleave with moving these into pending_txs
+      auto queued = commit_queue.exchange(nullptr);
+      while (queued != nullptr)
+      {
+        auto delay = now - std::min(now, queued->enqueued_ms);
+        group_commit_metrics.total_delay_ms += delay;
+        group_commit_metrics.max_delay_ms =
+          std::max(group_commit_metrics.max_delay_ms, delay);
+
+        add_pending(
+          queued->version,
+          std::move(queued->pending_tx),
+          queued->globally_committable);
+
+        auto next = queued->next;
+        delete queued;
+        --commit_queue_size;
+        queued = next;
+      }
+
+      return replicate_pending(r, std::move(vguard));
+    }
+
+    // Expects version_lock to be held
+    void add_pending(
+      Version version, PendingTx&& pending_tx, bool globally_committable)
+    {
+      if (globally_committable && version > last_committable)
+        last_committable = version;
+
+      pending_txs.insert(
+        version, {std::move(pending_tx), globally_committable});
+    }
+
+    // Replicates the pending transactions which are contiguous with those
+    // already replicated. Takes version_lock, held, and releases it before
+    // passing them to consensus
+    bool replicate_pending(
+      const std::shared_ptr<Consensus>& r, std::unique_lock<SpinLock> vguard)
+    {
+      BatchVector batch;
+      Version previous_last_replicated = 0;
+      Version next_last_replicated = 0;
+      Version previous_rollback_count = 0;
+
+      {
+        auto h = get_history();
+
+        for (Version offset = 1; true; ++offset)
+        {
+          auto pending = pending_txs.take(last_replicated + offset);
+          if (!pending.has_value())
+            break;
+
+          auto& [pending_tx_, committable_] = pending.value();
+          auto [success_, reqid, data_] = pending_tx_();
+          auto data_shared =
+            std::make_shared<std::vector<uint8_t>>(std::move(data_));
+
+          // NB: this cannot happen currently. Regular Tx only make it here if
+          // they did succeed, and signatures cannot conflict because they
+          // execute in order with a read_version that's version - 1, so even
+          // two contiguous signatures are fine
+          if (success_ != CommitSuccess::OK)
+            LOG_DEBUG_FMT("Failed Tx commit {}", last_replicated + offset);
+
+          if (h)
+          {
+            h->add_pending(reqid, last_replicated + offset, data_shared);
+          }
+
+          LOG_DEBUG_FMT(
+            "Batching {} ({})", last_replicated + offset, data_shared->size());
+          batch.emplace_back(
+            last_replicated + offset, data_shared, committable_);
+        }
+
+        if (batch.size() == 0)
+          return true;
+
+        group_commit_metrics.batches++;
+        group_commit_metrics.txs += batch.size();
+        group_commit_metrics.max_batch_size =
+          std::max(group_commit_metrics.max_batch_size, batch.size());
+
+        previous_rollback_count = rollback_count;
+        previous_last_replicated = last_replicated;
+        next_last_replicated = last_replicated + batch.size();
+        vguard.unlock();
+      }
+
+      if (r->replicate(batch))
+      {
+        vguard.lock();
+        if (
+          last_replicated == previous_last_replicated &&
+          previous_rollback_count == rollback_count)
+        {
+          last_replicated = next_last_replicated;
+        }
+        return true;
+      }
+      else
+      {
+        LOG_DEBUG_FMT("Failed to replicate");
+        return false;
+      }
+    }
+
+    // Replaces the state of each map with its snapshot, and makes the store
+    // globally committed at v. Expects maps_lock to be held
+    void apply_snapshots(Version v, std::vector<MapSnapshot>& snapshots)
+    {
+      for (auto map : maps_by_id)
+        map->lock();
+
+      for (auto& [map, snapshot] : snapshots)
+        map->apply_snapshot(v, std::move(snapshot));
+
+      for (auto map : maps_by_id)
+        map->unlock();
+
+      std::lock_guard<SpinLock> vguard(version_lock);
+      version = v;
+      compacted = v;
+      last_replicated = v;
+      last_committable = v;
+    }
+
+  public:
+    void clone_schema(Store& target)
+    {
+      std::lock_guard<SpinLock> mguard(maps_lock);
+
+      if ((maps.size() != 0) || (version != 0))
         throw std::logic_error("Cannot clone schema on a non-empty store");
 
+      maps_by_id.resize(target.maps_by_id.size());
       for (auto& [name, map] : target.maps)
       {
-        maps[name] = std::unique_ptr<AbstractMap<S, D>>(map->clone(this));
+        auto clone = map->clone(this);
+        maps[name] = std::unique_ptr<AbstractMap<S, D>>(clone);
+        maps_by_id[clone->get_id()] = clone;
       }
     }
 
@@ -1368,6 +3096,11 @@ namespace kv
 
     Store(const Store& that) = delete;
 
+    ~Store()
+    {
+      discard_commit_queue();
+    }
+
     std::shared_ptr<Consensus> get_consensus() override
     {
       return consensus;
@@ -1436,6 +3169,7 @@ namespace kv
      *
      * @param name Map name
      * @param global_hook Handler to execute on global commit
+     * @param indexes Secondary indexes, from `Map::make_index`
      *
      * @return Newly created Map
      */
@@ -1444,10 +3178,11 @@ namespace kv
       std::string name,
       SecurityDomain security_domain = kv::SecurityDomain::PRIVATE,
       typename Map<K, V, H>::CommitHook local_hook = nullptr,
-      typename Map<K, V, H>::CommitHook global_hook = nullptr)
+      typename Map<K, V, H>::CommitHook global_hook = nullptr,
+      typename Map<K, V, H>::Indexes indexes = {})
     {
       return create<Map<K, V, H>>(
-        name, security_domain, local_hook, global_hook);
+        name, security_domain, local_hook, global_hook, std::move(indexes));
     }
 
     /** Create a Map
@@ -1457,6 +3192,7 @@ namespace kv
      *
      * @param name Map name
      * @param global_hook Handler to execute on global commit
+     * @param indexes Secondary indexes, from `M::make_index`
      *
      * @return Newly created Map
      */
@@ -1465,7 +3201,8 @@ namespace kv
       std::string name,
       SecurityDomain security_domain = kv::SecurityDomain::PRIVATE,
       typename M::CommitHook local_hook = nullptr,
-      typename M::CommitHook global_hook = nullptr)
+      typename M::CommitHook global_hook = nullptr,
+      typename M::Indexes indexes = {})
     {
       std::lock_guard<SpinLock> mguard(maps_lock);
 
@@ -1485,9 +3222,18 @@ namespace kv
         }
       }
 
-      auto result =
-        new M(this, name, security_domain, replicated, local_hook, global_hook);
+      const auto id = static_cast<MapId>(maps_by_id.size());
+      auto result = new M(
+        this,
+        name,
+        id,
+        security_domain,
+        replicated,
+        local_hook,
+        global_hook,
+        std::move(indexes));
       maps[name] = std::unique_ptr<AbstractMap<S, D>>(result);
+      maps_by_id.push_back(result);
       return *result;
     }
 
@@ -1501,14 +3247,14 @@ namespace kv
       if (v > current_version())
         return;
 
-      for (auto& map : maps)
-        map.second->lock();
+      for (auto map : maps_by_id)
+        map->lock();
 
-      for (auto& map : maps)
-        map.second->compact(v);
+      for (auto map : maps_by_id)
+        map->compact(v);
 
-      for (auto& map : maps)
-        map.second->unlock();
+      for (auto map : maps_by_id)
+        map->unlock();
 
       {
         std::lock_guard<SpinLock> vguard(version_lock);
@@ -1523,8 +3269,8 @@ namespace kv
           e->compact(v);
       }
 
-      for (auto& map : maps)
-        map.second->post_compact();
+      for (auto map : maps_by_id)
+        map->post_compact();
     }
 
     void rollback(Version v) override
@@ -1540,14 +3286,14 @@ namespace kv
       if (v < commit_version())
         return;
 
-      for (auto& map : maps)
-        map.second->lock();
+      for (auto map : maps_by_id)
+        map->lock();
 
-      for (auto& map : maps)
-        map.second->rollback(v);
+      for (auto map : maps_by_id)
+        map->rollback(v);
 
-      for (auto& map : maps)
-        map.second->unlock();
+      for (auto map : maps_by_id)
+        map->unlock();
 
       std::lock_guard<SpinLock> vguard(version_lock);
       version = v;
@@ -1555,6 +3301,7 @@ namespace kv
       last_committable = v;
       rollback_count++;
       pending_txs.clear();
+      discard_commit_queue();
       auto h = get_history();
       if (h)
         h->rollback(v);
@@ -1563,177 +3310,293 @@ namespace kv
         e->rollback(v);
     }
 
-    DeserialiseSuccess deserialise_views(
+    DeserialiseSuccess deserialise_views(
+      const std::vector<uint8_t>& data,
+      bool public_only = false,
+      Term* term = nullptr,
+      Tx* tx = nullptr)
+    {
+      return deserialise_views(data.data(), data.size(), public_only, term, tx);
+    }
+
+    DeserialiseSuccess deserialise_views(
+      const uint8_t* data,
+      size_t size,
+      bool public_only = false,
+      Term* term = nullptr,
+      Tx* tx = nullptr)
+    {
+      // If we pass in a transaction we don't want to commit, just deserialise
+      // and put the views into that transaction.
+      // Tread carefully here: at the moment passing in a transaction assumes we
+      // are using pbft as the consensus and that we are deserialising for
+      // playback purposes
+      auto commit = (tx == nullptr);
+
+      DeserialisedTx deserialised{data, size, public_only};
+      if (!deserialise_tx(deserialised, commit))
+        return DeserialiseSuccess::FAILED;
+
+      return apply_deserialised(deserialised, term, tx);
+    }
+
+    /** Decrypt and deserialise a transaction, without applying it yet. This
+     * does not modify the store, so it may run on another thread while
+     * earlier transactions are being applied.
+     *
+     * @param data Serialised transaction, which must remain valid until it
+     * is applied
+     * @param size Size of the serialised transaction
+     * @param public_only Only apply the public domain
+     *
+     * @return Function which applies the transaction, and returns as
+     * deserialise() would. Transactions must be applied in order. If the
+     * transaction could not be deserialised ahead of time, for instance
+     * because it is encrypted with a key introduced by the transaction
+     * before it, it is deserialised again when applied
+     */
+    std::function<DeserialiseSuccess(Term*)> prepare_deserialise(
+      const uint8_t* data, size_t size, bool public_only = false)
+    {
+      auto deserialised = std::make_shared<DeserialisedTx>(
+        DeserialisedTx{data, size, public_only});
+
+      bool prepared = false;
+      try
+      {
+        prepared = deserialise_tx(*deserialised, true);
+      }
+      catch (const std::exception& e)
+      {
+        LOG_DEBUG_FMT("Could not deserialise Tx ahead of time: {}", e.what());
+      }
+
+      if (!prepared)
+      {
+        return [this, data, size, public_only](Term* term) {
+          return deserialise(data, size, public_only, term);
+        };
+      }
+
+      return [this, deserialised](Term* term) {
+        return apply_deserialised(*deserialised, term, nullptr);
+      };
+    }
+
+    /** Apply a serialised transaction, reading it in place. Nothing is
+     * retained from the input once this returns.
+     *
+     * @param data Serialised transaction
+     * @param size Size of the serialised transaction
+     * @param public_only Only apply the public domain
+     * @param term Set to the term of the signature, if this is a signature
+     *
+     * @return Whether the transaction was applied, and whether it was a
+     * signature
+     */
+    DeserialiseSuccess deserialise(
+      const uint8_t* data,
+      size_t size,
+      bool public_only = false,
+      Term* term = nullptr) override
+    {
+      return deserialise_views(data, size, public_only, term);
+    }
+
+    DeserialiseSuccess deserialise(
       const std::vector<uint8_t>& data,
       bool public_only = false,
-      Term* term = nullptr,
-      Tx* tx = nullptr)
+      Term* term = nullptr)
     {
-      // If we pass in a transaction we don't want to commit, just deserialise
-      // and put the views into that transaction.
-      // Tread carefully here: at the moment passing in a transaction assumes we
-      // are using pbft as the consensus and that we are deserialising for
-      // playback purposes
-      auto commit = (tx == nullptr);
-
-      // This will return FAILED if the serialised transaction is being
-      // applied out of order.
-      // Processing transactions locally and also deserialising to the
-      // same store will result in a store version mismatch and
-      // deserialisation will then fail.
-      auto e = get_encryptor();
+      return deserialise(data.data(), data.size(), public_only, term);
+    }
 
-      // create the first deserialiser
-      auto d = std::make_unique<D>(
-        e,
-        public_only ? kv::SecurityDomain::PUBLIC :
-                      std::optional<kv::SecurityDomain>());
+    /** Take a snapshot of all replicated maps at the last globally committed
+     * version.
+     *
+     * Maps are only locked one at a time, for as long as it takes to find
+     * their state at that version, so this does not block commits on other
+     * maps.
+     *
+     * @return Snapshot, or nullptr if nothing has been committed yet
+     */
+    std::unique_ptr<Snapshot> snapshot()
+    {
+      // Holding maps_lock prevents compaction, so the committed version cannot
+      // move while the maps are visited.
+      std::lock_guard<SpinLock> mguard(maps_lock);
 
-      if (!d->init(data.data(), data.size()))
+      Version v;
+      std::vector<uint8_t> tree;
       {
-        LOG_FAIL_FMT("Initialisation of deserialise object failed");
-        return DeserialiseSuccess::FAILED;
-      }
+        std::lock_guard<SpinLock> vguard(version_lock);
+        v = compacted;
+        if (v == 0)
+          return nullptr;
 
-      Version v = d->template deserialise_version<Version>();
-      // Throw away any local commits that have not propagated via the
-      // consensus.
-      rollback(v - 1);
+        auto h = get_history();
+        if (h)
+          tree = h->serialise_tree(v);
+      }
 
-      // Make sure this is the next transaction.
-      auto cv = current_version();
-      if (cv != (v - 1))
+      typename Snapshot::MapSnapshots snapshots;
+      for (auto& [name, map] : maps)
       {
-        LOG_FAIL_FMT(
-          "Tried to deserialise {} but current_version is {}", v, cv);
-        return DeserialiseSuccess::FAILED;
+        if (!map->is_replicated())
+          continue;
+
+        map->lock();
+        snapshots.push_back(map->snapshot(v));
+        map->unlock();
       }
 
-      // Deserialised transactions express read dependencies as versions,
-      // rather than with the actual value read. As a result, they don't
-      // need snapshot isolation on the map state, and so do not need to
-      // lock all the maps before creating the transaction.
+      std::vector<Version> view_history;
+      auto c = get_consensus();
+      if (c)
+        view_history = c->get_view_history(v);
+
+      return std::make_unique<Snapshot>(
+        v,
+        std::move(snapshots),
+        std::move(tree),
+        std::move(view_history),
+        get_encryptor());
+    }
+
+    /** Initialise an empty store with the state of the replicated maps of
+     * another store, at its last globally committed version.
+     *
+     * Map states are persistent, so their contents are shared with that store
+     * rather than copied, and neither store is affected by later changes to
+     * the other.
+     *
+     * @param that Store with the same schema
+     */
+    void clone_state(Store& that)
+    {
+      if (current_version() != 0)
+        throw std::logic_error("Cannot clone state into a non-empty store");
+
+      std::lock_guard<SpinLock> that_mguard(that.maps_lock);
       std::lock_guard<SpinLock> mguard(maps_lock);
-      OrderedViews<S, D> views;
 
-      for (auto r = d->start_map(); r.has_value(); r = d->start_map())
+      auto v = that.commit_version();
+      std::vector<MapSnapshot> snapshots;
+      for (auto& [name, map] : that.maps)
       {
-        const auto map_name = r.value();
+        if (!map->is_replicated())
+          continue;
 
-        auto search = maps.find(map_name);
+        auto search = maps.find(name);
         if (search == maps.end())
-        {
-          LOG_FAIL_FMT("No such map {} at version {}", map_name, v);
-          return DeserialiseSuccess::FAILED;
-        }
-
-        auto view_search = views.find(map_name);
-        if (view_search != views.end())
-        {
-          LOG_FAIL_FMT("Multiple writes on {} at version {}", map_name, v);
-          return DeserialiseSuccess::FAILED;
-        }
-
-        auto view = search->second->create_view(v);
-        // if we are not committing now then use NoVersion to deserialise
-        // otherwise the view will be considered as having a committed
-        // version
-        auto deserialise_version = (commit ? v : NoVersion);
-        if (!view->deserialise(*d, deserialise_version))
-        {
-          LOG_FAIL_FMT(
-            "Could not deserialise Tx for map {} at version {}",
-            map_name,
-            deserialise_version);
-          return DeserialiseSuccess::FAILED;
-        }
+          throw std::logic_error(fmt::format("No such map {}", name));
 
-        views[map_name] = {search->second.get(),
-                           std::unique_ptr<AbstractTxView<S, D>>(view)};
+        map->lock();
+        snapshots.emplace_back(search->second.get(), map->snapshot(v));
+        map->unlock();
       }
 
-      if (!d->end())
+      apply_snapshots(v, snapshots);
+    }
+
+    /** Initialise an empty store from a serialised snapshot.
+     *
+     * The store becomes globally committed at the snapshot's version, so that
+     * it can continue by deserialising the transactions that follow it.
+     *
+     * @param data Serialised snapshot
+     * @param size Size of the serialised snapshot
+     * @param view_history Set to the view history in the snapshot
+     * @param public_only Only apply the public domain
+     *
+     * @return FAILED if the store is not empty, or if the snapshot cannot be
+     * deserialised or its history cannot be verified. PASS otherwise
+     */
+    DeserialiseSuccess deserialise_snapshot(
+      const uint8_t* data,
+      size_t size,
+      std::vector<Version>* view_history = nullptr,
+      bool public_only = false)
+    {
+      if (current_version() != 0)
       {
-        LOG_FAIL_FMT("Unexpected content in Tx at version {}", v);
+        LOG_FAIL_FMT("Cannot apply a snapshot to a store that is not empty");
         return DeserialiseSuccess::FAILED;
       }
 
-      auto success = DeserialiseSuccess::PASS;
+      Version v;
+      std::vector<Version> views;
+      std::vector<uint8_t> tree;
 
-      if (commit)
+      try
       {
-        success = commit_deserialised(views, v);
-        if (success == DeserialiseSuccess::FAILED)
+        auto d = std::make_unique<D>(
+          get_encryptor(),
+          public_only ? kv::SecurityDomain::PUBLIC :
+                        std::optional<kv::SecurityDomain>());
+
+        if (!d->init(data, size))
         {
-          return success;
+          LOG_FAIL_FMT("Initialisation of snapshot deserialiser failed");
+          return DeserialiseSuccess::FAILED;
         }
-        auto h = get_history();
-        if (h)
+
+        v = d->template deserialise_version<Version>();
+        d->deserialise_snapshot_header(views, tree);
+
+        std::lock_guard<SpinLock> mguard(maps_lock);
+        std::vector<MapSnapshot> snapshots;
+
+        for (auto r = d->start_map(); r.has_value(); r = d->start_map())
         {
-          auto search = views.find("ccf.signatures");
-          if (search != views.end())
+          auto search = maps.find(r.value());
+          if (search == maps.end())
           {
-            // Transactions containing a signature must only contain
-            // a signature and must be verified
-            if (views.size() > 1)
-            {
-              LOG_FAIL_FMT(
-                "Unexpected contents in signature transaction {}", v);
-              return DeserialiseSuccess::FAILED;
-            }
-
-            if (!h->verify(term))
-            {
-              LOG_FAIL_FMT("Signature in transaction {} failed to verify", v);
-              return DeserialiseSuccess::FAILED;
-            }
-            success = DeserialiseSuccess::PASS_SIGNATURE;
+            LOG_FAIL_FMT("No such map {} in snapshot at {}", r.value(), v);
+            return DeserialiseSuccess::FAILED;
           }
 
-          h->append(data.data(), data.size());
+          snapshots.emplace_back(
+            search->second.get(), search->second->deserialise_snapshot(*d));
         }
-      }
-      else
-      {
-        // Transactions containing a pre prepare or a pbft request should not
-        // contain anything else
-        if (views.size() > 1)
+
+        if (!d->end())
         {
-          LOG_FAIL_FMT("Unexpected contents in pbft transaction {}", v);
+          LOG_FAIL_FMT("Unexpected content in snapshot at {}", v);
           return DeserialiseSuccess::FAILED;
         }
 
-        auto search = views.find("ccf.pbft.preprepares");
-        if (search != views.end())
-        {
-          success = DeserialiseSuccess::PASS_PRE_PREPARE;
-        }
-        else
-        {
-          auto search = views.find("ccf.pbft.requests");
-          if (search == views.end())
-          {
-            // we have deserialised an entry that didn't belong to the pbft
-            // requests nor the pbft pre prepares table
-            return DeserialiseSuccess::FAILED;
-          }
-        }
+        apply_snapshots(v, snapshots);
+      }
+      catch (const std::exception& e)
+      {
+        LOG_FAIL_FMT("Failed to deserialise snapshot: {}", e.what());
+        return DeserialiseSuccess::FAILED;
       }
 
-      if (tx)
+      // The history is verified against the signature in the snapshot, so
+      // this can only be done once the maps have been applied
+      auto h = get_history();
+      if (h && !h->deserialise_tree(tree, v))
       {
-        tx->set_view_list(views);
+        LOG_FAIL_FMT("Could not verify history of snapshot at {}", v);
+        clear();
+        return DeserialiseSuccess::FAILED;
       }
 
-      return success;
+      if (view_history)
+        *view_history = std::move(views);
+
+      return DeserialiseSuccess::PASS;
     }
 
-    DeserialiseSuccess deserialise(
+    DeserialiseSuccess deserialise_snapshot(
       const std::vector<uint8_t>& data,
-      bool public_only = false,
-      Term* term = nullptr) override
+      std::vector<Version>* view_history = nullptr,
+      bool public_only = false)
     {
-      return deserialise_views(data, public_only, term);
+      return deserialise_snapshot(
+        data.data(), data.size(), view_history, public_only);
     }
 
     bool operator==(const Store<S, D>& that) const
@@ -1791,77 +3654,191 @@ namespace kv
         version,
         (globally_committable ? " globally_committable" : ""));
 
-      BatchVector batch;
-      Version previous_last_replicated = 0;
-      Version next_last_replicated = 0;
-      Version previous_rollback_count = 0;
+      // Without batching, transactions are replicated by the thread which
+      // commits them, without being queued
+      if (group_commit_max_batch_size == 1 && commit_queue_size == 0)
+      {
+        std::unique_lock<SpinLock> vguard(version_lock);
+        add_pending(version, std::move(pending_tx), globally_committable);
+        return replicate_pending(r, std::move(vguard)) ?
+          CommitSuccess::OK :
+          CommitSuccess::NO_REPLICATE;
+      }
+
+      auto queued = new QueuedTx{version,
+                                 std::move(pending_tx),
+                                 globally_committable,
+                                 elapsed_ms.load(),
+                                 commit_queue.load()};
+      while (!commit_queue.compare_exchange_weak(queued->next, queued))
+        ;
+      if (queued->next == nullptr)
+        commit_queue_opened_ms = queued->enqueued_ms;
+
+      if (
+        ++commit_queue_size >= group_commit_max_batch_size ||
+        globally_committable)
+        return flush();
+
+      // The transaction is only queued. If its batch later fails to
+      // replicate, only the thread which flushes it is told.
+      return CommitSuccess::OK;
+    }
+
+    /** Replicate all queued transactions that are contiguous with those
+     * already replicated, as a single batch.
+     *
+     * Only one thread flushes at a time. If a flush is already in progress,
+     * this returns immediately and the flushing thread goes round again on
+     * its behalf.
+     *
+     * @return NO_REPLICATE if consensus refused a batch, OK otherwise
+     */
+    CommitSuccess flush()
+    {
+      auto r = get_consensus();
+      if (!r)
+        return CommitSuccess::OK;
 
+      auto result = CommitSuccess::OK;
+      flush_requested = true;
+
+      while (flush_requested)
       {
-        std::lock_guard<SpinLock> vguard(version_lock);
-        if (globally_committable && version > last_committable)
-          last_committable = version;
+        std::unique_lock<SpinLock> fguard(flush_lock, std::try_to_lock);
+        if (!fguard.owns_lock())
+          break;
 
-        pending_txs.insert(
-          {version,
-           std::make_pair(std::move(pending_tx), globally_committable)});
+        flush_requested = false;
+        if (!replicate_queued(r))
+          result = CommitSuccess::NO_REPLICATE;
+      }
 
-        auto h = get_history();
-        auto c = get_consensus();
+      return result;
+    }
 
-        for (Version offset = 1; true; ++offset)
-        {
-          auto search = pending_txs.find(last_replicated + offset);
-          if (search == pending_txs.end())
-            break;
+    /** Set how transactions are grouped before being replicated.
+     *
+     * @param config Batch size and delay thresholds
+     */
+    void set_group_commit(const GroupCommitConfig& config)
+    {
+      group_commit_max_batch_size = std::max<size_t>(config.max_batch_size, 1);
+      group_commit_max_delay_ms = config.max_delay.count();
+    }
 
-          auto& [pending_tx_, committable_] = search->second;
-          auto [success_, reqid, data_] = pending_tx_();
-          auto data_shared =
-            std::make_shared<std::vector<uint8_t>>(std::move(data_));
+    GroupCommitMetrics get_group_commit_metrics()
+    {
+      std::lock_guard<SpinLock> vguard(version_lock);
+      return group_commit_metrics;
+    }
 
-          // NB: this cannot happen currently. Regular Tx only make it here if
-          // they did succeed, and signatures cannot conflict because they
-          // execute in order with a read_version that's version - 1, so even
-          // two contiguous signatures are fine
-          if (success_ != CommitSuccess::OK)
-            LOG_DEBUG_FMT("Failed Tx commit {}", last_replicated + offset);
+    /** Set how asynchronous global hooks are run
+     *
+     * @param dispatcher Called from `compact()` with a function which runs
+     * the pending global hooks of a map. The dispatcher should run it on
+     * another thread, and may run several of them at once
+     */
+    void set_global_hook_dispatcher(
+      std::function<void(std::function<void()>&&)> dispatcher)
+    {
+      global_hook_dispatcher = dispatcher;
+    }
 
-          if (h)
-          {
-            h->add_pending(reqid, version, data_shared);
-          }
+    void dispatch_global_hooks(std::function<void()>&& run)
+    {
+      if (global_hook_dispatcher)
+        global_hook_dispatcher(std::move(run));
+      else
+        run();
+    }
 
-          LOG_DEBUG_FMT(
-            "Batching {} ({})", last_replicated + offset, data_shared->size());
-          batch.emplace_back(
-            last_replicated + offset, data_shared, committable_);
-          pending_txs.erase(search);
-        }
+    /** Set how large transactions are deserialised in parallel, one map per
+     * task
+     *
+     * @param dispatcher Called with a number of helpers, and a function for
+     * them to run. The dispatcher should run that function on up to that many
+     * other threads. Each call helps deserialise the current transaction, and
+     * returns once nothing is left to do, so helpers may run late or not at
+     * all
+     * @param min_size Serialised transactions smaller than this are
+     * deserialised on the calling thread
+     */
+    void set_parallel_deserialise(
+      std::function<void(size_t, std::function<void()>&&)> dispatcher,
+      size_t min_size = 64 * 1024)
+    {
+      parallel_deserialise_dispatcher = dispatcher;
+      parallel_deserialise_min_size = min_size;
+    }
 
-        if (batch.size() == 0)
-          return CommitSuccess::OK;
+    /** Queues of the maps with asynchronous global hooks
+     */
+    std::map<std::string, GlobalHookMetrics> get_global_hook_metrics()
+    {
+      std::map<std::string, GlobalHookMetrics> result;
+      std::lock_guard<SpinLock> mguard(maps_lock);
 
-        previous_rollback_count = rollback_count;
-        previous_last_replicated = last_replicated;
-        next_last_replicated = last_replicated + batch.size();
+      for (auto& [name, map] : maps)
+      {
+        auto metrics = map->get_global_hook_metrics();
+        if (metrics.has_value())
+          result.emplace(name, metrics.value());
       }
 
-      if (r->replicate(batch))
+      return result;
+    }
+
+    /** Memory used by each map
+     */
+    std::map<std::string, MemoryMetrics> get_memory_metrics()
+    {
+      // Maps are never removed from the store, and measuring them may take
+      // a while, so this does not hold maps_lock while doing so.
+      std::vector<std::pair<std::string, AbstractMap<S, D>*>> to_measure;
       {
-        std::lock_guard<SpinLock> vguard(version_lock);
-        if (
-          last_replicated == previous_last_replicated &&
-          previous_rollback_count == rollback_count)
-        {
-          last_replicated = next_last_replicated;
-        }
-        return CommitSuccess::OK;
+        std::lock_guard<SpinLock> mguard(maps_lock);
+        for (auto& [name, map] : maps)
+          to_measure.emplace_back(name, map.get());
       }
-      else
+
+      std::map<std::string, MemoryMetrics> result;
+      for (auto& [name, map] : to_measure)
+        result.emplace(name, map->get_memory_metrics());
+
+      return result;
+    }
+
+    /** Conflicts detected on each map, for maps which have had any
+     */
+    std::map<std::string, ConflictMetrics> get_conflict_metrics()
+    {
+      std::map<std::string, ConflictMetrics> result;
+      std::lock_guard<SpinLock> mguard(maps_lock);
+
+      for (auto& [name, map] : maps)
       {
-        LOG_DEBUG_FMT("Failed to replicate");
-        return CommitSuccess::NO_REPLICATE;
+        auto metrics = map->get_conflict_metrics();
+        if (metrics.early != 0 || metrics.at_commit != 0)
+          result.emplace(name, metrics);
       }
+
+      return result;
+    }
+
+    /** Advance the store's clock, flushing queued transactions if the oldest
+     * of them has waited for the configured delay.
+     *
+     * @param elapsed Time since the last tick
+     */
+    void tick(std::chrono::milliseconds elapsed)
+    {
+      auto now = elapsed_ms += elapsed.count();
+
+      if (
+        commit_queue_size > 0 &&
+        now - commit_queue_opened_ms >= group_commit_max_delay_ms)
+        flush();
     }
 
     Version next_version() override
@@ -1888,14 +3865,14 @@ namespace kv
       std::lock_guard<SpinLock> mguard(maps_lock);
 
       // This deletes the entire content of all maps in the store.
-      for (auto& map : maps)
-        map.second->lock();
+      for (auto map : maps_by_id)
+        map->lock();
 
-      for (auto& map : maps)
-        map.second->clear();
+      for (auto map : maps_by_id)
+        map->clear();
 
-      for (auto& map : maps)
-        map.second->unlock();
+      for (auto map : maps_by_id)
+        map->unlock();
 
       {
         std::lock_guard<SpinLock> vguard(version_lock);
@@ -1905,6 +3882,7 @@ namespace kv
         last_committable = 0;
         rollback_count = 0;
         pending_txs.clear();
+        discard_commit_queue();
       }
     }
 
@@ -1933,7 +3911,6 @@ namespace kv
       {
         if (map->get_security_domain() == SecurityDomain::PRIVATE)
         {
-          map->lock();
           entries.emplace_back(name, map.get(), nullptr);
         }
       }
@@ -1952,7 +3929,6 @@ namespace kv
               "Private map list mismatch during swap, " + std::get<0>(*entry) +
               " != " + name);
 
-          map->lock();
           std::get<2>(*entry) = map.get();
 
           ++entry;
@@ -1966,6 +3942,20 @@ namespace kv
           std::get<0>(*entry));
       }
 
+      // Maps in each store are locked in that store's MapId order, as they
+      // would be by a transaction committing over them.
+      for (auto map : maps_by_id)
+      {
+        if (map->get_security_domain() == SecurityDomain::PRIVATE)
+          map->lock();
+      }
+
+      for (auto map : store.maps_by_id)
+      {
+        if (map->get_security_domain() == SecurityDomain::PRIVATE)
+          map->lock();
+      }
+
       for (auto& [name, lhs, rhs] : entries)
       {
         lhs->swap(rhs);
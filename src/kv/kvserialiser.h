@@ -5,6 +5,14 @@
 
 #ifdef USE_NLJSON_KV_SERIALISER
 #  include "kv/nljsonserialise.h"
+#elif defined(USE_FLATBUFFERS_KV_SERIALISER)
+#  include "kv/flatbuffersserialise.h"
+
+namespace kv
+{
+  using KvStoreSerialiser = FlatbuffersKvStoreSerialiser;
+  using KvStoreDeserialiser = FlatbuffersKvStoreDeserialiser;
+}
 #else
 #  include "kv/msgpackserialise.h"
 #endif
@@ -11,6 +11,7 @@
 #include <functional>
 #include <limits>
 #include <memory>
+#include <string>
 #include <unordered_set>
 #include <vector>
 
@@ -25,6 +26,9 @@ namespace kv
   // TermHistory
   using Term = uint64_t;
   using NodeId = uint64_t;
+  // MapId densely indexes the maps of a Store, in order of creation. It is
+  // used to address a transaction's views without comparing map names
+  using MapId = uint32_t;
   static const Version NoVersion = std::numeric_limits<Version>::min();
 
   using BatchVector = std::vector<
@@ -37,6 +41,83 @@ namespace kv
     NO_REPLICATE
   };
 
+  // Committed transactions are queued, and replicated in batches once
+  // max_batch_size of them are queued or the oldest has waited max_delay.
+  // Globally committable transactions (signatures) are never held back. The
+  // default replicates every transaction as soon as it is committed.
+  //
+  // With batching, CommitSuccess::OK only means that a transaction has been
+  // queued, not that it has been replicated. If consensus then refuses the
+  // batch, NO_REPLICATE is returned to the thread which flushed it, and
+  // not to those whose transactions it carried. Their responses have
+  // already reported their versions, which are never replicated.
+  struct GroupCommitConfig
+  {
+    size_t max_batch_size = 1;
+    std::chrono::milliseconds max_delay = std::chrono::milliseconds(0);
+  };
+
+  struct GroupCommitMetrics
+  {
+    // Calls to Consensus::replicate, and the transactions they carried
+    size_t batches = 0;
+    size_t txs = 0;
+    size_t max_batch_size = 0;
+    // Time transactions spent queued before being flushed, as measured by
+    // the ticks the store has been given
+    uint64_t total_delay_ms = 0;
+    uint64_t max_delay_ms = 0;
+  };
+  DECLARE_JSON_TYPE(GroupCommitMetrics)
+  DECLARE_JSON_REQUIRED_FIELDS(
+    GroupCommitMetrics,
+    batches,
+    txs,
+    max_batch_size,
+    total_delay_ms,
+    max_delay_ms)
+
+  // Transactions on a map which were found to conflict during execution, with
+  // early conflict detection, and when they were committed
+  struct ConflictMetrics
+  {
+    size_t early = 0;
+    size_t at_commit = 0;
+    // Keys which currently conflict often enough to be given their own lane
+    size_t hot_keys = 0;
+  };
+  DECLARE_JSON_TYPE(ConflictMetrics)
+  DECLARE_JSON_REQUIRED_FIELDS(ConflictMetrics, early, at_commit, hot_keys)
+
+  struct GlobalHookMetrics
+  {
+    // Deltas waiting for an asynchronous global hook, and the most there have
+    // been at once
+    size_t queued = 0;
+    size_t max_queued = 0;
+    // Deltas passed to the hook, and the callbacks they were coalesced into
+    size_t deltas = 0;
+    size_t callbacks = 0;
+  };
+  DECLARE_JSON_TYPE(GlobalHookMetrics)
+  DECLARE_JSON_REQUIRED_FIELDS(
+    GlobalHookMetrics, queued, max_queued, deltas, callbacks)
+
+  // Memory used by the versions of a map which have not been compacted away.
+  // Nodes and entries shared between versions are counted once, and memory
+  // owned by keys and values is not included. Only maps kept in a champ::Map
+  // report their entries, nodes and bytes.
+  struct MemoryMetrics
+  {
+    size_t versions = 0;
+    // Entries in the latest version, including removed keys
+    size_t entries = 0;
+    size_t nodes = 0;
+    size_t bytes = 0;
+  };
+  DECLARE_JSON_TYPE(MemoryMetrics)
+  DECLARE_JSON_REQUIRED_FIELDS(MemoryMetrics, versions, entries, nodes, bytes)
+
   enum SecurityDomain
   {
     PUBLIC, // Public domains indicate the version and always appears, first
@@ -77,6 +158,22 @@ namespace kv
     }
   };
 
+  /** Thrown by a transaction view with early conflict detection, as soon as
+   * the transaction is certain to conflict at commit. The transaction should
+   * be reset with Tx::reset_conflicted() and executed again.
+   *
+   * A handler which catches and swallows this still cannot commit, since the
+   * same conflict is found when the transaction is prepared.
+   */
+  class EarlyConflict : public std::exception
+  {
+  public:
+    const char* what() const throw() override
+    {
+      return "Transaction read a value which has since been written";
+    }
+  };
+
   class Syncable
   {
   public:
@@ -150,6 +247,9 @@ namespace kv
     virtual crypto::Sha256Hash get_replicated_state_root() = 0;
     virtual std::vector<uint8_t> get_receipt(Version v) = 0;
     virtual bool verify_receipt(const std::vector<uint8_t>& receipt) = 0;
+    virtual std::vector<uint8_t> serialise_tree(Version v) = 0;
+    virtual bool deserialise_tree(
+      const std::vector<uint8_t>& tree, Version v) = 0;
   };
 
   class Consensus
@@ -213,6 +313,28 @@ namespace kv
       state = Primary;
     }
 
+    /** Start as a backup from a snapshot of the store at seqno, rather than
+     * from an empty ledger.
+     *
+     * @param seqno Version of the snapshot, which is globally committed
+     * @param view View in which seqno was committed
+     * @param view_history First SeqNo of each view up to view
+     */
+    virtual void init_as_backup(
+      SeqNo seqno, View view, const std::vector<SeqNo>& view_history)
+    {
+      state = Backup;
+    }
+
+    /** First SeqNo of each view, for all views that started at or before
+     * seqno. Recorded in snapshots so that a node starting from one knows
+     * the view of every transaction it does not have.
+     */
+    virtual std::vector<SeqNo> get_view_history(SeqNo seqno)
+    {
+      return {};
+    }
+
     virtual bool replicate(const BatchVector& entries) = 0;
     virtual View get_view() = 0;
 
@@ -232,6 +354,12 @@ namespace kv
     }
 
     virtual void periodic(std::chrono::milliseconds elapsed) {}
+
+    /** The host has durably stored the ledger up to seqno, after processing
+     * the given number of truncations of it
+     */
+    virtual void ledger_durable(SeqNo seqno, size_t truncations) {}
+
     virtual void enable_all_domains() {}
     virtual void resume_replication() {}
     virtual void suspend_replication(kv::Version) {}
@@ -298,22 +426,41 @@ namespace kv
   {
   public:
     virtual ~AbstractTxEncryptor() {}
+    // Writes get_header_length() bytes of header, and plain.n bytes of
+    // cipher, to memory owned by the caller
     virtual void encrypt(
-      const std::vector<uint8_t>& plain,
-      const std::vector<uint8_t>& additional_data,
-      std::vector<uint8_t>& serialised_header,
-      std::vector<uint8_t>& cipher,
+      CBuffer plain,
+      CBuffer additional_data,
+      uint8_t* serialised_header,
+      uint8_t* cipher,
       kv::Version version) = 0;
     virtual bool decrypt(
-      const std::vector<uint8_t>& cipher,
-      const std::vector<uint8_t>& additional_data,
-      const std::vector<uint8_t>& serialised_header,
+      CBuffer cipher,
+      CBuffer additional_data,
+      CBuffer serialised_header,
       std::vector<uint8_t>& plain,
       kv::Version version) = 0;
     virtual void set_view(Consensus::View view) = 0;
     virtual size_t get_header_length() = 0;
     virtual void update_encryption_key(
       Version version, const std::vector<uint8_t>& raw_ledger_key) = 0;
+
+    void encrypt(
+      const std::vector<uint8_t>& plain,
+      const std::vector<uint8_t>& additional_data,
+      std::vector<uint8_t>& serialised_header,
+      std::vector<uint8_t>& cipher,
+      kv::Version version)
+    {
+      serialised_header.resize(get_header_length());
+      cipher.resize(plain.size());
+      encrypt(
+        plain,
+        additional_data,
+        serialised_header.data(),
+        cipher.data(),
+        version);
+    }
   };
 
   class AbstractStore
@@ -327,7 +474,8 @@ namespace kv
     virtual std::shared_ptr<TxHistory> get_history() = 0;
     virtual std::shared_ptr<AbstractTxEncryptor> get_encryptor() = 0;
     virtual DeserialiseSuccess deserialise(
-      const std::vector<uint8_t>& data,
+      const uint8_t* data,
+      size_t size,
       bool public_only = false,
       Term* term = nullptr) = 0;
     virtual void compact(Version v) = 0;
@@ -345,6 +493,7 @@ namespace kv
     virtual bool has_writes() = 0;
     virtual bool has_changes() = 0;
     virtual bool prepare() = 0;
+    virtual std::optional<size_t> get_hot_conflict() = 0;
     virtual void commit(Version v) = 0;
     virtual void post_commit() = 0;
     virtual void serialise(S& s, bool include_reads) = 0;
@@ -362,6 +511,8 @@ namespace kv
     virtual bool operator==(const AbstractMap<S, D>& that) const = 0;
     virtual bool operator!=(const AbstractMap<S, D>& that) const = 0;
 
+    virtual const std::string& get_name() const = 0;
+    virtual MapId get_id() const = 0;
     virtual AbstractStore* get_store() = 0;
     virtual AbstractTxView<S, D>* create_view(Version version) = 0;
     virtual void compact(Version v) = 0;
@@ -372,6 +523,24 @@ namespace kv
     virtual SecurityDomain get_security_domain() = 0;
     virtual bool is_replicated() = 0;
     virtual void clear() = 0;
+    virtual ConflictMetrics get_conflict_metrics() = 0;
+    virtual std::optional<GlobalHookMetrics> get_global_hook_metrics() = 0;
+    virtual MemoryMetrics get_memory_metrics() = 0;
+
+    /** State of a map at a single version, which can be serialised without
+     * holding the map's lock.
+     */
+    class Snapshot
+    {
+    public:
+      virtual ~Snapshot() = default;
+      virtual void serialise(S& s) = 0;
+    };
+
+    virtual std::unique_ptr<Snapshot> snapshot(Version v) = 0;
+    virtual std::unique_ptr<Snapshot> deserialise_snapshot(D& d) = 0;
+    virtual void apply_snapshot(
+      Version v, std::unique_ptr<Snapshot> snapshot) = 0;
 
     virtual AbstractMap<S, D>* clone(AbstractStore* store) = 0;
     virtual void swap(AbstractMap<S, D>* map) = 0;
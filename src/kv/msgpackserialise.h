@@ -50,10 +50,10 @@ namespace kv
       return sb.size() == 0;
     }
 
-    std::vector<uint8_t> get_raw_data()
+    // Refers to the data appended so far, until the next append or clear
+    CBuffer get_raw_data()
     {
-      return {reinterpret_cast<uint8_t*>(sb.data()),
-              reinterpret_cast<uint8_t*>(sb.data()) + sb.size()};
+      return {reinterpret_cast<const uint8_t*>(sb.data()), sb.size()};
     }
   };
 
@@ -63,7 +63,30 @@ namespace kv
     const char* data_ptr;
     size_t data_offset;
     size_t data_size;
-    msgpack::object_handle msg;
+
+  private:
+    // Objects are unpacked into a zone owned by the calling thread, which is
+    // cleared rather than reallocated for each read. Strings and binaries are
+    // not copied into the zone, but refer to the input buffer, so that each
+    // key and value is copied once, straight into its final type
+    static msgpack::zone& unpack_zone()
+    {
+      thread_local msgpack::zone zone;
+      return zone;
+    }
+
+    static bool reference_in_place(msgpack::type::object_type, size_t, void*)
+    {
+      return true;
+    }
+
+    msgpack::object unpack(size_t& offset)
+    {
+      auto& zone = unpack_zone();
+      zone.clear();
+      return msgpack::unpack(
+        zone, data_ptr, data_size, offset, &reference_in_place);
+    }
 
   public:
     MsgPackReader(const MsgPackReader& other) = delete;
@@ -81,20 +104,91 @@ namespace kv
       data_size = data_in_size;
     }
 
+    /** Read only the items of another reader from offset begin to end,
+     * which must be item boundaries of that reader
+     */
+    void init_section(const MsgPackReader& parent, size_t begin, size_t end)
+    {
+      data_ptr = parent.data_ptr;
+      data_offset = begin;
+      data_size = end;
+    }
+
+    size_t get_offset() const
+    {
+      return data_offset;
+    }
+
     template <typename T>
     T read_next()
     {
-      msgpack::unpack(msg, data_ptr, data_size, data_offset);
-      return msg->as<T>();
+      return unpack(data_offset).as<T>();
     }
 
     template <typename T>
     T peek_next()
     {
-      auto before_offset = data_offset;
-      msgpack::unpack(msg, data_ptr, data_size, data_offset);
-      data_offset = before_offset;
-      return msg->as<T>();
+      auto offset = data_offset;
+      return unpack(offset).as<T>();
+    }
+
+    /** Move past the next object, reading only the headers of the objects
+     * in it
+     */
+    void skip_next()
+    {
+      auto read_length = [this](size_t bytes) {
+        if (data_offset + bytes > data_size)
+          throw msgpack::insufficient_bytes("insufficient bytes");
+
+        size_t length = 0;
+        for (size_t i = 0; i < bytes; ++i)
+        {
+          length <<= 8;
+          length |= static_cast<uint8_t>(data_ptr[data_offset++]);
+        }
+        return length;
+      };
+
+      // Objects left to skip, including the elements of arrays and maps
+      size_t pending = 1;
+      while (pending > 0)
+      {
+        pending--;
+        const auto type = static_cast<uint8_t>(read_length(1));
+
+        size_t payload = 0;
+        if (type == 0xc1)
+          throw msgpack::parse_error("invalid type 0xc1");
+        else if (type <= 0x7f || type >= 0xe0 || (type >= 0xc0 && type <= 0xc3))
+          payload = 0; // fixint, nil and bool
+        else if (type <= 0x8f)
+          pending += 2 * (type & 0x0f); // fixmap
+        else if (type <= 0x9f)
+          pending += type & 0x0f; // fixarray
+        else if (type <= 0xbf)
+          payload = type & 0x1f; // fixstr
+        else if (type <= 0xc6)
+          payload = read_length(1 << (type - 0xc4)); // bin 8, 16 and 32
+        else if (type <= 0xc9)
+          payload = read_length(1 << (type - 0xc7)) + 1; // ext 8, 16 and 32
+        else if (type <= 0xcb)
+          payload = type == 0xca ? 4 : 8; // float 32 and 64
+        else if (type <= 0xd3)
+          payload = 1 << ((type - 0xcc) % 4); // uint and int 8 to 64
+        else if (type <= 0xd8)
+          payload = (1 << (type - 0xd4)) + 1; // fixext 1 to 16
+        else if (type <= 0xdb)
+          payload = read_length(1 << (type - 0xd9)); // str 8, 16 and 32
+        else if (type <= 0xdd)
+          pending += read_length(type == 0xdc ? 2 : 4); // array 16 and 32
+        else
+          pending += 2 * read_length(type == 0xde ? 2 : 4); // map 16 and 32
+
+        if (data_offset + payload > data_size)
+          throw msgpack::insufficient_bytes("insufficient bytes");
+        data_offset += payload;
+      }
     }
 
     bool is_eos()
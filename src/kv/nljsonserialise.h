@@ -28,6 +28,7 @@ namespace kv
   {
   private:
     nlohmann::json arr;
+    std::vector<uint8_t> raw;
 
   public:
     template <typename T>
@@ -47,9 +48,11 @@ namespace kv
       return arr.empty();
     }
 
-    std::vector<uint8_t> get_raw_data()
+    // Refers to the data appended so far, until the next append or clear
+    CBuffer get_raw_data()
     {
-      return nlohmann::json::to_msgpack(arr);
+      raw = nlohmann::json::to_msgpack(arr);
+      return raw;
     }
   };
 
@@ -78,6 +81,25 @@ namespace kv
       }
     }
 
+    /** Read only the items of another reader from offset begin to end
+     */
+    void init_section(const JsonReader& parent, size_t begin, size_t end)
+    {
+      data_offset = 0;
+      arr = nlohmann::json(
+        parent.arr.begin() + begin, parent.arr.begin() + end);
+    }
+
+    size_t get_offset() const
+    {
+      return data_offset;
+    }
+
+    void skip_next()
+    {
+      ++data_offset;
+    }
+
     template <typename T>
     T read_next()
     {
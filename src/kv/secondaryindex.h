@@ -0,0 +1,167 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "ds/champmap.h"
+#include "kvtypes.h"
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace kv
+{
+  /** Persistent state of a secondary index over a map, at one version of the
+   * map.
+   *
+   * States are immutable, and are replaced on each commit which writes to the
+   * map, so each version retained by the map holds the index as it was at
+   * that version. Rollback and compaction then apply to indexes as they do to
+   * the map's own state.
+   */
+  template <class K, class V>
+  class AbstractIndex
+  {
+  public:
+    /** A change to the value of a key. Either value is nullptr if the key is
+     * absent on that side of the change.
+     */
+    struct Change
+    {
+      const K* key;
+      const V* before;
+      const V* after;
+    };
+
+    virtual ~AbstractIndex() = default;
+
+    virtual const std::string& get_name() const = 0;
+
+    /** Get the state of this index after the changes committed at a version
+     *
+     * @param changes Changes made to the map
+     * @param version Version at which the changes were committed
+     *
+     * @return New index state
+     */
+    virtual std::shared_ptr<const AbstractIndex> apply(
+      const std::vector<Change>& changes, Version version) const = 0;
+
+    /** Get an empty state of this index
+     *
+     * @return Index state with no entries
+     */
+    virtual std::shared_ptr<const AbstractIndex> empty() const = 0;
+  };
+
+  /** A secondary index, from an index key extracted from each value of a map
+   * to the keys which currently hold a value with that index key.
+   *
+   * Removed keys are kept as tombstones, as in the map itself. Each index key
+   * records the last version at which a key was added to or removed from it,
+   * so that transactions which read through the index can detect conflicting
+   * changes to its membership.
+   */
+  template <class K, class V, class H, class IK, class IH = std::hash<IK>>
+  class Index : public AbstractIndex<K, V>
+  {
+  public:
+    using Extractor = std::function<IK(const V&)>;
+    using Change = typename AbstractIndex<K, V>::Change;
+
+    struct Entry
+    {
+      Version version;
+      champ::Map<K, Version, H> keys;
+    };
+
+  private:
+    struct Definition
+    {
+      std::string name;
+      Extractor extract;
+    };
+
+    std::shared_ptr<const Definition> definition;
+    champ::Map<IK, Entry, IH> entries;
+
+    Index(
+      std::shared_ptr<const Definition> definition_,
+      champ::Map<IK, Entry, IH> entries_) :
+      definition(std::move(definition_)),
+      entries(std::move(entries_))
+    {}
+
+  public:
+    Index(std::string name, Extractor extract) :
+      definition(std::make_shared<const Definition>(
+        Definition{std::move(name), std::move(extract)}))
+    {}
+
+    const std::string& get_name() const override
+    {
+      return definition->name;
+    }
+
+    IK extract(const V& value) const
+    {
+      return definition->extract(value);
+    }
+
+    /** Get the keys whose values have an index key
+     *
+     * @param index_key Index key
+     *
+     * @return Pointer to the entry for the index key, nullptr if no key has
+     * ever had a value with it
+     */
+    const Entry* get(const IK& index_key) const
+    {
+      return entries.getp(index_key);
+    }
+
+    std::shared_ptr<const AbstractIndex<K, V>> apply(
+      const std::vector<Change>& changes, Version version) const override
+    {
+      auto next = entries.transient();
+
+      auto update = [&next, version](
+                      const IK& index_key, const K& key, bool add) {
+        auto entry = next.get(index_key).value_or(Entry{version, {}});
+        entry.version = version;
+        entry.keys = entry.keys.put(key, add ? version : -version);
+        next.put(index_key, entry);
+      };
+
+      for (const auto& change : changes)
+      {
+        std::optional<IK> before;
+        std::optional<IK> after;
+        if (change.before != nullptr)
+          before = extract(*change.before);
+        if (change.after != nullptr)
+          after = extract(*change.after);
+
+        // Values which keep their index key do not change the index
+        if (before.has_value() && after.has_value() && *before == *after)
+          continue;
+
+        if (before.has_value())
+          update(*before, *change.key, false);
+        if (after.has_value())
+          update(*after, *change.key, true);
+      }
+
+      return std::shared_ptr<const Index>(
+        new Index(definition, next.persistent()));
+    }
+
+    std::shared_ptr<const AbstractIndex<K, V>> empty() const override
+    {
+      return std::shared_ptr<const Index>(
+        new Index(definition, champ::Map<IK, Entry, IH>()));
+    }
+  };
+}
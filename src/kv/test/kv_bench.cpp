@@ -3,11 +3,16 @@
 #define PICOBENCH_IMPLEMENT_WITH_MAIN
 
 #include "consensus/test/stub_consensus.h"
+#include "kv/flatbuffersserialise.h"
 #include "kv/kv.h"
 #include "node/encryptor.h"
 
+#include <atomic>
+#include <cstdlib>
 #include <picobench/picobench.hpp>
+#include <set>
 #include <string>
+#include <thread>
 
 using namespace ccf;
 
@@ -16,6 +21,28 @@ inline void clobber_memory()
   asm volatile("" : : : "memory");
 }
 
+// Count heap allocations, so that benchmarks can report them
+static std::atomic<size_t> heap_allocations = 0;
+
+void* operator new(size_t size)
+{
+  ++heap_allocations;
+  auto p = malloc(size);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+
 // Helper functions to use a dummy encryption key
 std::shared_ptr<ccf::LedgerSecrets> create_ledger_secrets()
 {
@@ -28,19 +55,19 @@ std::shared_ptr<ccf::LedgerSecrets> create_ledger_secrets()
 }
 
 // Test functions
-template <kv::SecurityDomain SD>
+template <kv::SecurityDomain SD, typename KvStore = Store>
 static void serialise(picobench::state& s)
 {
   logger::config::level() = logger::INFO;
 
-  Store kv_store;
+  KvStore kv_store;
   auto secrets = create_ledger_secrets();
   auto encryptor = std::make_shared<ccf::RaftTxEncryptor>(1, secrets);
   kv_store.set_encryptor(encryptor);
 
-  auto& map0 = kv_store.create<std::string, std::string>("map0", SD);
-  auto& map1 = kv_store.create<std::string, std::string>("map1", SD);
-  Store::Tx tx;
+  auto& map0 = kv_store.template create<std::string, std::string>("map0", SD);
+  auto& map1 = kv_store.template create<std::string, std::string>("map1", SD);
+  typename KvStore::Tx tx;
   auto [tx0, tx1] = tx.get_view(map0, map1);
 
   for (int i = 0; i < s.iterations(); i++)
@@ -57,25 +84,25 @@ static void serialise(picobench::state& s)
   s.stop_timer();
 }
 
-template <kv::SecurityDomain SD>
+template <kv::SecurityDomain SD, typename KvStore = Store>
 static void deserialise(picobench::state& s)
 {
   logger::config::level() = logger::INFO;
 
   auto consensus = std::make_shared<kv::StubConsensus>();
-  Store kv_store(consensus);
-  Store kv_store2;
+  KvStore kv_store(consensus);
+  KvStore kv_store2;
 
   auto secrets = create_ledger_secrets();
   auto encryptor = std::make_shared<ccf::RaftTxEncryptor>(1, secrets);
   kv_store.set_encryptor(encryptor);
   kv_store2.set_encryptor(encryptor);
 
-  auto& map0 = kv_store.create<std::string, std::string>("map0", SD);
-  auto& map1 = kv_store.create<std::string, std::string>("map1", SD);
-  auto& map0_ = kv_store2.create<std::string, std::string>("map0", SD);
-  auto& map1_ = kv_store2.create<std::string, std::string>("map1", SD);
-  Store::Tx tx;
+  auto& map0 = kv_store.template create<std::string, std::string>("map0", SD);
+  auto& map1 = kv_store.template create<std::string, std::string>("map1", SD);
+  auto& map0_ = kv_store2.template create<std::string, std::string>("map0", SD);
+  auto& map1_ = kv_store2.template create<std::string, std::string>("map1", SD);
+  typename KvStore::Tx tx;
   auto [tx0, tx1] = tx.get_view(map0, map1);
 
   for (int i = 0; i < s.iterations(); i++)
@@ -94,6 +121,150 @@ static void deserialise(picobench::state& s)
   s.stop_timer();
 }
 
+// Measures a follower applying replicated transactions, each writing 8
+// values of 128 bytes (a little over 1KB serialised), so that ops/second
+// approximates follower apply throughput in KB/s
+template <kv::SecurityDomain SD, typename KvStore = Store>
+static void follower_apply(picobench::state& s)
+{
+  logger::config::level() = logger::INFO;
+
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  KvStore kv_store(consensus);
+  KvStore kv_store2;
+
+  auto secrets = create_ledger_secrets();
+  auto encryptor = std::make_shared<ccf::RaftTxEncryptor>(1, secrets);
+  kv_store.set_encryptor(encryptor);
+  kv_store2.set_encryptor(encryptor);
+
+  auto& map0 = kv_store.template create<std::string, std::string>("map0", SD);
+  kv_store2.template create<std::string, std::string>("map0", SD);
+
+  const std::string value(128, 'v');
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    typename KvStore::Tx tx;
+    auto tx0 = tx.get_view(map0);
+    for (int j = 0; j < 8; j++)
+      tx0->put("key" + std::to_string(i) + "-" + std::to_string(j), value);
+
+    auto rc = tx.commit();
+    if (rc != kv::CommitSuccess::OK)
+    {
+      throw std::logic_error(
+        "Transaction commit failed: " + std::to_string(rc));
+    }
+  }
+
+  std::vector<std::vector<uint8_t>> entries;
+  for (auto [data, ok] = consensus->pop_oldest_data(); ok;
+       std::tie(data, ok) = consensus->pop_oldest_data())
+    entries.push_back(std::move(data));
+
+  s.start_timer();
+  for (size_t i = 0; i < entries.size(); ++i)
+  {
+    auto rc = kv_store2.deserialise(entries[i].data(), entries[i].size());
+    if (rc != kv::DeserialiseSuccess::PASS)
+      throw std::logic_error(
+        "Transaction deserialisation failed: " + std::to_string(rc));
+
+    // Compact periodically, as global commit would
+    if (i % 100 == 0)
+      kv_store2.compact(kv_store2.current_version());
+  }
+  s.stop_timer();
+}
+
+// Measures a follower applying large transactions which each write 16384
+// keys of the private domain, spread evenly over M maps. If P, the maps of
+// each transaction are deserialised in parallel, with a helper thread per map
+template <size_t M, bool P>
+static void deserialise_maps_impl(picobench::state& s)
+{
+  logger::config::level() = logger::INFO;
+
+  constexpr size_t keys_per_tx = 16384;
+
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+  Store kv_store2;
+
+  auto secrets = create_ledger_secrets();
+  auto encryptor = std::make_shared<ccf::RaftTxEncryptor>(1, secrets);
+  kv_store.set_encryptor(encryptor);
+  kv_store2.set_encryptor(encryptor);
+
+  std::vector<Store::Map<std::string, std::string>*> maps;
+  for (size_t m = 0; m < M; ++m)
+    maps.push_back(
+      &kv_store.create<std::string, std::string>("map" + std::to_string(m)));
+  kv_store2.clone_schema(kv_store);
+
+  std::vector<std::thread> helpers;
+  if (P)
+  {
+    kv_store2.set_parallel_deserialise(
+      [&helpers](size_t count, std::function<void()>&& help) {
+        for (size_t i = 0; i < count; ++i)
+          helpers.emplace_back(help);
+      });
+  }
+
+  const std::string value(64, 'v');
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    Store::Tx tx;
+    for (size_t m = 0; m < M; ++m)
+    {
+      auto view = tx.get_view(*maps[m]);
+      for (size_t k = 0; k < keys_per_tx / M; ++k)
+        view->put("key" + std::to_string(k), value);
+    }
+
+    auto rc = tx.commit();
+    if (rc != kv::CommitSuccess::OK)
+    {
+      throw std::logic_error(
+        "Transaction commit failed: " + std::to_string(rc));
+    }
+  }
+
+  std::vector<std::vector<uint8_t>> entries;
+  for (auto [data, ok] = consensus->pop_oldest_data(); ok;
+       std::tie(data, ok) = consensus->pop_oldest_data())
+    entries.push_back(std::move(data));
+
+  s.start_timer();
+  for (auto& entry : entries)
+  {
+    auto rc = kv_store2.deserialise(entry);
+    if (rc != kv::DeserialiseSuccess::PASS)
+      throw std::logic_error(
+        "Transaction deserialisation failed: " + std::to_string(rc));
+
+    for (auto& helper : helpers)
+      helper.join();
+    helpers.clear();
+
+    kv_store2.compact(kv_store2.current_version());
+  }
+  s.stop_timer();
+}
+
+template <size_t M>
+static void deserialise_maps(picobench::state& s)
+{
+  deserialise_maps_impl<M, false>(s);
+}
+
+template <size_t M>
+static void deserialise_maps_parallel(picobench::state& s)
+{
+  deserialise_maps_impl<M, true>(s);
+}
+
 template <size_t S>
 static void commit_latency(picobench::state& s)
 {
@@ -104,8 +275,8 @@ static void commit_latency(picobench::state& s)
   auto encryptor = std::make_shared<ccf::RaftTxEncryptor>(1, secrets);
   kv_store.set_encryptor(encryptor);
 
-  auto& map0 = kv_store.create<std::string, std::string>("map0");
-  auto& map1 = kv_store.create<std::string, std::string>("map1");
+  auto& map0 = kv_store.template create<std::string, std::string>("map0");
+  auto& map1 = kv_store.template create<std::string, std::string>("map1");
 
   for (int i = 0; i < s.iterations(); i++)
   {
@@ -130,7 +301,316 @@ static void commit_latency(picobench::state& s)
   s.stop_timer();
 }
 
+// Measures commits from T threads at once, which reach Store::commit out of
+// version order and wait in pending_txs for their predecessors
+template <size_t T>
+static void commit_latency_threads(picobench::state& s)
+{
+  logger::config::level() = logger::INFO;
+
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+
+  std::vector<Store::Map<size_t, size_t>*> maps;
+  for (size_t i = 0; i < T; ++i)
+  {
+    maps.push_back(&kv_store.create<size_t, size_t>(
+      "map" + std::to_string(i), kv::SecurityDomain::PUBLIC));
+  }
+
+  const size_t iterations = s.iterations();
+
+  s.start_timer();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < T; ++t)
+  {
+    threads.emplace_back([&, t]() {
+      for (size_t i = t; i < iterations; i += T)
+      {
+        Store::Tx tx;
+        auto view = tx.get_view(*maps[t]);
+        view->put(i, i);
+
+        auto rc = tx.commit();
+        if (rc != kv::CommitSuccess::OK)
+        {
+          throw std::logic_error(
+            "Transaction commit failed: " + std::to_string(rc));
+        }
+      }
+    });
+  }
+
+  for (auto& thread : threads)
+    thread.join();
+  s.stop_timer();
+
+  if (consensus->number_of_replicas() != iterations)
+    throw std::logic_error("Not all transactions were replicated");
+}
+
+// Commits reserved versions in reverse order, W at a time, so that each
+// window is held in pending_txs until its first version arrives
+template <size_t W>
+static void commit_latency_reversed(picobench::state& s)
+{
+  logger::config::level() = logger::INFO;
+
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+  const size_t iterations = s.iterations();
+
+  s.start_timer();
+  for (size_t i = 0; i < iterations; i += W)
+  {
+    auto window = std::min(W, iterations - i);
+    auto first = kv_store.next_version();
+    for (size_t j = 1; j < window; ++j)
+      kv_store.next_version();
+
+    for (size_t j = window; j > 0; --j)
+    {
+      auto rc = kv_store.commit(
+        first + j - 1, kv::MovePendingTx(std::vector<uint8_t>(1), {}), false);
+      if (rc != kv::CommitSuccess::OK)
+      {
+        throw std::logic_error(
+          "Transaction commit failed: " + std::to_string(rc));
+      }
+    }
+  }
+  s.stop_timer();
+
+  if (consensus->number_of_replicas() != iterations)
+    throw std::logic_error("Not all transactions were replicated");
+}
+
+// Measures the fixed cost of creating views and committing small
+// transactions, in a store holding as many maps as a typical CCF network
+template <size_t S>
+static void tx_overhead(picobench::state& s)
+{
+  logger::config::level() = logger::INFO;
+
+  Store kv_store;
+  constexpr size_t map_count = 32;
+  std::vector<Store::Map<std::string, std::string>*> maps;
+  for (size_t i = 0; i < map_count; ++i)
+  {
+    maps.push_back(&kv_store.template create<std::string, std::string>(
+      "map" + std::to_string(i), kv::SecurityDomain::PUBLIC));
+  }
+
+  s.start_timer();
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    Store::Tx tx;
+    for (size_t iMap = 0; iMap < S; iMap++)
+    {
+      auto view = tx.get_view(*maps[(iMap * 5) % map_count]);
+      view->get("key");
+      view->put("key", "value");
+    }
+
+    auto rc = tx.commit();
+    if (rc != kv::CommitSuccess::OK)
+    {
+      throw std::logic_error(
+        "Transaction commit failed: " + std::to_string(rc));
+    }
+
+    // Compact periodically, as global commit would, so that the cost does
+    // not depend on the number of retained states
+    if (i % 100 == 0)
+      kv_store.compact(kv_store.current_version());
+  }
+  s.stop_timer();
+}
+
+// Commits transactions which read R keys and write one. If Moved, another
+// transaction writes to the map first, so every read must be validated
+// Executes transactions like tx_overhead, each with its own arena scope as
+// in RpcFrontend::process if A, and reports the heap allocations per
+// transaction
+template <bool A>
+static void tx_allocations(picobench::state& s)
+{
+  logger::config::level() = logger::INFO;
+
+  Store kv_store;
+  constexpr size_t map_count = 4;
+  std::vector<Store::Map<std::string, std::string>*> maps;
+  for (size_t i = 0; i < map_count; ++i)
+  {
+    maps.push_back(&kv_store.template create<std::string, std::string>(
+      "map" + std::to_string(i), kv::SecurityDomain::PUBLIC));
+  }
+
+  const auto arena_before = ds::Arena::thread_stats();
+  const size_t allocations_before = heap_allocations;
+
+  s.start_timer();
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    std::optional<ds::ArenaScope> scope;
+    if constexpr (A)
+      scope.emplace();
+
+    Store::Tx tx;
+    for (size_t iMap = 0; iMap < map_count; iMap++)
+    {
+      auto view = tx.get_view(*maps[iMap]);
+      for (size_t k = 0; k < 8; ++k)
+        view->get("key" + std::to_string(k));
+      view->put("key", "value");
+    }
+
+    auto rc = tx.commit();
+    if (rc != kv::CommitSuccess::OK)
+    {
+      throw std::logic_error(
+        "Transaction commit failed: " + std::to_string(rc));
+    }
+
+    if (i % 100 == 0)
+      kv_store.compact(kv_store.current_version());
+  }
+  s.stop_timer();
+
+  // Report once for each number of iterations, rather than for every sample
+  static std::set<int> reported;
+  if (!reported.insert(s.iterations()).second)
+    return;
+
+  const auto arena_after = ds::Arena::thread_stats();
+  LOG_INFO_FMT(
+    "tx_allocations<{}>: {:.1f} heap allocations per tx, {:.1f} arena "
+    "allocations per tx, {} arena chunks",
+    A,
+    (double)(heap_allocations - allocations_before) / s.iterations(),
+    (double)(arena_after.allocations - arena_before.allocations) /
+      s.iterations(),
+    arena_after.chunks - arena_before.chunks);
+}
+
+// Commits transactions which read and write K keys of a single map, to
+// measure the cost of read and write sets as they grow
+template <size_t K>
+static void tx_keys(picobench::state& s)
+{
+  logger::config::level() = logger::INFO;
+
+  Store kv_store;
+  auto& map =
+    kv_store.create<size_t, size_t>("map", kv::SecurityDomain::PUBLIC);
+
+  s.start_timer();
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    for (size_t k = 0; k < K; ++k)
+    {
+      view->get(k);
+      view->put(k, i);
+    }
+
+    auto rc = tx.commit();
+    if (rc != kv::CommitSuccess::OK)
+    {
+      throw std::logic_error(
+        "Transaction commit failed: " + std::to_string(rc));
+    }
+
+    if (i % 100 == 0)
+      kv_store.compact(kv_store.current_version());
+  }
+  s.stop_timer();
+}
+
+template <size_t R, bool Moved>
+static void read_validation_impl(picobench::state& s)
+{
+  logger::config::level() = logger::INFO;
+
+  Store kv_store;
+  auto& map = kv_store.create<std::string, std::string>(
+    "map", kv::SecurityDomain::PUBLIC);
+
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    for (size_t i = 0; i < R; ++i)
+      view->put("key" + std::to_string(i), "value");
+    tx.commit();
+  }
+
+  s.start_timer();
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    for (size_t j = 0; j < R; ++j)
+      view->get("key" + std::to_string(j));
+    view->put("written", "value");
+
+    if constexpr (Moved)
+    {
+      Store::Tx tx2;
+      auto view2 = tx2.get_view(map);
+      view2->put("other", "value");
+      tx2.commit();
+    }
+
+    auto rc = tx.commit();
+    if (rc != kv::CommitSuccess::OK)
+    {
+      throw std::logic_error(
+        "Transaction commit failed: " + std::to_string(rc));
+    }
+
+    if (i % 100 == 0)
+      kv_store.compact(kv_store.current_version());
+  }
+  s.stop_timer();
+}
+
+template <size_t R>
+static void read_validation(picobench::state& s)
+{
+  read_validation_impl<R, false>(s);
+}
+
+template <size_t R>
+static void read_validation_moved(picobench::state& s)
+{
+  read_validation_impl<R, true>(s);
+}
+
+using FlatbuffersStore = kv::Store<
+  kv::FlatbuffersKvStoreSerialiser,
+  kv::FlatbuffersKvStoreDeserialiser>;
+
+template <kv::SecurityDomain SD>
+static void serialise_flatbuffers(picobench::state& s)
+{
+  serialise<SD, FlatbuffersStore>(s);
+}
+
+template <kv::SecurityDomain SD>
+static void deserialise_flatbuffers(picobench::state& s)
+{
+  deserialise<SD, FlatbuffersStore>(s);
+}
+
+template <kv::SecurityDomain SD>
+static void follower_apply_flatbuffers(picobench::state& s)
+{
+  follower_apply<SD, FlatbuffersStore>(s);
+}
+
 const std::vector<int> tx_count = {10, 100, 1000};
+const std::vector<int> large_tx_count = {1, 10};
 const uint32_t sample_size = 100;
 
 using SD = kv::SecurityDomain;
@@ -138,6 +618,33 @@ using SD = kv::SecurityDomain;
 PICOBENCH_SUITE("commit_latency");
 PICOBENCH(commit_latency<10>).iterations(tx_count).samples(10).baseline();
 PICOBENCH(commit_latency<100>).iterations(tx_count).samples(10);
+PICOBENCH(commit_latency_threads<1>).iterations(tx_count).samples(10);
+PICOBENCH(commit_latency_threads<4>).iterations(tx_count).samples(10);
+PICOBENCH(commit_latency_reversed<8>).iterations(tx_count).samples(10);
+PICOBENCH(commit_latency_reversed<256>).iterations(tx_count).samples(10);
+
+PICOBENCH_SUITE("tx_overhead");
+PICOBENCH(tx_overhead<1>).iterations(tx_count).samples(10).baseline();
+PICOBENCH(tx_overhead<4>).iterations(tx_count).samples(10);
+PICOBENCH(tx_overhead<16>).iterations(tx_count).samples(10);
+
+PICOBENCH_SUITE("tx_allocations");
+PICOBENCH(tx_allocations<false>).iterations(tx_count).samples(10).baseline();
+PICOBENCH(tx_allocations<true>).iterations(tx_count).samples(10);
+
+PICOBENCH_SUITE("tx_keys");
+PICOBENCH(tx_keys<1>).iterations(tx_count).samples(10).baseline();
+PICOBENCH(tx_keys<2>).iterations(tx_count).samples(10);
+PICOBENCH(tx_keys<4>).iterations(tx_count).samples(10);
+PICOBENCH(tx_keys<8>).iterations(tx_count).samples(10);
+PICOBENCH(tx_keys<16>).iterations(tx_count).samples(10);
+PICOBENCH(tx_keys<64>).iterations(tx_count).samples(10);
+
+PICOBENCH_SUITE("read_validation");
+PICOBENCH(read_validation<10>).iterations(tx_count).samples(10).baseline();
+PICOBENCH(read_validation_moved<10>).iterations(tx_count).samples(10);
+PICOBENCH(read_validation<1000>).iterations(tx_count).samples(10);
+PICOBENCH(read_validation_moved<1000>).iterations(tx_count).samples(10);
 
 PICOBENCH_SUITE("serialise");
 PICOBENCH(serialise<SD::PUBLIC>)
@@ -145,6 +652,12 @@ PICOBENCH(serialise<SD::PUBLIC>)
   .samples(sample_size)
   .baseline();
 PICOBENCH(serialise<SD::PRIVATE>).iterations(tx_count).samples(sample_size);
+PICOBENCH(serialise_flatbuffers<SD::PUBLIC>)
+  .iterations(tx_count)
+  .samples(sample_size);
+PICOBENCH(serialise_flatbuffers<SD::PRIVATE>)
+  .iterations(tx_count)
+  .samples(sample_size);
 
 PICOBENCH_SUITE("deserialise");
 PICOBENCH(deserialise<SD::PUBLIC>)
@@ -152,3 +665,33 @@ PICOBENCH(deserialise<SD::PUBLIC>)
   .samples(sample_size)
   .baseline();
 PICOBENCH(deserialise<SD::PRIVATE>).iterations(tx_count).samples(sample_size);
+PICOBENCH(deserialise_flatbuffers<SD::PUBLIC>)
+  .iterations(tx_count)
+  .samples(sample_size);
+PICOBENCH(deserialise_flatbuffers<SD::PRIVATE>)
+  .iterations(tx_count)
+  .samples(sample_size);
+
+PICOBENCH_SUITE("deserialise_maps");
+PICOBENCH(deserialise_maps<1>)
+  .iterations(large_tx_count)
+  .samples(10)
+  .baseline();
+PICOBENCH(deserialise_maps_parallel<1>).iterations(large_tx_count).samples(10);
+PICOBENCH(deserialise_maps<4>).iterations(large_tx_count).samples(10);
+PICOBENCH(deserialise_maps_parallel<4>).iterations(large_tx_count).samples(10);
+PICOBENCH(deserialise_maps<8>).iterations(large_tx_count).samples(10);
+PICOBENCH(deserialise_maps_parallel<8>).iterations(large_tx_count).samples(10);
+
+PICOBENCH_SUITE("follower_apply");
+PICOBENCH(follower_apply<SD::PUBLIC>)
+  .iterations(tx_count)
+  .samples(sample_size)
+  .baseline();
+PICOBENCH(follower_apply<SD::PRIVATE>).iterations(tx_count).samples(sample_size);
+PICOBENCH(follower_apply_flatbuffers<SD::PUBLIC>)
+  .iterations(tx_count)
+  .samples(sample_size);
+PICOBENCH(follower_apply_flatbuffers<SD::PRIVATE>)
+  .iterations(tx_count)
+  .samples(sample_size);
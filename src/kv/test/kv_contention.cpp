@@ -3,6 +3,7 @@
 #include "../kv.h"
 #include "../kvserialiser.h"
 #include "ds/logger.h"
+#include "ds/thread_messaging.h"
 #include "enclave/appinterface.h"
 
 #define DOCTEST_CONFIG_NO_SHORT_MACRO_NAMES
@@ -10,12 +11,16 @@
 #include <atomic>
 #include <chrono>
 #include <doctest/doctest.h>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
 using namespace ccf;
 
+enclave::ThreadMessaging enclave::ThreadMessaging::thread_messaging;
+std::atomic<uint16_t> enclave::ThreadMessaging::thread_count = 0;
+
 DOCTEST_TEST_CASE("Concurrent kv access" * doctest::test_suite("concurrency"))
 {
   logger::config::level() = logger::INFO;
@@ -203,3 +208,168 @@ DOCTEST_TEST_CASE("Concurrent kv access" * doctest::test_suite("concurrency"))
     compact_thread.join();
   }
 }
+
+struct RetryMsg
+{
+  std::function<void()> run;
+};
+
+static void retry_cb(std::unique_ptr<enclave::Tmsg<RetryMsg>> msg)
+{
+  msg->data.run();
+}
+
+DOCTEST_TEST_CASE("Hot key contention" * doctest::test_suite("concurrency"))
+{
+  logger::config::level() = logger::INFO;
+
+  // Threads transfer between accounts, and most transfers involve one of a
+  // few hot accounts, as in SmallBank. Transactions which conflict are
+  // retried, either straight away or, with lanes, as they are by the RPC
+  // frontend: as tasks on the worker thread which runs the lane of the key
+  // they conflicted on, once that key is known to be hot. As in the enclave,
+  // worker threads are numbered from 1, and run the tasks posted to them
+  // between their own transactions
+  using MapType = Store::Map<size_t, int64_t>;
+  constexpr size_t account_count = 1000;
+  constexpr size_t hot_account_count = 2;
+  constexpr int64_t initial_balance = 1000;
+
+  constexpr uint16_t worker_count = 8;
+  constexpr size_t tx_count = 500;
+
+  enclave::ThreadMessaging::thread_count = worker_count + 1;
+
+  struct Results
+  {
+    size_t commits = 0;
+    size_t conflicts = 0;
+    std::chrono::microseconds elapsed;
+  };
+
+  auto run = [&](bool use_lanes) {
+    Store kv_store;
+    auto& accounts =
+      kv_store.create<MapType>("accounts", kv::SecurityDomain::PUBLIC);
+    enclave::ThreadMessaging workers(worker_count + 1);
+
+    {
+      Store::Tx tx;
+      auto view = tx.get_view(accounts);
+      for (size_t i = 0; i < account_count; ++i)
+        view->put(i, initial_balance);
+      DOCTEST_REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    }
+
+    std::atomic<size_t> commits = 0;
+    std::atomic<size_t> conflicts = 0;
+
+    // Returns the key the transfer conflicted on, if it should be retried
+    // in the lane for that key
+    auto transfer =
+      [&](size_t from, size_t to, bool defer) -> std::optional<size_t> {
+      Store::Tx tx;
+      while (true)
+      {
+        auto view = tx.get_view(accounts);
+        const auto from_balance = view->get(from).value();
+        const auto to_balance = view->get(to).value();
+
+        // Yield now, to increase the chance of conflicts
+        std::this_thread::yield();
+
+        view->put(from, from_balance - 1);
+        view->put(to, to_balance + 1);
+
+        if (tx.commit() == kv::CommitSuccess::OK)
+        {
+          ++commits;
+          return std::nullopt;
+        }
+
+        ++conflicts;
+        auto hot_conflict = tx.get_hot_conflict();
+        if (defer && hot_conflict.has_value())
+          return hot_conflict;
+      }
+    };
+
+    auto worker_fn = [&](uint16_t tid) {
+      auto& task = workers.get_task(tid);
+      const size_t seed = tid - 1;
+
+      for (size_t i = 0; i < tx_count; ++i)
+      {
+        workers.run_one(task);
+
+        const size_t from = (seed + i) % hot_account_count;
+        const size_t to = hot_account_count +
+          (seed * tx_count + i) % (account_count - hot_account_count);
+
+        auto hot_conflict = transfer(from, to, use_lanes);
+        if (hot_conflict.has_value())
+        {
+          auto msg = std::make_unique<enclave::Tmsg<RetryMsg>>(&retry_cb);
+          msg->data.run = [&transfer, from, to]() {
+            transfer(from, to, false);
+          };
+          workers.add_task<RetryMsg>(
+            enclave::ThreadMessaging::get_lane_thread(hot_conflict.value()),
+            std::move(msg));
+        }
+      }
+
+      // Run the retries still posted to this thread, until every transfer
+      // has committed
+      while (commits < worker_count * tx_count)
+      {
+        if (!workers.run_one(task))
+          std::this_thread::yield();
+      }
+    };
+
+    const auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (uint16_t tid = 1; tid <= worker_count; ++tid)
+      threads.emplace_back(worker_fn, tid);
+    for (auto& t : threads)
+      t.join();
+    const auto end = std::chrono::high_resolution_clock::now();
+
+    // Every transfer happened exactly once, and no money was lost
+    int64_t total = 0;
+    {
+      Store::Tx tx;
+      auto view = tx.get_view(accounts);
+      for (size_t i = 0; i < account_count; ++i)
+        total += view->get(i).value();
+    }
+    DOCTEST_REQUIRE(total == initial_balance * (int64_t)account_count);
+    DOCTEST_REQUIRE(commits == worker_count * tx_count);
+
+    auto metrics = kv_store.get_conflict_metrics();
+    DOCTEST_REQUIRE(metrics["accounts"].at_commit == conflicts);
+
+    return Results{
+      commits,
+      conflicts,
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)};
+  };
+
+  for (auto use_lanes : {false, true})
+  {
+    const auto results = run(use_lanes);
+    const auto attempts = results.commits + results.conflicts;
+    LOG_INFO_FMT(
+      "{}: {} commits in {}us ({:.0f} tx/s), {} conflicts ({:.1f}% of "
+      "attempts)",
+      use_lanes ? "With lanes" : "Without lanes",
+      results.commits,
+      results.elapsed.count(),
+      results.commits * 1e6 / std::max<int64_t>(results.elapsed.count(), 1),
+      results.conflicts,
+      100.0 * results.conflicts / attempts);
+  }
+
+  enclave::ThreadMessaging::thread_count = 0;
+}
@@ -3,6 +3,7 @@
 #include "consensus/test/stub_consensus.h"
 #include "ds/logger.h"
 #include "enclave/appinterface.h"
+#include "kv/flatbuffersserialise.h"
 #include "kv/kv.h"
 #include "kv/kvserialiser.h"
 #include "node/encryptor.h"
@@ -10,6 +11,7 @@
 #include <doctest/doctest.h>
 #include <msgpack/msgpack.hpp>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace ccf;
@@ -358,6 +360,60 @@ TEST_CASE("Integrity" * doctest::test_suite("serialisation"))
       kv_store_target.deserialise(serialised_tx) ==
       kv::DeserialiseSuccess::FAILED);
   }
+
+  SUBCASE("Snapshot view history")
+  {
+    struct ViewHistoryConsensus : public kv::StubConsensus
+    {
+      std::vector<kv::Version> get_view_history(kv::Version) override
+      {
+        return {1, 0x4242424242};
+      }
+    };
+    auto consensus = std::make_shared<ViewHistoryConsensus>();
+
+    auto secrets = std::make_shared<ccf::LedgerSecrets>();
+    secrets->set_secret(1, std::vector<uint8_t>(16, 0x42));
+    auto encryptor = std::make_shared<ccf::RaftTxEncryptor>(1, secrets);
+
+    Store kv_store(consensus);
+    kv_store.set_encryptor(encryptor);
+    auto& public_map = kv_store.create<std::string, std::string>(
+      "public_map", kv::SecurityDomain::PUBLIC);
+
+    Store::Tx tx;
+    auto view = tx.get_view(public_map);
+    view->put("pubk1", "pubv1");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    kv_store.compact(kv_store.current_version());
+    auto serialised = kv_store.snapshot()->serialise();
+
+    {
+      Store kv_store_target;
+      kv_store_target.clone_schema(kv_store);
+      kv_store_target.set_encryptor(encryptor);
+
+      std::vector<kv::Version> view_history;
+      REQUIRE(
+        kv_store_target.deserialise_snapshot(serialised, &view_history) ==
+        kv::DeserialiseSuccess::PASS);
+      REQUIRE(view_history == consensus->get_view_history(1));
+    }
+
+    // Tamper with the view history
+    std::vector<uint8_t> view_to_corrupt(5, 0x42);
+    REQUIRE(corrupt_serialised_tx(serialised, view_to_corrupt));
+
+    {
+      Store kv_store_target;
+      kv_store_target.clone_schema(kv_store);
+      kv_store_target.set_encryptor(encryptor);
+
+      REQUIRE(
+        kv_store_target.deserialise_snapshot(serialised) ==
+        kv::DeserialiseSuccess::FAILED);
+    }
+  }
 }
 
 TEST_CASE("nlohmann (de)serialisation" * doctest::test_suite("serialisation"))
@@ -531,4 +587,263 @@ TEST_CASE("Exceptional serdes" * doctest::test_suite("serialisation"))
 
     REQUIRE_THROWS_AS(tx.commit(), kv::KvSerialiserException);
   }
-}
\ No newline at end of file
+}
+TEST_CASE("Nested serialisers" * doctest::test_suite("serialisation"))
+{
+  auto encryptor = std::make_shared<ccf::NullTxEncryptor>();
+
+  auto serialise = [&](kv::KvStoreSerialiser& s, const std::string& key) {
+    s.start_map("pub_map", kv::SecurityDomain::PUBLIC);
+    s.serialise_write(key, key);
+    s.start_map("priv_map", kv::SecurityDomain::PRIVATE);
+    s.serialise_write(key, key);
+  };
+
+  std::vector<uint8_t> alone;
+  {
+    kv::KvStoreSerialiser s(encryptor, 1);
+    serialise(s, "outer");
+    alone = s.get_raw_data();
+  }
+
+  INFO("A serialiser is not affected by another on the same thread");
+  {
+    kv::KvStoreSerialiser outer(encryptor, 1);
+    outer.start_map("pub_map", kv::SecurityDomain::PUBLIC);
+    outer.serialise_write(std::string("outer"), std::string("outer"));
+    {
+      kv::KvStoreSerialiser inner(encryptor, 2);
+      serialise(inner, "inner");
+      REQUIRE(inner.get_raw_data() != alone);
+    }
+    outer.start_map("priv_map", kv::SecurityDomain::PRIVATE);
+    outer.serialise_write(std::string("outer"), std::string("outer"));
+    REQUIRE(outer.get_raw_data() == alone);
+  }
+}
+
+using FlatbuffersStore = kv::Store<
+  kv::FlatbuffersKvStoreSerialiser,
+  kv::FlatbuffersKvStoreDeserialiser>;
+
+TEST_CASE("FlatBuffers serialisation" * doctest::test_suite("serialisation"))
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  auto encryptor = std::make_shared<ccf::NullTxEncryptor>();
+
+  FlatbuffersStore kv_store(consensus);
+  FlatbuffersStore kv_store_target;
+  kv_store.set_encryptor(encryptor);
+  kv_store_target.set_encryptor(encryptor);
+
+  auto& priv_map = kv_store.create<std::string, std::string>("priv_map");
+  auto& pub_map = kv_store.create<std::string, std::string>(
+    "pub_map", kv::SecurityDomain::PUBLIC);
+  auto& custom_map = kv_store.create<CustomClass, CustomClass>(
+    "custom_map", kv::SecurityDomain::PUBLIC);
+  auto& json_map =
+    kv_store.create<nlohmann::json, nlohmann::json>("json_map");
+  kv_store_target.clone_schema(kv_store);
+
+  INFO("Commit to all maps and deserialise in target store");
+  {
+    FlatbuffersStore::Tx tx;
+    auto [view_priv, view_pub, view_custom, view_json] =
+      tx.get_view(priv_map, pub_map, custom_map, json_map);
+    view_priv->put("privk1", "privv1");
+    view_priv->put("privk2", "privv2");
+    view_pub->put("pubk1", "pubv1");
+    view_custom->put(CustomClass(3), CustomClass(33));
+    view_json->put(std::vector<int>{4, 5, 6}, "xyz");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    REQUIRE(
+      kv_store_target.deserialise(consensus->get_latest_data().first) ==
+      kv::DeserialiseSuccess::PASS);
+
+    FlatbuffersStore::Tx tx_target;
+    auto [target_priv, target_pub, target_custom, target_json] =
+      tx_target.get_view(
+        *kv_store_target.get<std::string, std::string>("priv_map"),
+        *kv_store_target.get<std::string, std::string>("pub_map"),
+        *kv_store_target.get<CustomClass, CustomClass>("custom_map"),
+        *kv_store_target.get<nlohmann::json, nlohmann::json>("json_map"));
+    REQUIRE(target_priv->get("privk1") == "privv1");
+    REQUIRE(target_priv->get("privk2") == "privv2");
+    REQUIRE(target_pub->get("pubk1") == "pubv1");
+    REQUIRE(target_custom->get(CustomClass(3)) == CustomClass(33));
+    REQUIRE(target_json->get(std::vector<int>{4, 5, 6}) == "xyz");
+  }
+
+  INFO("Commit a removal and deserialise in target store");
+  {
+    FlatbuffersStore::Tx tx;
+    tx.get_view(priv_map)->remove("privk1");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    REQUIRE(
+      kv_store_target.deserialise(consensus->get_latest_data().first) ==
+      kv::DeserialiseSuccess::PASS);
+
+    FlatbuffersStore::Tx tx_target;
+    auto view_target = tx_target.get_view(
+      *kv_store_target.get<std::string, std::string>("priv_map"));
+    REQUIRE(!view_target->get("privk1").has_value());
+    REQUIRE(view_target->get("privk2") == "privv2");
+  }
+
+  INFO("Corrupted transactions are rejected");
+  {
+    FlatbuffersStore::Tx tx;
+    tx.get_view(pub_map)->put("pubk2", "pubv2");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    auto data = consensus->get_latest_data().first;
+    auto hdr_size = encryptor->get_header_length();
+    std::fill(
+      data.begin() + hdr_size + sizeof(size_t), data.end(), uint8_t(0xff));
+    REQUIRE_THROWS_AS(
+      kv_store_target.deserialise(data), kv::KvSerialiserException);
+  }
+}
+
+TEST_CASE(
+  "FlatBuffers keys and values are readable in place" *
+  doctest::test_suite("serialisation"))
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+
+  FlatbuffersStore kv_store(consensus);
+  auto& pub_map = kv_store.create<std::string, std::string>(
+    "pub_map", kv::SecurityDomain::PUBLIC);
+
+  FlatbuffersStore::Tx tx;
+  tx.get_view(pub_map)->put("pubk1", "pubv1");
+  REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+  // Without an encryptor, the transaction is the public domain only
+  auto data = consensus->get_latest_data().first;
+  kv::FlatbuffersReader reader(data.data(), data.size());
+  REQUIRE(reader.read_next<kv::Version>() == 1);
+
+  std::vector<std::string> items;
+  while (!reader.is_eos())
+  {
+    auto raw = reader.read_next_raw();
+    REQUIRE(raw.p >= data.data());
+    REQUIRE(raw.p + raw.n <= data.data() + data.size());
+    items.emplace_back(raw.p, raw.p + raw.n);
+  }
+
+  REQUIRE(std::find(items.begin(), items.end(), "pub_map") != items.end());
+  REQUIRE(std::find(items.begin(), items.end(), "pubk1") != items.end());
+  REQUIRE(std::find(items.begin(), items.end(), "pubv1") != items.end());
+}
+
+template <typename KvStore>
+void check_parallel_deserialise()
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  auto encryptor = std::make_shared<ccf::NullTxEncryptor>();
+
+  KvStore kv_store(consensus);
+  KvStore kv_store_target;
+  kv_store.set_encryptor(encryptor);
+  kv_store_target.set_encryptor(encryptor);
+
+  constexpr size_t map_count = 4;
+  std::vector<typename KvStore::template Map<std::string, std::string>*> maps;
+  for (size_t i = 0; i < map_count; ++i)
+  {
+    maps.push_back(&kv_store.template create<std::string, std::string>(
+      fmt::format("map{}", i),
+      i % 2 == 0 ? kv::SecurityDomain::PUBLIC : kv::SecurityDomain::PRIVATE));
+  }
+  kv_store_target.clone_schema(kv_store);
+
+  // Every transaction is deserialised in parallel, by helper threads started
+  // for it
+  std::vector<std::thread> helpers;
+  kv_store_target.set_parallel_deserialise(
+    [&helpers](size_t count, std::function<void()>&& help) {
+      for (size_t i = 0; i < count; ++i)
+        helpers.emplace_back(help);
+    },
+    0);
+
+  auto get_target = [&](size_t i) {
+    return kv_store_target.template get<std::string, std::string>(
+      fmt::format("map{}", i));
+  };
+
+  INFO("Maps of different sizes are all deserialised");
+  {
+    typename KvStore::Tx tx;
+    for (size_t i = 0; i < map_count; ++i)
+    {
+      auto view = tx.get_view(*maps[i]);
+      for (size_t j = 0; j < 100 * (i + 1); ++j)
+        view->put(fmt::format("key{}", j), fmt::format("value{}-{}", i, j));
+    }
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    REQUIRE(
+      kv_store_target.deserialise(consensus->get_latest_data().first) ==
+      kv::DeserialiseSuccess::PASS);
+    REQUIRE(helpers.size() == map_count - 1);
+
+    typename KvStore::Tx tx_target;
+    for (size_t i = 0; i < map_count; ++i)
+    {
+      auto view = tx_target.get_view(*get_target(i));
+      for (size_t j = 0; j < 100 * (i + 1); ++j)
+      {
+        REQUIRE(
+          view->get(fmt::format("key{}", j)) ==
+          fmt::format("value{}-{}", i, j));
+      }
+      REQUIRE(!view->get(fmt::format("key{}", 100 * (i + 1))).has_value());
+    }
+  }
+
+  INFO("Removals are deserialised alongside writes");
+  {
+    typename KvStore::Tx tx;
+    tx.get_view(*maps[0])->remove("key0");
+    tx.get_view(*maps[3])->put("key0", "updated");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    REQUIRE(
+      kv_store_target.deserialise(consensus->get_latest_data().first) ==
+      kv::DeserialiseSuccess::PASS);
+
+    typename KvStore::Tx tx_target;
+    auto [view0, view3] = tx_target.get_view(*get_target(0), *get_target(3));
+    REQUIRE(!view0->get("key0").has_value());
+    REQUIRE(view0->get("key1") == "value0-1");
+    REQUIRE(view3->get("key0") == "updated");
+  }
+
+  INFO("Transactions on unknown maps are rejected");
+  {
+    KvStore kv_store_partial;
+    kv_store_partial.set_encryptor(encryptor);
+    kv_store_partial.template create<std::string, std::string>(
+      "map0", kv::SecurityDomain::PUBLIC);
+    kv_store_partial.set_parallel_deserialise(
+      [](size_t, std::function<void()>&&) {}, 0);
+
+    REQUIRE(
+      kv_store_partial.deserialise(consensus->pop_oldest_data().first) ==
+      kv::DeserialiseSuccess::FAILED);
+  }
+
+  for (auto& helper : helpers)
+    helper.join();
+}
+
+TEST_CASE("Parallel deserialisation" * doctest::test_suite("serialisation"))
+{
+  check_parallel_deserialise<Store>();
+  check_parallel_deserialise<FlatbuffersStore>();
+}
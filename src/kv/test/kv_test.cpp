@@ -5,6 +5,7 @@
 #include "../kvserialiser.h"
 #include "../node/entities.h"
 #include "../node/history.h"
+#include "consensus/test/stub_consensus.h"
 #include "ds/logger.h"
 #include "enclave/appinterface.h"
 #include "node/encryptor.h"
@@ -149,6 +150,534 @@ TEST_CASE("Reads/writes and deletions")
   }
 }
 
+TEST_CASE("Transactions over many maps")
+{
+  Store kv_store;
+  Store other_store;
+
+  // Create more maps than a transaction holds views for inline, in reverse
+  // name order so that creation order and name order differ
+  constexpr size_t map_count = 20;
+  std::vector<Store::Map<std::string, std::string>*> maps;
+  for (size_t i = 0; i < map_count; ++i)
+  {
+    maps.push_back(&kv_store.create<std::string, std::string>(
+      "map" + std::to_string(map_count - i), kv::SecurityDomain::PUBLIC));
+    REQUIRE(maps.back()->get_id() == i);
+  }
+  auto& other_map = other_store.create<std::string, std::string>(
+    "map" + std::to_string(map_count), kv::SecurityDomain::PUBLIC);
+  REQUIRE(other_map.get_id() == maps[0]->get_id());
+
+  INFO("Views are created once per map, in any order");
+  {
+    Store::Tx tx;
+    for (size_t i = 0; i < map_count; ++i)
+    {
+      auto view = tx.get_view(*maps[(i * 7) % map_count]);
+      view->put("key", std::to_string(i));
+    }
+    for (size_t i = 0; i < map_count; ++i)
+    {
+      auto view = tx.get_view(*maps[(i * 7) % map_count]);
+      REQUIRE(view->get("key") == std::to_string(i));
+    }
+
+    REQUIRE_THROWS_AS(tx.get_view(other_map), std::logic_error);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Writes to all maps are committed");
+  {
+    Store::Tx tx;
+    for (size_t i = 0; i < map_count; ++i)
+    {
+      auto view = tx.get_view(*maps[(i * 7) % map_count]);
+      REQUIRE(view->get("key") == std::to_string(i));
+    }
+  }
+
+  INFO("Wide transactions conflict as a whole");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    for (auto map : maps)
+    {
+      auto view1 = tx1.get_view(*map);
+      auto view2 = tx2.get_view(*map);
+      view1->put("key", view1->get("key").value() + "a");
+      view2->put("key", view2->get("key").value() + "b");
+    }
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx2.commit() == kv::CommitSuccess::CONFLICT);
+  }
+}
+
+TEST_CASE("Ordered map range reads")
+{
+  Store kv_store;
+  using OrderedMap = Store::OrderedMap<size_t, std::string>;
+  auto& map = kv_store.create<OrderedMap>("map", kv::SecurityDomain::PUBLIC);
+
+  auto keys_in_range = [](OrderedMap::TxView* view, size_t from, size_t to) {
+    std::vector<size_t> keys;
+    view->range(from, to, [&keys](const size_t& k, const std::string& v) {
+      REQUIRE(v == std::to_string(k));
+      keys.push_back(k);
+      return true;
+    });
+    return keys;
+  };
+
+  INFO("Populate map with even keys");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    for (size_t k = 0; k < 20; k += 2)
+      view->put(k, std::to_string(k));
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Range reads are ordered and include own writes");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(keys_in_range(view, 3, 9) == std::vector<size_t>{4, 6, 8});
+
+    view->put(5, "5");
+    view->remove(6);
+    view->put(100, "100");
+    REQUIRE(keys_in_range(view, 3, 9) == std::vector<size_t>{4, 5, 8});
+    REQUIRE(keys_in_range(view, 3, 5) == std::vector<size_t>{4});
+    REQUIRE(keys_in_range(view, 18, 200) == std::vector<size_t>{18, 100});
+
+    auto lb = view->lower_bound(6);
+    REQUIRE(lb.has_value());
+    REQUIRE(lb->first == 8);
+    REQUIRE(!view->lower_bound(101).has_value());
+
+    size_t count = 0;
+    view->range(0, 20, [&count](const auto& k, const auto& v) {
+      return ++count < 3;
+    });
+    REQUIRE(count == 3);
+  }
+
+  INFO("Range reads may write to the map");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put(1, "1");
+    view->put(3, "3");
+
+    // Growing the write set moves its entries. Keys written during the
+    // iteration are not visited.
+    std::vector<size_t> keys;
+    view->range(0, 2000, [&](const size_t& k, const std::string& v) {
+      REQUIRE(v == std::to_string(k));
+      keys.push_back(k);
+      view->put(k + 1000, std::to_string(k + 1000));
+      view->remove(3);
+      return true;
+    });
+    REQUIRE(
+      keys ==
+      std::vector<size_t>{0, 1, 2, 3, 4, 6, 8, 10, 12, 14, 16, 18});
+    REQUIRE(keys_in_range(view, 1000, 1002) == std::vector<size_t>{1000, 1001});
+    REQUIRE(!view->get(3).has_value());
+  }
+
+  INFO("Writes into a read range conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+
+    REQUIRE(keys_in_range(view1, 3, 9) == std::vector<size_t>{4, 6, 8});
+    view1->put(1000, "1000");
+
+    view2->put(7, "7");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Removals from a read range conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+
+    REQUIRE(keys_in_range(view1, 3, 9) == std::vector<size_t>{4, 6, 7, 8});
+    view1->put(1000, "1000");
+
+    view2->remove(6);
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Inserts before a lower bound conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+
+    auto lb = view1->lower_bound(9);
+    REQUIRE(lb.has_value());
+    REQUIRE(lb->first == 10);
+    view1->put(1000, "1000");
+
+    view2->put(9, "9");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Writes outside read ranges do not conflict");
+  {
+    Store::Tx tx3;
+    Store::Tx tx4;
+    auto view3 = tx3.get_view(map);
+    auto view4 = tx4.get_view(map);
+
+    REQUIRE(keys_in_range(view3, 3, 9) == std::vector<size_t>{4, 7, 8});
+    view3->put(1000, "1000");
+
+    view4->put(9, "9");
+    view4->put(2, "2");
+    REQUIRE(tx4.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx3.commit() == kv::CommitSuccess::OK);
+  }
+}
+
+TEST_CASE("Secondary indexes")
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+
+  // Values are "species:name", indexed by species
+  using Pets = Store::Map<size_t, std::string>;
+  auto species = [](const std::string& v) { return v.substr(0, v.find(':')); };
+  auto& map = kv_store.create<Pets>(
+    "pets",
+    kv::SecurityDomain::PUBLIC,
+    nullptr,
+    nullptr,
+    {Pets::make_index<std::string>("by_species", species)});
+
+  auto keys_by = [](Pets::TxView* view, const std::string& s) {
+    std::vector<size_t> keys;
+    view->get_by_index(
+      "by_species", s, [&keys, &s](const size_t& k, const std::string& v) {
+        REQUIRE(v.rfind(s + ":", 0) == 0);
+        keys.push_back(k);
+        return true;
+      });
+    std::sort(keys.begin(), keys.end());
+    return keys;
+  };
+
+  INFO("Index reflects committed values and own writes");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put(1, "cat:tom");
+    view->put(2, "dog:rex");
+    view->put(3, "cat:felix");
+    REQUIRE(keys_by(view, "cat") == std::vector<size_t>{1, 3});
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(keys_by(view, "cat") == std::vector<size_t>{1, 3});
+    REQUIRE(keys_by(view, "dog") == std::vector<size_t>{2});
+    REQUIRE(keys_by(view, "fish").empty());
+
+    view->put(1, "dog:tom");
+    view->remove(3);
+    view->put(4, "cat:garfield");
+    REQUIRE(keys_by(view, "cat") == std::vector<size_t>{4});
+    REQUIRE(keys_by(view, "dog") == std::vector<size_t>{1, 2});
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(keys_by(view, "cat") == std::vector<size_t>{4});
+    REQUIRE(keys_by(view, "dog") == std::vector<size_t>{1, 2});
+  }
+
+  INFO("Index reads may write to the map");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put(5, "cat:tabby");
+
+    // Growing the write set moves its entries. Keys written during the
+    // iteration are not visited.
+    std::vector<size_t> keys;
+    view->get_by_index(
+      "by_species",
+      std::string("cat"),
+      [&](const size_t& k, const std::string& v) {
+        REQUIRE(v.rfind("cat:", 0) == 0);
+        keys.push_back(k);
+        for (size_t i = 0; i < 8; ++i)
+          view->put(100 + k * 10 + i, "cat:kitten");
+        view->remove(5);
+        return true;
+      });
+    std::sort(keys.begin(), keys.end());
+    REQUIRE(keys == std::vector<size_t>{4, 5});
+    REQUIRE(keys_by(view, "cat").size() == 17);
+  }
+
+  INFO("Unknown indexes and index key types are rejected");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    auto visit = [](const size_t&, const std::string&) { return true; };
+    REQUIRE_THROWS_AS(
+      view->get_by_index("by_name", std::string("cat"), visit),
+      std::logic_error);
+    REQUIRE_THROWS_AS(
+      view->get_by_index("by_species", size_t(0), visit), std::logic_error);
+  }
+
+  INFO("Changes to the keys with a read index key conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+
+    REQUIRE(keys_by(view1, "cat") == std::vector<size_t>{4});
+    view1->put(100, "fish:nemo");
+
+    view2->put(5, "cat:tabby");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Changes to the values read through an index conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+
+    REQUIRE(keys_by(view1, "dog") == std::vector<size_t>{1, 2});
+    view1->put(100, "fish:nemo");
+
+    view2->put(2, "dog:fido");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Changes to other index keys do not conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+
+    REQUIRE(keys_by(view1, "dog") == std::vector<size_t>{1, 2});
+    view1->put(100, "fish:nemo");
+
+    view2->put(6, "cat:salem");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Index is maintained when transactions are deserialised");
+  {
+    Store target;
+    target.clone_schema(kv_store);
+    while (consensus->number_of_replicas() > 0)
+    {
+      REQUIRE(
+        target.deserialise(consensus->pop_oldest_data().first) ==
+        kv::DeserialiseSuccess::PASS);
+    }
+
+    Store::Tx tx;
+    auto view = tx.get_view(*target.get<Pets>("pets"));
+    REQUIRE(keys_by(view, "cat") == std::vector<size_t>{4, 5, 6});
+    REQUIRE(keys_by(view, "dog") == std::vector<size_t>{1, 2});
+    REQUIRE(keys_by(view, "fish") == std::vector<size_t>{100});
+  }
+
+  INFO("Index is rebuilt when a snapshot is applied");
+  {
+    kv_store.compact(kv_store.current_version());
+    auto snapshot = kv_store.snapshot();
+    REQUIRE(snapshot != nullptr);
+
+    Store target;
+    target.clone_schema(kv_store);
+    REQUIRE(
+      target.deserialise_snapshot(snapshot->serialise()) ==
+      kv::DeserialiseSuccess::PASS);
+
+    Store::Tx tx;
+    auto view = tx.get_view(*target.get<Pets>("pets"));
+    REQUIRE(keys_by(view, "cat") == std::vector<size_t>{4, 5, 6});
+    REQUIRE(keys_by(view, "fish") == std::vector<size_t>{100});
+  }
+
+  INFO("Index is rolled back with the map");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put(7, "cat:luna");
+    view->remove(100);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    kv_store.rollback(kv_store.current_version() - 1);
+
+    Store::Tx tx2;
+    auto view2 = tx2.get_view(map);
+    REQUIRE(keys_by(view2, "cat") == std::vector<size_t>{4, 5, 6});
+    REQUIRE(keys_by(view2, "fish") == std::vector<size_t>{100});
+  }
+}
+
+TEST_CASE("Group commit")
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+  auto& map =
+    kv_store.create<size_t, size_t>("map", kv::SecurityDomain::PUBLIC);
+
+  auto commit_one = [&](size_t i) {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put(i, i);
+    return tx.commit();
+  };
+
+  INFO("By default, every transaction is replicated as soon as it commits");
+  {
+    REQUIRE(commit_one(0) == kv::CommitSuccess::OK);
+    REQUIRE(consensus->number_of_replicas() == 1);
+
+    auto metrics = kv_store.get_group_commit_metrics();
+    REQUIRE(metrics.batches == 1);
+    REQUIRE(metrics.txs == 1);
+    REQUIRE(metrics.max_batch_size == 1);
+  }
+
+  kv_store.set_group_commit({4, std::chrono::milliseconds(100)});
+  consensus->flush();
+
+  INFO("Transactions are held back until a batch is full");
+  {
+    for (size_t i = 1; i < 4; ++i)
+    {
+      REQUIRE(commit_one(i) == kv::CommitSuccess::OK);
+      REQUIRE(consensus->number_of_replicas() == 0);
+    }
+
+    REQUIRE(commit_one(4) == kv::CommitSuccess::OK);
+    REQUIRE(consensus->number_of_replicas() == 4);
+
+    auto metrics = kv_store.get_group_commit_metrics();
+    REQUIRE(metrics.batches == 2);
+    REQUIRE(metrics.txs == 5);
+    REQUIRE(metrics.max_batch_size == 4);
+  }
+
+  consensus->flush();
+
+  INFO("Queued transactions are flushed once the oldest has waited enough");
+  {
+    REQUIRE(commit_one(5) == kv::CommitSuccess::OK);
+    kv_store.tick(std::chrono::milliseconds(50));
+    REQUIRE(commit_one(6) == kv::CommitSuccess::OK);
+    REQUIRE(consensus->number_of_replicas() == 0);
+
+    kv_store.tick(std::chrono::milliseconds(50));
+    REQUIRE(consensus->number_of_replicas() == 2);
+
+    auto metrics = kv_store.get_group_commit_metrics();
+    REQUIRE(metrics.batches == 3);
+    REQUIRE(metrics.max_delay_ms == 100);
+    REQUIRE(metrics.total_delay_ms == 150);
+  }
+
+  consensus->flush();
+
+  INFO("Globally committable transactions flush the queue immediately");
+  {
+    REQUIRE(commit_one(7) == kv::CommitSuccess::OK);
+    REQUIRE(
+      kv_store.commit(
+        kv_store.next_version(), kv::MovePendingTx({0}, {}), true) ==
+      kv::CommitSuccess::OK);
+    REQUIRE(consensus->number_of_replicas() == 2);
+    REQUIRE(kv_store.commit_gap() == 0);
+  }
+
+  consensus->flush();
+
+  INFO("Queued transactions which are rolled back are never replicated");
+  {
+    REQUIRE(commit_one(8) == kv::CommitSuccess::OK);
+    kv_store.rollback(kv_store.current_version() - 1);
+    kv_store.tick(std::chrono::milliseconds(100));
+    REQUIRE(consensus->number_of_replicas() == 0);
+
+    REQUIRE(commit_one(9) == kv::CommitSuccess::OK);
+    REQUIRE(kv_store.flush() == kv::CommitSuccess::OK);
+    REQUIRE(consensus->number_of_replicas() == 1);
+
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(!view->get(8).has_value());
+    REQUIRE(view->get(9).has_value());
+  }
+}
+
+TEST_CASE("Out of order commits")
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+
+  auto commit_at = [&](kv::Version v) {
+    std::vector<uint8_t> data(sizeof(v));
+    memcpy(data.data(), &v, sizeof(v));
+    return kv_store.commit(v, kv::MovePendingTx(std::move(data), {}), false);
+  };
+
+  INFO("Versions far ahead of the last replicated wait for the gap to fill");
+  {
+    constexpr kv::Version count = 3000;
+    for (kv::Version v = 1; v <= count; ++v)
+      kv_store.next_version();
+
+    for (kv::Version v = count; v > 1; --v)
+    {
+      REQUIRE(commit_at(v) == kv::CommitSuccess::OK);
+      REQUIRE(consensus->number_of_replicas() == 0);
+    }
+
+    REQUIRE(commit_at(1) == kv::CommitSuccess::OK);
+    REQUIRE(consensus->number_of_replicas() == count);
+
+    for (kv::Version v = 1; v <= count; ++v)
+    {
+      auto [data, ok] = consensus->pop_oldest_data();
+      REQUIRE(ok);
+      kv::Version replicated;
+      memcpy(&replicated, data.data(), sizeof(replicated));
+      REQUIRE(replicated == v);
+    }
+  }
+}
+
 TEST_CASE("Rollback and compact")
 {
   Store kv_store;
@@ -203,6 +732,72 @@ TEST_CASE("Rollback and compact")
   }
 }
 
+TEST_CASE("Historical reads")
+{
+  Store kv_store;
+  auto& map = kv_store.create<std::string, std::string>(
+    "map", kv::SecurityDomain::PUBLIC);
+
+  for (auto value : {"v1", "v2", "v3", "v4"})
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put("key", value);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+  kv_store.compact(3);
+
+  INFO("Read retained versions");
+  {
+    Store::Tx tx;
+    tx.set_read_version(3);
+    auto view = tx.get_view(map);
+    REQUIRE(view->get("key") == "v3");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    REQUIRE(kv_store.current_version() == 4);
+  }
+
+  INFO("Cannot read versions that are not globally committed");
+  {
+    Store::Tx tx;
+    tx.set_read_version(4);
+    REQUIRE_THROWS_AS(tx.get_view(map), std::logic_error);
+  }
+
+  INFO("Cannot write in a historical transaction");
+  {
+    Store::Tx tx;
+    tx.set_read_version(3);
+    auto view = tx.get_view(map);
+    view->put("key", "v5");
+    REQUIRE_THROWS_AS(tx.commit(), std::logic_error);
+  }
+
+  INFO("Compacted versions are read from a historical store");
+  {
+    Store::Tx tx;
+    tx.set_read_version(2);
+    REQUIRE_THROWS_AS(tx.get_view(map), std::logic_error);
+
+    auto historical_store = std::make_shared<Store>();
+    historical_store->clone_schema(kv_store);
+    auto& historical_map =
+      *historical_store->get<Store::Map<std::string, std::string>>("map");
+    for (auto value : {"v1", "v2"})
+    {
+      Store::Tx tx;
+      auto view = tx.get_view(historical_map);
+      view->put("key", value);
+      REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    }
+
+    Store::Tx tx2;
+    tx2.set_read_version(2, historical_store);
+    auto view = tx2.get_view(map);
+    REQUIRE(view->get("key") == "v2");
+  }
+}
+
 TEST_CASE("Clear entire store")
 {
   Store kv_store;
@@ -438,6 +1033,153 @@ TEST_CASE("Global commit hooks")
   }
 }
 
+TEST_CASE("Asynchronous global commit hooks")
+{
+  using State = Store::Map<std::string, std::string>::State;
+  using Write = Store::Map<std::string, std::string>::Write;
+  struct GlobalHookInput
+  {
+    kv::Version version;
+    Write writes;
+  };
+
+  std::vector<GlobalHookInput> global_writes;
+  auto global_hook = [&](kv::Version v, const State& s, const Write& w) {
+    global_writes.emplace_back(GlobalHookInput({v, w}));
+  };
+
+  std::vector<std::function<void()>> dispatched;
+  Store kv_store;
+  kv_store.set_global_hook_dispatcher(
+    [&](std::function<void()>&& run) { dispatched.push_back(std::move(run)); });
+
+  auto& map = kv_store.create<std::string, std::string>(
+    "map", kv::SecurityDomain::PUBLIC);
+  map.set_global_hook(global_hook, true);
+
+  auto commit_write = [&](const std::string& k, const std::string& v) {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put(k, v);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  };
+
+  INFO("Compaction only dispatches the hook");
+  {
+    commit_write("key1", "value1");
+    kv_store.compact(1);
+    REQUIRE(global_writes.empty());
+    REQUIRE(dispatched.size() == 1);
+    REQUIRE(kv_store.get_global_hook_metrics()["map"].queued == 1);
+  }
+
+  INFO("Queued deltas are coalesced, in order");
+  {
+    commit_write("key1", "value2");
+    commit_write("key2", "value3");
+    kv_store.compact(3);
+    REQUIRE(dispatched.size() == 2);
+
+    for (auto& run : dispatched)
+      run();
+    dispatched.clear();
+
+    REQUIRE(global_writes.size() == 1);
+    REQUIRE(global_writes.at(0).version == 3);
+    REQUIRE(global_writes.at(0).writes.size() == 2);
+    REQUIRE(global_writes.at(0).writes.at("key1").value == "value2");
+    REQUIRE(global_writes.at(0).writes.at("key2").value == "value3");
+
+    auto metrics = kv_store.get_global_hook_metrics()["map"];
+    REQUIRE(metrics.queued == 0);
+    REQUIRE(metrics.max_queued == 3);
+    REQUIRE(metrics.deltas == 3);
+    REQUIRE(metrics.callbacks == 1);
+    global_writes.clear();
+  }
+
+  INFO("Without a dispatcher, hooks run during compaction");
+  {
+    kv_store.set_global_hook_dispatcher(nullptr);
+    commit_write("key3", "value4");
+    kv_store.compact(4);
+    REQUIRE(global_writes.size() == 1);
+    REQUIRE(global_writes.at(0).version == 4);
+    global_writes.clear();
+  }
+
+  INFO("Hooks dispatched before the store is destroyed do not run");
+  {
+    {
+      Store other_store;
+      other_store.set_global_hook_dispatcher([&](std::function<void()>&& run) {
+        dispatched.push_back(std::move(run));
+      });
+      auto& other_map = other_store.create<std::string, std::string>(
+        "map", kv::SecurityDomain::PUBLIC);
+      other_map.set_global_hook(global_hook, true);
+
+      Store::Tx tx;
+      auto view = tx.get_view(other_map);
+      view->put("key", "value");
+      REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+      other_store.compact(1);
+      REQUIRE(dispatched.size() == 1);
+    }
+
+    dispatched.front()();
+    REQUIRE(global_writes.empty());
+  }
+}
+
+TEST_CASE("Memory metrics")
+{
+  Store kv_store;
+  auto& map =
+    kv_store.create<size_t, std::string>("map", kv::SecurityDomain::PUBLIC);
+  kv_store.create<Store::OrderedMap<size_t, std::string>>("ordered");
+
+  auto metrics = kv_store.get_memory_metrics();
+  REQUIRE(metrics["map"].versions == 1);
+  REQUIRE(metrics["map"].entries == 0);
+  REQUIRE(metrics["map"].nodes == 1);
+  REQUIRE(metrics["ordered"].versions == 1);
+
+  for (size_t i = 0; i < 10; ++i)
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    for (size_t k = 0; k < 100; ++k)
+      view->put(i * 100 + k, "value");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  auto before = kv_store.get_memory_metrics()["map"];
+  REQUIRE(before.versions == 11);
+  REQUIRE(before.entries == 1000);
+  REQUIRE(before.nodes > 1);
+
+  INFO("Compaction releases earlier versions");
+  kv_store.compact(kv_store.current_version());
+  auto after = kv_store.get_memory_metrics()["map"];
+  REQUIRE(after.versions == 1);
+  REQUIRE(after.entries == 1000);
+  REQUIRE(after.nodes < before.nodes);
+  REQUIRE(after.bytes < before.bytes);
+
+  INFO("Versions share the nodes they have not modified");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put(0, "new value");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+  auto updated = kv_store.get_memory_metrics()["map"];
+  REQUIRE(updated.versions == 2);
+  REQUIRE(updated.bytes > after.bytes);
+  REQUIRE(updated.bytes < 2 * after.bytes);
+}
+
 TEST_CASE("Clone schema")
 {
   auto encryptor = std::make_shared<ccf::NullTxEncryptor>();
@@ -461,6 +1203,116 @@ TEST_CASE("Clone schema")
   REQUIRE(clone.deserialise(data) == kv::DeserialiseSuccess::PASS);
 }
 
+TEST_CASE("Snapshot")
+{
+  auto encryptor = std::make_shared<ccf::NullTxEncryptor>();
+  Store store;
+  store.set_encryptor(encryptor);
+
+  auto& public_map =
+    store.create<size_t, std::string>("public", kv::SecurityDomain::PUBLIC);
+  auto& private_map = store.create<size_t, std::string>("private");
+
+  INFO("No snapshot before anything is committed");
+  {
+    REQUIRE(store.snapshot() == nullptr);
+  }
+
+  {
+    Store::Tx tx;
+    auto [view1, view2] = tx.get_view(public_map, private_map);
+    view1->put(42, "aardvark");
+    view1->put(43, "baboon");
+    view2->put(14, "alligator");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+  {
+    Store::Tx tx;
+    auto view1 = tx.get_view(public_map);
+    view1->remove(43);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+  store.compact(store.current_version());
+
+  INFO("Later transactions are not included in the snapshot");
+  {
+    Store::Tx tx;
+    auto view2 = tx.get_view(private_map);
+    view2->put(15, "antelope");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  auto snapshot = store.snapshot();
+  REQUIRE(snapshot != nullptr);
+  REQUIRE(snapshot->get_version() == 2);
+  auto serialised = snapshot->serialise();
+
+  INFO("Snapshot can be applied to an empty store");
+  {
+    Store clone;
+    clone.clone_schema(store);
+    clone.set_encryptor(encryptor);
+
+    REQUIRE(
+      clone.deserialise_snapshot(serialised) == kv::DeserialiseSuccess::PASS);
+    REQUIRE(clone.current_version() == 2);
+    REQUIRE(clone.commit_version() == 2);
+
+    auto& clone_public =
+      *clone.get<Store::Map<size_t, std::string>>("public");
+    auto& clone_private =
+      *clone.get<Store::Map<size_t, std::string>>("private");
+
+    Store::Tx tx;
+    auto [view1, view2] = tx.get_view(clone_public, clone_private);
+    REQUIRE(view1->get(42) == "aardvark");
+    REQUIRE(!view1->get(43).has_value());
+    REQUIRE(view2->get(14) == "alligator");
+    REQUIRE(!view2->get(15).has_value());
+
+    INFO("Store continues after the snapshot");
+    view2->put(15, "antelope");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    REQUIRE(clone.current_version() == 3);
+  }
+
+  INFO("Public only snapshot leaves private maps empty");
+  {
+    Store clone;
+    clone.clone_schema(store);
+    clone.set_encryptor(encryptor);
+
+    REQUIRE(
+      clone.deserialise_snapshot(serialised, nullptr, true) ==
+      kv::DeserialiseSuccess::PASS);
+
+    Store::Tx tx;
+    auto view2 =
+      tx.get_view(*clone.get<Store::Map<size_t, std::string>>("private"));
+    REQUIRE(!view2->get(14).has_value());
+  }
+
+  INFO("Snapshot cannot be applied to a store that is not empty");
+  {
+    REQUIRE(
+      store.deserialise_snapshot(serialised) ==
+      kv::DeserialiseSuccess::FAILED);
+  }
+
+  INFO("Truncated snapshot is rejected");
+  {
+    Store clone;
+    clone.clone_schema(store);
+    clone.set_encryptor(encryptor);
+
+    serialised.resize(serialised.size() / 2);
+    REQUIRE(
+      clone.deserialise_snapshot(serialised) ==
+      kv::DeserialiseSuccess::FAILED);
+    REQUIRE(clone.current_version() == 0);
+  }
+}
+
 TEST_CASE("Deserialise return status")
 {
   Store store;
@@ -811,4 +1663,99 @@ TEST_CASE("Conflict resolution")
   // Re-running a _committed_ transaction is exceptionally bad
   REQUIRE_THROWS(tx1.commit());
   REQUIRE_THROWS(tx2.commit());
-}
\ No newline at end of file
+}
+TEST_CASE("Early conflict detection")
+{
+  Store kv_store;
+  auto& map = kv_store.create<std::string, std::string>(
+    "map", kv::SecurityDomain::PUBLIC);
+  auto& other = kv_store.create<std::string, std::string>(
+    "other", kv::SecurityDomain::PUBLIC);
+  map.set_early_conflict_detection(true);
+
+  auto commit_write = [&](const std::string& k, const std::string& v) {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put(k, v);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  };
+
+  commit_write("foo", "initial");
+
+  INFO("Reads which are still current do not conflict");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(view->get("foo").value() == "initial");
+    view->put("foo", "updated");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Stale reads throw once the view has written");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(view->get("foo").value() == "updated");
+
+    commit_write("foo", "concurrent");
+
+    // Stale, but a read-only view cannot conflict
+    REQUIRE(view->get("foo").value() == "updated");
+    REQUIRE(view->get("bar") == std::nullopt);
+    REQUIRE_THROWS_AS(view->put("bar", "value"), kv::EarlyConflict);
+
+    auto metrics = kv_store.get_conflict_metrics();
+    REQUIRE(metrics.size() == 1);
+    REQUIRE(metrics["map"].early == 1);
+    REQUIRE(metrics["map"].at_commit == 0);
+
+    // After a reset, the transaction runs against the latest state
+    tx.reset_conflicted();
+    view = tx.get_view(map);
+    REQUIRE(view->get("foo").value() == "concurrent");
+    view->put("bar", "value");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Stale reads after a write throw immediately");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put("baz", "value");
+    commit_write("foo", "again");
+    REQUIRE_THROWS_AS(view->get("foo"), kv::EarlyConflict);
+    REQUIRE(kv_store.get_conflict_metrics()["map"].early == 2);
+  }
+
+  INFO("Early conflicts which are swallowed still conflict at commit");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put("baz", "other");
+    commit_write("foo", "later");
+    REQUIRE_THROWS_AS(view->get("foo"), std::exception);
+    REQUIRE(tx.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Maps without detection only conflict at commit");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(other);
+    view->get("foo");
+
+    {
+      Store::Tx tx2;
+      auto view2 = tx2.get_view(other);
+      view2->put("foo", "value");
+      REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    }
+
+    REQUIRE(view->get("foo") == std::nullopt);
+    view->put("foo", "stale");
+    REQUIRE(tx.commit() == kv::CommitSuccess::CONFLICT);
+
+    auto metrics = kv_store.get_conflict_metrics();
+    REQUIRE(metrics["other"].early == 0);
+    REQUIRE(metrics["other"].at_commit == 1);
+  }
+}
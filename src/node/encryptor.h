@@ -18,26 +18,29 @@ namespace ccf
   class NullTxEncryptor : public kv::AbstractTxEncryptor
   {
   public:
+    using kv::AbstractTxEncryptor::encrypt;
+
     void encrypt(
-      const std::vector<uint8_t>& plain,
-      const std::vector<uint8_t>& additional_data,
-      std::vector<uint8_t>& serialised_header,
-      std::vector<uint8_t>& cipher,
+      CBuffer plain,
+      CBuffer additional_data,
+      uint8_t* serialised_header,
+      uint8_t* cipher,
       kv::Version version) override
     {
       crypto::GcmHeader<crypto::GCM_SIZE_IV> gcm_hdr = {};
-      serialised_header = std::move(gcm_hdr.serialise());
-      cipher = plain;
+      gcm_hdr.serialise(serialised_header);
+      if (plain.n > 0)
+        memmove(cipher, plain.p, plain.n);
     }
 
     bool decrypt(
-      const std::vector<uint8_t>& cipher,
-      const std::vector<uint8_t>& additional_data,
-      const std::vector<uint8_t>& serialised_header,
+      CBuffer cipher,
+      CBuffer additional_data,
+      CBuffer serialised_header,
       std::vector<uint8_t>& plain,
       kv::Version version) override
     {
-      plain = cipher;
+      plain.assign(cipher.p, cipher.p + cipher.n);
       return true;
     }
 
@@ -125,33 +128,36 @@ namespace ccf
       }
     }
 
+    using kv::AbstractTxEncryptor::encrypt;
+
     /**
-     * Encrypt data and return serialised GCM header and cipher.
+     * Encrypt data and write serialised GCM header and cipher. Cipher may
+     * be the same memory as plain.
      *
      * @param[in]   plain             Plaintext to encrypt
      * @param[in]   additional_data   Additional data to tag
-     * @param[out]  serialised_header Serialised header (iv + tag)
-     * @param[out]  cipher            Encrypted ciphertext
+     * @param[out]  serialised_header Serialised header (iv + tag), of
+     * get_header_length() bytes
+     * @param[out]  cipher            Encrypted ciphertext, of plain.n bytes
      * @param[in]   version           Version used to retrieve the corresponding
      * encryption key
      */
     void encrypt(
-      const std::vector<uint8_t>& plain,
-      const std::vector<uint8_t>& additional_data,
-      std::vector<uint8_t>& serialised_header,
-      std::vector<uint8_t>& cipher,
+      CBuffer plain,
+      CBuffer additional_data,
+      uint8_t* serialised_header,
+      uint8_t* cipher,
       kv::Version version) override
     {
       crypto::GcmHeader<crypto::GCM_SIZE_IV> gcm_hdr;
-      cipher.resize(plain.size());
 
       // Set IV
       set_iv(gcm_hdr, version);
 
       get_encryption_key(version).encrypt(
-        gcm_hdr.get_iv(), plain, additional_data, cipher.data(), gcm_hdr.tag);
+        gcm_hdr.get_iv(), plain, additional_data, cipher, gcm_hdr.tag);
 
-      serialised_header = std::move(gcm_hdr.serialise());
+      gcm_hdr.serialise(serialised_header);
     }
 
     /**
@@ -167,15 +173,15 @@ namespace ccf
      * @return Boolean status indicating success of decryption.
      */
     bool decrypt(
-      const std::vector<uint8_t>& cipher,
-      const std::vector<uint8_t>& additional_data,
-      const std::vector<uint8_t>& serialised_header,
+      CBuffer cipher,
+      CBuffer additional_data,
+      CBuffer serialised_header,
       std::vector<uint8_t>& plain,
       kv::Version version) override
     {
       crypto::GcmHeader<crypto::GCM_SIZE_IV> gcm_hdr;
       gcm_hdr.deserialise(serialised_header);
-      plain.resize(cipher.size());
+      plain.resize(cipher.n);
 
       auto ret = get_encryption_key(version).decrypt(
         gcm_hdr.get_iv(), gcm_hdr.tag, cipher, additional_data, plain.data());
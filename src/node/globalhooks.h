@@ -0,0 +1,63 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "ds/logger.h"
+#include "ds/thread_messaging.h"
+#include "entities.h"
+
+#include <functional>
+#include <memory>
+
+namespace ccf
+{
+  /** Runs the asynchronous global hooks of a store on a worker thread, so
+   * that they do not hold up compaction, and so consensus.
+   *
+   * Every hook is run on the same worker, so hooks do not run concurrently
+   * with each other. If there are no worker threads, hooks are run straight
+   * away.
+   */
+  class GlobalHookDispatcher
+  {
+  private:
+    struct HookMsg
+    {
+      std::function<void()> run;
+    };
+
+    static void run_hooks_cb(std::unique_ptr<enclave::Tmsg<HookMsg>> msg)
+    {
+      try
+      {
+        msg->data.run();
+      }
+      catch (const std::exception& e)
+      {
+        LOG_FAIL_FMT("Global hook failed: {}", e.what());
+      }
+    }
+
+  public:
+    static void dispatch(std::function<void()>&& run)
+    {
+      auto msg = std::make_unique<enclave::Tmsg<HookMsg>>(&run_hooks_cb);
+      msg->data.run = std::move(run);
+
+      if (enclave::ThreadMessaging::thread_count > 1)
+      {
+        enclave::ThreadMessaging::thread_messaging.add_task<HookMsg>(
+          enclave::ThreadMessaging::get_execution_thread(0), std::move(msg));
+      }
+      else
+      {
+        run_hooks_cb(std::move(msg));
+      }
+    }
+
+    static void install(Store& store)
+    {
+      store.set_global_hook_dispatcher(&dispatch);
+    }
+  };
+}
@@ -0,0 +1,467 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "consensus/ledgerenclavetypes.h"
+#include "ds/json.h"
+#include "ds/logger.h"
+#include "ds/ringbuffer_types.h"
+#include "ds/spinlock.h"
+#include "entities.h"
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+
+namespace ccf
+{
+  namespace historical
+  {
+    struct StateCacheMetrics
+    {
+      // Reads served by the live store, by a cached state, and those which
+      // had to wait for a state to be rebuilt
+      size_t live_hits = 0;
+      size_t cache_hits = 0;
+      size_t misses = 0;
+      // Rebuilds, the ledger entries they applied, and the time they took, as
+      // measured by the ticks the cache has been given
+      size_t rebuilds = 0;
+      size_t failed_rebuilds = 0;
+      size_t entries_applied = 0;
+      uint64_t total_rebuild_ms = 0;
+      uint64_t max_rebuild_ms = 0;
+      // Current contents of the cache
+      size_t cached_states = 0;
+      size_t cached_bytes = 0;
+    };
+    DECLARE_JSON_TYPE(StateCacheMetrics)
+    DECLARE_JSON_REQUIRED_FIELDS(
+      StateCacheMetrics,
+      live_hits,
+      cache_hits,
+      misses,
+      rebuilds,
+      failed_rebuilds,
+      entries_applied,
+      total_rebuild_ms,
+      max_rebuild_ms,
+      cached_states,
+      cached_bytes)
+
+    /** Serves reads of the store at past versions.
+     *
+     * The live store only retains the state of its maps back to the last
+     * compaction. Older states are rebuilt in separate stores by replaying
+     * ledger entries fetched from the host, starting from the closest earlier
+     * state in the cache, or from the start of the ledger. Rebuilt states are
+     * kept in a least-recently-used cache, bounded by an estimate of their
+     * size: the size of the ledger entries applied to build them.
+     *
+     * The host is not trusted to serve the committed ledger. A rebuild keeps
+     * applying entries past its target until it reaches a signature, which is
+     * verified over the Merkle root of every entry before it. The signature
+     * must also be in the view in which the live consensus committed it, so
+     * that a fork which was since rolled back cannot be replayed. Only then
+     * is the state at the target made available.
+     *
+     * A state which could not be rebuilt is not attempted again for a while,
+     * so that callers polling for it do not replay the ledger each time. If
+     * the node's ledger starts after a snapshot, entries before it cannot be
+     * fetched, and states are only rebuilt from cached states after it.
+     */
+    class StateCache
+    {
+    public:
+      static constexpr size_t default_max_cache_bytes = 64 * 1024 * 1024;
+      static constexpr uint64_t failed_rebuild_retry_ms = 10000;
+
+      /** Creates the history of a store being rebuilt, which verifies the
+       * signatures in the entries applied to it. If tree is not empty, the
+       * store was cloned from a cached state, and tree is the serialised
+       * Merkle tree that was verified up to that state.
+       */
+      using HistoryFactory = std::function<std::shared_ptr<kv::TxHistory>(
+        Store& store, const std::vector<uint8_t>& tree)>;
+
+      /** Creates the encryptor of a store being rebuilt. The live store's
+       * encryptor cannot be shared, since it drops keys that have been
+       * superseded when it is compacted, and so could not decrypt entries
+       * written before a rekey.
+       */
+      using EncryptorFactory =
+        std::function<std::shared_ptr<kv::AbstractTxEncryptor>()>;
+
+    private:
+      struct CachedState
+      {
+        consensus::Index idx;
+        std::shared_ptr<Store> store;
+        size_t bytes;
+        std::vector<uint8_t> tree;
+      };
+
+      struct Rebuild
+      {
+        std::shared_ptr<Store> store;
+        std::shared_ptr<kv::TxHistory> history;
+        size_t bytes;
+        uint64_t started_ms;
+
+        // Set once the target has been applied, until a signature covering
+        // it has been verified
+        std::shared_ptr<Store> target_store = nullptr;
+        std::vector<uint8_t> target_tree = {};
+        size_t target_bytes = 0;
+      };
+
+      Store& source_store;
+      ringbuffer::WriterPtr to_host;
+      size_t max_cache_bytes;
+      HistoryFactory make_history = nullptr;
+      EncryptorFactory make_encryptor = nullptr;
+
+      SpinLock lock;
+
+      // Most recently used first
+      std::list<CachedState> cache;
+      size_t cached_bytes = 0;
+
+      // Rebuilds in progress, by target index
+      std::map<consensus::Index, Rebuild> rebuilds;
+
+      // Entries requested from the host, which have not arrived yet. Several
+      // rebuilds may be waiting for the same entry, which is only requested
+      // once.
+      std::set<consensus::Index> requested;
+
+      // Indices of states which could not be rebuilt, and when
+      std::map<consensus::Index, uint64_t> failed;
+
+      // Entries up to this index are not in the host's ledger
+      consensus::Index ledger_start = 0;
+
+      uint64_t now_ms = 0;
+      StateCacheMetrics metrics;
+
+      void request_entry(consensus::Index idx)
+      {
+        if (requested.insert(idx).second)
+        {
+          RINGBUFFER_WRITE_MESSAGE(
+            consensus::ledger_get_historical, to_host, idx);
+        }
+      }
+
+      void fail_rebuild(consensus::Index idx)
+      {
+        metrics.failed_rebuilds++;
+        failed.emplace(idx, now_ms);
+      }
+
+      void start_rebuild(consensus::Index idx)
+      {
+        auto store = std::make_shared<Store>();
+        store->clone_schema(source_store);
+        if (make_encryptor != nullptr)
+          store->set_encryptor(make_encryptor());
+        size_t bytes = 0;
+        std::vector<uint8_t> tree;
+
+        // Continue from the latest cached state before idx, if there is one
+        auto base = cache.end();
+        for (auto it = cache.begin(); it != cache.end(); ++it)
+        {
+          if (it->idx < idx && (base == cache.end() || it->idx > base->idx))
+            base = it;
+        }
+
+        auto base_idx = base == cache.end() ? 0 : base->idx;
+        if (base_idx < ledger_start)
+        {
+          LOG_FAIL_FMT(
+            "Could not rebuild state at {}: ledger starts after {}",
+            idx,
+            ledger_start);
+          fail_rebuild(idx);
+          return;
+        }
+
+        if (base != cache.end())
+        {
+          store->clone_state(*base->store);
+          bytes = base->bytes;
+          tree = base->tree;
+          cache.splice(cache.begin(), cache, base);
+        }
+
+        auto history = make_history(*store, tree);
+        store->set_history(history);
+
+        LOG_DEBUG_FMT(
+          "Rebuilding state at {} from {}", idx, store->current_version());
+
+        rebuilds.emplace(idx, Rebuild{store, history, bytes, now_ms});
+        request_entry(store->current_version() + 1);
+      }
+
+      void reach_target(consensus::Index idx, Rebuild& rebuild)
+      {
+        // The rebuild store carries on towards the next signature, so the
+        // state at the target is kept in a store of its own
+        rebuild.store->compact(idx);
+        rebuild.target_store = std::make_shared<Store>();
+        rebuild.target_store->clone_schema(source_store);
+        rebuild.target_store->clone_state(*rebuild.store);
+        rebuild.target_tree = rebuild.history->serialise_tree(idx);
+        rebuild.target_bytes = rebuild.bytes;
+      }
+
+      bool is_committed_view(consensus::Index idx, kv::Term term)
+      {
+        auto consensus = source_store.get_consensus();
+        return consensus == nullptr || consensus->get_view(idx) == term;
+      }
+
+      void complete_rebuild(consensus::Index idx, Rebuild&& rebuild)
+      {
+        auto rebuild_ms = now_ms - rebuild.started_ms;
+        metrics.rebuilds++;
+        metrics.total_rebuild_ms += rebuild_ms;
+        metrics.max_rebuild_ms = std::max(metrics.max_rebuild_ms, rebuild_ms);
+
+        cache.push_front({idx,
+                          rebuild.target_store,
+                          rebuild.target_bytes,
+                          std::move(rebuild.target_tree)});
+        cached_bytes += rebuild.target_bytes;
+
+        // The state that has just been rebuilt is kept, even if it exceeds
+        // the budget on its own
+        while (cached_bytes > max_cache_bytes && cache.size() > 1)
+        {
+          LOG_DEBUG_FMT("Evicting state at {}", cache.back().idx);
+          cached_bytes -= cache.back().bytes;
+          cache.pop_back();
+        }
+      }
+
+    public:
+      StateCache(
+        Store& source_store_,
+        ringbuffer::AbstractWriterFactory& writer_factory,
+        size_t max_cache_bytes_ = default_max_cache_bytes) :
+        source_store(source_store_),
+        to_host(writer_factory.create_writer_to_outside()),
+        max_cache_bytes(max_cache_bytes_)
+      {}
+
+      /** Set the index of the snapshot the node's ledger starts after. The
+       * host cannot serve the entries up to it.
+       */
+      void set_ledger_start(consensus::Index idx)
+      {
+        std::lock_guard<SpinLock> guard(lock);
+        ledger_start = idx;
+      }
+
+      void set_max_cache_bytes(size_t max_cache_bytes_)
+      {
+        std::lock_guard<SpinLock> guard(lock);
+        max_cache_bytes = max_cache_bytes_;
+      }
+
+      /** Set how the histories of rebuilt stores are created. Until this is
+       * called, no state is rebuilt, and only the live store can be read.
+       */
+      void set_history_factory(HistoryFactory make_history_)
+      {
+        std::lock_guard<SpinLock> guard(lock);
+        make_history = make_history_;
+      }
+
+      /** Set how the encryptors of rebuilt stores are created. Until this is
+       * called, rebuilt stores have no encryptor, and can only apply entries
+       * that were not encrypted.
+       */
+      void set_encryptor_factory(EncryptorFactory make_encryptor_)
+      {
+        std::lock_guard<SpinLock> guard(lock);
+        make_encryptor = make_encryptor_;
+      }
+
+      /** Get a store holding the state at idx, rebuilt from the ledger.
+       *
+       * @param idx Globally committed index
+       *
+       * @return Store, or nullptr if the state has not been rebuilt yet. The
+       * rebuild is then started, unless it recently failed, and the caller
+       * should try again later
+       */
+      std::shared_ptr<Store> get_store_at(consensus::Index idx)
+      {
+        std::lock_guard<SpinLock> guard(lock);
+
+        if (idx == 0 || idx > source_store.commit_version())
+          return nullptr;
+
+        for (auto it = cache.begin(); it != cache.end(); ++it)
+        {
+          if (it->idx == idx)
+          {
+            metrics.cache_hits++;
+            cache.splice(cache.begin(), cache, it);
+            return it->store;
+          }
+        }
+
+        metrics.misses++;
+
+        if (
+          make_history != nullptr && rebuilds.find(idx) == rebuilds.end() &&
+          failed.find(idx) == failed.end())
+          start_rebuild(idx);
+
+        return nullptr;
+      }
+
+      /** Make tx a read-only transaction at idx.
+       *
+       * The live store is used if it still retains the state at idx.
+       * Otherwise, tx reads from the state rebuilt at idx.
+       *
+       * @param tx Transaction on which no view has been created yet
+       * @param idx Globally committed index
+       *
+       * @return false if the state at idx is not available yet, in which case
+       * it is being rebuilt and the caller should try again later
+       */
+      bool set_read_version(Store::Tx& tx, consensus::Index idx)
+      {
+        if (idx != 0 && idx == source_store.commit_version())
+        {
+          {
+            std::lock_guard<SpinLock> guard(lock);
+            metrics.live_hits++;
+          }
+          tx.set_read_version(idx);
+          return true;
+        }
+
+        auto store = get_store_at(idx);
+        if (store == nullptr)
+          return false;
+
+        tx.set_read_version(idx, store);
+        return true;
+      }
+
+      void handle_ledger_entry(
+        consensus::Index idx, const std::vector<uint8_t>& entry)
+      {
+        std::lock_guard<SpinLock> guard(lock);
+        requested.erase(idx);
+
+        for (auto it = rebuilds.begin(); it != rebuilds.end();)
+        {
+          auto& [target, rebuild] = *it;
+
+          // Several rebuilds may be waiting for the same entry
+          if (rebuild.store->current_version() + 1 != idx)
+          {
+            ++it;
+            continue;
+          }
+
+          kv::Term term = 0;
+          auto result = rebuild.store->deserialise(entry, false, &term);
+          if (result == kv::DeserialiseSuccess::FAILED)
+          {
+            LOG_FAIL_FMT(
+              "Could not rebuild state at {}: bad entry {}", target, idx);
+            fail_rebuild(target);
+            it = rebuilds.erase(it);
+            continue;
+          }
+
+          metrics.entries_applied++;
+          rebuild.bytes += entry.size();
+
+          if (idx == target)
+            reach_target(idx, rebuild);
+
+          if (
+            result == kv::DeserialiseSuccess::PASS_SIGNATURE && idx >= target)
+          {
+            if (!is_committed_view(idx, term))
+            {
+              LOG_FAIL_FMT(
+                "Could not rebuild state at {}: signature {} is in view {}, "
+                "which did not commit it",
+                target,
+                idx,
+                term);
+              fail_rebuild(target);
+              it = rebuilds.erase(it);
+              continue;
+            }
+
+            complete_rebuild(target, std::move(rebuild));
+            it = rebuilds.erase(it);
+            continue;
+          }
+
+          request_entry(idx + 1);
+          ++it;
+        }
+      }
+
+      void handle_no_entry(consensus::Index idx)
+      {
+        std::lock_guard<SpinLock> guard(lock);
+        requested.erase(idx);
+
+        for (auto it = rebuilds.begin(); it != rebuilds.end();)
+        {
+          if (it->second.store->current_version() + 1 == idx)
+          {
+            LOG_FAIL_FMT(
+              "Could not rebuild state at {}: no entry {}", it->first, idx);
+            fail_rebuild(it->first);
+            it = rebuilds.erase(it);
+          }
+          else
+          {
+            ++it;
+          }
+        }
+      }
+
+      void tick(std::chrono::milliseconds elapsed)
+      {
+        std::lock_guard<SpinLock> guard(lock);
+        now_ms += elapsed.count();
+
+        for (auto it = failed.begin(); it != failed.end();)
+        {
+          if (now_ms - it->second >= failed_rebuild_retry_ms)
+            it = failed.erase(it);
+          else
+            ++it;
+        }
+      }
+
+      StateCacheMetrics get_metrics()
+      {
+        std::lock_guard<SpinLock> guard(lock);
+        auto result = metrics;
+        result.cached_states = cache.size();
+        result.cached_bytes = cached_bytes;
+        return result;
+      }
+    };
+  }
+}
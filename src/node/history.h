@@ -53,7 +53,8 @@ namespace ccf
     APPEND,
     VERIFY,
     ROLLBACK,
-    COMPACT
+    COMPACT,
+    DESERIALISE
   };
 
   constexpr size_t MAX_HISTORY_LEN = 1000;
@@ -77,6 +78,10 @@ namespace ccf
       case COMPACT:
         os << "compact";
         break;
+
+      case DESERIALISE:
+        os << "deserialise";
+        break;
     }
 
     return os;
@@ -193,6 +198,17 @@ namespace ccf
     {
       return true;
     }
+
+    std::vector<uint8_t> serialise_tree(kv::Version v) override
+    {
+      return {};
+    }
+
+    bool deserialise_tree(
+      const std::vector<uint8_t>& tree, kv::Version v) override
+    {
+      return true;
+    }
   };
 
   class Receipt
@@ -282,6 +298,10 @@ namespace ccf
     MerkleTreeHistory(const std::vector<uint8_t>& serialised)
     {
       tree = mt_deserialize(serialised.data(), serialised.size());
+      if (tree == nullptr)
+      {
+        throw std::logic_error("Invalid serialised merkle tree");
+      }
     }
 
     MerkleTreeHistory()
@@ -360,6 +380,25 @@ namespace ccf
       mt_serialize(tree, output.data(), output.capacity());
       return output;
     }
+
+    // Serialise the tree as it was when index was its last leaf
+    std::vector<uint8_t> serialise(uint64_t index)
+    {
+      MerkleTreeHistory retracted(serialise());
+      retracted.retract(index);
+      return retracted.serialise();
+    }
+
+    void deserialise(const std::vector<uint8_t>& serialised)
+    {
+      auto deserialised = mt_deserialize(serialised.data(), serialised.size());
+      if (deserialised == nullptr)
+      {
+        throw std::logic_error("Invalid serialised merkle tree");
+      }
+      mt_free(tree);
+      tree = deserialised;
+    }
   };
 
   template <class T>
@@ -461,6 +500,16 @@ namespace ccf
         *term = sig_value.term;
       }
 
+      crypto::Sha256Hash root = replicated_state_tree.get_root();
+      log_hash(root, VERIFY);
+      return verify_signature(ni_tv, sig_value, root);
+    }
+
+    bool verify_signature(
+      Nodes::TxView* ni_tv,
+      const Signature& sig_value,
+      const crypto::Sha256Hash& root)
+    {
       auto ni = ni_tv->get(sig_value.node);
       if (!ni.has_value())
       {
@@ -469,8 +518,6 @@ namespace ccf
         return false;
       }
       tls::VerifierPtr from_cert = tls::make_verifier(ni.value().cert);
-      crypto::Sha256Hash root = replicated_state_tree.get_root();
-      log_hash(root, VERIFY);
       return from_cert->verify_hash(
         root.h.data(),
         root.h.size(),
@@ -478,6 +525,57 @@ namespace ccf
         sig_value.sig.size());
     }
 
+    std::vector<uint8_t> serialise_tree(kv::Version v) override
+    {
+      return replicated_state_tree.serialise(v);
+    }
+
+    bool deserialise_tree(
+      const std::vector<uint8_t>& tree, kv::Version v) override
+    {
+      // The signature at v signs the root of the tree before it was appended,
+      // so the tree must be retracted by one leaf to verify it
+      Store::Tx tx;
+      auto [sig_tv, ni_tv] = tx.get_view(signatures, nodes);
+      auto sig = sig_tv->get(0);
+      if (!sig.has_value() || sig->index != v)
+      {
+        LOG_FAIL_FMT("No signature at {} to verify tree against", v);
+        return false;
+      }
+
+      try
+      {
+        T signed_tree(tree);
+        signed_tree.retract(v - 1);
+        auto root = signed_tree.get_root();
+        if (root != sig->root || !verify_signature(ni_tv, sig.value(), root))
+        {
+          LOG_FAIL_FMT("Tree does not match signature at {}", v);
+          return false;
+        }
+
+        replicated_state_tree.deserialise(tree);
+      }
+      catch (const std::logic_error& e)
+      {
+        LOG_FAIL_FMT("Invalid tree at {}: {}", v, e.what());
+        return false;
+      }
+
+      log_hash(replicated_state_tree.get_root(), DESERIALISE);
+      return true;
+    }
+
+    /** Continue from a tree that has already been verified, such as that of
+     * a state rebuilt from the ledger, rather than from an empty tree.
+     */
+    void set_tree(const std::vector<uint8_t>& tree)
+    {
+      replicated_state_tree.deserialise(tree);
+      log_hash(replicated_state_tree.get_root(), DESERIALISE);
+    }
+
     void rollback(kv::Version v) override
     {
       replicated_state_tree.retract(v);
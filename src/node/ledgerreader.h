@@ -0,0 +1,162 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "consensus/ledgerenclavetypes.h"
+#include "ds/buffer.h"
+#include "ds/logger.h"
+#include "ds/serialized.h"
+
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace ccf
+{
+  /** Reads the ledger from the host, as the node recovers.
+   *
+   * The host is asked for a range of entries, which it sends back in
+   * batches. The next batch is asked for before the current one is applied,
+   * so that the host reads it in the meantime. If reading stops before the
+   * end of the range, because an entry could not be applied or was the last
+   * one needed, the batch read ahead is ignored when it arrives.
+   */
+  class LedgerReader
+  {
+  public:
+    /** Applies the entry at an index. Returns false to stop reading. */
+    using ApplyEntry = std::function<bool(consensus::Index, const CBuffer&)>;
+
+    static constexpr consensus::Index end_of_ledger =
+      std::numeric_limits<consensus::Index>::max();
+
+  private:
+    ringbuffer::WriterPtr to_host;
+
+    bool reading = false;
+    consensus::Index last_idx = 0;
+    consensus::Index to = end_of_ledger;
+
+    void request(consensus::Index from)
+    {
+      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_get_range, to_host, from, to);
+    }
+
+    bool expect(consensus::Index from)
+    {
+      if (!reading)
+      {
+        LOG_DEBUG_FMT("Ignoring ledger entries from {}: not reading", from);
+        return false;
+      }
+
+      // Only the batch following the last entry read is expected. Others
+      // answer requests made before reading restarted.
+      if (from != last_idx + 1)
+      {
+        LOG_FAIL_FMT(
+          "Ignoring ledger entries from {}, expected {}", from, last_idx + 1);
+        return false;
+      }
+
+      return true;
+    }
+
+    static std::vector<CBuffer> split(const uint8_t* data, size_t size)
+    {
+      std::vector<CBuffer> entries;
+      while (size > 0)
+      {
+        auto entry_len = serialized::read<uint32_t>(data, size);
+        entries.emplace_back(data, entry_len);
+        serialized::skip(data, size, entry_len);
+      }
+      return entries;
+    }
+
+  public:
+    LedgerReader(ringbuffer::AbstractWriterFactory& writer_factory) :
+      to_host(writer_factory.create_writer_to_outside())
+    {}
+
+    /** Start reading the entries after an index
+     *
+     * @param after Index of the last entry already applied
+     * @param to_ Last index to read
+     */
+    void start(consensus::Index after, consensus::Index to_ = end_of_ledger)
+    {
+      reading = true;
+      last_idx = after;
+      to = to_;
+      request(last_idx + 1);
+    }
+
+    /** Stop reading. Replies to outstanding requests are ignored. */
+    void stop()
+    {
+      reading = false;
+    }
+
+    bool is_reading() const
+    {
+      return reading;
+    }
+
+    /** Index of the last entry applied */
+    consensus::Index get_last_idx() const
+    {
+      return last_idx;
+    }
+
+    /** Apply a batch of entries sent by the host, in order, until one of
+     * them cannot be applied
+     *
+     * @param from Index of the first entry in the batch
+     * @param data Entries, each framed by its size
+     * @param size Size of the entries
+     * @param apply Called on each entry
+     */
+    void handle_entries(
+      consensus::Index from,
+      const uint8_t* data,
+      size_t size,
+      const ApplyEntry& apply)
+    {
+      if (!expect(from))
+        return;
+
+      auto entries = split(data, size);
+
+      auto next = from + entries.size();
+      if (next <= to)
+        request(next);
+
+      for (const auto& entry : entries)
+      {
+        ++last_idx;
+        if (!apply(last_idx, entry))
+        {
+          stop();
+          return;
+        }
+      }
+    }
+
+    /** Handle the host's reply that it has no entry at an index
+     *
+     * @param idx Index asked for
+     *
+     * @return true if this was the entry following the last one applied, in
+     * which case the end of the ledger has been reached and reading stops
+     */
+    bool handle_no_entry(consensus::Index idx)
+    {
+      if (!expect(idx))
+        return false;
+
+      stop();
+      return true;
+    }
+  };
+}
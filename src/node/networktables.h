@@ -12,6 +12,7 @@
 #include "consensus/raft/rafttables.h"
 #include "entities.h"
 #include "governancehistory.h"
+#include "historicalqueries.h"
 #include "members.h"
 #include "nodes.h"
 #include "proposals.h"
@@ -84,6 +85,11 @@ namespace ccf
     pbft::RequestsMap& pbft_requests_map;
     pbft::PrePreparesMap& pbft_pre_prepares_map;
 
+    //
+    // Historical states of the tables, set once the enclave has started
+    //
+    std::shared_ptr<historical::StateCache> historical_states;
+
     NetworkTables(const ConsensusType& consensus_type = ConsensusType::RAFT) :
       tables(
         (consensus_type == ConsensusType::RAFT) ?
@@ -7,16 +7,19 @@
 #include "consensus/pbft/pbft.h"
 #include "consensus/raft/raftconsensus.h"
 #include "crypto/cryptobox.h"
+#include "ds/buffer.h"
 #include "ds/logger.h"
 #include "enclave/rpcsessions.h"
 #include "encryptor.h"
 #include "entities.h"
 #include "genesisgen.h"
 #include "history.h"
+#include "ledgerreader.h"
 #include "networkstate.h"
 #include "node/rpc/jsonrpc.h"
 #include "nodetonode.h"
 #include "notifier.h"
+#include "paralleldeserialise.h"
 #include "rpc/consts.h"
 #include "rpc/frontend.h"
 #include "rpc/memberfrontend.h"
@@ -24,6 +27,7 @@
 #include "seal.h"
 #include "secretshare.h"
 #include "sharemanager.h"
+#include "snapshotter.h"
 #include "timer.h"
 #include "tls/25519.h"
 #include "tls/client.h"
@@ -188,6 +192,8 @@ namespace ccf
     // join protocol
     //
     std::shared_ptr<Timer> join_timer;
+    std::optional<Join::In> join_args;
+    std::vector<uint8_t> startup_snapshot;
 
     //
     // recovery
@@ -201,7 +207,12 @@ namespace ccf
     std::vector<kv::Version> term_history;
     kv::Version last_recovered_commit_idx = 1;
 
-    consensus::Index ledger_idx = 0;
+    LedgerReader ledger_reader;
+
+    //
+    // snapshots
+    //
+    std::shared_ptr<Snapshotter> snapshotter;
 
   public:
     NodeState(
@@ -221,7 +232,8 @@ namespace ccf
       notifier(notifier),
       timers(timers),
       seal(std::make_shared<Seal>(writer_factory)),
-      share_manager(network)
+      share_manager(network),
+      ledger_reader(writer_factory)
     {
       ::EverCrypt_AutoConfig2_init();
     }
@@ -257,6 +269,25 @@ namespace ccf
       create_node_cert(args.config);
       open_node_frontend();
 
+      network.tables->set_group_commit(
+        {args.config.group_commit.max_batch_size,
+         std::chrono::milliseconds(args.config.group_commit.max_delay_ms)});
+
+      if (network.historical_states)
+      {
+        network.historical_states->set_max_cache_bytes(
+          args.config.historical_states.max_cache_bytes);
+      }
+
+      // Snapshots are only taken with Raft, since they record its term history
+      // and since the PBFT encryptor would reuse the IV of the transaction at
+      // the snapshot's version
+      if (network.consensus_type == ConsensusType::RAFT)
+      {
+        snapshotter = std::make_shared<Snapshotter>(
+          writer_factory, network.tables, args.config.snapshots.tx_interval);
+      }
+
 #ifdef GET_QUOTE
       if (network.consensus_type != ConsensusType::PBFT)
       {
@@ -291,6 +322,7 @@ namespace ccf
           setup_encryptor(network.consensus_type);
           setup_consensus(network.consensus_type, args.config);
           setup_history();
+          setup_historical_states();
 
           // Become the primary and force replication
           consensus->force_become_primary();
@@ -337,6 +369,7 @@ namespace ccf
             tls::create_entropy()->random(crypto::BoxKey::KEY_SIZE));
 
           setup_history();
+          setup_historical_states();
           setup_encryptor(network.consensus_type);
 
           // Accept members connections for members to finish recovery once
@@ -438,6 +471,12 @@ namespace ccf
             setup_encryptor(resp.consensus_type);
             setup_consensus(resp.consensus_type, args.config, resp.public_only);
             setup_history();
+            setup_historical_states();
+
+            if (!startup_snapshot.empty())
+            {
+              join_from_snapshot_unsafe(resp.public_only);
+            }
 
             open_member_frontend();
 
@@ -500,6 +539,16 @@ namespace ccf
       std::lock_guard<SpinLock> guard(lock);
       sm.expect(State::pending);
 
+      // Joining starts once the host has replied with its latest snapshot, if
+      // it has one, which is applied when the node is trusted
+      join_args = args;
+      request_snapshot();
+    }
+
+    void start_join_unsafe()
+    {
+      const auto args = join_args.value();
+
       initiate_join(args);
 
       join_timer = timers.new_timer(
@@ -515,6 +564,53 @@ namespace ccf
       join_timer->start();
     }
 
+    void join_from_snapshot_unsafe(bool public_only)
+    {
+      std::vector<kv::Version> view_history;
+      auto result = network.tables->deserialise_snapshot(
+        startup_snapshot, &view_history, public_only);
+      startup_snapshot = {};
+
+      if (result == kv::DeserialiseSuccess::FAILED)
+      {
+        LOG_FAIL_FMT("Could not join from snapshot, replaying entire ledger");
+        return;
+      }
+
+      auto v = network.tables->current_version();
+      LOG_INFO_FMT("Joining from snapshot at {}", v);
+
+      // The local ledger continues from the snapshot
+      ledger_init(v);
+      consensus->init_as_backup(
+        v, view_history.empty() ? 0 : view_history.size() - 1, view_history);
+      snapshotter->set_last_snapshot_idx(v);
+
+      // Local hooks have not run for the state in the snapshot, so the
+      // configuration and the service status are read from it instead
+      Store::Tx tx;
+      auto [nodes_view, service_view] =
+        tx.get_view(network.nodes, network.service);
+
+      std::unordered_set<NodeId> configuration;
+      nodes_view->foreach([&](const NodeId& node_id, const NodeInfo& ni) {
+        if (ni.status == NodeStatus::TRUSTED)
+        {
+          add_node(node_id, ni.nodehost, ni.nodeport);
+          configuration.insert(node_id);
+        }
+        return true;
+      });
+      consensus->add_configuration(v, move(configuration));
+
+      auto service = service_view->get(0);
+      if (service.has_value() && service->status == ServiceStatus::OPEN)
+      {
+        consensus->set_f(1);
+        open_user_frontend();
+      }
+    }
+
     //
     // funcs in state "readingPublicLedger"
     //
@@ -523,25 +619,52 @@ namespace ccf
       std::lock_guard<SpinLock> guard(lock);
       sm.expect(State::readingPublicLedger);
       LOG_INFO_FMT("Start public recovery");
-      read_ledger_idx(++ledger_idx);
+
+      // Recovery starts from the host's latest snapshot, if it has one
+      request_snapshot();
     }
 
-    void recover_public_ledger_entry(const std::vector<uint8_t>& ledger_entry)
+    void recover_public_snapshot_unsafe(
+      consensus::Index idx, const std::vector<uint8_t>& snapshot)
     {
-      std::lock_guard<SpinLock> guard(lock);
-      sm.expect(State::readingPublicLedger);
+      consensus::Index ledger_idx = 0;
+      if (!snapshot.empty())
+      {
+        std::vector<kv::Version> view_history;
+        auto result =
+          network.tables->deserialise_snapshot(snapshot, &view_history, true);
+        if (result == kv::DeserialiseSuccess::FAILED)
+        {
+          LOG_FAIL_FMT("Could not recover from snapshot at {}", idx);
+          request_snapshot(idx);
+          return;
+        }
 
-      LOG_DEBUG_FMT(
-        "Deserialising public ledger entry ({})", ledger_entry.size());
+        ledger_idx = network.tables->current_version();
+        LOG_INFO_FMT(
+          "Recovering public ledger from snapshot at {}", ledger_idx);
+
+        ledger_init(ledger_idx);
+        term_history = view_history;
+        last_recovered_commit_idx = ledger_idx;
+      }
+
+      ledger_reader.start(ledger_idx);
+    }
+
+    bool recover_public_ledger_entry_unsafe(
+      consensus::Index ledger_idx, const CBuffer& entry)
+    {
+      LOG_DEBUG_FMT("Deserialising public ledger entry ({})", entry.n);
 
       // When reading the public ledger, deserialise in the real store
-      auto result = network.tables->deserialise(ledger_entry, true);
+      auto result = network.tables->deserialise(entry.p, entry.n, true);
       if (result == kv::DeserialiseSuccess::FAILED)
       {
         LOG_FAIL_FMT("Failed to deserialise entry in public ledger");
         network.tables->rollback(ledger_idx - 1);
         recover_public_ledger_end_unsafe();
-        return;
+        return false;
       }
 
       // If the ledger entry is a signature, it is safe to compact the store
@@ -567,7 +690,7 @@ namespace ccf
         }
       }
 
-      read_ledger_idx(++ledger_idx);
+      return true;
     }
 
     void recover_public_ledger_end_unsafe()
@@ -651,22 +774,19 @@ namespace ccf
     //
     // funcs in state "readingPrivateLedger"
     //
-    void recover_private_ledger_entry(const std::vector<uint8_t>& ledger_entry)
+    bool recover_private_ledger_entry_unsafe(
+      consensus::Index ledger_idx, const CBuffer& entry)
     {
-      std::lock_guard<SpinLock> guard(lock);
-      sm.expect(State::readingPrivateLedger);
-
-      LOG_INFO_FMT(
-        "Deserialising private ledger entry ({})", ledger_entry.size());
+      LOG_INFO_FMT("Deserialising private ledger entry ({})", entry.n);
 
       // When reading the private ledger, deserialise in the recovery store
-      auto result = recovery_store->deserialise(ledger_entry);
+      auto result = recovery_store->deserialise(entry.p, entry.n);
       if (result == kv::DeserialiseSuccess::FAILED)
       {
         LOG_FAIL_FMT("Failed to deserialise entry in private ledger");
         recovery_store->rollback(ledger_idx - 1);
         recover_private_ledger_end_unsafe();
-        return;
+        return false;
       }
 
       if (result == kv::DeserialiseSuccess::PASS_SIGNATURE)
@@ -676,11 +796,41 @@ namespace ccf
       {
         LOG_INFO_FMT("Reached recovery final version at {}", recovery_v);
         recover_private_ledger_end_unsafe();
+        return false;
       }
-      else
+
+      return true;
+    }
+
+    void recover_private_snapshot_unsafe(
+      consensus::Index idx, const std::vector<uint8_t>& snapshot)
+    {
+      consensus::Index ledger_idx = 0;
+      if (!snapshot.empty())
       {
-        read_ledger_idx(++ledger_idx);
+        if (
+          idx > recovery_v ||
+          recovery_store->deserialise_snapshot(snapshot) ==
+            kv::DeserialiseSuccess::FAILED)
+        {
+          LOG_FAIL_FMT("Could not recover from snapshot at {}", idx);
+          request_snapshot(idx);
+          return;
+        }
+
+        ledger_idx = recovery_store->current_version();
+        LOG_INFO_FMT(
+          "Recovering private ledger from snapshot at {}", ledger_idx);
+
+        if (ledger_idx == recovery_v)
+        {
+          recover_private_ledger_end_unsafe();
+          return;
+        }
       }
+
+      // The private ledger is only read up to the recovery version
+      ledger_reader.start(ledger_idx, recovery_v);
     }
 
     void recover_private_ledger_end_unsafe()
@@ -735,10 +885,28 @@ namespace ccf
     //
     // funcs in state "readingPublicLedger" or "readingPrivateLedger"
     //
-    void recover_ledger_end()
+    void recover_ledger_entries(
+      consensus::Index from, const uint8_t* data, size_t size)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+
+      // The reader ignores batches that arrive once recovery has stopped
+      // reading the ledger, such as the one read ahead of a failed entry
+      ledger_reader.handle_entries(
+        from, data, size, [this](consensus::Index idx, const CBuffer& entry) {
+          if (is_reading_public_ledger())
+            return recover_public_ledger_entry_unsafe(idx, entry);
+          return recover_private_ledger_entry_unsafe(idx, entry);
+        });
+    }
+
+    void recover_ledger_end(consensus::Index idx)
     {
       std::lock_guard<SpinLock> guard(lock);
 
+      if (!ledger_reader.handle_no_entry(idx))
+        return;
+
       if (is_reading_public_ledger())
       {
         recover_public_ledger_end_unsafe();
@@ -755,6 +923,48 @@ namespace ccf
       }
     }
 
+    //
+    // funcs in state "pending", "readingPublicLedger" or
+    // "readingPrivateLedger"
+    //
+    void recv_snapshot(
+      consensus::Index idx, const std::vector<uint8_t>& snapshot)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+
+      // An empty snapshot means that the host has none to offer
+      if (network.consensus_type != ConsensusType::RAFT && !snapshot.empty())
+      {
+        LOG_FAIL_FMT("Ignoring snapshot at {}: Raft only", idx);
+        recv_snapshot_unsafe(idx, {});
+        return;
+      }
+
+      recv_snapshot_unsafe(idx, snapshot);
+    }
+
+    void recv_snapshot_unsafe(
+      consensus::Index idx, const std::vector<uint8_t>& snapshot)
+    {
+      if (sm.check(State::pending))
+      {
+        startup_snapshot = snapshot;
+        start_join_unsafe();
+      }
+      else if (sm.check(State::readingPublicLedger))
+      {
+        recover_public_snapshot_unsafe(idx, snapshot);
+      }
+      else if (sm.check(State::readingPrivateLedger))
+      {
+        recover_private_snapshot_unsafe(idx, snapshot);
+      }
+      else
+      {
+        LOG_FAIL_FMT("Cannot use snapshot at {}: Unexpected state", idx);
+      }
+    }
+
     //
     // funcs in state "partOfPublicNetwork"
     //
@@ -856,9 +1066,9 @@ namespace ccf
         // Setup new temporary store and record current version/root
         setup_private_recovery_store();
 
-        // Start reading private security domain of ledger
-        ledger_idx = 0;
-        read_ledger_idx(++ledger_idx);
+        // Start reading private security domain of ledger, from the latest
+        // snapshot if there is one
+        request_snapshot();
 
         sm.advance(State::readingPrivateLedger);
       }
@@ -886,9 +1096,9 @@ namespace ccf
       // Setup new temporary store and record current version/root
       setup_private_recovery_store();
 
-      // Start reading private security domain of ledger
-      ledger_idx = 0;
-      read_ledger_idx(++ledger_idx);
+      // Start reading private security domain of ledger, from the latest
+      // snapshot if there is one
+      request_snapshot();
 
       sm.advance(State::readingPrivateLedger);
       return true;
@@ -904,7 +1114,19 @@ namespace ccf
         !sm.check(State::partOfPublicNetwork))
         return;
 
+      network.tables->tick(elapsed);
       consensus->periodic(elapsed);
+      if (network.historical_states)
+        network.historical_states->tick(elapsed);
+
+      if (snapshotter && sm.check(State::partOfNetwork))
+        snapshotter->update();
+    }
+
+    void ledger_durable(kv::Version version, size_t truncations)
+    {
+      if (consensus)
+        consensus->ledger_durable(version, truncations);
     }
 
     void node_msg(const std::vector<uint8_t>& data)
@@ -1328,9 +1550,9 @@ namespace ccf
       // from commit hook
       consensus->suspend_replication(recovery_v + 1);
 
-      // Start reading private security domain of ledger
-      ledger_idx = 0;
-      read_ledger_idx(++ledger_idx);
+      // Start reading private security domain of ledger, from the latest
+      // snapshot if there is one
+      request_snapshot();
 
       sm.advance(State::readingPrivateLedger);
     }
@@ -1458,6 +1680,11 @@ namespace ccf
         std::chrono::milliseconds(consensus_config.raft_request_timeout),
         std::chrono::milliseconds(consensus_config.raft_election_timeout),
         public_only);
+      raft->set_durable_ledger(consensus_config.raft_durable_ledger);
+      raft->set_ack_on_record(consensus_config.raft_ack_on_record);
+      raft->set_apply_dispatcher([](std::function<void()>&& help) {
+        ParallelDeserialiseDispatcher::dispatch(1, std::move(help));
+      });
 
       consensus = std::make_shared<RaftConsensusType>(std::move(raft));
 
@@ -1528,6 +1755,47 @@ namespace ccf
       network.tables->set_history(history);
     }
 
+    void setup_historical_states()
+    {
+      if (!network.historical_states)
+        return;
+
+      // Rebuilt stores verify signatures against the nodes and signatures
+      // they have replayed themselves, as a joining node would. They never
+      // sign anything with the node's key.
+      network.historical_states->set_history_factory(
+        [this](Store& store, const std::vector<uint8_t>& tree) {
+          auto history = std::make_shared<MerkleTxHistory>(
+            store,
+            self,
+            *node_sign_kp,
+            *store.get<Signatures>(Tables::SIGNATURES),
+            *store.get<Nodes>(Tables::NODES));
+          if (!tree.empty())
+            history->set_tree(tree);
+          return history;
+        });
+
+      // Each rebuilt store has an encryptor of its own, created from the
+      // ledger secrets, which hold every key used up to the last global
+      // commit. As for the recovery store, secrets are never sealed on
+      // compaction.
+      network.historical_states->set_encryptor_factory(
+        [this]() -> std::shared_ptr<kv::AbstractTxEncryptor> {
+#ifdef USE_NULL_ENCRYPTOR
+          return std::make_shared<NullTxEncryptor>();
+#else
+          if (network.consensus_type == ConsensusType::PBFT)
+          {
+            return std::make_shared<PbftTxEncryptor>(
+              network.ledger_secrets, true);
+          }
+          return std::make_shared<RaftTxEncryptor>(
+            self, network.ledger_secrets, true);
+#endif
+        });
+    }
+
     void setup_encryptor(ConsensusType consensus_type)
     {
       // This function makes use of network secrets and should be called once
@@ -1593,14 +1861,23 @@ namespace ccf
       }
     }
 
-    void read_ledger_idx(consensus::Index idx)
+    void ledger_truncate(consensus::Index idx)
     {
-      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_get, to_host, idx);
+      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_truncate, to_host, idx);
     }
 
-    void ledger_truncate(consensus::Index idx)
+    void ledger_init(consensus::Index idx)
     {
-      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_truncate, to_host, idx);
+      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_init, to_host, idx);
+
+      // Historical states cannot be rebuilt from entries before the snapshot
+      if (network.historical_states)
+        network.historical_states->set_ledger_start(idx);
+    }
+
+    void request_snapshot(consensus::Index before = 0)
+    {
+      RINGBUFFER_WRITE_MESSAGE(consensus::snapshot_get, to_host, before);
     }
 
     void setup_pbft(const CCFConfig& config)
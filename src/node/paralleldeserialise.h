@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "ds/thread_messaging.h"
+#include "entities.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+namespace ccf
+{
+  /** Lets the worker threads help deserialise large transactions, so that a
+   * follower applying a transaction which writes to several maps is not
+   * limited to a single thread.
+   *
+   * The thread deserialising the transaction does its share of the work, and
+   * does not wait for helpers to start, so a busy worker delays nothing.
+   */
+  class ParallelDeserialiseDispatcher
+  {
+  private:
+    struct HelpMsg
+    {
+      std::function<void()> help;
+    };
+
+    static void help_cb(std::unique_ptr<enclave::Tmsg<HelpMsg>> msg)
+    {
+      msg->data.help();
+    }
+
+  public:
+    static void dispatch(size_t helpers, std::function<void()>&& help)
+    {
+      if (enclave::ThreadMessaging::thread_count <= 1)
+        return;
+
+      const size_t workers = enclave::ThreadMessaging::thread_count - 1;
+      for (size_t i = 0; i < std::min(helpers, workers); ++i)
+      {
+        auto msg = std::make_unique<enclave::Tmsg<HelpMsg>>(&help_cb);
+        msg->data.help = help;
+        enclave::ThreadMessaging::thread_messaging.add_task<HelpMsg>(
+          enclave::ThreadMessaging::get_execution_thread(i), std::move(msg));
+      }
+    }
+
+    static void install(Store& store)
+    {
+      store.set_parallel_deserialise(&dispatch);
+    }
+  };
+}
@@ -2,6 +2,7 @@
 // Licensed under the Apache 2.0 License.
 #pragma once
 #include "ds/json_schema.h"
+#include "node/historicalqueries.h"
 #include "node/identity.h"
 #include "node/ledgersecrets.h"
 #include "node/nodes.h"
@@ -40,6 +41,18 @@ namespace ccf
     {
       HistogramResults histogram;
       nlohmann::json tx_rates;
+      kv::GroupCommitMetrics group_commit;
+      historical::StateCacheMetrics historical_states;
+      std::map<std::string, kv::ConflictMetrics> conflicts;
+      std::map<std::string, kv::GlobalHookMetrics> global_hooks;
+    };
+  };
+
+  struct GetMemoryMetrics
+  {
+    struct Out
+    {
+      std::map<std::string, kv::MemoryMetrics> maps;
     };
   };
 
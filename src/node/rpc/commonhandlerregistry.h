@@ -6,6 +6,7 @@
 #include "handlerregistry.h"
 #include "jsonhandler.h"
 #include "metrics.h"
+#include "node/networktables.h"
 
 namespace ccf
 {
@@ -20,6 +21,8 @@ namespace ccf
 
     Nodes* nodes = nullptr;
 
+    std::shared_ptr<historical::StateCache> historical_states = nullptr;
+
   protected:
     Store* tables = nullptr;
 
@@ -31,6 +34,13 @@ namespace ccf
       tables(&store)
     {}
 
+    CommonHandlerRegistry(
+      NetworkTables& network, const std::string& certs_table_name = "") :
+      CommonHandlerRegistry(*network.tables, certs_table_name)
+    {
+      historical_states = network.historical_states;
+    }
+
     void init_handlers(Store& t) override
     {
       HandlerRegistry::init_handlers(t);
@@ -57,9 +67,21 @@ namespace ccf
 
       auto get_metrics = [this](Store::Tx& tx, nlohmann::json&& params) {
         auto result = metrics.get_metrics();
+        result.group_commit = tables->get_group_commit_metrics();
+        result.conflicts = tables->get_conflict_metrics();
+        result.global_hooks = tables->get_global_hook_metrics();
+        if (historical_states != nullptr)
+          result.historical_states = historical_states->get_metrics();
         return make_success(result);
       };
 
+      // Walks every node of every map, so it is not part of getMetrics
+      auto get_memory_metrics =
+        [this](Store::Tx& tx, nlohmann::json&& params) {
+          return make_success(
+            GetMemoryMetrics::Out{tables->get_memory_metrics()});
+        };
+
       auto make_signature = [this](Store::Tx& tx, nlohmann::json&& params) {
         if (consensus != nullptr)
         {
@@ -242,6 +264,13 @@ namespace ccf
         .set_auto_schema<void, GetMetrics::Out>()
         .set_execute_locally(true)
         .set_http_get_only();
+      install(
+        GeneralProcs::GET_MEMORY_METRICS,
+        json_adapter(get_memory_metrics),
+        Read)
+        .set_auto_schema<void, GetMemoryMetrics::Out>()
+        .set_execute_locally(true)
+        .set_http_get_only();
       install(GeneralProcs::MK_SIGN, json_adapter(make_signature), Write)
         .set_auto_schema<void, bool>();
       install(GeneralProcs::WHO_AM_I, json_adapter(who_am_i), Read)
@@ -9,6 +9,7 @@ namespace ccf
   {
     static constexpr auto GET_COMMIT = "getCommit";
     static constexpr auto GET_METRICS = "getMetrics";
+    static constexpr auto GET_MEMORY_METRICS = "getMemoryMetrics";
     static constexpr auto MK_SIGN = "mkSign";
     static constexpr auto GET_PRIMARY_INFO = "getPrimaryInfo";
     static constexpr auto GET_NETWORK_INFO = "getNetworkInfo";
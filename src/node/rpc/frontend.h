@@ -5,8 +5,10 @@
 #include "consensus/pbft/pbftrequests.h"
 #include "consensus/pbft/pbfttables.h"
 #include "consts.h"
+#include "ds/arena.h"
 #include "ds/buffer.h"
 #include "ds/spinlock.h"
+#include "ds/thread_messaging.h"
 #include "enclave/rpchandler.h"
 #include "forwarder.h"
 #include "node/clientsignatures.h"
@@ -56,6 +58,95 @@ namespace ccf
     std::chrono::milliseconds ms_to_sig = std::chrono::milliseconds(1000);
     bool request_storing_disabled = false;
 
+    // Transactions which conflict on a hot key are executed again in the
+    // key's lane, as tasks on the worker thread given by
+    // ThreadMessaging::get_lane_thread. That thread also serves sessions, so
+    // the retries in a lane run one after the other, but may still conflict
+    // with transactions executing on other threads. A retry in a lane is
+    // attempted at most max_lane_attempts times, after which the caller is
+    // told that the transaction conflicted.
+    //
+    // While some of a session's requests are in a lane, its next requests are
+    // processed in the same lane, so that responses are sent to the session
+    // in the order its requests arrived.
+    std::shared_ptr<enclave::AbstractRPCResponder> rpc_responder;
+    static constexpr size_t max_lane_attempts = 100;
+
+    struct LaneMsg
+    {
+      RpcFrontend* frontend;
+      std::shared_ptr<enclave::RpcContext> ctx;
+      uint16_t session_thread;
+    };
+
+    struct LaneDoneMsg
+    {
+      std::shared_ptr<enclave::SessionContext> session;
+    };
+
+    static void process_in_lane_cb(
+      std::unique_ptr<enclave::Tmsg<LaneMsg>> msg)
+    {
+      auto& [frontend, ctx, session_thread] = msg->data;
+      frontend->process_in_lane(ctx, session_thread);
+    }
+
+    static void lane_done_cb(std::unique_ptr<enclave::Tmsg<LaneDoneMsg>> msg)
+    {
+      --msg->data.session->requests_in_lane;
+    }
+
+    bool can_defer_to_lane(std::shared_ptr<enclave::RpcContext> ctx)
+    {
+      return rpc_responder != nullptr &&
+        !ctx->session->original_caller.has_value() &&
+        enclave::ThreadMessaging::thread_count > 1;
+    }
+
+    void defer_to_lane(
+      std::shared_ptr<enclave::RpcContext> ctx, uint16_t lane_thread)
+    {
+      auto& session = *ctx->session;
+      session.lane_thread = lane_thread;
+      ++session.requests_in_lane;
+
+      auto msg =
+        std::make_unique<enclave::Tmsg<LaneMsg>>(&process_in_lane_cb);
+      msg->data = {
+        this, ctx, enclave::ThreadMessaging::thread_messaging.get_thread_id()};
+      enclave::ThreadMessaging::thread_messaging.add_task<LaneMsg>(
+        lane_thread, std::move(msg));
+    }
+
+    void process_in_lane(
+      std::shared_ptr<enclave::RpcContext> ctx, uint16_t session_thread)
+    {
+      ds::ArenaScope arena_scope;
+      update_consensus();
+
+      Store::Tx tx;
+      auto caller_id = handlers.get_caller_id(tx, ctx->session->caller_cert);
+      auto rep =
+        process_command(ctx, tx, caller_id, nullptr, max_lane_attempts);
+      if (!rep.has_value())
+      {
+        rep = forward_to_primary(ctx, caller_id);
+      }
+
+      if (rep.has_value())
+      {
+        rpc_responder->reply_async(
+          ctx->session->client_session_id, rep.value());
+      }
+
+      // Posted after the response, which the session's thread then sends
+      // first
+      auto done = std::make_unique<enclave::Tmsg<LaneDoneMsg>>(&lane_done_cb);
+      done->data.session = ctx->session;
+      enclave::ThreadMessaging::thread_messaging.add_task<LaneDoneMsg>(
+        session_thread, std::move(done));
+    }
+
     void update_consensus()
     {
       auto c = tables.get_consensus().get();
@@ -182,6 +273,12 @@ namespace ccf
       ms_to_sig = sig_max_ms;
     }
 
+    void set_rpc_responder(
+      std::shared_ptr<enclave::AbstractRPCResponder> rpc_responder_) override
+    {
+      rpc_responder = rpc_responder_;
+    }
+
     void set_cmd_forwarder(
       std::shared_ptr<enclave::AbstractForwarder> cmd_forwarder_) override
     {
@@ -207,6 +304,9 @@ namespace ccf
      * If an RPC that requires writing to the kv store is processed on a
      * backup, the serialised RPC is forwarded to the current network primary.
      *
+     * The read sets and views of transactions executed by this RPC are
+     * allocated from the calling thread's arena, which is reset on return.
+     *
      * @param ctx Context for this RPC
      * @returns nullopt if the result is pending (to be forwarded, or still
      * to-be-executed by consensus), else the response (may contain error)
@@ -214,6 +314,10 @@ namespace ccf
     std::optional<std::vector<uint8_t>> process(
       std::shared_ptr<enclave::RpcContext> ctx) override
     {
+      // Opened before any transaction is created, so that it is closed after
+      // they have all been destroyed
+      ds::ArenaScope arena_scope;
+
       update_consensus();
 
       Store::Tx tx;
@@ -261,33 +365,58 @@ namespace ccf
       }
       else
       {
-        auto rep = process_command(ctx, tx, caller_id);
+        // The session's earlier requests are still in a lane, so this one
+        // is processed after them, in the same lane
+        if (ctx->session->requests_in_lane > 0)
+        {
+          defer_to_lane(ctx, ctx->session->lane_thread);
+          return std::nullopt;
+        }
+
+        bool deferred = false;
+        auto rep = process_command(ctx, tx, caller_id, &deferred);
+
+        // The RPC is executed again in a lane, which replies to the session
+        if (deferred)
+        {
+          return std::nullopt;
+        }
 
         // If necessary, forward the RPC to the current primary
         if (!rep.has_value())
         {
-          if (consensus != nullptr)
-          {
-            auto primary_id = consensus->primary();
-
-            if (
-              primary_id != NoNode && cmd_forwarder &&
-              cmd_forwarder->forward_command(
-                ctx, primary_id, caller_id, get_cert_to_forward(ctx)))
-            {
-              // Indicate that the RPC has been forwarded to primary
-              LOG_DEBUG_FMT("RPC forwarded to primary {}", primary_id);
-              return std::nullopt;
-            }
-          }
-          ctx->set_response_status(HTTP_STATUS_INTERNAL_SERVER_ERROR);
-          ctx->set_response_body("RPC could not be forwarded to primary.");
-          return ctx->serialise_response();
+          return forward_to_primary(ctx, caller_id);
         }
         return rep.value();
       }
     }
 
+    /** Forward an RPC to the current primary
+     *
+     * @return nullopt if the RPC was forwarded, else an error response
+     */
+    std::optional<std::vector<uint8_t>> forward_to_primary(
+      std::shared_ptr<enclave::RpcContext> ctx, CallerId caller_id)
+    {
+      if (consensus != nullptr)
+      {
+        auto primary_id = consensus->primary();
+
+        if (
+          primary_id != NoNode && cmd_forwarder &&
+          cmd_forwarder->forward_command(
+            ctx, primary_id, caller_id, get_cert_to_forward(ctx)))
+        {
+          // Indicate that the RPC has been forwarded to primary
+          LOG_DEBUG_FMT("RPC forwarded to primary {}", primary_id);
+          return std::nullopt;
+        }
+      }
+      ctx->set_response_status(HTTP_STATUS_INTERNAL_SERVER_ERROR);
+      ctx->set_response_body("RPC could not be forwarded to primary.");
+      return ctx->serialise_response();
+    }
+
     virtual std::vector<uint8_t> get_cert_to_forward(
       std::shared_ptr<enclave::RpcContext> ctx)
     {
@@ -395,7 +524,9 @@ namespace ccf
     std::optional<std::vector<uint8_t>> process_command(
       std::shared_ptr<enclave::RpcContext> ctx,
       Store::Tx& tx,
-      CallerId caller_id)
+      CallerId caller_id,
+      bool* deferred = nullptr,
+      size_t max_attempts = 0)
     {
       const auto method = ctx->get_method();
       const auto local_method = method.substr(method.find_first_not_of('/'));
@@ -518,13 +649,41 @@ namespace ccf
         }
       }
 
-      auto func = handler->func;
-      auto args = RequestArgs{ctx, tx, caller_id};
-
       tx_count++;
 
-      while (true)
+      return execute(
+        ctx, tx, caller_id, handler->func, deferred, max_attempts);
+    }
+
+    /** Execute a handler until its transaction commits or it fails.
+     *
+     * @param deferred If not nullptr, a transaction which conflicts on a hot
+     * key may be processed again in the lane for that key. This is then set,
+     * nullopt is returned, and the lane sends the response to the session.
+     * @param max_attempts If not 0, the number of times the handler may be
+     * executed before the transaction is given up on as conflicting
+     */
+    std::optional<std::vector<uint8_t>> execute(
+      std::shared_ptr<enclave::RpcContext> ctx,
+      Store::Tx& tx,
+      CallerId caller_id,
+      const HandleFunction& func,
+      bool* deferred,
+      size_t max_attempts)
+    {
+      auto args = RequestArgs{ctx, tx, caller_id};
+
+      for (size_t attempts = 0;; ++attempts)
       {
+        if (max_attempts != 0 && attempts == max_attempts)
+        {
+          ctx->set_response_status(HTTP_STATUS_CONFLICT);
+          ctx->set_response_body(fmt::format(
+            "Transaction continued to conflict after {} attempts.",
+            max_attempts));
+          return ctx->serialise_response();
+        }
+
         try
         {
           func(args);
@@ -572,6 +731,18 @@ namespace ccf
 
             case kv::CommitSuccess::CONFLICT:
             {
+              auto hot_conflict = tx.get_hot_conflict();
+              if (
+                deferred != nullptr && hot_conflict.has_value() &&
+                can_defer_to_lane(ctx))
+              {
+                defer_to_lane(
+                  ctx,
+                  enclave::ThreadMessaging::get_lane_thread(
+                    hot_conflict.value()));
+                *deferred = true;
+                return std::nullopt;
+              }
               break;
             }
 
@@ -583,6 +754,11 @@ namespace ccf
             }
           }
         }
+        catch (const kv::EarlyConflict&)
+        {
+          // The transaction would conflict at commit, so run it again now
+          tx.reset_conflicted();
+        }
         catch (const RpcException& e)
         {
           ctx->set_response_status(e.status);
@@ -476,7 +476,7 @@ namespace ccf
 
   public:
     MemberHandlers(NetworkTables& network, AbstractNodeState& node) :
-      CommonHandlerRegistry(*network.tables, Tables::MEMBER_CERTS),
+      CommonHandlerRegistry(network, Tables::MEMBER_CERTS),
       network(network),
       node(node),
       tsr(network)
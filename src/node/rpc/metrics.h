@@ -74,9 +74,9 @@ namespace metrics
   public:
     ccf::GetMetrics::Out get_metrics()
     {
-      nlohmann::json result;
-      result["histogram"] = get_histogram_results();
-      result["tx_rates"] = get_tx_rates();
+      ccf::GetMetrics::Out result;
+      result.histogram = get_histogram_results();
+      result.tx_rates = get_tx_rates();
 
       return result;
     }
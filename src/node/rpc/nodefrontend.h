@@ -137,7 +137,7 @@ namespace ccf
 
   public:
     NodeHandlers(NetworkState& network, AbstractNodeState& node) :
-      CommonHandlerRegistry(*network.tables),
+      CommonHandlerRegistry(network),
       network(network),
       node(node)
     {}
@@ -77,7 +77,17 @@ namespace ccf
   DECLARE_JSON_REQUIRED_FIELDS(
     GetMetrics::HistogramResults, low, high, overflow, underflow, buckets)
   DECLARE_JSON_TYPE(GetMetrics::Out)
-  DECLARE_JSON_REQUIRED_FIELDS(GetMetrics::Out, histogram, tx_rates)
+  DECLARE_JSON_REQUIRED_FIELDS(
+    GetMetrics::Out,
+    histogram,
+    tx_rates,
+    group_commit,
+    historical_states,
+    conflicts,
+    global_hooks)
+
+  DECLARE_JSON_TYPE(GetMemoryMetrics::Out)
+  DECLARE_JSON_REQUIRED_FIELDS(GetMemoryMetrics::Out, maps)
 
   DECLARE_JSON_TYPE(GetPrimaryInfo::Out)
   DECLARE_JSON_REQUIRED_FIELDS(
@@ -71,7 +71,7 @@ namespace ccf
     {}
 
     UserHandlerRegistry(NetworkTables& network) :
-      CommonHandlerRegistry(*network.tables, Tables::USER_CERTS)
+      CommonHandlerRegistry(network, Tables::USER_CERTS)
     {}
   };
 
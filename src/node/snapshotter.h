@@ -0,0 +1,113 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "consensus/ledgerenclavetypes.h"
+#include "ds/logger.h"
+#include "ds/ringbuffer_types.h"
+#include "ds/thread_messaging.h"
+#include "entities.h"
+
+#include <atomic>
+#include <memory>
+
+namespace ccf
+{
+  class Snapshotter : public std::enable_shared_from_this<Snapshotter>
+  {
+  private:
+    ringbuffer::WriterPtr to_host;
+    std::shared_ptr<Store> store;
+    const size_t snapshot_tx_interval;
+
+    kv::Version last_snapshot_idx = 0;
+    std::atomic<bool> snapshot_in_progress = false;
+
+    struct SnapshotMsg
+    {
+      std::shared_ptr<Snapshotter> self;
+      std::unique_ptr<Store::Snapshot> snapshot;
+    };
+
+    static void serialise_snapshot_cb(
+      std::unique_ptr<enclave::Tmsg<SnapshotMsg>> msg)
+    {
+      msg->data.self->serialise_snapshot(std::move(msg->data.snapshot));
+    }
+
+    void serialise_snapshot(std::unique_ptr<Store::Snapshot> snapshot)
+    {
+      auto idx = static_cast<consensus::Index>(snapshot->get_version());
+
+      // The whole snapshot is sent to the host in one message. If it is
+      // larger than the ringbuffer's maximum message size, writing it throws
+      // and no snapshot is taken.
+      try
+      {
+        auto serialised = snapshot->serialise();
+        RINGBUFFER_WRITE_MESSAGE(consensus::snapshot, to_host, idx, serialised);
+        LOG_DEBUG_FMT("Sent snapshot at {} ({} bytes)", idx, serialised.size());
+      }
+      catch (const std::exception& e)
+      {
+        LOG_FAIL_FMT("Could not write snapshot at {}: {}", idx, e.what());
+      }
+
+      snapshot_in_progress = false;
+    }
+
+  public:
+    Snapshotter(
+      ringbuffer::AbstractWriterFactory& writer_factory,
+      std::shared_ptr<Store> store_,
+      size_t snapshot_tx_interval_) :
+      to_host(writer_factory.create_writer_to_outside()),
+      store(store_),
+      snapshot_tx_interval(snapshot_tx_interval_)
+    {}
+
+    void set_last_snapshot_idx(kv::Version idx)
+    {
+      last_snapshot_idx = idx;
+    }
+
+    /** Take a snapshot of the store if enough transactions have been
+     * committed since the last one.
+     *
+     * Only the state of the store is captured on the calling thread. The
+     * snapshot is serialised and sent to the host by a worker thread, if
+     * there is one. There is at most one snapshot in progress at a time.
+     */
+    void update()
+    {
+      if (snapshot_tx_interval == 0 || snapshot_in_progress)
+        return;
+
+      if (store->commit_version() - last_snapshot_idx < snapshot_tx_interval)
+        return;
+
+      auto snapshot = store->snapshot();
+      if (snapshot == nullptr)
+        return;
+
+      last_snapshot_idx = snapshot->get_version();
+      snapshot_in_progress = true;
+
+      auto msg =
+        std::make_unique<enclave::Tmsg<SnapshotMsg>>(&serialise_snapshot_cb);
+      msg->data.self = shared_from_this();
+      msg->data.snapshot = std::move(snapshot);
+
+      if (enclave::ThreadMessaging::thread_count > 1)
+      {
+        enclave::ThreadMessaging::thread_messaging.add_task<SnapshotMsg>(
+          enclave::ThreadMessaging::get_execution_thread(last_snapshot_idx),
+          std::move(msg));
+      }
+      else
+      {
+        serialise_snapshot_cb(std::move(msg));
+      }
+    }
+  };
+}
@@ -0,0 +1,428 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "node/historicalqueries.h"
+
+#include "consensus/test/stub_consensus.h"
+#include "ds/messaging.h"
+#include "node/encryptor.h"
+#include "node/history.h"
+#include "node/nodes.h"
+#include "node/signatures.h"
+
+#include <algorithm>
+#include <cstring>
+#include <doctest/doctest.h>
+#include <map>
+#include <string>
+
+using namespace ccf;
+
+using MapT = Store::Map<size_t, std::string>;
+
+crypto::Sha256Hash chain_root(uint64_t chain)
+{
+  crypto::Sha256Hash root;
+  std::memcpy(root.h.data(), &chain, sizeof(chain));
+  return root;
+}
+
+uint64_t chain_append(uint64_t chain, const uint8_t* data, size_t size)
+{
+  return chain * 31 +
+    std::hash<std::string>{}(std::string(data, data + size));
+}
+
+// Stands in for the Merkle tree: chains the hashes of the entries applied to
+// the store, and only verifies signatures over the current chain
+class ChainedHistory : public NullTxHistory
+{
+  Signatures& signatures;
+
+public:
+  uint64_t chain;
+
+  ChainedHistory(
+    Store& store,
+    tls::KeyPair& kp,
+    Signatures& signatures_,
+    Nodes& nodes,
+    uint64_t chain_) :
+    NullTxHistory(store, 0, kp, signatures_, nodes),
+    signatures(signatures_),
+    chain(chain_)
+  {}
+
+  void append(const std::vector<uint8_t>& replicated) override
+  {
+    append(replicated.data(), replicated.size());
+  }
+
+  void append(const uint8_t* replicated, size_t replicated_size) override
+  {
+    chain = chain_append(chain, replicated, replicated_size);
+  }
+
+  bool verify(kv::Term* term = nullptr) override
+  {
+    Store::Tx tx;
+    auto sig = tx.get_view(signatures)->get(0);
+    if (!sig.has_value())
+      return false;
+
+    if (term)
+      *term = sig->term;
+    return sig->root == chain_root(chain);
+  }
+
+  std::vector<uint8_t> serialise_tree(kv::Version v) override
+  {
+    std::vector<uint8_t> tree(sizeof(chain));
+    std::memcpy(tree.data(), &chain, sizeof(chain));
+    return tree;
+  }
+};
+
+class ViewConsensus : public kv::StubConsensus
+{
+public:
+  View view;
+
+  ViewConsensus(View view_) : view(view_) {}
+
+  View get_view(SeqNo seqno) override
+  {
+    return view;
+  }
+};
+
+struct TestLedger
+{
+  ringbuffer::Circuit& eio;
+  std::map<consensus::Index, std::vector<uint8_t>> entries;
+  uint64_t chain = 0;
+
+  void add(consensus::Index idx, const std::vector<uint8_t>& entry)
+  {
+    entries[idx] = entry;
+    chain = chain_append(chain, entry.data(), entry.size());
+  }
+
+  void write(Store& store, MapT& map)
+  {
+    auto idx = store.next_version();
+    Store::Tx tx(idx);
+    auto view = tx.get_view(map);
+    view->put(0, fmt::format("value at {}", idx));
+    auto [success, reqid, data] = tx.commit_reserved();
+    REQUIRE(success == kv::CommitSuccess::OK);
+    add(idx, data);
+  }
+
+  void sign(Store& store, Signatures& signatures, kv::Term term)
+  {
+    auto idx = store.next_version();
+    Store::Tx tx(idx);
+    auto view = tx.get_view(signatures);
+    Signature sig(0, idx);
+    sig.term = term;
+    sig.root = chain_root(chain);
+    view->put(0, sig);
+    auto [success, reqid, data] = tx.commit_reserved();
+    REQUIRE(success == kv::CommitSuccess::OK);
+    add(idx, data);
+  }
+
+  // Replies to the cache's requests, as the host would, until it stops
+  // requesting entries. Returns the number of requests
+  size_t serve(historical::StateCache& cache)
+  {
+    size_t served = 0;
+    while (true)
+    {
+      std::vector<consensus::Index> requested;
+      eio.read_from_inside().read(
+        -1, [&](ringbuffer::Message m, const uint8_t* data, size_t size) {
+          REQUIRE(m == consensus::ledger_get_historical);
+          auto [idx] =
+            ringbuffer::read_message<consensus::ledger_get_historical>(
+              data, size);
+          requested.push_back(idx);
+        });
+
+      if (requested.empty())
+        return served;
+
+      for (auto idx : requested)
+      {
+        auto search = entries.find(idx);
+        if (search != entries.end())
+          cache.handle_ledger_entry(idx, search->second);
+        else
+          cache.handle_no_entry(idx);
+      }
+      served += requested.size();
+    }
+  }
+};
+
+struct TestStore
+{
+  Store store;
+  MapT& map;
+  Signatures& signatures;
+  Nodes& nodes;
+  tls::KeyPairPtr kp = tls::make_key_pair();
+
+  TestStore() :
+    map(store.create<MapT>("map", kv::SecurityDomain::PUBLIC)),
+    signatures(store.create<Signatures>(
+      Tables::SIGNATURES, kv::SecurityDomain::PUBLIC)),
+    nodes(store.create<Nodes>(Tables::NODES, kv::SecurityDomain::PUBLIC))
+  {}
+
+  historical::StateCache::HistoryFactory history_factory()
+  {
+    return [this](Store& s, const std::vector<uint8_t>& tree) {
+      uint64_t chain = 0;
+      if (!tree.empty())
+        std::memcpy(&chain, tree.data(), sizeof(chain));
+      return std::make_shared<ChainedHistory>(
+        s,
+        *kp,
+        *s.get<Signatures>(Tables::SIGNATURES),
+        *s.get<Nodes>(Tables::NODES),
+        chain);
+    };
+  }
+};
+
+std::string read_at(
+  historical::StateCache& cache, MapT& map, consensus::Index idx)
+{
+  Store::Tx tx;
+  REQUIRE(cache.set_read_version(tx, idx));
+  auto view = tx.get_view(map);
+  auto value = view->get(0);
+  REQUIRE(value.has_value());
+  return value.value();
+}
+
+TEST_CASE("Historical states are rebuilt from the ledger")
+{
+  TestStore ts;
+  auto& store = ts.store;
+  auto& map = ts.map;
+
+  ringbuffer::Circuit eio(1 << 16);
+  ringbuffer::WriterFactory wf(eio);
+  TestLedger ledger{eio};
+
+  store.set_encryptor(std::make_shared<NullTxEncryptor>());
+  for (size_t i = 1; i <= 5; ++i)
+    ledger.write(store, map);
+  ledger.sign(store, ts.signatures, 2);
+  store.compact(6);
+
+  historical::StateCache cache(store, wf);
+
+  INFO("Nothing is rebuilt until rebuilt stores can verify the ledger");
+  {
+    REQUIRE(cache.get_store_at(3) == nullptr);
+    REQUIRE(ledger.serve(cache) == 0);
+    cache.set_history_factory(ts.history_factory());
+  }
+
+  // Each rebuild has an encryptor of its own, which the live store's
+  // compactions cannot affect
+  size_t encryptors = 0;
+  cache.set_encryptor_factory([&encryptors]() {
+    encryptors++;
+    return std::make_shared<NullTxEncryptor>();
+  });
+
+  INFO("Latest committed state is read from the live store");
+  {
+    REQUIRE(read_at(cache, map, 6) == "value at 5");
+    REQUIRE(ledger.serve(cache) == 0);
+    REQUIRE(cache.get_metrics().live_hits == 1);
+  }
+
+  INFO("Older states are rebuilt, up to the signature that covers them");
+  {
+    Store::Tx tx;
+    REQUIRE_FALSE(cache.set_read_version(tx, 3));
+    REQUIRE_FALSE(cache.set_read_version(tx, 3));
+    REQUIRE(ledger.serve(cache) == 6);
+    REQUIRE(read_at(cache, map, 3) == "value at 3");
+
+    auto metrics = cache.get_metrics();
+    REQUIRE(metrics.misses == 3);
+    REQUIRE(metrics.cache_hits == 1);
+    REQUIRE(metrics.rebuilds == 1);
+    REQUIRE(metrics.entries_applied == 6);
+    REQUIRE(metrics.cached_states == 1);
+    REQUIRE(encryptors == 1);
+  }
+
+  INFO("Rebuilds continue from the closest earlier state");
+  {
+    REQUIRE(cache.get_store_at(4) == nullptr);
+    REQUIRE(ledger.serve(cache) == 3);
+    REQUIRE(read_at(cache, map, 4) == "value at 4");
+    REQUIRE(read_at(cache, map, 3) == "value at 3");
+
+    auto metrics = cache.get_metrics();
+    REQUIRE(metrics.rebuilds == 2);
+    REQUIRE(metrics.entries_applied == 9);
+    REQUIRE(metrics.cached_states == 2);
+    REQUIRE(encryptors == 2);
+  }
+
+  INFO("Uncommitted states are not rebuilt");
+  {
+    REQUIRE(cache.get_store_at(7) == nullptr);
+    REQUIRE(ledger.serve(cache) == 0);
+  }
+
+  INFO("Least recently used states are evicted");
+  {
+    cache.set_max_cache_bytes(1);
+    REQUIRE(cache.get_store_at(2) == nullptr);
+    REQUIRE(ledger.serve(cache) == 6);
+    REQUIRE(read_at(cache, map, 2) == "value at 2");
+
+    auto metrics = cache.get_metrics();
+    REQUIRE(metrics.cached_states == 1);
+    REQUIRE(cache.get_store_at(3) == nullptr);
+    REQUIRE(ledger.serve(cache) == 4);
+  }
+
+  INFO("Rebuilds fail if the ledger is missing entries");
+  {
+    ledger.entries.erase(1);
+    cache.set_max_cache_bytes(historical::StateCache::default_max_cache_bytes);
+    REQUIRE(cache.get_store_at(1) == nullptr);
+    REQUIRE(ledger.serve(cache) == 1);
+    REQUIRE(cache.get_metrics().failed_rebuilds == 1);
+  }
+
+  INFO("Failed rebuilds are not attempted again for a while");
+  {
+    REQUIRE(cache.get_store_at(1) == nullptr);
+    REQUIRE(ledger.serve(cache) == 0);
+
+    cache.tick(std::chrono::milliseconds(
+      historical::StateCache::failed_rebuild_retry_ms));
+    REQUIRE(cache.get_store_at(1) == nullptr);
+    REQUIRE(ledger.serve(cache) == 1);
+    REQUIRE(cache.get_metrics().failed_rebuilds == 2);
+  }
+}
+
+TEST_CASE("Historical entries are fetched once")
+{
+  TestStore ts;
+  auto& store = ts.store;
+  auto& map = ts.map;
+
+  ringbuffer::Circuit eio(1 << 16);
+  ringbuffer::WriterFactory wf(eio);
+  TestLedger ledger{eio};
+
+  for (size_t i = 1; i <= 5; ++i)
+    ledger.write(store, map);
+  ledger.sign(store, ts.signatures, 2);
+  store.compact(6);
+
+  historical::StateCache cache(store, wf);
+  cache.set_history_factory(ts.history_factory());
+
+  INFO("Rebuilds waiting for the same entries share them");
+  {
+    REQUIRE(cache.get_store_at(2) == nullptr);
+    REQUIRE(cache.get_store_at(4) == nullptr);
+    REQUIRE(ledger.serve(cache) == 6);
+    REQUIRE(read_at(cache, map, 2) == "value at 2");
+    REQUIRE(read_at(cache, map, 4) == "value at 4");
+    REQUIRE(cache.get_metrics().entries_applied == 12);
+  }
+
+  INFO("States are not rebuilt from before the start of the ledger");
+  {
+    cache.set_ledger_start(3);
+    REQUIRE(cache.get_store_at(1) == nullptr);
+    REQUIRE(ledger.serve(cache) == 0);
+    REQUIRE(cache.get_metrics().failed_rebuilds == 1);
+
+    INFO("But may be from cached states after it");
+    REQUIRE(cache.get_store_at(5) == nullptr);
+    REQUIRE(ledger.serve(cache) == 2);
+    REQUIRE(read_at(cache, map, 5) == "value at 5");
+  }
+}
+
+TEST_CASE("Historical states are verified against signatures")
+{
+  TestStore ts;
+  auto& store = ts.store;
+  auto& map = ts.map;
+
+  ringbuffer::Circuit eio(1 << 16);
+  ringbuffer::WriterFactory wf(eio);
+  TestLedger ledger{eio};
+
+  for (size_t i = 1; i <= 3; ++i)
+    ledger.write(store, map);
+  ledger.sign(store, ts.signatures, 2);
+  ledger.write(store, map);
+  store.compact(5);
+
+  auto consensus = std::make_shared<ViewConsensus>(2);
+  store.set_consensus(consensus);
+
+  historical::StateCache cache(store, wf);
+  cache.set_history_factory(ts.history_factory());
+
+  INFO("Entries which do not match the signature are rejected");
+  {
+    auto good = ledger.entries[2];
+    auto& bad = ledger.entries[2];
+    std::string value = "value at 2";
+    auto search =
+      std::search(bad.begin(), bad.end(), value.begin(), value.end());
+    REQUIRE(search != bad.end());
+    *search = 'V';
+
+    REQUIRE(cache.get_store_at(2) == nullptr);
+    REQUIRE(ledger.serve(cache) == 4);
+    REQUIRE(cache.get_metrics().failed_rebuilds == 1);
+    REQUIRE(cache.get_metrics().rebuilds == 0);
+
+    ledger.entries[2] = good;
+    REQUIRE(cache.get_store_at(2) == nullptr);
+    REQUIRE(ledger.serve(cache) == 0);
+
+    cache.tick(std::chrono::milliseconds(
+      historical::StateCache::failed_rebuild_retry_ms));
+    REQUIRE(cache.get_store_at(2) == nullptr);
+    REQUIRE(ledger.serve(cache) == 4);
+    REQUIRE(read_at(cache, map, 2) == "value at 2");
+  }
+
+  INFO("Signatures from a view which did not commit them are rejected");
+  {
+    consensus->view = 3;
+    REQUIRE(cache.get_store_at(3) == nullptr);
+    REQUIRE(ledger.serve(cache) == 2);
+    REQUIRE(cache.get_metrics().failed_rebuilds == 2);
+    consensus->view = 2;
+  }
+
+  INFO("States after the last signature are not available");
+  {
+    REQUIRE(cache.get_store_at(5) == nullptr);
+    REQUIRE(ledger.serve(cache) == 4);
+    REQUIRE(cache.get_metrics().failed_rebuilds == 3);
+  }
+}
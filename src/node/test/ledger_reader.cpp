@@ -0,0 +1,175 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "node/ledgerreader.h"
+
+#include "ds/messaging.h"
+
+#include <doctest/doctest.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace ccf;
+
+using Range = std::pair<consensus::Index, consensus::Index>;
+
+// Frames the entries at [from, to], each holding its index as a string
+std::vector<uint8_t> make_batch(consensus::Index from, consensus::Index to)
+{
+  std::vector<uint8_t> batch;
+  for (auto idx = from; idx <= to; ++idx)
+  {
+    auto entry = std::to_string(idx);
+    uint32_t frame = entry.size();
+    auto p = reinterpret_cast<const uint8_t*>(&frame);
+    batch.insert(batch.end(), p, p + sizeof(frame));
+    batch.insert(batch.end(), entry.begin(), entry.end());
+  }
+  return batch;
+}
+
+std::vector<Range> read_requests(ringbuffer::Circuit& eio)
+{
+  std::vector<Range> requests;
+  eio.read_from_inside().read(
+    -1, [&](ringbuffer::Message m, const uint8_t* data, size_t size) {
+      REQUIRE(m == consensus::ledger_get_range);
+      auto [from, to] =
+        ringbuffer::read_message<consensus::ledger_get_range>(data, size);
+      requests.emplace_back(from, to);
+    });
+  return requests;
+}
+
+struct Applied
+{
+  std::vector<consensus::Index> indices;
+  consensus::Index fail_at = 0;
+
+  LedgerReader::ApplyEntry apply()
+  {
+    return [this](consensus::Index idx, const CBuffer& entry) {
+      REQUIRE(std::string(entry.p, entry.p + entry.n) == std::to_string(idx));
+      if (idx == fail_at)
+        return false;
+      indices.push_back(idx);
+      return true;
+    };
+  }
+};
+
+void handle_batch(
+  LedgerReader& reader,
+  consensus::Index from,
+  consensus::Index to,
+  Applied& applied)
+{
+  auto batch = make_batch(from, to);
+  reader.handle_entries(from, batch.data(), batch.size(), applied.apply());
+}
+
+constexpr auto end_of_ledger = LedgerReader::end_of_ledger;
+
+TEST_CASE("Ledger is read in batches")
+{
+  ringbuffer::Circuit eio(1 << 12);
+  ringbuffer::WriterFactory wf(eio);
+  LedgerReader reader(wf);
+  Applied applied;
+
+  reader.start(0);
+  REQUIRE(read_requests(eio) == std::vector<Range>{{1, end_of_ledger}});
+
+  INFO("The next batch is asked for as soon as one arrives");
+  {
+    handle_batch(reader, 1, 3, applied);
+    REQUIRE(read_requests(eio) == std::vector<Range>{{4, end_of_ledger}});
+    REQUIRE(applied.indices == std::vector<consensus::Index>{1, 2, 3});
+    REQUIRE(reader.get_last_idx() == 3);
+  }
+
+  INFO("Batches which do not follow the last entry read are ignored");
+  {
+    handle_batch(reader, 3, 5, applied);
+    handle_batch(reader, 5, 6, applied);
+    REQUIRE(read_requests(eio).empty());
+    REQUIRE(applied.indices.size() == 3);
+    REQUIRE_FALSE(reader.handle_no_entry(6));
+    REQUIRE(reader.is_reading());
+  }
+
+  INFO("Reading stops at the end of the ledger");
+  {
+    handle_batch(reader, 4, 4, applied);
+    REQUIRE(read_requests(eio) == std::vector<Range>{{5, end_of_ledger}});
+    REQUIRE(reader.handle_no_entry(5));
+    REQUIRE_FALSE(reader.is_reading());
+    REQUIRE(applied.indices == std::vector<consensus::Index>{1, 2, 3, 4});
+  }
+}
+
+TEST_CASE("Ledger is read up to the end of a range")
+{
+  ringbuffer::Circuit eio(1 << 12);
+  ringbuffer::WriterFactory wf(eio);
+  LedgerReader reader(wf);
+  Applied applied;
+
+  // As when recovering the private ledger from a snapshot at 10, up to 15
+  reader.start(10, 15);
+  REQUIRE(read_requests(eio) == std::vector<Range>{{11, 15}});
+
+  handle_batch(reader, 11, 13, applied);
+  REQUIRE(read_requests(eio) == std::vector<Range>{{14, 15}});
+
+  INFO("No batch is asked for past the end of the range");
+  {
+    handle_batch(reader, 14, 15, applied);
+    REQUIRE(read_requests(eio).empty());
+    REQUIRE(
+      applied.indices == std::vector<consensus::Index>{11, 12, 13, 14, 15});
+    REQUIRE(reader.get_last_idx() == 15);
+  }
+}
+
+TEST_CASE("Ledger reading stops at an entry which cannot be applied")
+{
+  ringbuffer::Circuit eio(1 << 12);
+  ringbuffer::WriterFactory wf(eio);
+  LedgerReader reader(wf);
+  Applied applied;
+
+  reader.start(0);
+  read_requests(eio);
+
+  INFO("Entries after the failed one in the batch are not applied");
+  {
+    applied.fail_at = 3;
+    handle_batch(reader, 1, 5, applied);
+    REQUIRE(applied.indices == std::vector<consensus::Index>{1, 2});
+    REQUIRE(reader.get_last_idx() == 3);
+    REQUIRE_FALSE(reader.is_reading());
+  }
+
+  INFO("The batch read ahead is ignored when it arrives");
+  {
+    REQUIRE(read_requests(eio) == std::vector<Range>{{6, end_of_ledger}});
+    handle_batch(reader, 6, 8, applied);
+    REQUIRE_FALSE(reader.handle_no_entry(9));
+    REQUIRE(read_requests(eio).empty());
+    REQUIRE(applied.indices.size() == 2);
+  }
+
+  INFO("Replies to requests made before reading restarted are ignored");
+  {
+    applied.fail_at = 0;
+    reader.start(0, 4);
+    REQUIRE(read_requests(eio) == std::vector<Range>{{1, 4}});
+    handle_batch(reader, 9, 9, applied);
+    REQUIRE(applied.indices.size() == 2);
+
+    handle_batch(reader, 1, 4, applied);
+    REQUIRE(applied.indices == std::vector<consensus::Index>{1, 2, 1, 2, 3, 4});
+  }
+}
@@ -62,8 +62,8 @@ def run(args):
         network.start_and_join(args)
         primary, term = network.find_primary()
 
-        ledger_filename = network.find_primary()[0].remote.ledger_path()
-        ledger = infra.ledger.Ledger(ledger_filename)
+        ledger_dir = network.find_primary()[0].remote.ledger_path()
+        ledger = infra.ledger.Ledger(ledger_dir)
         (
             original_proposals,
             original_votes,
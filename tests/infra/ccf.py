@@ -159,7 +159,7 @@ class Network:
             node.network_state = infra.node.NodeNetworkState.joined
 
     def _start_all_nodes(
-        self, args, recovery=False, ledger_file=None, sealed_secrets=None
+        self, args, recovery=False, ledger_dir=None, sealed_secrets=None
     ):
         hosts = self.hosts or ["localhost"] * number_of_local.nodes()
 
@@ -192,7 +192,7 @@ class Network:
                     else:
                         node.recover(
                             lib_name=args.package,
-                            ledger_file=ledger_file,
+                            ledger_dir=ledger_dir,
                             sealed_secrets=sealed_secrets,
                             workspace=args.workspace,
                             label=args.label,
@@ -280,10 +280,10 @@ class Network:
         self.status = ServiceStatus.OPEN
         LOG.success("***** Network is now open *****")
 
-    def start_in_recovery(self, args, ledger_file, sealed_secrets):
+    def start_in_recovery(self, args, ledger_dir, sealed_secrets):
         self.common_dir = get_common_folder_name(args.workspace, args.label)
         primary = self._start_all_nodes(
-            args, recovery=True, ledger_file=ledger_file, sealed_secrets=sealed_secrets
+            args, recovery=True, ledger_dir=ledger_dir, sealed_secrets=sealed_secrets
         )
         self.wait_for_all_nodes_to_catch_up(primary)
         LOG.success("All nodes joined recovered public network")
@@ -1,13 +1,17 @@
 # Copyright (c) Microsoft Corporation. All rights reserved.
 # Licensed under the Apache 2.0 License.
 import io
+import itertools
 import msgpack
+import os
+import re
 import struct
 
 GCM_SIZE_TAG = 16
 GCM_SIZE_IV = 12
 LEDGER_TRANSACTION_SIZE = 4
 LEDGER_DOMAIN_SIZE = 8
+LEDGER_CHUNK_TRAILER_SIZE = 8
 
 
 def to_uint_32(buffer):
@@ -92,10 +96,18 @@ class Transaction:
     _file_size = 0
     gcm_header = None
 
-    def __init__(self, filename):
+    def __init__(self, filename, complete=False):
         self._file = open(filename, mode="rb")
-        self._file.seek(0, 2)
-        self._file_size = self._file.tell()
+        if complete:
+            # Complete chunks end with the positions of their entries, followed
+            # by the size of their entries
+            self._file.seek(-LEDGER_CHUNK_TRAILER_SIZE, 2)
+            self._file_size = to_uint_64(
+                _byte_read_safe(self._file, LEDGER_CHUNK_TRAILER_SIZE)
+            )
+        else:
+            self._file.seek(0, 2)
+            self._file_size = self._file.tell()
         self._file.seek(0, 0)
 
     def __del__(self):
@@ -142,10 +154,21 @@ class Transaction:
 
 class Ledger:
 
-    _filename = None
+    _chunks = []
 
-    def __init__(self, filename):
-        self._filename = filename
+    def __init__(self, directory):
+        self._chunks = []
+        for name in os.listdir(directory):
+            match = re.fullmatch(r"ledger_(\d+)(-\d+)?", name)
+            if match:
+                start_idx = int(match.group(1))
+                complete = match.group(2) is not None
+                self._chunks.append(
+                    (start_idx, os.path.join(directory, name), complete)
+                )
+        self._chunks.sort()
 
     def __iter__(self):
-        return Transaction(self._filename)
+        return itertools.chain.from_iterable(
+            Transaction(path, complete) for _, path, complete in self._chunks
+        )
@@ -1,6 +1,7 @@
 # Copyright (c) Microsoft Corporation. All rights reserved.
 # Licensed under the Apache 2.0 License.
 import os
+import stat
 import time
 from enum import Enum
 import paramiko
@@ -176,7 +177,12 @@ class SSHRemote(CmdMixin):
             src_path = os.path.join(self.common_dir, path)
             tgt_path = os.path.join(self.root, os.path.basename(src_path))
             LOG.info("[{}] copy {} from {}".format(self.hostname, tgt_path, src_path))
-            session.put(src_path, tgt_path)
+            if os.path.isdir(src_path):
+                session.mkdir(tgt_path)
+                for f in os.listdir(src_path):
+                    session.put(os.path.join(src_path, f), os.path.join(tgt_path, f))
+            else:
+                session.put(src_path, tgt_path)
         session.close()
         executable = self.cmd[0]
         if executable.startswith("./"):
@@ -198,10 +204,16 @@ class SSHRemote(CmdMixin):
             for seconds in range(timeout):
                 try:
                     target_name = target_name or file_name
-                    session.get(
-                        os.path.join(self.root, file_name),
-                        os.path.join(dst_path, target_name),
-                    )
+                    src_path = os.path.join(self.root, file_name)
+                    tgt_path = os.path.join(dst_path, target_name)
+                    if stat.S_ISDIR(session.stat(src_path).st_mode):
+                        os.makedirs(tgt_path, exist_ok=True)
+                        for f in session.listdir(src_path):
+                            session.get(
+                                os.path.join(src_path, f), os.path.join(tgt_path, f)
+                            )
+                    else:
+                        session.get(src_path, tgt_path)
                     LOG.debug(
                         "[{}] found {} after {}s".format(
                             self.hostname, file_name, seconds
@@ -414,7 +426,7 @@ class LocalRemote(CmdMixin):
         for path in self.data_files:
             dst_path = self.root
             src_path = os.path.join(self.common_dir, path)
-            assert self._rc("cp {} {}".format(src_path, dst_path)) == 0
+            assert self._rc("cp -r {} {}".format(src_path, dst_path)) == 0
 
     def get(self, file_name, dst_path, timeout=60, target_name=None):
         path = os.path.join(self.root, file_name)
@@ -425,9 +437,12 @@ class LocalRemote(CmdMixin):
         else:
             raise ValueError(path)
         target_name = target_name or file_name
-        assert (
-            self._rc("cp {} {}".format(path, os.path.join(dst_path, target_name))) == 0
-        )
+        tgt_path = os.path.join(dst_path, target_name)
+        if os.path.isdir(path):
+            # Copy the contents, so that an existing target is not nested into
+            os.makedirs(tgt_path, exist_ok=True)
+            path = os.path.join(path, ".")
+        assert self._rc("cp -r {} {}".format(path, tgt_path)) == 0
 
     def list_files(self):
         return os.listdir(self.root)
@@ -553,7 +568,7 @@ class CCFRemote(object):
         memory_reserve_startup=0,
         notify_server=None,
         gov_script=None,
-        ledger_file=None,
+        ledger_dir=None,
         sealed_secrets=None,
         json_log_path=None,
         binary_dir=".",
@@ -571,14 +586,14 @@ class CCFRemote(object):
         self.BIN = infra.path.build_bin_path(
             self.BIN, enclave_type, binary_dir=binary_dir
         )
-        self.ledger_file = ledger_file
-        self.ledger_file_name = (
-            os.path.basename(ledger_file) if ledger_file else f"{local_node_id}.ledger"
+        self.ledger_dir = ledger_dir
+        self.ledger_dir_name = (
+            os.path.basename(ledger_dir) if ledger_dir else f"{local_node_id}.ledger"
         )
         self.common_dir = common_dir
 
         exe_files = [self.BIN, lib_path] + self.DEPS
-        data_files = [self.ledger_file] if self.ledger_file else []
+        data_files = [self.ledger_dir] if self.ledger_dir else []
 
         # lib_path may be relative or absolute. The remote implementation should
         # copy (or symlink) to the target workspace, and then node will be able
@@ -598,7 +613,7 @@ class CCFRemote(object):
             f"--node-address={host}:{node_port}",
             f"--rpc-address={host}:{rpc_port}",
             f"--public-rpc-address={pubhost}:{rpc_port}",
-            f"--ledger-file={self.ledger_file_name}",
+            f"--ledger-dir={self.ledger_dir_name}",
             f"--node-cert-file={self.pem}",
             f"--host-log-level={host_log_level}",
             election_timeout_arg,
@@ -745,11 +760,11 @@ class CCFRemote(object):
         return os.path.join(self.common_dir, latest_sealed_secrets)
 
     def get_ledger(self):
-        self.remote.get(self.ledger_file_name, self.common_dir)
-        return self.ledger_file_name
+        self.remote.get(self.ledger_dir_name, self.common_dir)
+        return self.ledger_dir_name
 
     def ledger_path(self):
-        return os.path.join(self.remote.root, self.ledger_file_name)
+        return os.path.join(self.remote.root, self.ledger_dir_name)
 
 
 @contextmanager